@@ -5,6 +5,8 @@
 #include "msl_verify.hpp"
 #include "serialize.hpp"
 
+#include <systemd/sd-bus.h>
+
 #include <phosphor-logging/elog-errors.hpp>
 #include <phosphor-logging/elog.hpp>
 #include <phosphor-logging/log.hpp>
@@ -26,7 +28,6 @@ namespace updater
 namespace softwareServer = sdbusplus::xyz::openbmc_project::Software::server;
 
 using namespace phosphor::logging;
-using sdbusplus::exception::SdBusError;
 using InternalFailure =
     sdbusplus::xyz::openbmc_project::Common::Error::InternalFailure;
 
@@ -36,46 +37,27 @@ namespace control = sdbusplus::xyz::openbmc_project::Control::server;
 
 void Activation::subscribeToSystemdSignals()
 {
-    auto method = this->bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                            SYSTEMD_INTERFACE, "Subscribe");
-    try
-    {
-        this->bus.call_noreply(method);
-    }
-    catch (const SdBusError& e)
+    // The units are started after the subscription on the same connection,
+    // so systemd handles it first.
+    if (!systemdSubscription)
     {
-        if (e.name() != nullptr &&
-            strcmp("org.freedesktop.systemd1.AlreadySubscribed", e.name()) == 0)
-        {
-            // If an Activation attempt fails, the Unsubscribe method is not
-            // called. This may lead to an AlreadySubscribed error if the
-            // Activation is re-attempted.
-        }
-        else
-        {
-            log<level::ERR>("Error subscribing to systemd",
-                            entry("ERROR=%s", e.what()));
-        }
+        systemdSubscription =
+            std::make_unique<SignalRouter::Subscription>(parent.signalRouter);
     }
-
-    return;
 }
 
 void Activation::unsubscribeFromSystemdSignals()
 {
-    auto method = this->bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                            SYSTEMD_INTERFACE, "Unsubscribe");
-    try
-    {
-        this->bus.call_noreply(method);
-    }
-    catch (const SdBusError& e)
-    {
-        log<level::ERR>("Error in unsubscribing from systemd signals",
-                        entry("ERROR=%s", e.what()));
-    }
+    // Called from unitStateChange() too, the router lets a handler remove
+    // its own registration.
+    unitWatches.clear();
+    systemdSubscription.reset();
+}
 
-    return;
+void Activation::watchUnit(const std::string& unit)
+{
+    unitWatches.push_back(parent.signalRouter.onJobRemoved(
+        unit, [this](const JobRemoved& job) { unitStateChange(job); }));
 }
 
 auto Activation::activation(Activations value) -> Activations
@@ -86,6 +68,11 @@ auto Activation::activation(Activations value) -> Activations
         redundancyPriority.reset(nullptr);
     }
 
+    if (value != softwareServer::Activation::Activations::Active)
+    {
+        activationReadback.reset(nullptr);
+    }
+
     if (value == softwareServer::Activation::Activations::Activating)
     {
 #ifdef WANT_SIGNATURE_VERIFY
@@ -164,21 +151,20 @@ auto Activation::activation(Activations value) -> Activations
 
         flashWrite();
 
-#if defined UBIFS_LAYOUT || defined MMC_LAYOUT
-
+        // A failure to start writing has set the activation to Failed
+        // already, which dropped the progress.
+        if (!activationProgress)
+        {
+            return softwareServer::Activation::activation();
+        }
         return softwareServer::Activation::activation(value);
-
-#else // STATIC_LAYOUT
-
-        onFlashWriteSuccess();
-        return softwareServer::Activation::activation(
-            softwareServer::Activation::Activations::Active);
-#endif
     }
     else
     {
         activationBlocksTransition.reset(nullptr);
         activationProgress.reset(nullptr);
+        unsubscribeFromSystemdSignals();
+        flashJob.reset();
     }
     return softwareServer::Activation::activation(value);
 }
@@ -213,16 +199,18 @@ void Activation::onFlashWriteSuccess()
     // can be re-programmed.
     parent.createUpdateableAssociation(path);
 
-    if (Activation::checkApplyTimeImmediate() == true)
-    {
-        log<level::INFO>("Image Active. ApplyTime is immediate, "
-                         "rebooting BMC.");
-        Activation::rebootBmc();
-    }
-    else
-    {
-        log<level::INFO>("BMC image ready, need reboot to get activated.");
-    }
+    Activation::checkApplyTimeImmediate([this](bool immediate) {
+        if (immediate)
+        {
+            log<level::INFO>("Image Active. ApplyTime is immediate, "
+                             "rebooting BMC.");
+            Activation::rebootBmc();
+        }
+        else
+        {
+            log<level::INFO>("BMC image ready, need reboot to get activated.");
+        }
+    });
 
     activation(softwareServer::Activation::Activations::Active);
 }
@@ -233,16 +221,38 @@ void Activation::deleteImageManagerObject()
     auto method = this->bus.new_method_call(VERSION_BUSNAME, path.c_str(),
                                             "xyz.openbmc_project.Object.Delete",
                                             "Delete");
-    try
-    {
-        bus.call_noreply(method);
-    }
-    catch (const SdBusError& e)
-    {
-        log<level::ERR>("Error in Deleting image from image manager",
-                        entry("VERSIONPATH=%s", path.c_str()));
-        return;
-    }
+    utils::callAsync(
+        bus, method,
+        [path = path](sdbusplus::message::message&, const sd_bus_error* error) {
+            if (error)
+            {
+                log<level::ERR>("Error in Deleting image from image manager",
+                                entry("VERSIONPATH=%s", path.c_str()));
+            }
+        });
+}
+
+void Activation::startFlashUnit(const std::string& unit)
+{
+    watchUnit(unit);
+
+    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
+                                      SYSTEMD_INTERFACE, "StartUnit");
+    method.append(unit, "replace");
+    utils::callAsync(
+        bus, method,
+        [this, alive = lifetime.token(), unit](sdbusplus::message::message&,
+                                                const sd_bus_error* error) {
+            if (!error || alive.expired())
+            {
+                return;
+            }
+            log<level::ERR>("Error starting flash unit",
+                            entry("UNIT=%s", unit.c_str()),
+                            entry("ERROR=%s", error->name));
+            Activation::activation(
+                softwareServer::Activation::Activations::Failed);
+        });
 }
 
 auto Activation::requestedActivation(RequestedActivations value)
@@ -271,20 +281,72 @@ auto Activation::requestedActivation(RequestedActivations value)
 uint8_t RedundancyPriority::priority(uint8_t value)
 {
     // Set the priority value so that the freePriority() function can order
-    // the versions by priority.
-    auto newPriority = softwareServer::RedundancyPriority::priority(value);
-    parent.parent.savePriority(parent.versionId, value);
+    // the versions by priority. freePriority() persists the new ordering of
+    // all the versions at once, including this one, and emits the changes
+    // of the other versions.
+    auto newPriority =
+        softwareServer::RedundancyPriority::priority(value, true);
     parent.parent.freePriority(value, parent.versionId);
+    emitPriorityChanged();
     return newPriority;
 }
 
 uint8_t RedundancyPriority::sdbusPriority(uint8_t value)
 {
     parent.parent.savePriority(parent.versionId, value);
-    return softwareServer::RedundancyPriority::priority(value);
+    auto newPriority =
+        softwareServer::RedundancyPriority::priority(value, true);
+    emitPriorityChanged();
+    return newPriority;
+}
+
+void RedundancyPriority::reorderPriority(uint8_t value)
+{
+    softwareServer::RedundancyPriority::priority(value, true);
+}
+
+void RedundancyPriority::emitPriorityChanged()
+{
+    getDeferredSignals().propertyChanged(
+        parent.path, softwareServer::RedundancyPriority::interface, "Priority");
+}
+
+void ActivationProgress::bytesWritten(uint64_t done, uint64_t total,
+                                      uint8_t first, uint8_t last)
+{
+    if (!meter)
+    {
+        meter.emplace(first, last);
+    }
+    if (!meter->update(done, total))
+    {
+        return;
+    }
+
+    // The properties are set without a signal each and announced together
+    // at the end of the loop iteration.
+    auto& signals = getDeferredSignals();
+    if (progress() != meter->progress())
+    {
+        progress(meter->progress(), true);
+        signals.propertyChanged(
+            path, softwareServer::ActivationProgress::interface, "Progress");
+    }
+    if (bytesPerSecond() != meter->bytesPerSecond())
+    {
+        bytesPerSecond(meter->bytesPerSecond(), true);
+        signals.propertyChanged(path, softwareServer::ActivationRate::interface,
+                                "BytesPerSecond");
+    }
+    if (secondsRemaining() != meter->secondsRemaining())
+    {
+        secondsRemaining(meter->secondsRemaining(), true);
+        signals.propertyChanged(path, softwareServer::ActivationRate::interface,
+                                "SecondsRemaining");
+    }
 }
 
-void Activation::unitStateChange(sdbusplus::message::message& msg)
+void Activation::unitStateChange(const JobRemoved& job)
 {
     if (softwareServer::Activation::activation() !=
         softwareServer::Activation::Activations::Activating)
@@ -296,12 +358,12 @@ void Activation::unitStateChange(sdbusplus::message::message& msg)
     auto purpose = parent.versions.find(versionId)->second->purpose();
     if (purpose == VersionPurpose::Host)
     {
-        onStateChangesBios(msg);
+        onStateChangesBios(job);
         return;
     }
 #endif
 
-    onStateChanges(msg);
+    onStateChanges(job);
 
     return;
 }
@@ -328,58 +390,37 @@ void ActivationBlocksTransition::enableRebootGuard()
 {
     log<level::INFO>("BMC image activating - BMC reboots are disabled.");
 
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append("reboot-guard-enable.service", "replace");
-    bus.call_noreply(method);
+    utils::startUnitAsync(bus, "reboot-guard-enable.service");
 }
 
 void ActivationBlocksTransition::disableRebootGuard()
 {
     log<level::INFO>("BMC activation has ended - BMC reboots are re-enabled.");
 
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append("reboot-guard-disable.service", "replace");
-    bus.call_noreply(method);
+    utils::startUnitAsync(bus, "reboot-guard-disable.service");
 }
 
-bool Activation::checkApplyTimeImmediate()
+void Activation::checkApplyTimeImmediate(std::function<void(bool)> handler)
 {
-    auto service = utils::getService(bus, applyTimeObjPath, applyTimeIntf);
-    if (service.empty())
-    {
-        log<level::INFO>("Error getting the service name for BMC image "
-                         "ApplyTime. The BMC needs to be manually rebooted to "
-                         "complete the image activation if needed "
-                         "immediately.");
-    }
-    else
-    {
-
-        auto method = bus.new_method_call(service.c_str(), applyTimeObjPath,
-                                          dbusPropIntf, "Get");
-        method.append(applyTimeIntf, applyTimeProp);
-
-        try
-        {
-            auto reply = bus.call(method);
-
-            std::variant<std::string> result;
-            reply.read(result);
-            auto applyTime = std::get<std::string>(result);
-            if (applyTime == applyTimeImmediate)
+    parent.lookups.getPropertyAsync(
+        applyTimeObjPath, applyTimeIntf, applyTimeProp,
+        [alive = lifetime.token(), handler](bool found,
+                                            const std::string& value) {
+            if (alive.expired())
             {
-                return true;
+                return;
             }
-        }
-        catch (const SdBusError& e)
-        {
-            log<level::ERR>("Error in getting ApplyTime",
-                            entry("ERROR=%s", e.what()));
-        }
-    }
-    return false;
+            if (!found)
+            {
+                log<level::INFO>("Error getting the BMC image ApplyTime. "
+                                 "The BMC needs to be manually rebooted to "
+                                 "complete the image activation if needed "
+                                 "immediately.");
+                handler(false);
+                return;
+            }
+            handler(value == applyTimeImmediate);
+        });
 }
 
 #ifdef HOST_BIOS_UPGRADE
@@ -388,36 +429,29 @@ void Activation::flashWriteHost()
     auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
                                       SYSTEMD_INTERFACE, "StartUnit");
     auto biosServiceFile = "obmc-flash-host-bios@" + versionId + ".service";
+    watchUnit(biosServiceFile);
     method.append(biosServiceFile, "replace");
-    try
-    {
-        auto reply = bus.call(method);
-    }
-    catch (const SdBusError& e)
-    {
-        log<level::ERR>("Error in trying to upgrade Host Bios.");
-        report<InternalFailure>();
-    }
+    utils::callAsync(
+        bus, method,
+        [](sdbusplus::message::message&, const sd_bus_error* error) {
+            if (error)
+            {
+                log<level::ERR>("Error in trying to upgrade Host Bios.");
+                report<InternalFailure>();
+            }
+        });
 }
 
-void Activation::onStateChangesBios(sdbusplus::message::message& msg)
+void Activation::onStateChangesBios(const JobRemoved& job)
 {
-    uint32_t newStateID{};
-    sdbusplus::message::object_path newStateObjPath;
-    std::string newStateUnit{};
-    std::string newStateResult{};
-
-    // Read the msg and populate each variable
-    msg.read(newStateID, newStateObjPath, newStateUnit, newStateResult);
-
     auto biosServiceFile = "obmc-flash-host-bios@" + versionId + ".service";
 
-    if (newStateUnit == biosServiceFile)
+    if (job.unit == biosServiceFile)
     {
         // unsubscribe to systemd signals
         unsubscribeFromSystemdSignals();
 
-        if (newStateResult == "done")
+        if (job.result == "done")
         {
             // Remove version object from image manager
             deleteImageManagerObject();
@@ -432,7 +466,7 @@ void Activation::onStateChangesBios(sdbusplus::message::message& msg)
             parent.biosVersion->version(
                 parent.versions.find(versionId)->second->version());
         }
-        else if (newStateResult == "failed")
+        else if (job.result == "failed")
         {
             // Set Activation value to Failed
             activation(softwareServer::Activation::Activations::Failed);
@@ -451,17 +485,17 @@ void Activation::rebootBmc()
     auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
                                       SYSTEMD_INTERFACE, "StartUnit");
     method.append("force-reboot.service", "replace");
-    try
-    {
-        auto reply = bus.call(method);
-    }
-    catch (const SdBusError& e)
-    {
-        log<level::ALERT>("Error in trying to reboot the BMC. "
-                          "The BMC needs to be manually rebooted to complete "
-                          "the image activation.");
-        report<InternalFailure>();
-    }
+    utils::callAsync(
+        bus, method,
+        [](sdbusplus::message::message&, const sd_bus_error* error) {
+            if (error)
+            {
+                log<level::ALERT>("Error in trying to reboot the BMC. "
+                                  "The BMC needs to be manually rebooted to "
+                                  "complete the image activation.");
+                report<InternalFailure>();
+            }
+        });
 }
 
 } // namespace updater
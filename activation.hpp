@@ -2,9 +2,16 @@
 
 #include "config.h"
 
+#include "async_call.hpp"
+#include "deferred_signals.hpp"
 #include "flash.hpp"
+#include "flash_job.hpp"
+#include "progress_meter.hpp"
+#include "signal_router.hpp"
 #include "utils.hpp"
 #include "xyz/openbmc_project/Software/ActivationProgress/server.hpp"
+#include "xyz/openbmc_project/Software/ActivationRate/server.hpp"
+#include "xyz/openbmc_project/Software/ActivationReadback/server.hpp"
 #include "xyz/openbmc_project/Software/RedundancyPriority/server.hpp"
 
 #include <sdbusplus/server.hpp>
@@ -12,6 +19,8 @@
 #include <xyz/openbmc_project/Software/Activation/server.hpp>
 #include <xyz/openbmc_project/Software/ActivationBlocksTransition/server.hpp>
 
+#include <map>
+
 #ifdef WANT_SIGNATURE_VERIFY
 #include <filesystem>
 #endif
@@ -38,12 +47,14 @@ using ActivationBlocksTransitionInherit = sdbusplus::server::object::object<
 using RedundancyPriorityInherit = sdbusplus::server::object::object<
     sdbusplus::xyz::openbmc_project::Software::server::RedundancyPriority>;
 using ActivationProgressInherit = sdbusplus::server::object::object<
-    sdbusplus::xyz::openbmc_project::Software::server::ActivationProgress>;
+    sdbusplus::xyz::openbmc_project::Software::server::ActivationProgress,
+    sdbusplus::xyz::openbmc_project::Software::server::ActivationRate>;
+using ActivationReadbackInherit = sdbusplus::server::object::object<
+    sdbusplus::xyz::openbmc_project::Software::server::ActivationReadback>;
 
 constexpr auto applyTimeImmediate =
     "xyz.openbmc_project.Software.ApplyTime.RequestedApplyTimes.Immediate";
 constexpr auto applyTimeIntf = "xyz.openbmc_project.Software.ApplyTime";
-constexpr auto dbusPropIntf = "org.freedesktop.DBus.Properties";
 constexpr auto applyTimeObjPath = "/xyz/openbmc_project/software/apply_time";
 constexpr auto applyTimeProp = "RequestedApplyTime";
 
@@ -72,9 +83,8 @@ class RedundancyPriority : public RedundancyPriorityInherit
     RedundancyPriority(sdbusplus::bus::bus& bus, const std::string& path,
                        Activation& parent, uint8_t value,
                        bool freePriority = true) :
-        RedundancyPriorityInherit(bus, path.c_str(),
-                                  action::emit_interface_added),
-        parent(parent)
+        RedundancyPriorityInherit(bus, path.c_str(), action::emit_no_signals),
+        parent(parent), deferredInterface(path, interface)
     {
         // Set Property
         if (freePriority)
@@ -104,6 +114,18 @@ class RedundancyPriority : public RedundancyPriorityInherit
      */
     uint8_t sdbusPriority(uint8_t value);
 
+    /** @brief Set the priority as part of a reordering of all the versions,
+     *         without persisting it or emitting PropertiesChanged. The
+     *         caller persists the new ordering and then emits the changes.
+     *
+     *  @param[in] value - uint8_t
+     */
+    void reorderPriority(uint8_t value);
+
+    /** @brief Emit PropertiesChanged for the Priority property, at the end
+     *         of the event loop iteration */
+    void emitPriorityChanged();
+
     /** @brief Priority property get function
      *
      *  @returns uint8_t - The Priority value
@@ -112,6 +134,10 @@ class RedundancyPriority : public RedundancyPriorityInherit
 
     /** @brief Parent Object. */
     Activation& parent;
+
+  private:
+    /** @brief Announces the interface with the other deferred signals */
+    DeferredInterface deferredInterface;
 };
 
 /** @class ActivationBlocksTransition
@@ -130,8 +156,8 @@ class ActivationBlocksTransition : public ActivationBlocksTransitionInherit
     ActivationBlocksTransition(sdbusplus::bus::bus& bus,
                                const std::string& path) :
         ActivationBlocksTransitionInherit(bus, path.c_str(),
-                                          action::emit_interface_added),
-        bus(bus)
+                                          action::emit_no_signals),
+        bus(bus), deferredInterface(path, interface)
     {
         enableRebootGuard();
     }
@@ -144,6 +170,9 @@ class ActivationBlocksTransition : public ActivationBlocksTransitionInherit
   private:
     sdbusplus::bus::bus& bus;
 
+    /** @brief Announces the interface with the other deferred signals */
+    DeferredInterface deferredInterface;
+
     /** @brief Enables a Guard that blocks any BMC reboot commands */
     void enableRebootGuard();
 
@@ -160,11 +189,65 @@ class ActivationProgress : public ActivationProgressInherit
      * @param[in] path   - The Dbus object path
      */
     ActivationProgress(sdbusplus::bus::bus& bus, const std::string& path) :
-        ActivationProgressInherit(bus, path.c_str(),
-                                  action::emit_interface_added)
+        ActivationProgressInherit(bus, path.c_str(), action::emit_no_signals),
+        path(path),
+        deferredInterface(path, sdbusplus::xyz::openbmc_project::Software::
+                                    server::ActivationProgress::interface),
+        deferredRate(path, sdbusplus::xyz::openbmc_project::Software::server::
+                               ActivationRate::interface)
+    {
+        progress(0, true);
+    }
+
+    /** @brief Account for the bytes written, which take the progress from
+     *         first to last. The progress, the throughput and the time left
+     *         are published at most once a second, so that a fast write
+     *         does not flood D-Bus.
+     *
+     *  @param[in] done - The bytes written so far
+     *  @param[in] total - The bytes to write
+     *  @param[in] first - The progress before the first byte
+     *  @param[in] last - The progress once the bytes are all written
+     */
+    void bytesWritten(uint64_t done, uint64_t total, uint8_t first,
+                      uint8_t last);
+
+  private:
+    std::string path;
+
+    /** @brief Paces the updates of the write, once it started */
+    std::optional<ProgressMeter> meter;
+
+    /** @brief Announce the interfaces with the other deferred signals */
+    DeferredInterface deferredInterface;
+    DeferredInterface deferredRate;
+};
+
+/** @class ActivationReadback
+ *  @brief Lists the images of an activation that were read back
+ *  @details A concrete implementation for
+ *  xyz.openbmc_project.Software.ActivationReadback DBus API.
+ */
+class ActivationReadback : public ActivationReadbackInherit
+{
+  public:
+    /** @brief Constructs ActivationReadback.
+     *
+     * @param[in] bus    - The Dbus bus object
+     * @param[in] path   - The Dbus object path
+     * @param[in] images - The images read back, with their sizes
+     */
+    ActivationReadback(sdbusplus::bus::bus& bus, const std::string& path,
+                       const std::map<std::string, uint64_t>& images) :
+        ActivationReadbackInherit(bus, path.c_str(), action::emit_no_signals),
+        deferredInterface(path, interface)
     {
-        progress(0);
+        ActivationReadbackInherit::images(images, true);
     }
+
+  private:
+    /** @brief Announces the interface with the other deferred signals */
+    DeferredInterface deferredInterface;
 };
 
 /** @class Activation
@@ -190,14 +273,7 @@ class Activation : public ActivationInherit, public Flash
                    Activations activationStatus,
                AssociationList& assocs) :
         ActivationInherit(bus, path.c_str(), true),
-        bus(bus), path(path), parent(parent), versionId(versionId),
-        systemdSignals(
-            bus,
-            sdbusRule::type::signal() + sdbusRule::member("JobRemoved") +
-                sdbusRule::path("/org/freedesktop/systemd1") +
-                sdbusRule::interface("org.freedesktop.systemd1.Manager"),
-            std::bind(std::mem_fn(&Activation::unitStateChange), this,
-                      std::placeholders::_1))
+        bus(bus), path(path), parent(parent), versionId(versionId)
     {
         // Set Properties.
         activation(activationStatus);
@@ -239,26 +315,45 @@ class Activation : public ActivationInherit, public Flash
      */
     void onFlashWriteSuccess();
 
+#ifdef UBIFS_LAYOUT
+    /**
+     * @brief Finish the activation once the UBI volumes are written: update
+     *        the U-Boot environment and point it to the new version.
+     *
+     * @param[in] removed - The versions whose volumes were removed to make
+     *                      room
+     */
+    void onVolumesWritten(const std::vector<std::string>& removed);
+#endif
+
 #ifdef HOST_BIOS_UPGRADE
     /* @brief write to Host flash function */
     void flashWriteHost();
 
     /** @brief Function that acts on Bios upgrade service file state changes */
-    void onStateChangesBios(sdbusplus::message::message&);
+    void onStateChangesBios(const JobRemoved& job);
 #endif
 
     /** @brief Overloaded function that acts on service file state changes */
-    void onStateChanges(sdbusplus::message::message&) override;
+    void onStateChanges(const JobRemoved& job) override;
 
     /** @brief Check if systemd state change is relevant to this object
      *
      * Instance specific interface to handle the detected systemd state
      * change
      *
-     * @param[in]  msg       - Data associated with subscribed signal
+     * @param[in]  job       - The removed job of a watched unit
      *
      */
-    void unitStateChange(sdbusplus::message::message& msg);
+    void unitStateChange(const JobRemoved& job);
+
+    /**
+     * @brief Call unitStateChange() when a job of a unit is removed, until
+     *        the systemd signals are unsubscribed from
+     *
+     * @param[in] unit - The unit to watch
+     */
+    void watchUnit(const std::string& unit);
 
     /**
      * @brief subscribe to the systemd signals
@@ -273,8 +368,8 @@ class Activation : public ActivationInherit, public Flash
      * @brief unsubscribe from the systemd signals
      *
      * systemd signals are only of interest during the activation process.
-     * Once complete, we want to unsubscribe to avoid unnecessary calls of
-     * unitStateChange().
+     * Once complete, or failed, we want to unsubscribe to avoid unnecessary
+     * calls of unitStateChange().
      *
      */
     void unsubscribeFromSystemdSignals();
@@ -286,11 +381,22 @@ class Activation : public ActivationInherit, public Flash
     void deleteImageManagerObject();
 
     /**
-     * @brief Determine the configured image apply time value
+     * @brief Watch and start one of the units that write the image, without
+     *        waiting for systemd. The activation fails if the job cannot be
+     *        queued.
+     *
+     * @param[in] unit - The unit to start
+     */
+    void startFlashUnit(const std::string& unit);
+
+    /**
+     * @brief Determine the configured image apply time value, without
+     *        waiting for the peers
      *
-     * @return true if the image apply time value is immediate
+     * @param[in] handler - Called with true if the image apply time value
+     *                      is immediate, unless the Activation is gone
      **/
-    bool checkApplyTimeImmediate();
+    void checkApplyTimeImmediate(std::function<void(bool)> handler);
 
     /**
      * @brief Reboot the BMC. Called when ApplyTime is immediate.
@@ -320,8 +426,17 @@ class Activation : public ActivationInherit, public Flash
     /** @brief Persistent ActivationProgress dbus object */
     std::unique_ptr<ActivationProgress> activationProgress;
 
-    /** @brief Used to subscribe to dbus systemd signals **/
-    sdbusplus::bus::match_t systemdSignals;
+    /** @brief The images read back by the last write, kept while Active */
+    std::unique_ptr<ActivationReadback> activationReadback;
+
+    /** @brief Keeps the systemd signals subscribed during the activation **/
+    std::unique_ptr<SignalRouter::Subscription> systemdSubscription;
+
+    /** @brief The units watched by unitStateChange() **/
+    std::vector<SignalRouter::Registration> unitWatches;
+
+    /** @brief The images being written in process, if any **/
+    std::unique_ptr<FlashJob> flashJob;
 
     /** @brief Tracks whether the read-write volume has been created as
      * part of the activation process. **/
@@ -335,6 +450,10 @@ class Activation : public ActivationInherit, public Flash
      *         variables has completed. **/
     bool ubootEnvVarsUpdated = false;
 
+    /** @brief Lets replies to asynchronous calls check that this object
+     *         still exists, declared last so that it expires first. **/
+    utils::Lifetime lifetime;
+
 #ifdef WANT_SIGNATURE_VERIFY
   private:
     /** @brief Verify signature of the images.
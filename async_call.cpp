@@ -0,0 +1,118 @@
+#include "config.h"
+
+#include "async_call.hpp"
+
+#include <phosphor-logging/log.hpp>
+#include <sdbusplus/exception.hpp>
+
+#include <utility>
+#include <vector>
+
+namespace utils
+{
+
+using namespace phosphor::logging;
+
+namespace
+{
+
+int onReply(sd_bus_message* m, void* userdata, sd_bus_error* /* error */)
+{
+    auto& handler = *static_cast<ReplyHandler*>(userdata);
+    sdbusplus::message::message reply(m);
+    auto error = sd_bus_message_get_error(m);
+    try
+    {
+        handler(reply, sd_bus_error_is_set(error) ? error : nullptr);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Error handling D-Bus reply",
+                        entry("ERROR=%s", e.what()));
+    }
+    return 0;
+}
+
+void destroyHandler(void* userdata)
+{
+    delete static_cast<ReplyHandler*>(userdata);
+}
+
+} // namespace
+
+void callAsync(sdbusplus::bus::bus& bus, sdbusplus::message::message& method,
+               ReplyHandler handler)
+{
+    auto userdata = new ReplyHandler(std::move(handler));
+    sd_bus_slot* slot = nullptr;
+    auto rc = sd_bus_call_async(bus.get(), &slot, method.get(), onReply,
+                                userdata, 0);
+    if (rc < 0)
+    {
+        delete userdata;
+        throw sdbusplus::exception::SdBusError(-rc, "sd_bus_call_async");
+    }
+
+    // The bus owns the slot from now on, and frees the handler along with
+    // it once the reply has been handled.
+    sd_bus_slot_set_destroy_callback(slot, destroyHandler);
+    sd_bus_slot_set_floating(slot, 1);
+    sd_bus_slot_unref(slot);
+}
+
+void callAsync(sdbusplus::bus::bus& bus, sdbusplus::message::message& method,
+               const std::string& what)
+{
+    callAsync(bus, method,
+              [what](sdbusplus::message::message&, const sd_bus_error* error) {
+                  if (error)
+                  {
+                      log<level::ERR>("D-Bus call failed",
+                                      entry("CALL=%s", what.c_str()),
+                                      entry("ERROR=%s", error->name));
+                  }
+              });
+}
+
+void startUnitAsync(sdbusplus::bus::bus& bus, const std::string& unit)
+{
+    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
+                                      SYSTEMD_INTERFACE, "StartUnit");
+    method.append(unit, "replace");
+    callAsync(bus, method, "StartUnit " + unit);
+}
+
+void getServiceAsync(sdbusplus::bus::bus& bus, const std::string& path,
+                     const std::string& interface,
+                     std::function<void(const std::string& service)> handler)
+{
+    auto method = bus.new_method_call(MAPPER_BUSNAME, MAPPER_PATH,
+                                      MAPPER_BUSNAME, "GetObject");
+    method.append(path);
+    method.append(std::vector<std::string>({interface}));
+
+    callAsync(bus, method,
+              [path, interface,
+               handler = std::move(handler)](sdbusplus::message::message& reply,
+                                             const sd_bus_error* error) {
+                  std::vector<
+                      std::pair<std::string, std::vector<std::string>>>
+                      response;
+                  if (error)
+                  {
+                      log<level::ERR>("Error in mapper method call",
+                                      entry("ERROR=%s", error->name),
+                                      entry("PATH=%s", path.c_str()),
+                                      entry("INTERFACE=%s",
+                                            interface.c_str()));
+                  }
+                  else
+                  {
+                      reply.read(response);
+                  }
+                  handler(response.empty() ? std::string{}
+                                           : response[0].first);
+              });
+}
+
+} // namespace utils
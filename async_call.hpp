@@ -0,0 +1,82 @@
+#pragma once
+
+#include <systemd/sd-bus.h>
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/message.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace utils
+{
+
+/** @brief Called with the reply of an asynchronous method call
+ *
+ *  @param[in] reply - The reply, or the error reply
+ *  @param[in] error - The error, nullptr if the call succeeded
+ */
+using ReplyHandler = std::function<void(sdbusplus::message::message& reply,
+                                        const sd_bus_error* error)>;
+
+/** @brief Start a method call without waiting for its reply. The handler is
+ *         called from the bus processing of the event loop once the reply,
+ *         an error or a timeout arrives. Messages are sent in order, so a
+ *         call made after another one is handled by the peer after it.
+ *         Throws SdBusError if the call cannot be queued.
+ *
+ *  @param[in] bus - The bus to call on
+ *  @param[in] method - The method call
+ *  @param[in] handler - Called with the reply
+ */
+void callAsync(sdbusplus::bus::bus& bus, sdbusplus::message::message& method,
+               ReplyHandler handler);
+
+/** @brief Start a method call whose reply is only checked for errors,
+ *         which are logged with the description of the call.
+ *
+ *  @param[in] bus - The bus to call on
+ *  @param[in] method - The method call
+ *  @param[in] what - Description of the call for the error log
+ */
+void callAsync(sdbusplus::bus::bus& bus, sdbusplus::message::message& method,
+               const std::string& what);
+
+/** @brief Start a systemd StartUnit call for a unit, in "replace" mode,
+ *         logging errors.
+ *
+ *  @param[in] bus - The bus to call on
+ *  @param[in] unit - The unit to start
+ */
+void startUnitAsync(sdbusplus::bus::bus& bus, const std::string& unit);
+
+/** @brief Asynchronous version of getService()
+ *
+ *  @param[in] bus - The bus to call on
+ *  @param[in] path - The object path
+ *  @param[in] interface - The interface the service must implement
+ *  @param[in] handler - Called with the service, empty if not found
+ */
+void getServiceAsync(sdbusplus::bus::bus& bus, const std::string& path,
+                     const std::string& interface,
+                     std::function<void(const std::string& service)> handler);
+
+/** @class Lifetime
+ *  @brief Lets the handlers of asynchronous calls check that the object
+ *         that made the call still exists when the reply arrives.
+ */
+class Lifetime
+{
+  public:
+    /** @brief A token that expires when the Lifetime is destroyed */
+    std::weak_ptr<void> token() const
+    {
+        return alive;
+    }
+
+  private:
+    std::shared_ptr<void> alive = std::make_shared<char>();
+};
+
+} // namespace utils
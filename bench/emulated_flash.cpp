@@ -0,0 +1,245 @@
+#include "emulated_flash.hpp"
+
+#include "gpt.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+using namespace phosphor::software::updater;
+
+namespace
+{
+
+constexpr uint32_t norEraseSize = 64 * 1024;
+constexpr uint32_t mmcEraseSize = 512 * 1024;
+constexpr uint64_t envSize = 2 * norEraseSize;
+constexpr uint64_t rwfsSize = 4 * 1024 * 1024;
+constexpr uint64_t hostfwSize = 4 * 1024 * 1024;
+constexpr uint64_t mib = 1024 * 1024;
+
+/** @brief Size of a partition holding an image, with the same amount of
+ *         headroom real layouts leave for growth, rounded up to 1MiB. */
+uint64_t partitionSize(const std::map<std::string, size_t>& imageFiles,
+                       const std::string& name)
+{
+    auto it = imageFiles.find(name);
+    uint64_t size = it == imageFiles.end() ? 0 : it->second;
+    return (size + size / 4 + 2 * mib - 1) / mib * mib;
+}
+
+} // namespace
+
+Layout parseLayout(const std::string& name)
+{
+    if (name == "static")
+    {
+        return Layout::Static;
+    }
+    if (name == "ubi")
+    {
+        return Layout::Ubi;
+    }
+    if (name == "mmc")
+    {
+        return Layout::Mmc;
+    }
+    throw std::invalid_argument("Unknown flash layout " + name);
+}
+
+EmulatedFlash::EmulatedFlash(Layout layout, const fs::path& dir,
+                             const std::map<std::string, size_t>& imageFiles) :
+    layout(layout)
+{
+    fs::create_directories(dir);
+
+    auto uboot = partitionSize(imageFiles, "image-u-boot");
+    auto kernel = partitionSize(imageFiles, "image-kernel");
+    auto rofs = partitionSize(imageFiles, "image-rofs");
+    auto rwfs = std::max(partitionSize(imageFiles, "image-rwfs"), rwfsSize);
+
+    switch (layout)
+    {
+        case Layout::Static:
+        {
+            const std::vector<std::pair<std::string, uint64_t>> parts = {
+                {"u-boot", uboot - envSize},
+                {"u-boot-env", envSize},
+                {"kernel", kernel},
+                {"rofs", rofs},
+                {"rwfs", rwfs}};
+
+            uint64_t size = 0;
+            for (const auto& part : parts)
+            {
+                size += part.second;
+            }
+            auto bmc = std::make_unique<FileDevice>(dir / "bmc", size,
+                                                    norEraseSize,
+                                                    FileDevice::Type::nor);
+            auto& chip = *bmc;
+            chips.emplace("bmc", std::move(bmc));
+
+            uint64_t offset = 0;
+            for (const auto& [name, partSize] : parts)
+            {
+                partitions.emplace(name, std::make_unique<PartitionDevice>(
+                                             chip, name, offset, partSize));
+                offset += partSize;
+            }
+            break;
+        }
+        case Layout::Ubi:
+        {
+            // Each chip holds a UBI device large enough for two versions
+            // and the rwfs volume.
+            auto capacity = 2 * (kernel + rofs) + rwfs;
+            for (const auto& name : {"bmc", "alt-bmc"})
+            {
+                ubis.emplace(name, std::make_unique<FileUbiDevice>(
+                                       dir / (std::string(name) + "-ubi"),
+                                       name, capacity));
+            }
+            break;
+        }
+        case Layout::Mmc:
+        {
+            const std::vector<std::pair<std::string, uint64_t>> parts = {
+                {"boot-a", kernel}, {"boot-b", kernel}, {"rofs-a", rofs},
+                {"rofs-b", rofs},   {"rwfs", rwfs},     {"hostfw", hostfwSize}};
+
+            // GPT structures and 1MiB alignment of each partition
+            uint64_t size = 2 * mib * (parts.size() + 2);
+            for (const auto& part : parts)
+            {
+                size += part.second;
+            }
+            auto disk = std::make_unique<FileDevice>(
+                dir / "mmcblk0", size, mmcEraseSize, FileDevice::Type::block);
+            Gpt::create(*disk, parts);
+            chips.emplace("mmcblk0", std::move(disk));
+
+            chips.emplace("mmcblk0boot0",
+                          std::make_unique<FileDevice>(
+                              dir / "mmcblk0boot0", uboot, mmcEraseSize,
+                              FileDevice::Type::block));
+            break;
+        }
+    }
+}
+
+FlashDevice& EmulatedFlash::mtd(const std::string& name)
+{
+    auto it = partitions.find(name);
+    if (it != partitions.end())
+    {
+        return *it->second;
+    }
+    if (layout != Layout::Mmc)
+    {
+        auto chip = chips.find(name);
+        if (chip != chips.end())
+        {
+            return *chip->second;
+        }
+    }
+    throw std::invalid_argument("No emulated MTD partition " + name);
+}
+
+UbiDevice& EmulatedFlash::ubi(const std::string& mtdName)
+{
+    auto it = ubis.find(mtdName);
+    if (it == ubis.end())
+    {
+        throw std::invalid_argument("No emulated UBI device on " + mtdName);
+    }
+    return *it->second;
+}
+
+FlashDevice& EmulatedFlash::disk(const std::string& name)
+{
+    auto it = chips.find(name);
+    if (layout != Layout::Mmc || it == chips.end())
+    {
+        throw std::invalid_argument("No emulated disk " + name);
+    }
+    return *it->second;
+}
+
+std::string EmulatedFlash::chipOf(const std::string& name)
+{
+    // The partitions are all on the "bmc" chip, the boot partition of the
+    // eMMC is on the same device as the user area.
+    if (partitions.count(name))
+    {
+        return "bmc";
+    }
+    if (name == "mmcblk0boot0")
+    {
+        return "mmcblk0";
+    }
+    return name;
+}
+
+std::unique_ptr<FlashBackend> EmulatedFlash::backend()
+{
+    switch (layout)
+    {
+        case Layout::Static:
+            return std::make_unique<StaticBackend>(*this);
+        case Layout::Ubi:
+        {
+            // Keep a copy of the kernel on the alt chip, like dual chip
+            // systems do.
+            UbiBackend::Config config;
+            config.kernelMirrorMtd = "alt-bmc";
+            return std::make_unique<UbiBackend>(*this, config);
+        }
+        case Layout::Mmc:
+            return std::make_unique<MmcBackend>(*this, MmcBackend::Config{});
+    }
+    return nullptr;
+}
+
+uint64_t EmulatedFlash::bytesWritten() const
+{
+    uint64_t bytes = 0;
+    for (const auto& chip : chips)
+    {
+        bytes += chip.second->bytesWritten();
+    }
+    for (const auto& ubi : ubis)
+    {
+        bytes += ubi.second->bytesWritten();
+    }
+    return bytes;
+}
+
+uint64_t EmulatedFlash::bytesErased() const
+{
+    uint64_t bytes = 0;
+    for (const auto& chip : chips)
+    {
+        bytes += chip.second->bytesErased();
+    }
+    return bytes;
+}
+
+void EmulatedFlash::sync()
+{
+    for (const auto& chip : chips)
+    {
+        chip.second->sync();
+    }
+}
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
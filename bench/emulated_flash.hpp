@@ -0,0 +1,94 @@
+#pragma once
+
+#include "flash_backend.hpp"
+#include "flash_device.hpp"
+#include "ubi_device.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+namespace fs = std::filesystem;
+
+/** @brief The flash layouts the updater supports */
+enum class Layout
+{
+    Static,
+    Ubi,
+    Mmc
+};
+
+/** @brief Parse "static", "ubi" or "mmc", throws std::invalid_argument */
+Layout parseLayout(const std::string& name);
+
+/** @class EmulatedFlash
+ *  @brief The flash devices of a BMC, emulated with files in a directory.
+ *  @details The devices are sized to fit the given image files, laid out
+ *           the way the OpenBMC machine layouts are:
+ *           - static: one NOR chip "bmc" with u-boot, u-boot-env, kernel,
+ *             rofs and rwfs partitions.
+ *           - ubi: NOR chips "bmc" and "alt-bmc" with a UBI device each.
+ *           - mmc: an eMMC disk "mmcblk0" with a GPT holding boot-a/b,
+ *             rofs-a/b, rwfs and hostfw, and the "mmcblk0boot0" hardware
+ *             partition for u-boot.
+ */
+class EmulatedFlash : public updater::FlashDevices
+{
+  public:
+    EmulatedFlash() = delete;
+    EmulatedFlash(const EmulatedFlash&) = delete;
+    EmulatedFlash& operator=(const EmulatedFlash&) = delete;
+    EmulatedFlash(EmulatedFlash&&) = delete;
+    EmulatedFlash& operator=(EmulatedFlash&&) = delete;
+
+    /** @brief Creates the device files
+     *
+     *  @param[in] layout - The layout to emulate
+     *  @param[in] dir - Directory for the device files, created if needed
+     *  @param[in] imageFiles - Sizes of the image files, keyed by file name
+     */
+    EmulatedFlash(Layout layout, const fs::path& dir,
+                  const std::map<std::string, size_t>& imageFiles);
+
+    updater::FlashDevice& mtd(const std::string& name) override;
+    updater::UbiDevice& ubi(const std::string& mtdName) override;
+    updater::FlashDevice& disk(const std::string& name) override;
+    std::string chipOf(const std::string& name) override;
+
+    /** @brief A backend for the emulated layout */
+    std::unique_ptr<updater::FlashBackend> backend();
+
+    /** @brief Total bytes programmed into the emulated chips and disks */
+    uint64_t bytesWritten() const;
+
+    /** @brief Total bytes erased on the emulated chips and disks */
+    uint64_t bytesErased() const;
+
+    /** @brief Flush all the device files */
+    void sync();
+
+  private:
+    Layout layout;
+
+    /** @brief Whole chips and disks, the physical media */
+    std::map<std::string, std::unique_ptr<updater::FileDevice>> chips;
+
+    /** @brief MTD partitions of the chips */
+    std::map<std::string, std::unique_ptr<updater::PartitionDevice>> partitions;
+
+    std::map<std::string, std::unique_ptr<updater::UbiDevice>> ubis;
+};
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,52 @@
+#include "event_loop.hpp"
+
+#include "image_manager.hpp"
+
+#include <systemd/sd-event.h>
+
+#include <cstdint>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+bool extractTarball(const std::string& tarball, const std::string& extractDir)
+{
+    // The default loop of the thread, kept between the calls like the
+    // daemon keeps its loop.
+    static sd_event* event = [] {
+        sd_event* loop = nullptr;
+        sd_event_default(&loop);
+        return loop;
+    }();
+    if (!event)
+    {
+        return false;
+    }
+
+    bool done = false;
+    bool extracted = false;
+    if (manager::Manager::unTarAsync(event, tarball, extractDir,
+                                     [&done, &extracted](bool result) {
+                                         done = true;
+                                         extracted = result;
+                                     }) < 0)
+    {
+        return false;
+    }
+    while (!done)
+    {
+        if (sd_event_run(event, UINT64_MAX) < 0)
+        {
+            return false;
+        }
+    }
+    return extracted;
+}
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+/** @brief Extract a tarball the way the image manager does, with
+ *         Manager::unTarAsync(), running an event loop until tar is reaped.
+ *  @details SIGCHLD must be blocked, see utils::blockChildSignal().
+ *
+ *  @param[in] tarball - The tarball
+ *  @param[in] extractDir - The directory to extract it to
+ *
+ *  @return Whether the tarball was extracted
+ */
+bool extractTarball(const std::string& tarball, const std::string& extractDir);
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,78 @@
+#include "resource_usage.hpp"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<uint64_t> allocCount{0};
+std::atomic<uint64_t> allocBytes{0};
+} // namespace
+
+void* operator new(size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t /* size */) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t /* size */) noexcept
+{
+    std::free(ptr);
+}
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+uint64_t allocationCount()
+{
+    return allocCount.load(std::memory_order_relaxed);
+}
+
+uint64_t allocatedBytes()
+{
+    return allocBytes.load(std::memory_order_relaxed);
+}
+
+long peakRssKiB()
+{
+    struct rusage usage
+    {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
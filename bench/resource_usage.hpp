@@ -0,0 +1,62 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+/** @brief Number of heap allocations made by the process so far.
+ *  @details Counted by the global operator new replacement linked into the
+ *           benchmark binaries.
+ */
+uint64_t allocationCount();
+
+/** @brief Number of bytes requested from the heap so far. */
+uint64_t allocatedBytes();
+
+/** @brief Peak resident set size of the process in KiB. */
+long peakRssKiB();
+
+/** @class ResourceCounters
+ *  @brief Samples the allocation counters around a benchmark loop and
+ *         reports them, together with the peak RSS, as benchmark counters.
+ */
+class ResourceCounters
+{
+  public:
+    explicit ResourceCounters(benchmark::State& state) :
+        state(state), allocs(allocationCount()), bytes(allocatedBytes())
+    {}
+
+    ~ResourceCounters()
+    {
+        state.counters["allocs"] = benchmark::Counter(
+            static_cast<double>(allocationCount() - allocs),
+            benchmark::Counter::kAvgIterations);
+        state.counters["alloc_bytes"] = benchmark::Counter(
+            static_cast<double>(allocatedBytes() - bytes),
+            benchmark::Counter::kAvgIterations,
+            benchmark::Counter::OneK::kIs1024);
+        state.counters["peak_rss_KiB"] =
+            benchmark::Counter(static_cast<double>(peakRssKiB()));
+    }
+
+    ResourceCounters(const ResourceCounters&) = delete;
+    ResourceCounters& operator=(const ResourceCounters&) = delete;
+
+  private:
+    benchmark::State& state;
+    uint64_t allocs;
+    uint64_t bytes;
+};
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,254 @@
+#include "config.h"
+
+#include "synthetic_image.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+namespace
+{
+
+using EVP_PKEY_Ptr = std::unique_ptr<EVP_PKEY, decltype(&::EVP_PKEY_free)>;
+using EVP_PKEY_CTX_Ptr =
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&::EVP_PKEY_CTX_free)>;
+using EVP_MD_CTX_Ptr =
+    std::unique_ptr<EVP_MD_CTX, decltype(&::EVP_MD_CTX_free)>;
+using BIO_Ptr = std::unique_ptr<BIO, decltype(&::BIO_free)>;
+
+std::string bioToString(BIO* bio)
+{
+    char* data = nullptr;
+    auto len = BIO_get_mem_data(bio, &data);
+    return std::string(data, len);
+}
+
+void writeFile(const fs::path& path, const std::string& content)
+{
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    file << content;
+    if (!file)
+    {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+}
+
+} // namespace
+
+SyntheticImage::SyntheticImage(const ImageSpec& spec, const fs::path& baseDir) :
+    imageSpec(spec)
+{
+    auto tmpl = (baseDir / "synthXXXXXX").string();
+    if (!mkdtemp(tmpl.data()))
+    {
+        throw std::runtime_error("mkdtemp failed for " + tmpl);
+    }
+    root = tmpl;
+    images = root / "images";
+    conf = root / "conf";
+    fs::create_directories(images);
+    fs::create_directories(conf / spec.keyType);
+
+    // Generate the signing key pair.
+    EVP_PKEY_CTX_Ptr keyCtx(EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr),
+                            ::EVP_PKEY_CTX_free);
+    EVP_PKEY* rawKey = nullptr;
+    if (!keyCtx || EVP_PKEY_keygen_init(keyCtx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_keygen_bits(keyCtx.get(), spec.keyBits) <= 0 ||
+        EVP_PKEY_keygen(keyCtx.get(), &rawKey) <= 0)
+    {
+        throw std::runtime_error("RSA key generation failed");
+    }
+    EVP_PKEY_Ptr key(rawKey, ::EVP_PKEY_free);
+
+    BIO_Ptr pubBio(BIO_new(BIO_s_mem()), ::BIO_free);
+    BIO_Ptr privBio(BIO_new(BIO_s_mem()), ::BIO_free);
+    PEM_write_bio_PUBKEY(pubBio.get(), key.get());
+    PEM_write_bio_PrivateKey(privBio.get(), key.get(), nullptr, nullptr, 0,
+                             nullptr, nullptr);
+    auto publicKey = bioToString(pubBio.get());
+    privateKey = bioToString(privBio.get());
+
+    // System level configuration: the key and hash used to validate the
+    // MANIFEST and the image specific public key.
+    writeFile(conf / spec.keyType / PUBLICKEY_FILE_NAME, publicKey);
+    writeFile(conf / spec.keyType / HASH_FILE_NAME,
+              "HashType=" + spec.hashType + "\n");
+
+    writeFile(images / MANIFEST_FILE_NAME,
+              "purpose=xyz.openbmc_project.Software.Version.VersionPurpose."
+              "BMC\nversion=" +
+                  spec.version + "\nKeyType=" + spec.keyType +
+                  "\nHashType=" + spec.hashType +
+                  "\nMachineName=" + spec.machineName + "\n");
+    writeFile(images / PUBLICKEY_FILE_NAME, publicKey);
+
+    // Scale the images the way a typical BMC tarball is laid out, with the
+    // read-only filesystem being the bulk of the data.
+    constexpr size_t minSize = 4096;
+    writeImageFile("image-rofs", spec.imageSize);
+    writeImageFile("image-kernel", std::max(spec.imageSize / 8, minSize));
+    writeImageFile("image-rwfs", std::max(spec.imageSize / 32, minSize));
+    writeImageFile("image-u-boot",
+                   std::min(spec.imageSize, static_cast<size_t>(512 * 1024)));
+
+    fs::path manifest(images / MANIFEST_FILE_NAME);
+    fs::path pubkey(images / PUBLICKEY_FILE_NAME);
+    sign(manifest);
+    sign(pubkey);
+    for (const auto& file : files)
+    {
+        sign(images / file.first);
+    }
+}
+
+SyntheticImage::~SyntheticImage()
+{
+    std::error_code ec;
+    fs::remove_all(root, ec);
+}
+
+const fs::path& SyntheticImage::tarball()
+{
+    if (tarPath.empty())
+    {
+        auto path = root / "image.tar";
+        auto cmd = "tar -cf " + path.string() + " -C " + images.string() + " .";
+        if (std::system(cmd.c_str()) != 0)
+        {
+            throw std::runtime_error("Failed to create " + path.string());
+        }
+        tarPath = path;
+    }
+    return tarPath;
+}
+
+size_t SyntheticImage::totalBytes() const
+{
+    size_t total = 0;
+    for (const auto& file : files)
+    {
+        total += file.second;
+    }
+    return total;
+}
+
+void SyntheticImage::writeImageFile(const std::string& name, size_t size)
+{
+    // xorshift64 so the content is deterministic but not trivially
+    // compressible, like a real squashfs or kernel image.
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ std::hash<std::string>{}(name);
+    std::vector<uint64_t> buffer(8192);
+    std::ofstream file(images / name, std::ios::out | std::ios::binary);
+
+    size_t remaining = size;
+    while (remaining > 0)
+    {
+        for (auto& word : buffer)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+        auto chunk = std::min(remaining, buffer.size() * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(buffer.data()), chunk);
+        remaining -= chunk;
+    }
+    if (!file)
+    {
+        throw std::runtime_error("Failed to write image " + name);
+    }
+    files[name] = size;
+}
+
+void SyntheticImage::sign(const fs::path& file)
+{
+    BIO_Ptr keyBio(BIO_new_mem_buf(privateKey.data(), privateKey.size()),
+                   ::BIO_free);
+    EVP_PKEY_Ptr key(
+        PEM_read_bio_PrivateKey(keyBio.get(), nullptr, nullptr, nullptr),
+        ::EVP_PKEY_free);
+    auto md = EVP_get_digestbyname(imageSpec.hashType.c_str());
+    if (!key || !md)
+    {
+        throw std::runtime_error("Unable to sign with " + imageSpec.hashType);
+    }
+
+    EVP_MD_CTX_Ptr ctx(EVP_MD_CTX_new(), ::EVP_MD_CTX_free);
+    if (EVP_DigestSignInit(ctx.get(), nullptr, md, nullptr, key.get()) <= 0)
+    {
+        throw std::runtime_error("EVP_DigestSignInit failed");
+    }
+
+    std::ifstream in(file, std::ios::in | std::ios::binary);
+    std::vector<char> buffer(1024 * 1024);
+    while (in)
+    {
+        in.read(buffer.data(), buffer.size());
+        if (in.gcount() > 0)
+        {
+            EVP_DigestSignUpdate(ctx.get(), buffer.data(), in.gcount());
+        }
+    }
+
+    size_t sigLen = 0;
+    EVP_DigestSignFinal(ctx.get(), nullptr, &sigLen);
+    std::string signature(sigLen, '\0');
+    if (EVP_DigestSignFinal(ctx.get(),
+                            reinterpret_cast<unsigned char*>(signature.data()),
+                            &sigLen) <= 0)
+    {
+        throw std::runtime_error("EVP_DigestSignFinal failed");
+    }
+    signature.resize(sigLen);
+
+    fs::path sigFile(file);
+    sigFile += SIGNATURE_FILE_EXT;
+    writeFile(sigFile, signature);
+}
+
+size_t parseSize(const std::string& value)
+{
+    size_t pos = 0;
+    auto size = std::stoull(value, &pos);
+    if (pos < value.size())
+    {
+        switch (value[pos])
+        {
+            case 'G':
+            case 'g':
+                size *= 1024;
+                [[fallthrough]];
+            case 'M':
+            case 'm':
+                size *= 1024;
+                [[fallthrough]];
+            case 'K':
+            case 'k':
+                size *= 1024;
+                break;
+            default:
+                break;
+        }
+    }
+    return size;
+}
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
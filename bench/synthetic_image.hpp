@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace bench
+{
+
+namespace fs = std::filesystem;
+
+/** @struct ImageSpec
+ *  @brief Describes a synthetic BMC image to generate.
+ */
+struct ImageSpec
+{
+    /** @brief Size in bytes of the image-rofs file, the other images are
+     *         scaled from it the same way a real BMC tarball is laid out. */
+    size_t imageSize = 16 * 1024 * 1024;
+
+    /** @brief RSA key size used to sign the image files */
+    int keyBits = 2048;
+
+    /** @brief Hash function written to the MANIFEST and hashfunc files */
+    std::string hashType = "RSA-SHA256";
+
+    /** @brief Key type written to the MANIFEST file */
+    std::string keyType = "OpenBMC";
+
+    /** @brief Version string written to the MANIFEST file */
+    std::string version = "2.10.0-synthetic";
+
+    /** @brief Machine name written to the MANIFEST file */
+    std::string machineName = "synthetic";
+};
+
+/** @class SyntheticImage
+ *  @brief Generates a signed BMC image directory in a temporary location.
+ *  @details The layout matches what the image manager extracts into
+ *           IMG_UPLOAD_DIR and what Signature expects under
+ *           SIGNED_IMAGE_CONF_PATH, so the generated files can be fed
+ *           directly to the verification and untar code paths.
+ */
+class SyntheticImage
+{
+  public:
+    SyntheticImage() = delete;
+    SyntheticImage(const SyntheticImage&) = delete;
+    SyntheticImage& operator=(const SyntheticImage&) = delete;
+    SyntheticImage(SyntheticImage&&) = delete;
+    SyntheticImage& operator=(SyntheticImage&&) = delete;
+
+    /** @brief Generates the image, key, signatures and configuration.
+     *
+     *  @param[in] spec - The image description
+     *  @param[in] baseDir - Directory to create the temporary root under
+     */
+    explicit SyntheticImage(
+        const ImageSpec& spec,
+        const fs::path& baseDir = fs::temp_directory_path());
+
+    /** @brief Removes all the generated files */
+    ~SyntheticImage();
+
+    /** @brief The directory holding the MANIFEST and image files */
+    const fs::path& imageDir() const
+    {
+        return images;
+    }
+
+    /** @brief The directory to use as the signed image configuration path */
+    const fs::path& confDir() const
+    {
+        return conf;
+    }
+
+    /** @brief Path of a tarball of the image directory, created on first
+     *         use with the same tool the image manager extracts with. */
+    const fs::path& tarball();
+
+    /** @brief Sizes of the generated image files, keyed by file name */
+    const std::map<std::string, size_t>& imageFiles() const
+    {
+        return files;
+    }
+
+    /** @brief Total number of bytes of image data (excluding signatures) */
+    size_t totalBytes() const;
+
+    /** @brief The spec this image was generated from */
+    const ImageSpec& spec() const
+    {
+        return imageSpec;
+    }
+
+  private:
+    /** @brief Writes a file of the given size with pseudo-random data */
+    void writeImageFile(const std::string& name, size_t size);
+
+    /** @brief Signs a file with the generated private key, writing the
+     *         signature next to it with the SIGNATURE_FILE_EXT extension. */
+    void sign(const fs::path& file);
+
+    ImageSpec imageSpec;
+    fs::path root;
+    fs::path images;
+    fs::path conf;
+    fs::path tarPath;
+    std::map<std::string, size_t> files;
+
+    /** @brief PEM encoded private key, kept to sign the files */
+    std::string privateKey;
+};
+
+/** @brief Parse a size with an optional K, M or G suffix, as used by the
+ *         benchmark command line options. */
+size_t parseSize(const std::string& value);
+
+} // namespace bench
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,314 @@
+#include "config.h"
+
+#include "emulated_flash.hpp"
+#include "event_loop.hpp"
+#include "image_manager.hpp"
+#include "image_verify.hpp"
+#include "resource_usage.hpp"
+#include "spawn.hpp"
+#include "synthetic_image.hpp"
+#include "version.hpp"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace phosphor::software::bench;
+using phosphor::software::image::Signature;
+using phosphor::software::manager::Manager;
+using phosphor::software::manager::Version;
+
+namespace
+{
+
+/** @brief Command line options */
+struct Options
+{
+    Layout layout = Layout::Ubi;
+    ImageSpec spec;
+    fs::path workDir = fs::temp_directory_path();
+    bool keep = false;
+};
+
+void usage(const char* name)
+{
+    std::cerr
+        << "Usage: " << name << " [options]\n"
+        << "Runs a BMC code update end to end against emulated flash.\n"
+        << "  --layout=static|ubi|mmc   Flash layout to emulate (ubi)\n"
+        << "  --image_size=SIZE         Size of image-rofs, K/M/G suffixes\n"
+        << "  --key_bits=BITS           RSA key size used to sign the image\n"
+        << "  --hash_type=HASH          HashType, e.g. RSA-SHA256\n"
+        << "  --work_dir=DIR            Directory for the image and devices\n"
+        << "  --keep                    Keep the emulated devices\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        auto eq = arg.find('=');
+        auto name = arg.substr(0, eq);
+        auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--layout")
+        {
+            options.layout = parseLayout(value);
+        }
+        else if (name == "--image_size")
+        {
+            options.spec.imageSize = parseSize(value);
+        }
+        else if (name == "--key_bits")
+        {
+            options.spec.keyBits = std::stoi(value);
+        }
+        else if (name == "--hash_type")
+        {
+            options.spec.hashType = value;
+        }
+        else if (name == "--work_dir")
+        {
+            options.workDir = value;
+        }
+        else if (name == "--keep")
+        {
+            options.keep = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @struct Phase
+ *  @brief Measurements of one step of the update.
+ */
+struct Phase
+{
+    std::string name;
+    double seconds;
+    uint64_t bytesWritten;
+    uint64_t bytesErased;
+    uint64_t allocations;
+};
+
+/** @class Harness
+ *  @brief Drives the steps the image manager and the item updater go
+ *         through for an upload, measuring each of them.
+ *  @details Activation and ItemUpdater need their D-Bus peers (systemd,
+ *           the object mapper), so the harness calls the same code they
+ *           run: the untar and MANIFEST parsing of Manager::processImage,
+ *           Signature::verify, then the layout's flash backend.
+ */
+class Harness
+{
+  public:
+    Harness(SyntheticImage& image, EmulatedFlash& flash,
+            const fs::path& root) :
+        image(image),
+        flash(flash), uploadDir(root / "images")
+    {
+        fs::create_directories(uploadDir);
+    }
+
+    /** @brief Run all the phases, returns false on failure */
+    bool run()
+    {
+        return measure("upload", [this] { return upload(); }) &&
+               measure("processImage", [this] { return processImage(); }) &&
+               measure("verify", [this] { return verify(); }) &&
+               measure("activation", [this] { return activate(); }) &&
+               measure("completion", [this] { return complete(); });
+    }
+
+    /** @brief Print the measurements */
+    void report() const
+    {
+        uint64_t written = 0;
+        uint64_t erased = 0;
+        double seconds = 0;
+
+        std::printf("%-14s %10s %14s %14s %10s\n", "phase", "wall_ms",
+                    "bytes_written", "bytes_erased", "allocs");
+        for (const auto& phase : phases)
+        {
+            std::printf("%-14s %10.2f %14llu %14llu %10llu\n",
+                        phase.name.c_str(), phase.seconds * 1000,
+                        static_cast<unsigned long long>(phase.bytesWritten),
+                        static_cast<unsigned long long>(phase.bytesErased),
+                        static_cast<unsigned long long>(phase.allocations));
+            written += phase.bytesWritten;
+            erased += phase.bytesErased;
+            seconds += phase.seconds;
+        }
+        std::printf("%-14s %10.2f %14llu %14llu\n", "total", seconds * 1000,
+                    static_cast<unsigned long long>(written),
+                    static_cast<unsigned long long>(erased));
+        std::printf("image_bytes=%zu write_amplification=%.2f "
+                    "peak_rss_KiB=%ld\n",
+                    image.totalBytes(),
+                    image.totalBytes() ? double(written) / image.totalBytes()
+                                       : 0.0,
+                    peakRssKiB());
+    }
+
+  private:
+    bool measure(const std::string& name, const std::function<bool()>& step)
+    {
+        auto written = flash.bytesWritten();
+        auto erased = flash.bytesErased();
+        auto allocs = allocationCount();
+        auto start = std::chrono::steady_clock::now();
+
+        bool ok = false;
+        try
+        {
+            ok = step();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << name << ": " << e.what() << "\n";
+        }
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        phases.push_back({name, elapsed.count(),
+                          flash.bytesWritten() - written,
+                          flash.bytesErased() - erased,
+                          allocationCount() - allocs});
+        if (!ok)
+        {
+            std::cerr << name << " failed\n";
+        }
+        return ok;
+    }
+
+    /** @brief The REST server and the TFTP download write the tarball
+     *         into the upload directory */
+    bool upload()
+    {
+        tarball = uploadDir / "image.tar";
+        fs::copy_file(image.tarball(), tarball);
+        return true;
+    }
+
+    /** @brief The filesystem part of Manager::processImage */
+    bool processImage()
+    {
+        auto tmpDir = (uploadDir / "imageXXXXXX").string();
+        if (!mkdtemp(tmpDir.data()))
+        {
+            return false;
+        }
+        if (!extractTarball(tarball, tmpDir))
+        {
+            return false;
+        }
+        fs::remove(tarball);
+
+        auto manifest = fs::path(tmpDir) / MANIFEST_FILE_NAME;
+        auto version = Version::getValue(manifest, "version");
+        if (version.empty() || Version::getValue(manifest, "purpose").empty())
+        {
+            return false;
+        }
+
+        versionId = Version::getId(version);
+        imageDir = uploadDir / versionId;
+        fs::rename(tmpDir, imageDir);
+        return true;
+    }
+
+    bool verify()
+    {
+        Signature signature(imageDir, image.confDir());
+        return signature.verify();
+    }
+
+    /** @brief What Activation::flashWrite and the flash services do */
+    bool activate()
+    {
+        flash.backend()->write(imageDir, versionId);
+        return true;
+    }
+
+    bool complete()
+    {
+        flash.sync();
+        fs::remove_all(imageDir);
+        return true;
+    }
+
+    SyntheticImage& image;
+    EmulatedFlash& flash;
+    fs::path uploadDir;
+    fs::path tarball;
+    fs::path imageDir;
+    std::string versionId;
+    std::vector<Phase> phases;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    try
+    {
+        if (!parseOptions(argc, argv, options))
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The children are reaped through the event loop, like in the daemon.
+    utils::blockChildSignal();
+
+    auto root = (options.workDir / "update-harness-XXXXXX").string();
+    if (!mkdtemp(root.data()))
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = false;
+    try
+    {
+        SyntheticImage image(options.spec, root);
+        EmulatedFlash flash(options.layout, fs::path(root) / "flash",
+                            image.imageFiles());
+        Harness harness(image, flash, root);
+        ok = harness.run();
+        harness.report();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+    }
+
+    if (options.keep)
+    {
+        std::cout << "Emulated devices kept in " << root << "\n";
+    }
+    else
+    {
+        fs::remove_all(root);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,361 @@
+#include "config.h"
+
+#include "event_loop.hpp"
+#include "image_manager.hpp"
+#include "image_verify.hpp"
+#include "msl_verify.hpp"
+#include "resource_usage.hpp"
+#include "spawn.hpp"
+#include "synthetic_image.hpp"
+#include "version.hpp"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+using namespace phosphor::software::bench;
+using phosphor::software::image::Signature;
+using phosphor::software::manager::Manager;
+using phosphor::software::manager::Version;
+
+namespace
+{
+
+/** @brief Parameters selectable from the command line, in addition to the
+ *         regular --benchmark_* flags. */
+struct Options
+{
+    std::vector<size_t> imageSizes = {1024 * 1024, 16 * 1024 * 1024};
+    std::vector<int> keyBits = {2048, 4096};
+    std::vector<std::string> hashTypes = {"RSA-SHA256", "RSA-SHA512"};
+};
+
+std::vector<std::string> split(const std::string& value)
+{
+    std::vector<std::string> result;
+    std::istringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+/** @brief Consume our own flags from argv, leaving the rest for the
+ *         benchmark library. */
+Options parseOptions(int& argc, char** argv)
+{
+    Options options;
+    int out = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        auto eq = arg.find('=');
+        auto name = arg.substr(0, eq);
+        auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--image_sizes")
+        {
+            options.imageSizes.clear();
+            for (const auto& size : split(value))
+            {
+                options.imageSizes.push_back(parseSize(size));
+            }
+        }
+        else if (name == "--key_bits")
+        {
+            options.keyBits.clear();
+            for (const auto& bits : split(value))
+            {
+                options.keyBits.push_back(std::stoi(bits));
+            }
+        }
+        else if (name == "--hash_types")
+        {
+            options.hashTypes = split(value);
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+    argc = out;
+    return options;
+}
+
+/** @brief Generated images are expensive (key generation, signing), so
+ *         share them between the benchmarks that use the same parameters. */
+SyntheticImage& getImage(size_t size, int keyBits, const std::string& hash)
+{
+    static std::map<std::tuple<size_t, int, std::string>,
+                    std::unique_ptr<SyntheticImage>>
+        images;
+
+    auto key = std::make_tuple(size, keyBits, hash);
+    auto it = images.find(key);
+    if (it == images.end())
+    {
+        ImageSpec spec;
+        spec.imageSize = size;
+        spec.keyBits = keyBits;
+        spec.hashType = hash;
+        it = images.emplace(key, std::make_unique<SyntheticImage>(spec)).first;
+    }
+    return *it->second;
+}
+
+void signatureVerify(benchmark::State& state, size_t size, int keyBits,
+                     const std::string& hash)
+{
+    auto& image = getImage(size, keyBits, hash);
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        Signature signature(image.imageDir(), image.confDir());
+        if (!signature.verify())
+        {
+            state.SkipWithError("Signature verification failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * image.totalBytes());
+}
+
+void verifyFile(benchmark::State& state, size_t size, int keyBits,
+                const std::string& hash)
+{
+    auto& image = getImage(size, keyBits, hash);
+    auto file = image.imageDir() / "image-rofs";
+    auto sigFile = file;
+    sigFile += SIGNATURE_FILE_EXT;
+    auto publicKey = image.imageDir() / PUBLICKEY_FILE_NAME;
+
+    Signature signature(image.imageDir(), image.confDir());
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        if (!signature.verifyFile(file, sigFile, publicKey, hash))
+        {
+            state.SkipWithError("File verification failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            image.imageFiles().at("image-rofs"));
+}
+
+void getValue(benchmark::State& state, const std::string& key)
+{
+    auto& image = getImage(1024 * 1024, 2048, "RSA-SHA256");
+    auto manifest = (image.imageDir() / MANIFEST_FILE_NAME).string();
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Version::getValue(manifest, key));
+    }
+}
+
+void getId(benchmark::State& state)
+{
+    const std::string version = "2.10.0-dev-1234-g0123456789ab";
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Version::getId(version));
+    }
+}
+
+void mslVerify(benchmark::State& state)
+{
+    // With an empty BMC_MSL or REGEX_BMC_MSL this only measures the early
+    // return, configure both options to measure the regex path.
+    const std::string version = "2.10.0-dev-1234-g0123456789ab";
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(minimum_ship_level::verify(version));
+    }
+}
+
+void unTar(benchmark::State& state, size_t size)
+{
+    auto& image = getImage(size, 2048, "RSA-SHA256");
+    auto tarball = image.tarball().string();
+    auto extractDir = (image.imageDir().parent_path() / "extract").string();
+
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        fs::remove_all(extractDir);
+        fs::create_directories(extractDir);
+        state.ResumeTiming();
+
+        if (!extractTarball(tarball, extractDir))
+        {
+            state.SkipWithError("Untar failed");
+            break;
+        }
+    }
+    fs::remove_all(extractDir);
+    state.SetBytesProcessed(state.iterations() * fs::file_size(tarball));
+}
+
+/** @brief Grow the resident memory of the process to at least size bytes,
+ *         the way a long running daemon grows, which fork() has to map
+ *         into every child. */
+void touchMemory(size_t size)
+{
+    static std::vector<std::unique_ptr<char[]>> chunks;
+    static size_t resident = 0;
+    constexpr size_t chunkSize = 1024 * 1024;
+    while (resident < size)
+    {
+        chunks.emplace_back(new char[chunkSize]);
+        std::memset(chunks.back().get(), 1, chunkSize);
+        resident += chunkSize;
+    }
+}
+
+/** @brief The fork() and execv() path the launcher replaced */
+void forkExec(benchmark::State& state, size_t rss)
+{
+    touchMemory(rss);
+    char* const argv[] = {const_cast<char*>("true"), nullptr};
+
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execv("/bin/true", argv);
+            _exit(127);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+        {
+            state.SkipWithError("fork/execv of /bin/true failed");
+            break;
+        }
+    }
+}
+
+void spawn(benchmark::State& state, size_t rss)
+{
+    touchMemory(rss);
+    char* const argv[] = {const_cast<char*>("true"), nullptr};
+
+    ResourceCounters counters(state);
+    for (auto _ : state)
+    {
+        auto pid = utils::spawn("/bin/true", argv);
+        if (pid < 0 || utils::waitChild(pid) != 0)
+        {
+            state.SkipWithError("spawn of /bin/true failed");
+            break;
+        }
+    }
+}
+
+std::string sizeName(size_t size)
+{
+    if (size % (1024 * 1024) == 0)
+    {
+        return std::to_string(size / (1024 * 1024)) + "M";
+    }
+    if (size % 1024 == 0)
+    {
+        return std::to_string(size / 1024) + "K";
+    }
+    return std::to_string(size);
+}
+
+void registerBenchmarks(const Options& options)
+{
+    for (auto size : options.imageSizes)
+    {
+        for (auto bits : options.keyBits)
+        {
+            for (const auto& hash : options.hashTypes)
+            {
+                auto suffix = "/" + sizeName(size) + "/rsa" +
+                              std::to_string(bits) + "/" + hash;
+                benchmark::RegisterBenchmark(
+                    ("Signature::verify" + suffix).c_str(), signatureVerify,
+                    size, bits, hash)
+                    ->Unit(benchmark::kMillisecond)
+                    ->UseRealTime();
+                benchmark::RegisterBenchmark(
+                    ("Signature::verifyFile" + suffix).c_str(), verifyFile,
+                    size, bits, hash)
+                    ->Unit(benchmark::kMillisecond)
+                    ->UseRealTime();
+            }
+        }
+
+        benchmark::RegisterBenchmark(
+            ("Manager::unTarAsync/" + sizeName(size)).c_str(), unTar, size)
+            ->Unit(benchmark::kMillisecond)
+            ->UseRealTime();
+    }
+
+    // First and last key of the generated MANIFEST
+    benchmark::RegisterBenchmark("Version::getValue/purpose", getValue,
+                                 std::string("purpose"));
+    benchmark::RegisterBenchmark("Version::getValue/MachineName", getValue,
+                                 std::string("MachineName"));
+    benchmark::RegisterBenchmark("Version::getValue/missing", getValue,
+                                 std::string("missing"));
+    benchmark::RegisterBenchmark("Version::getId", getId);
+    benchmark::RegisterBenchmark("minimum_ship_level::verify", mslVerify);
+
+    // Spawn latency of a trivial program as the resident memory of the
+    // caller grows. The memory is never released, so these run last.
+    for (size_t rss : {0, 64 * 1024 * 1024, 256 * 1024 * 1024})
+    {
+        benchmark::RegisterBenchmark(
+            ("fork+execv/" + sizeName(rss)).c_str(), forkExec, rss)
+            ->Unit(benchmark::kMicrosecond)
+            ->UseRealTime();
+        benchmark::RegisterBenchmark(
+            ("utils::spawn/" + sizeName(rss)).c_str(), spawn, rss)
+            ->Unit(benchmark::kMicrosecond)
+            ->UseRealTime();
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    auto options = parseOptions(argc, argv);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    // The children are reaped through the event loop, like in the daemon.
+    utils::blockChildSignal();
+    registerBenchmarks(options);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
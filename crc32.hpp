@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+/**
+ * @brief Compute the IEEE 802.3 CRC-32 of a buffer
+ * @details Same polynomial and conventions as zlib's crc32(), which is what
+ *          both the GPT headers and the U-Boot environment use.
+ * @param[in] data - The data to checksum
+ * @param[in] length - Number of bytes in data
+ * @param[in] crc - The CRC of the preceding data, to checksum in pieces
+ * @return The CRC-32 value
+ */
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
+
+} // namespace utils
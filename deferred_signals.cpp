@@ -0,0 +1,127 @@
+#include "deferred_signals.hpp"
+
+#include <systemd/sd-bus.h>
+
+#include <phosphor-logging/log.hpp>
+
+#include <cerrno>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+using namespace phosphor::logging;
+
+namespace
+{
+
+/** @brief A NULL terminated list of names for the sd-bus strv calls */
+template <typename Names>
+std::vector<char*> strv(const Names& names)
+{
+    std::vector<char*> list;
+    for (const auto& name : names)
+    {
+        list.push_back(const_cast<char*>(name.c_str()));
+    }
+    list.push_back(nullptr);
+    return list;
+}
+
+/** @brief Log the failure of an emission. The object may have been
+ *  destroyed since the change was recorded, which is not an error.
+ */
+void checkEmitted(int rc, const char* what, const std::string& path)
+{
+    if (rc < 0 && rc != -ENOENT)
+    {
+        log<level::ERR>("Failed to emit D-Bus signal",
+                        entry("SIGNAL=%s", what),
+                        entry("PATH=%s", path.c_str()), entry("RC=%d", rc));
+    }
+}
+
+} // namespace
+
+void DeferredSignals::interfaceAdded(const std::string& path,
+                                     const char* interface)
+{
+    auto& object = objects[path];
+    object.changed.erase(interface);
+    object.added.insert(interface);
+}
+
+void DeferredSignals::interfaceRemoved(const std::string& path,
+                                       const char* interface)
+{
+    auto& object = objects[path];
+    object.changed.erase(interface);
+    if (object.added.erase(interface) == 0)
+    {
+        object.removed.insert(interface);
+    }
+}
+
+void DeferredSignals::propertyChanged(const std::string& path,
+                                      const char* interface,
+                                      const char* property)
+{
+    auto& object = objects[path];
+    if (object.added.count(interface) == 0)
+    {
+        object.changed[interface].insert(property);
+    }
+}
+
+void DeferredSignals::flush(sdbusplus::bus::bus& bus)
+{
+    // Emitting does not call back into this class, but take the pending
+    // signals out anyway so that the map is left empty on an exception.
+    auto pending = take();
+    for (const auto& [path, object] : pending)
+    {
+        if (!object.removed.empty())
+        {
+            auto names = strv(object.removed);
+            checkEmitted(sd_bus_emit_interfaces_removed_strv(
+                             bus.get(), path.c_str(), names.data()),
+                         "InterfacesRemoved", path);
+        }
+        if (!object.added.empty())
+        {
+            auto names = strv(object.added);
+            checkEmitted(sd_bus_emit_interfaces_added_strv(
+                             bus.get(), path.c_str(), names.data()),
+                         "InterfacesAdded", path);
+        }
+        for (const auto& [interface, properties] : object.changed)
+        {
+            auto names = strv(properties);
+            checkEmitted(sd_bus_emit_properties_changed_strv(
+                             bus.get(), path.c_str(), interface.c_str(),
+                             names.data()),
+                         "PropertiesChanged", path);
+        }
+    }
+}
+
+std::map<std::string, DeferredSignals::Object> DeferredSignals::take()
+{
+    std::map<std::string, Object> pending;
+    pending.swap(objects);
+    return pending;
+}
+
+DeferredSignals& getDeferredSignals()
+{
+    static DeferredSignals signals;
+    return signals;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
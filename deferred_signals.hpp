@@ -0,0 +1,122 @@
+#pragma once
+
+#include <sdbusplus/bus.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @class DeferredSignals
+ *  @brief Collects the InterfacesAdded, InterfacesRemoved and
+ *         PropertiesChanged signals of the objects during one iteration of
+ *         the event loop and emits them together at the end of it.
+ *  @details Each object gets at most one signal of each kind per iteration,
+ *           and one PropertiesChanged per interface listing all the changed
+ *           properties. The signals carry the values the properties have
+ *           when they are emitted. An interface added and removed within
+ *           the same iteration is never announced, and the changes of an
+ *           interface that is added or removed are dropped.
+ */
+class DeferredSignals
+{
+  public:
+    /** @brief The signals pending for an object */
+    struct Object
+    {
+        std::set<std::string> removed;
+        std::set<std::string> added;
+        std::map<std::string, std::set<std::string>> changed;
+    };
+
+    /** @brief Announce an interface, which was registered without
+     *         emitting any signal
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface name
+     */
+    void interfaceAdded(const std::string& path, const char* interface);
+
+    /** @brief Announce the removal of an interface
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface name
+     */
+    void interfaceRemoved(const std::string& path, const char* interface);
+
+    /** @brief Announce the change of a property, which was set without
+     *         emitting any signal
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface name
+     *  @param[in] property - The property name
+     */
+    void propertyChanged(const std::string& path, const char* interface,
+                         const char* property);
+
+    /** @brief Emit the collected signals. Removals are emitted before
+     *         additions, so an interface that is re-created within the
+     *         iteration is announced again with its new values.
+     *
+     *  @param[in] bus - The bus to emit on
+     */
+    void flush(sdbusplus::bus::bus& bus);
+
+    /** @brief Take the collected signals, leaving none pending
+     *
+     *  @return The signals by object path
+     */
+    std::map<std::string, Object> take();
+
+  private:
+    /** @brief The pending signals by object path */
+    std::map<std::string, Object> objects;
+};
+
+/** @brief The deferred signals of the updater, flushed by the main loop */
+DeferredSignals& getDeferredSignals();
+
+/** @class DeferredInterface
+ *  @brief Announces an interface of an object, created with
+ *         action::emit_no_signals, through the deferred signals while it
+ *         exists.
+ */
+class DeferredInterface
+{
+  public:
+    DeferredInterface() = delete;
+    DeferredInterface(const DeferredInterface&) = delete;
+    DeferredInterface& operator=(const DeferredInterface&) = delete;
+    DeferredInterface(DeferredInterface&&) = delete;
+    DeferredInterface& operator=(DeferredInterface&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface name
+     */
+    DeferredInterface(const std::string& path, const char* interface) :
+        path(path), interface(interface)
+    {
+        getDeferredSignals().interfaceAdded(path, interface);
+    }
+
+    ~DeferredInterface()
+    {
+        getDeferredSignals().interfaceRemoved(path, interface);
+    }
+
+  private:
+    std::string path;
+    const char* interface;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -2,16 +2,15 @@
 
 #include "download_manager.hpp"
 
+#include "spawn.hpp"
 #include "xyz/openbmc_project/Common/error.hpp"
 
-#include <sys/wait.h>
-#include <unistd.h>
-
 #include <phosphor-logging/elog-errors.hpp>
 #include <phosphor-logging/elog.hpp>
 #include <phosphor-logging/log.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
 #include <string>
@@ -27,6 +26,9 @@ using namespace sdbusplus::xyz::openbmc_project::Common::Error;
 using namespace phosphor::logging;
 namespace fs = std::filesystem;
 
+/** @brief How long a TFTP transfer may take */
+constexpr std::chrono::minutes tftpTimeout(10);
+
 void Download::downloadViaTFTP(std::string fileName, std::string serverAddress)
 {
     using Argument = xyz::openbmc_project::Common::InvalidArgument;
@@ -68,49 +70,34 @@ void Download::downloadViaTFTP(std::string fileName, std::string serverAddress)
         return;
     }
 
-    pid_t pid = fork();
-
-    if (pid == 0)
+    // The transfer is not waited for, the image manager picks the image up
+    // when it lands in the upload directory. The event loop reaps it.
+    auto localPath = std::string{IMG_UPLOAD_DIR} + '/' + fileName;
+    const char* argv[] = {"tftp",
+                          "-g",
+                          "-r",
+                          fileName.c_str(),
+                          serverAddress.c_str(),
+                          "-l",
+                          localPath.c_str(),
+                          nullptr};
+    auto started = utils::spawnAsync(
+        sd_bus_get_event(bus.get()), "/usr/bin/tftp",
+        const_cast<char* const*>(argv), tftpTimeout,
+        [fileName](const utils::ChildExit& result) {
+            if (result.status != 0)
+            {
+                log<level::ERR>("TFTP transfer failed",
+                                entry("FILENAME=%s", fileName.c_str()),
+                                entry("STATUS=%d", result.status),
+                                entry("ERRORS=%s", result.errors.c_str()));
+            }
+        });
+    if (!started)
     {
-        pid_t nextPid = fork();
-        if (nextPid == 0)
-        {
-            // child process
-            execl("/usr/bin/tftp", "tftp", "-g", "-r", fileName.c_str(),
-                  serverAddress.c_str(), "-l",
-                  (std::string{IMG_UPLOAD_DIR} + '/' + fileName).c_str(),
-                  (char*)0);
-            // execl only returns on fail
-            log<level::ERR>("Error occurred during the TFTP call");
-            elog<InternalFailure>();
-        }
-        else if (nextPid < 0)
-        {
-            log<level::ERR>("Error occurred during fork");
-            elog<InternalFailure>();
-        }
-        // do nothing as parent if all is going well
-        // when parent exits, child will be reparented under init
-        // and then be reaped properly
-        exit(0);
-    }
-    else if (pid < 0)
-    {
-        log<level::ERR>("Error occurred during fork");
+        log<level::ERR>("Error occurred during the TFTP call");
         elog<InternalFailure>();
     }
-    else
-    {
-        int status;
-        if (waitpid(pid, &status, 0) < 0)
-        {
-            log<level::ERR>("waitpid error");
-        }
-        else if (WEXITSTATUS(status) != 0)
-        {
-            log<level::ERR>("failed to launch tftp");
-        }
-    }
 
     return;
 }
@@ -30,7 +30,7 @@ class Download : public DownloadInherit
      * @param[in] objPath   - The Dbus object path
      */
     Download(sdbusplus::bus::bus& bus, const std::string& objPath) :
-        DownloadInherit(bus, (objPath).c_str()){};
+        DownloadInherit(bus, (objPath).c_str()), bus(bus){};
 
     /**
      * @brief Download the specified image via TFTP
@@ -40,6 +40,10 @@ class Download : public DownloadInherit
      **/
     void downloadViaTFTP(std::string fileName,
                          std::string serverAddress) override;
+
+  private:
+    /** @brief The bus, whose event loop reaps the transfers */
+    sdbusplus::bus::bus& bus;
 };
 
 } // namespace manager
@@ -1,13 +1,22 @@
 #include "config.h"
 
 #include "download_manager.hpp"
+#include "spawn.hpp"
+
+#include <systemd/sd-event.h>
 
 #include <sdbusplus/bus.hpp>
 
 int main()
 {
+    // Before any thread or child exists, see utils::spawnAsync().
+    utils::blockChildSignal();
+
     auto bus = sdbusplus::bus::new_default();
 
+    sd_event* loop = nullptr;
+    sd_event_default(&loop);
+
     // Add sdbusplus ObjectManager.
     sdbusplus::server::manager::manager objManager(bus, SOFTWARE_OBJPATH);
 
@@ -15,10 +24,9 @@ int main()
 
     bus.request_name(DOWNLOAD_BUSNAME);
 
-    while (true)
-    {
-        bus.process_discard();
-        bus.wait();
-    }
+    bus.attach_event(loop, SD_EVENT_PRIORITY_NORMAL);
+    sd_event_loop(loop);
+
+    sd_event_unref(loop);
     return 0;
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <sdbusplus/bus.hpp>
+#include "signal_router.hpp"
 
 namespace phosphor
 {
@@ -28,8 +28,10 @@ class Flash
 
     /**
      * @brief Takes action when the state of the activation service file changes
+     *
+     * @param[in] job - The removed job of the service file
      */
-    virtual void onStateChanges(sdbusplus::message::message& msg) = 0;
+    virtual void onStateChanges(const JobRemoved& job) = 0;
 };
 
 } // namespace updater
@@ -0,0 +1,1729 @@
+#include "config.h"
+
+#include "flash_backend.hpp"
+
+#include "crc32.hpp"
+#include "gpt.hpp"
+#include "images.hpp"
+#include "persistent_state.hpp"
+#include "uboot_env.hpp"
+#include "version.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+using namespace phosphor::software::image;
+
+namespace
+{
+
+constexpr auto imagePrefix = "image-";
+
+/** @brief The size of the writes to devices written without erasing */
+constexpr uint32_t writeChunkSize = 1024 * 1024;
+
+/** @brief The alignment of the write buffers */
+constexpr size_t pageSize = 4096;
+
+/** @brief The bytes of an image written between two checkpoints */
+constexpr uint64_t checkpointInterval = 4 * 1024 * 1024;
+
+/** @brief The size of the reads checking a checkpoint or a digest */
+constexpr size_t checkChunkSize = 1024 * 1024;
+
+/** @brief The start of an eMMC partition zeroed to make it unbootable */
+constexpr uint64_t wipeSize = 1024 * 1024;
+
+/** @brief Serializes the accesses to the u-boot mirror record, which the
+ *         mirror and an activation can make from their workers */
+std::mutex mirrorStateLock;
+
+/** @brief The u-boot mirror record */
+struct MirrorState
+{
+    /** @brief Bumped whenever u-boot is programmed */
+    uint64_t generation = 0;
+
+    /** @brief The generation the alt chip was last mirrored from */
+    uint64_t mirrored = 0;
+
+    /** @brief See UbootMirror::fingerprint() */
+    uint32_t fingerprint = 0;
+
+    /** @brief Whether the record was read */
+    bool valid = false;
+};
+
+MirrorState readMirrorState(const fs::path& file)
+{
+    MirrorState state;
+    std::string data;
+    if (readFile(file, data))
+    {
+        std::istringstream fields(data);
+        state.valid = static_cast<bool>(fields >> state.generation >>
+                                        state.mirrored >> std::hex >>
+                                        state.fingerprint);
+    }
+    if (!state.valid)
+    {
+        state = {};
+    }
+    return state;
+}
+
+void writeMirrorState(const fs::path& file, const MirrorState& state)
+{
+    std::ostringstream data;
+    data << state.generation << ' ' << state.mirrored << ' ' << std::hex
+         << state.fingerprint << '\n';
+    writeFileAtomic(file, data.str());
+}
+
+/** @brief A SHA-256 context for a checkpoint */
+std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> newHash()
+{
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+        EVP_MD_CTX_new(), EVP_MD_CTX_free};
+    if (!hash || !EVP_DigestInit_ex(hash.get(), EVP_sha256(), nullptr))
+    {
+        throw std::bad_alloc();
+    }
+    return hash;
+}
+
+/** @brief The digest of the data hashed so far, the hash can go on */
+WriteCheckpoint::Digest digestOf(EVP_MD_CTX* hash)
+{
+    auto copy = newHash();
+    std::array<uint8_t, EVP_MAX_MD_SIZE> result{};
+    unsigned int resultSize = 0;
+    if (!EVP_MD_CTX_copy_ex(copy.get(), hash) ||
+        !EVP_DigestFinal_ex(copy.get(), result.data(), &resultSize))
+    {
+        throw std::bad_alloc();
+    }
+
+    WriteCheckpoint::Digest digest{};
+    std::copy_n(result.begin(), digest.size(), digest.begin());
+    return digest;
+}
+
+/** @brief A digest as hex digits */
+std::string toHex(const WriteCheckpoint::Digest& digest)
+{
+    std::ostringstream hex;
+    hex << std::hex << std::setfill('0');
+    for (auto byte : digest)
+    {
+        hex << std::setw(2) << static_cast<unsigned>(byte);
+    }
+    return hex.str();
+}
+
+/** @brief Parse the hex digits of a digest, false if they are not one */
+bool fromHex(const std::string& hex, WriteCheckpoint::Digest& digest)
+{
+    if (hex.size() != digest.size() * 2 ||
+        !std::all_of(hex.begin(), hex.end(),
+                     [](unsigned char c) { return std::isxdigit(c); }))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < digest.size(); i++)
+    {
+        digest[i] = static_cast<uint8_t>(
+            std::stoul(hex.substr(i * 2, 2), nullptr, 16));
+    }
+    return true;
+}
+
+/** @brief Sums the sizes of the image files present in a directory */
+uint64_t totalSize(const fs::path& imageDir,
+                   const std::vector<std::string>& names)
+{
+    uint64_t total = 0;
+    for (const auto& name : names)
+    {
+        std::error_code ec;
+        auto size = fs::file_size(imageDir / name, ec);
+        if (!ec)
+        {
+            total += size;
+        }
+    }
+    return total;
+}
+
+/** @brief Reports the progress of one image as part of the whole update */
+ProgressCallback overall(const ProgressCallback& progress, uint64_t& base,
+                         uint64_t total)
+{
+    if (!progress)
+    {
+        return nullptr;
+    }
+    return [&progress, &base, total](uint64_t done, uint64_t) {
+        progress(base + done, total);
+    };
+}
+
+/** @brief Checks the deltas shipped with a version: they must be for images
+ *         the layout rebuilds, against the running version named by
+ *         DeltaSource in the MANIFEST. Throws std::invalid_argument
+ *         otherwise.
+ *
+ *  @param[in] imageDir - Directory holding the image-* files
+ *  @param[in] supported - The images that can be shipped as deltas
+ *  @param[in] runningVersionId - The version id of the running image
+ */
+void checkDeltas(const fs::path& imageDir,
+                 const std::vector<std::string>& supported,
+                 const std::string& runningVersionId)
+{
+    bool found = false;
+    for (const auto& entry : fs::directory_iterator(imageDir))
+    {
+        auto name = entry.path().filename().string();
+        if (name.size() <= deltaSuffix.size() ||
+            name.compare(name.size() - deltaSuffix.size(), deltaSuffix.size(),
+                         deltaSuffix) != 0)
+        {
+            continue;
+        }
+        name.resize(name.size() - deltaSuffix.size());
+        if (std::find(supported.begin(), supported.end(), name) ==
+            supported.end())
+        {
+            throw std::invalid_argument("No delta support for " + name);
+        }
+        found = true;
+    }
+    if (!found)
+    {
+        return;
+    }
+
+    auto source = manager::Version::getValue(
+        (imageDir / MANIFEST_FILE_NAME).string(), "DeltaSource");
+    if (source.empty() || source != runningVersionId)
+    {
+        throw std::invalid_argument("Deltas against version " + source +
+                                    ", not the running one");
+    }
+}
+
+/** @brief Compares the start of a device with an image */
+bool matches(FlashDevice& device, ImageSource& source)
+{
+    if (source.size() > device.size())
+    {
+        return false;
+    }
+
+    constexpr size_t chunkSize = 64 * 1024;
+    std::vector<uint8_t> image(chunkSize);
+    std::vector<uint8_t> current(chunkSize);
+    uint64_t offset = 0;
+    while (auto length = source.read(image.data(), image.size()))
+    {
+        device.read(offset, current.data(), length);
+        if (std::memcmp(image.data(), current.data(), length))
+        {
+            return false;
+        }
+        offset += length;
+    }
+    return true;
+}
+
+/** @brief Program an image with writeImage() and have it read back as it
+ *         is written. The caller drops the record of the device from the
+ *         digests, if any, before changing it, this records the image.
+ */
+uint64_t writeVerified(ReadbackVerifier& verifier, FlashDevice& device,
+                       ImageSource& source, bool erase,
+                       const ProgressCallback& progress,
+                       const WritePlan* plan = nullptr,
+                       WriteCheckpoint* checkpoint = nullptr,
+                       ContentDigests* digests = nullptr)
+{
+    auto id = verifier.add(
+        device.name(), [&device](uint64_t offset, void* data, size_t length) {
+            device.readBack(offset, data, length);
+        });
+    DigestSource digested(source);
+    auto size = writeImage(
+        device, digested, erase,
+        [&verifier, &progress, id](uint64_t done, uint64_t total) {
+            verifier.committed(id, done);
+            if (progress)
+            {
+                progress(done, total);
+            }
+        },
+        plan, checkpoint);
+    verifier.completed(id, size, digested.digest());
+    if (digests)
+    {
+        digests->written(device.name(), size, digested.digest());
+    }
+    return size;
+}
+
+/** @brief The name of a UBI volume in the checkpoint and the digests */
+std::string volumeKey(UbiDevice& ubi, const std::string& volName)
+{
+    return ubi.name() + "/" + volName;
+}
+
+/** @class ChipScheduler
+ *  @brief Runs the writes of an update in parallel across chips, a bounded
+ *         number at a time on each chip, and reports their combined
+ *         progress.
+ *  @details A NOR chip serializes the writes to it anyway, so by default
+ *           the writes to one chip run one after the other, in the order
+ *           they were added. An eMMC queues the commands of several
+ *           writes. Once a write fails, the others stop at their next
+ *           progress report and run() rethrows the first failure.
+ */
+class ChipScheduler
+{
+  public:
+    /** @brief A write, which reports its own progress and throws on
+     *         failure */
+    using Write = std::function<void(const ProgressCallback& progress)>;
+
+    /** @brief Constructor
+     *
+     *  @param[in] progress - Called with the progress of all the writes,
+     *                        from the thread of whichever write progressed
+     *  @param[in] total - The bytes written by all the writes
+     *  @param[in] perChip - The number of writes run at once on a chip
+     */
+    ChipScheduler(const ProgressCallback& progress, uint64_t total,
+                  size_t perChip = 1) :
+        progress(progress),
+        total(total), perChip(perChip)
+    {
+    }
+
+    /** @brief Queue a write on a chip */
+    void add(const std::string& chip, Write write)
+    {
+        queues[chip].push_back(std::move(write));
+    }
+
+    /** @brief Run the queued writes and wait for them */
+    void run()
+    {
+        std::vector<std::deque<Write>*> runners;
+        for (auto& [chip, writes] : queues)
+        {
+            auto count = std::min(perChip, writes.size());
+            runners.insert(runners.end(), count, &writes);
+        }
+
+        // The last runner runs on this thread.
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i + 1 < runners.size(); i++)
+        {
+            try
+            {
+                workers.emplace_back(&ChipScheduler::runQueue, this,
+                                     std::ref(*runners[i]));
+            }
+            catch (const std::system_error&)
+            {
+                fail(std::current_exception());
+                break;
+            }
+        }
+        if (!runners.empty())
+        {
+            runQueue(*runners.back());
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        queues.clear();
+
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+
+  private:
+    void runQueue(std::deque<Write>& writes)
+    {
+        while (true)
+        {
+            Write write;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (failure || writes.empty())
+                {
+                    return;
+                }
+                write = std::move(writes.front());
+                writes.pop_front();
+            }
+
+            uint64_t reported = 0;
+            try
+            {
+                write([this, &reported](uint64_t done, uint64_t) {
+                    report(done - reported);
+                    reported = done;
+                });
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+                return;
+            }
+        }
+    }
+
+    void report(uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (failure)
+        {
+            throw std::runtime_error("Another write failed");
+        }
+        done += bytes;
+        if (progress)
+        {
+            progress(done, total);
+        }
+    }
+
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!failure)
+        {
+            failure = error;
+        }
+    }
+
+    const ProgressCallback& progress;
+    const uint64_t total;
+    const size_t perChip;
+
+    /** @brief Guards the queues and the state below, shared by the
+     *         writes */
+    std::mutex lock;
+    std::map<std::string, std::deque<Write>> queues;
+    uint64_t done = 0;
+    std::exception_ptr failure;
+};
+
+} // namespace
+
+FlashDevice& SystemFlashDevices::mtd(const std::string& name)
+{
+    auto it = mtds.find(name);
+    if (it == mtds.end())
+    {
+        auto path = MtdDevice::find(name);
+        if (path.empty())
+        {
+            throw std::invalid_argument("No MTD partition " + name);
+        }
+        it = mtds.emplace(name, std::make_unique<MtdDevice>(path, name)).first;
+    }
+    return *it->second;
+}
+
+UbiDevice& SystemFlashDevices::ubi(const std::string& mtdName)
+{
+    auto it = ubis.find(mtdName);
+    if (it == ubis.end())
+    {
+        // MtdDevice::find() returns /dev/mtdN.
+        auto path = MtdDevice::find(mtdName);
+        if (path.empty())
+        {
+            throw std::invalid_argument("No MTD partition " + mtdName);
+        }
+        auto ubiNum = KernelUbiDevice::findAttached(
+            std::stoi(path.substr(std::strlen("/dev/mtd"))));
+        if (ubiNum < 0)
+        {
+            throw std::invalid_argument("No UBI device on " + mtdName);
+        }
+        it = ubis.emplace(mtdName,
+                          std::make_unique<KernelUbiDevice>(ubiNum, mtdName))
+                 .first;
+    }
+    return *it->second;
+}
+
+SystemFlashDevices::~SystemFlashDevices()
+{
+    for (const auto& forceRo : forcedWritable)
+    {
+        std::ofstream(forceRo) << "1";
+    }
+}
+
+FlashDevice& SystemFlashDevices::disk(const std::string& name)
+{
+    auto it = disks.find(name);
+    if (it == disks.end())
+    {
+        auto path = "/dev/" + name;
+        if (!fs::exists(path))
+        {
+            throw std::invalid_argument("No block device " + name);
+        }
+
+        // The boot partitions of an eMMC are read only until force_ro is
+        // cleared, like mmc_update does around writing u-boot.
+        auto forceRo = fs::path("/sys/block") / name / "force_ro";
+        std::string value;
+        if (std::ifstream(forceRo) >> value && value == "1")
+        {
+            std::ofstream(forceRo) << "0";
+            forcedWritable.push_back(forceRo);
+        }
+
+        it = disks.emplace(name, std::make_unique<BlockDevice>(path, name,
+                                                               directIo))
+                 .first;
+    }
+    return *it->second;
+}
+
+std::string SystemFlashDevices::chipOf(const std::string& name)
+{
+    // The device of an MTD partition is its chip, e.g.
+    // /sys/devices/.../spi0.0 for the mtd3 partition.
+    auto path = MtdDevice::find(name);
+    if (!path.empty())
+    {
+        std::error_code ec;
+        auto chip = fs::canonical(
+            fs::path("/sys/class/mtd") / fs::path(path).filename(), ec);
+        return ec ? name : chip.parent_path().string();
+    }
+
+    // The boot partitions of an eMMC, mmcblkNbootM, are on mmcblkN.
+    auto boot = name.find("boot");
+    if (name.compare(0, 6, "mmcblk") == 0 && boot != std::string::npos)
+    {
+        return name.substr(0, boot);
+    }
+    return name;
+}
+
+bool WritePlan::covers(uint64_t offset, uint64_t length) const
+{
+    auto next = std::upper_bound(
+        ranges.begin(), ranges.end(), offset,
+        [](uint64_t value, const auto& range) { return value < range.first; });
+    if (next != ranges.end() && next->first < offset + length)
+    {
+        return true;
+    }
+    return next != ranges.begin() &&
+           std::prev(next)->first + std::prev(next)->second > offset;
+}
+
+uint64_t WritePlan::bytes() const
+{
+    uint64_t total = 0;
+    for (const auto& range : ranges)
+    {
+        total += range.second;
+    }
+    return total;
+}
+
+void WritePlan::store(const fs::path& path) const
+{
+    std::ostringstream data;
+    data << blockSize << ' ' << imageSize << '\n';
+    for (const auto& range : ranges)
+    {
+        data << range.first << ' ' << range.second << '\n';
+    }
+    writeFileAtomic(path, data.str());
+}
+
+std::optional<WritePlan> WritePlan::load(const fs::path& path)
+{
+    std::string data;
+    if (!readFile(path, data))
+    {
+        return std::nullopt;
+    }
+
+    std::istringstream fields(data);
+    WritePlan plan;
+    if (!(fields >> plan.blockSize >> plan.imageSize) || plan.blockSize == 0)
+    {
+        return std::nullopt;
+    }
+    uint64_t offset;
+    uint64_t length;
+    while (fields >> offset >> length)
+    {
+        plan.ranges.emplace_back(offset, length);
+    }
+    if (!fields.eof())
+    {
+        return std::nullopt;
+    }
+    return plan;
+}
+
+WritePlan planWrite(FlashDevice& device, ImageSource& source)
+{
+    WritePlan plan;
+    plan.imageSize = source.size();
+    if (plan.imageSize > device.size())
+    {
+        throw std::length_error("Image does not fit in " + device.name());
+    }
+
+    // Compare what each block would hold once written: on NOR flash the
+    // end of the last block is erased too.
+    plan.blockSize = device.eraseSize();
+    std::vector<uint8_t> wanted(plan.blockSize);
+    std::vector<uint8_t> current(plan.blockSize);
+    for (uint64_t offset = 0; offset < plan.imageSize;
+         offset += plan.blockSize)
+    {
+        size_t length = 0;
+        while (length < plan.blockSize && offset + length < plan.imageSize)
+        {
+            auto rc = source.read(wanted.data() + length,
+                                  plan.blockSize - length);
+            if (rc == 0)
+            {
+                throw std::runtime_error("Image ended early for " +
+                                         device.name());
+            }
+            length += rc;
+        }
+        auto blockLength = length;
+        if (device.requiresErase())
+        {
+            blockLength = std::min<uint64_t>(plan.blockSize,
+                                             device.size() - offset);
+            std::fill(wanted.begin() + length,
+                      wanted.begin() + blockLength, 0xFF);
+        }
+
+        device.read(offset, current.data(), blockLength);
+        if (std::memcmp(wanted.data(), current.data(), blockLength) == 0)
+        {
+            continue;
+        }
+        if (!plan.ranges.empty() &&
+            plan.ranges.back().first + plan.ranges.back().second == offset)
+        {
+            plan.ranges.back().second += blockLength;
+        }
+        else
+        {
+            plan.ranges.emplace_back(offset, blockLength);
+        }
+    }
+    return plan;
+}
+
+WriteCheckpoint::WriteCheckpoint(const fs::path& file,
+                                 const std::string& versionId) :
+    file(file),
+    versionId(versionId)
+{
+    std::string data;
+    if (!readFile(file, data))
+    {
+        return;
+    }
+
+    std::istringstream lines(data);
+    std::string recorded;
+    if (!std::getline(lines, recorded) || recorded != versionId)
+    {
+        return;
+    }
+
+    std::string name;
+    uint64_t committed;
+    std::string digest;
+    while (lines >> name >> committed >> digest)
+    {
+        Image image;
+        image.committed = committed;
+        if (fromHex(digest, image.digest))
+        {
+            images.emplace(name, std::move(image));
+        }
+    }
+}
+
+uint64_t WriteCheckpoint::committed(const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto image = images.find(name);
+    return image == images.end() ? 0 : image->second.committed;
+}
+
+uint64_t WriteCheckpoint::resume(const std::string& name, ImageSource& source,
+                                 const ReadbackVerifier::Reader& device,
+                                 uint64_t align)
+{
+    uint64_t target = 0;
+    Digest digest{};
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& image = images[name];
+        target = image.committed;
+        digest = image.digest;
+        image = Image{};
+        image.hash = newHash();
+    }
+    if (target == 0 || target > source.size() ||
+        (target % align && target != source.size()))
+    {
+        return 0;
+    }
+
+    // Check the device first, the image is a stream read only once.
+    std::vector<uint8_t> buffer(checkChunkSize);
+    auto hash = newHash();
+    try
+    {
+        for (uint64_t offset = 0; offset < target; offset += buffer.size())
+        {
+            auto length = std::min<uint64_t>(buffer.size(), target - offset);
+            device(offset, buffer.data(), length);
+            EVP_DigestUpdate(hash.get(), buffer.data(), length);
+        }
+    }
+    catch (const std::exception&)
+    {
+        return 0;
+    }
+    if (digestOf(hash.get()) != digest)
+    {
+        return 0;
+    }
+
+    hash = newHash();
+    for (uint64_t done = 0; done < target;)
+    {
+        auto length = source.read(
+            buffer.data(), std::min<uint64_t>(buffer.size(), target - done));
+        if (length == 0)
+        {
+            throw std::runtime_error("Image ended early for " + name);
+        }
+        EVP_DigestUpdate(hash.get(), buffer.data(), length);
+        done += length;
+    }
+    if (digestOf(hash.get()) != digest)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        images.erase(name);
+        store();
+        throw std::runtime_error("Image " + name +
+                                 " differs from the one written before");
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto& image = images[name];
+    image.committed = target;
+    image.digest = digest;
+    image.written = target;
+    image.hash = std::move(hash);
+    return target;
+}
+
+void WriteCheckpoint::advance(const std::string& name, const void* data,
+                              size_t length, uint64_t total,
+                              const std::function<void()>& sync)
+{
+    Image* image = nullptr;
+    uint64_t committed = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        image = &images[name];
+        if (!image->hash)
+        {
+            image->hash = newHash();
+        }
+        committed = image->committed;
+    }
+
+    // Only the writer of the image uses its hash.
+    EVP_DigestUpdate(image->hash.get(), data, length);
+    image->written += length;
+    if (image->written - committed < checkpointInterval &&
+        image->written != total)
+    {
+        return;
+    }
+
+    sync();
+    auto digest = digestOf(image->hash.get());
+    std::lock_guard<std::mutex> guard(lock);
+    image->committed = image->written;
+    image->digest = digest;
+    store();
+}
+
+void WriteCheckpoint::completed(const std::string& name, uint64_t size,
+                                const Digest& digest)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto& image = images[name];
+    image.committed = size;
+    image.digest = digest;
+    image.written = size;
+    store();
+}
+
+void WriteCheckpoint::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    images.clear();
+    std::error_code ec;
+    fs::remove(file, ec);
+}
+
+void WriteCheckpoint::store()
+{
+    std::ostringstream data;
+    data << versionId << '\n';
+    for (const auto& [name, image] : images)
+    {
+        if (image.committed)
+        {
+            data << name << ' ' << image.committed << ' '
+                 << toHex(image.digest) << '\n';
+        }
+    }
+    writeFileAtomic(file, data.str());
+}
+
+ContentDigests::ContentDigests(const fs::path& file) : file(file)
+{
+    std::string data;
+    if (!readFile(file, data))
+    {
+        return;
+    }
+
+    std::istringstream lines(data);
+    std::string name;
+    uint64_t size;
+    std::string hex;
+    while (lines >> name >> size >> hex)
+    {
+        Digest digest{};
+        if (fromHex(hex, digest))
+        {
+            images.emplace(name, std::make_pair(size, digest));
+        }
+    }
+}
+
+bool ContentDigests::holds(const std::string& name, ImageSource& source,
+                           const ReadbackVerifier::Reader& device)
+{
+    Digest recorded{};
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto image = images.find(name);
+        if (image == images.end() || image->second.first != source.size())
+        {
+            return false;
+        }
+        recorded = image->second.second;
+    }
+
+    // Hash the image, and compare its start with the partition in case
+    // something else wrote it.
+    std::vector<uint8_t> buffer(checkChunkSize);
+    auto hash = newHash();
+    uint64_t offset = 0;
+    while (auto length = source.read(buffer.data(), buffer.size()))
+    {
+        if (offset == 0)
+        {
+            std::vector<uint8_t> current(length);
+            try
+            {
+                device(0, current.data(), length);
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+            if (std::memcmp(buffer.data(), current.data(), length))
+            {
+                return false;
+            }
+        }
+        EVP_DigestUpdate(hash.get(), buffer.data(), length);
+        offset += length;
+    }
+    return offset == source.size() && digestOf(hash.get()) == recorded;
+}
+
+void ContentDigests::changing(const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (images.erase(name))
+    {
+        store();
+    }
+}
+
+void ContentDigests::written(const std::string& name, uint64_t size,
+                             const Digest& digest)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    images[name] = {size, digest};
+    store();
+}
+
+void ContentDigests::store()
+{
+    std::ostringstream data;
+    for (const auto& [name, image] : images)
+    {
+        data << name << ' ' << image.first << ' ' << toHex(image.second)
+             << '\n';
+    }
+    writeFileAtomic(file, data.str());
+}
+
+uint64_t writeImage(FlashDevice& device, ImageSource& source, bool erase,
+                    const ProgressCallback& progress, const WritePlan* plan,
+                    WriteCheckpoint* checkpoint)
+{
+    auto total = source.size();
+    if (total > device.size())
+    {
+        throw std::length_error("Image does not fit in " + device.name());
+    }
+    if (plan && plan->imageSize != total)
+    {
+        throw std::invalid_argument("Write plan is for another image");
+    }
+
+    // Program one erase block at a time, so that on NOR flash each block
+    // is erased right before it is written. Without erasing, e.g. on eMMC,
+    // the data is written in large chunks, page aligned for O_DIRECT.
+    auto blockSize = device.eraseSize();
+    if (!erase && blockSize < writeChunkSize)
+    {
+        blockSize = writeChunkSize / blockSize * blockSize;
+    }
+    auto bufferSize = (blockSize + pageSize - 1) / pageSize * pageSize;
+    std::unique_ptr<uint8_t, decltype(&std::free)> buffer(
+        static_cast<uint8_t*>(std::aligned_alloc(pageSize, bufferSize)),
+        std::free);
+    if (!buffer)
+    {
+        throw std::bad_alloc();
+    }
+
+    uint64_t offset = 0;
+    if (checkpoint)
+    {
+        offset = checkpoint->resume(
+            device.name(), source,
+            [&device](uint64_t from, void* data, size_t length) {
+                device.readBack(from, data, length);
+            },
+            blockSize);
+        if (offset && progress)
+        {
+            progress(offset, total);
+        }
+    }
+    while (offset < total)
+    {
+        size_t length = 0;
+        while (length < blockSize && offset + length < total)
+        {
+            auto rc = source.read(buffer.get() + length, blockSize - length);
+            if (rc == 0)
+            {
+                throw std::runtime_error("Image ended early for " +
+                                         device.name());
+            }
+            length += rc;
+        }
+
+        if (!plan || plan->covers(offset, length))
+        {
+            if (erase)
+            {
+                device.erase(offset, blockSize);
+            }
+            device.write(offset, buffer.get(), length);
+        }
+        if (checkpoint)
+        {
+            checkpoint->advance(device.name(), buffer.get(), length, total,
+                                [&device]() { device.sync(); });
+        }
+        offset += length;
+
+        if (progress)
+        {
+            progress(offset, total);
+        }
+    }
+    device.sync();
+    return total;
+}
+
+uint64_t mirrorDevice(FlashDevice& source, FlashDevice& target)
+{
+    if (source.size() > target.size())
+    {
+        throw std::length_error(source.name() + " does not fit in " +
+                                target.name());
+    }
+
+    // Compare one erase block at a time, and erase and program only the
+    // blocks that differ, instead of the whole device like mtd_copy.
+    uint64_t blockSize =
+        target.requiresErase() ? target.eraseSize() : writeChunkSize;
+    std::vector<uint8_t> wanted(blockSize);
+    std::vector<uint8_t> current(blockSize);
+    uint64_t programmed = 0;
+    for (uint64_t offset = 0; offset < source.size(); offset += blockSize)
+    {
+        auto length = std::min(blockSize, source.size() - offset);
+        source.read(offset, wanted.data(), length);
+        target.read(offset, current.data(), length);
+        if (std::memcmp(wanted.data(), current.data(), length) == 0)
+        {
+            continue;
+        }
+
+        if (target.requiresErase())
+        {
+            target.erase(offset, std::min(blockSize, target.size() - offset));
+        }
+        target.write(offset, wanted.data(), length);
+        programmed += length;
+    }
+    if (programmed)
+    {
+        target.sync();
+    }
+    return programmed;
+}
+
+uint32_t UbootMirror::fingerprint()
+{
+    const auto& [name, altName] = config.partitions.front();
+    std::vector<uint8_t> blocks;
+    for (auto* device : {&devices.mtd(name), &devices.mtd(altName)})
+    {
+        auto length = std::min<uint64_t>(device->eraseSize(), device->size());
+        auto offset = blocks.size();
+        blocks.resize(offset + length);
+        device->read(0, blocks.data() + offset, length);
+    }
+    return utils::crc32(blocks.data(), blocks.size());
+}
+
+bool UbootMirror::mirror(const std::function<void()>& onMirrored)
+{
+    std::lock_guard<std::mutex> guard(mirrorStateLock);
+    auto state = readMirrorState(config.stateFile);
+    if (state.valid && state.mirrored == state.generation &&
+        state.fingerprint == fingerprint())
+    {
+        return false;
+    }
+
+    // The other partitions, i.e. the environment, are only mirrored along
+    // with u-boot, like mirroruboot does.
+    bool programmed = false;
+    const auto& [name, altName] = config.partitions.front();
+    if (mirrorDevice(devices.mtd(name), devices.mtd(altName)))
+    {
+        programmed = true;
+
+        // Copy and fix up the environment under the fw_printenv lock, an
+        // update made meanwhile would leave a torn copy on the alt chip.
+        EnvLock lock;
+        for (size_t i = 1; i < config.partitions.size(); i++)
+        {
+            const auto& [other, altOther] = config.partitions[i];
+            mirrorDevice(devices.mtd(other), devices.mtd(altOther));
+        }
+        if (onMirrored)
+        {
+            onMirrored();
+        }
+    }
+
+    state.mirrored = state.generation;
+    state.fingerprint = fingerprint();
+    writeMirrorState(config.stateFile, state);
+    return programmed;
+}
+
+void UbootMirror::sourceChanged(const fs::path& stateFile)
+{
+    std::lock_guard<std::mutex> guard(mirrorStateLock);
+    auto state = readMirrorState(stateFile);
+    state.generation++;
+    writeMirrorState(stateFile, state);
+}
+
+void StaticBackend::write(const fs::path& imageDir,
+                          const std::string& /* versionId */,
+                          const ProgressCallback& progress)
+{
+    verified.clear();
+    ReadbackVerifier verifier;
+
+    // A full flash image replaces the whole chip, otherwise each image goes
+    // into the partition named after it.
+    if (fs::exists(imageDir / bmcFullImages))
+    {
+        auto& device = devices.mtd("bmc");
+        FileSource compared(imageDir / bmcFullImages);
+        auto plan = planWrite(device, compared);
+        FileSource source(imageDir / bmcFullImages);
+        writeVerified(verifier, device, source, true, progress, &plan);
+        verified = verifier.wait();
+        return;
+    }
+
+    uint64_t base = 0;
+    auto total = totalSize(imageDir, bmcImages);
+    for (const auto& name : bmcImages)
+    {
+        auto path = imageDir / name;
+        if (!fs::exists(path))
+        {
+            continue;
+        }
+
+        auto& device = devices.mtd(name.substr(std::strlen(imagePrefix)));
+        FileSource compared(path);
+        auto plan = planWrite(device, compared);
+        FileSource source(path);
+        base += writeVerified(verifier, device, source, true,
+                              overall(progress, base, total), &plan);
+    }
+    verified = verifier.wait();
+}
+
+UbiDevice& UbiBackend::roDevice()
+{
+    if (config.roMtd == config.roMtdAlt)
+    {
+        return devices.ubi(config.roMtd);
+    }
+
+    // Use the chip not holding the running version.
+    auto& primary = devices.ubi(config.roMtd);
+    if (!config.runningVersionId.empty() &&
+        primary.find("rofs-" + config.runningVersionId))
+    {
+        return devices.ubi(config.roMtdAlt);
+    }
+    return primary;
+}
+
+void UbiBackend::removeOldVolumes(UbiDevice& ubi, const std::string& prefix,
+                                  size_t keep, const std::string& versionId,
+                                  ContentDigests* digests)
+{
+    std::vector<std::string> versions;
+    for (const auto& volume : ubi.volumes())
+    {
+        if (volume.name.rfind(prefix, 0) == 0)
+        {
+            versions.push_back(volume.name.substr(prefix.size()));
+        }
+    }
+
+    auto count = versions.size();
+    for (const auto& version : versions)
+    {
+        if (count < keep)
+        {
+            break;
+        }
+        if (version == config.runningVersionId || version == versionId)
+        {
+            continue;
+        }
+        if (digests)
+        {
+            digests->changing(volumeKey(ubi, "rofs-" + version));
+            digests->changing(volumeKey(ubi, "kernel-" + version));
+        }
+        ubi.removeVolume("rofs-" + version);
+        ubi.removeVolume("kernel-" + version);
+        // The kernel copy on the other chip goes with the same version.
+        if (std::find(removed.begin(), removed.end(), version) ==
+            removed.end())
+        {
+            removed.push_back(version);
+        }
+        count--;
+    }
+}
+
+uint64_t UbiBackend::writeVolume(UbiDevice& ubi, const std::string& volName,
+                                 ImageSource& source,
+                                 ReadbackVerifier& verifier,
+                                 WriteCheckpoint* checkpoint,
+                                 ContentDigests* digests,
+                                 const ProgressCallback& progress)
+{
+    // A volume cannot be read while it is updated, it is read back while
+    // the next one is written.
+    auto reader = [&ubi, volName](uint64_t offset, void* data,
+                                  size_t length) {
+        ubi.readVolume(volName, offset, data, length);
+    };
+    auto id = verifier.add(volName, reader);
+    DigestSource digested(source);
+
+    // An interrupted volume update cannot resume, only a volume written
+    // whole is kept.
+    auto key = volumeKey(ubi, volName);
+    if (checkpoint && checkpoint->resume(key, digested, reader,
+                                         source.size()) == source.size())
+    {
+        if (progress)
+        {
+            progress(source.size(), source.size());
+        }
+    }
+    else
+    {
+        if (digests)
+        {
+            digests->changing(key);
+        }
+        if (!ubi.find(volName))
+        {
+            ubi.createVolume(volName, source.size(), true);
+        }
+        ubi.updateVolume(volName, digested, progress);
+        if (checkpoint)
+        {
+            checkpoint->completed(key, source.size(), digested.digest());
+        }
+    }
+    verifier.completed(id, source.size(), digested.digest());
+    if (digests)
+    {
+        digests->written(key, source.size(), digested.digest());
+    }
+    return source.size();
+}
+
+std::unique_ptr<ImageSource> UbiBackend::openImage(const fs::path& imageDir,
+                                                   const std::string& name)
+{
+    auto image = imageDir / (imagePrefix + name);
+    auto delta = image;
+    delta += deltaSuffix;
+    if (fs::exists(image) || !fs::exists(delta))
+    {
+        return std::make_unique<FileSource>(image);
+    }
+
+    auto volName = name + "-" + config.runningVersionId;
+    for (const auto& mtd : {config.roMtd, config.roMtdAlt})
+    {
+        auto& ubi = devices.ubi(mtd);
+        if (auto volume = ubi.find(volName))
+        {
+            return std::make_unique<DeltaSource>(
+                delta,
+                [&ubi, volName](uint64_t offset, void* data, size_t length) {
+                    ubi.readVolume(volName, offset, data, length);
+                },
+                volume->size);
+        }
+    }
+    throw std::invalid_argument("No volume " + volName + " to rebuild " +
+                                name + " from");
+}
+
+void UbiBackend::write(const fs::path& imageDir, const std::string& versionId,
+                       const ProgressCallback& progress)
+{
+    removed.clear();
+    verified.clear();
+    ubootWritten = false;
+
+    auto& rw = devices.ubi(config.rwMtd);
+    if (!rw.find("rwfs"))
+    {
+        rw.createVolume("rwfs", config.rwSize, false);
+    }
+
+    auto& ro = roDevice();
+    UbiDevice* mirror = nullptr;
+    if (!config.kernelMirrorMtd.empty() &&
+        config.kernelMirrorMtd != ro.name())
+    {
+        mirror = &devices.ubi(config.kernelMirrorMtd);
+    }
+
+    // Only rewrite u-boot when it changed, like the MMC layout does.
+    auto uboot = imageDir / "image-u-boot";
+    FlashDevice* ubootDevice = nullptr;
+    if (!config.ubootMtd.empty() && fs::exists(uboot))
+    {
+        auto& device = devices.mtd(config.ubootMtd);
+        FileSource current(uboot);
+        if (!matches(device, current))
+        {
+            ubootDevice = &device;
+        }
+    }
+    ubootWritten = ubootDevice != nullptr;
+
+    checkDeltas(imageDir, {"image-kernel", "image-rofs"},
+                config.runningVersionId);
+
+    // Volumes that already hold their image, e.g. when activating a version
+    // again, are not written. Null if the volume holds the image.
+    std::optional<ContentDigests> digests;
+    if (!config.digestFile.empty())
+    {
+        digests.emplace(config.digestFile);
+    }
+    auto recordedDigests = digests ? &*digests : nullptr;
+    auto open = [&](UbiDevice& ubi,
+                    const std::string& name) -> std::unique_ptr<ImageSource> {
+        auto volName = name + "-" + versionId;
+        if (digests &&
+            digests->holds(volumeKey(ubi, volName), *openImage(imageDir, name),
+                           [&ubi, volName](uint64_t offset, void* data,
+                                           size_t length) {
+                               ubi.readVolume(volName, offset, data, length);
+                           }))
+        {
+            return nullptr;
+        }
+        return openImage(imageDir, name);
+    };
+    auto kernel = open(ro, "kernel");
+    auto rofs = open(ro, "rofs");
+    std::unique_ptr<ImageSource> kernelCopy;
+    if (mirror)
+    {
+        kernelCopy = open(*mirror, "kernel");
+    }
+    uint64_t total = 0;
+    for (const auto* source : {kernel.get(), rofs.get(), kernelCopy.get()})
+    {
+        total += source ? source->size() : 0;
+    }
+    if (ubootDevice)
+    {
+        total += fs::file_size(uboot);
+    }
+
+    std::optional<WriteCheckpoint> checkpoint;
+    if (!config.checkpointFile.empty())
+    {
+        checkpoint.emplace(config.checkpointFile, versionId);
+    }
+    auto recorded = checkpoint ? &*checkpoint : nullptr;
+
+    ChipScheduler scheduler(progress, total);
+    ReadbackVerifier verifier;
+    try
+    {
+        removeOldVolumes(ro, "rofs-", config.roMtd == config.roMtdAlt ? 2 : 1,
+                         versionId, recordedDigests);
+        if (mirror)
+        {
+            removeOldVolumes(*mirror, "kernel-", 2, versionId,
+                             recordedDigests);
+        }
+
+        auto roChip = devices.chipOf(ro.name());
+        if (kernel)
+        {
+            scheduler.add(roChip, [&](const ProgressCallback& onProgress) {
+                writeVolume(ro, "kernel-" + versionId, *kernel, verifier,
+                            recorded, recordedDigests, onProgress);
+            });
+        }
+        if (rofs)
+        {
+            scheduler.add(roChip, [&](const ProgressCallback& onProgress) {
+                writeVolume(ro, "rofs-" + versionId, *rofs, verifier,
+                            recorded, recordedDigests, onProgress);
+                // The rofs is a squashfs, mounted from a ubiblock device.
+                ro.attachBlock("rofs-" + versionId);
+            });
+        }
+        else
+        {
+            ro.attachBlock("rofs-" + versionId);
+        }
+        if (kernelCopy)
+        {
+            scheduler.add(devices.chipOf(mirror->name()),
+                          [&](const ProgressCallback& onProgress) {
+                              writeVolume(*mirror, "kernel-" + versionId,
+                                          *kernelCopy, verifier, recorded,
+                                          recordedDigests, onProgress);
+                          });
+        }
+        if (ubootDevice)
+        {
+            scheduler.add(devices.chipOf(config.ubootMtd),
+                          [&](const ProgressCallback& onProgress) {
+                              FileSource source(uboot);
+                              writeVerified(verifier, *ubootDevice, source,
+                                            true, onProgress, nullptr,
+                                            recorded);
+                          });
+        }
+        scheduler.run();
+        verified = verifier.wait();
+        if (checkpoint)
+        {
+            checkpoint->clear();
+        }
+    }
+    catch (const WriteCancelled&)
+    {
+        // Keep what was written for the write to resume.
+        throw;
+    }
+    catch (const std::exception&)
+    {
+        verifier.stop();
+        if (checkpoint)
+        {
+            checkpoint->clear();
+        }
+
+        // Never remove the volumes the BMC runs from.
+        if (versionId != config.runningVersionId)
+        {
+            try
+            {
+                if (digests)
+                {
+                    digests->changing(volumeKey(ro, "rofs-" + versionId));
+                    digests->changing(volumeKey(ro, "kernel-" + versionId));
+                    if (mirror)
+                    {
+                        digests->changing(
+                            volumeKey(*mirror, "kernel-" + versionId));
+                    }
+                }
+                ro.removeVolume("rofs-" + versionId);
+                ro.removeVolume("kernel-" + versionId);
+                if (mirror)
+                {
+                    mirror->removeVolume("kernel-" + versionId);
+                }
+            }
+            catch (const std::exception&)
+            {}
+        }
+        throw;
+    }
+}
+
+void MmcBackend::write(const fs::path& imageDir, const std::string& versionId,
+                       const ProgressCallback& progress)
+{
+    verified.clear();
+
+    struct Target
+    {
+        GptPartition entry;
+        std::unique_ptr<FlashDevice> partition;
+
+        /** @brief The partition of the running side a delta applies to */
+        std::unique_ptr<FlashDevice> base;
+        std::unique_ptr<ImageSource> source;
+    };
+
+    checkDeltas(imageDir, {"image-kernel", "image-rofs"},
+                config.runningVersionId);
+
+    auto label = secondaryLabel();
+    Gpt gpt(devices.disk(config.disk));
+    const std::vector<std::pair<std::string, std::string>> images = {
+        {"image-kernel", "boot-"}, {"image-rofs", "rofs-"}};
+    // Partitions that already hold their image, e.g. when flipping back to
+    // the other side, are not written.
+    std::optional<ContentDigests> digests;
+    if (!config.digestFile.empty())
+    {
+        digests.emplace(config.digestFile);
+    }
+    auto recordedDigests = digests ? &*digests : nullptr;
+
+    std::vector<Target> targets;
+    uint64_t total = 0;
+    for (const auto& [name, prefix] : images)
+    {
+        auto partition = prefix + label;
+        auto path = imageDir / name;
+        auto delta = path;
+        delta += deltaSuffix;
+        std::unique_ptr<FlashDevice> base;
+        if (!fs::exists(path) && fs::exists(delta))
+        {
+            base = gpt.open(prefix + config.runningLabel);
+        }
+        auto open = [&]() -> std::unique_ptr<ImageSource> {
+            if (base)
+            {
+                auto& device = *base;
+                return std::make_unique<DeltaSource>(
+                    delta,
+                    [&device](uint64_t offset, void* data, size_t length) {
+                        device.read(offset, data, length);
+                    },
+                    device.size());
+            }
+            if (ZstdSource::isCompressed(path))
+            {
+                return std::make_unique<ZstdSource>(path,
+                                                    config.decoderThreads);
+            }
+            return std::make_unique<FileSource>(path);
+        };
+
+        auto device = gpt.open(partition);
+        auto& current = *device;
+        if (digests &&
+            digests->holds(current.name(), *open(),
+                           [&current](uint64_t offset, void* data,
+                                      size_t length) {
+                               current.read(offset, data, length);
+                           }))
+        {
+            continue;
+        }
+        auto source = open();
+        total += source->size();
+        targets.push_back({*gpt.find(partition), std::move(device),
+                           std::move(base), std::move(source)});
+    }
+
+    // Only rewrite u-boot when it changed, like cmp_uboot does.
+    auto uboot = imageDir / "image-u-boot";
+    FlashDevice* ubootDevice = nullptr;
+    if (fs::exists(uboot))
+    {
+        auto& boot = devices.disk(config.bootPartition);
+        FileSource current(uboot);
+        if (!matches(boot, current))
+        {
+            ubootDevice = &boot;
+            total += fs::file_size(uboot);
+        }
+    }
+
+    std::optional<WriteCheckpoint> checkpoint;
+    if (!config.checkpointFile.empty())
+    {
+        checkpoint.emplace(config.checkpointFile, versionId);
+    }
+    auto recorded = checkpoint ? &*checkpoint : nullptr;
+
+    // The eMMC queues the commands of all the writes.
+    ChipScheduler scheduler(progress, total, targets.size() + 1);
+    ReadbackVerifier verifier;
+    for (auto& target : targets)
+    {
+        scheduler.add(devices.chipOf(config.disk),
+                      [this, &target, &verifier, recorded,
+                       recordedDigests](const ProgressCallback& onProgress) {
+                          if (recordedDigests)
+                          {
+                              recordedDigests->changing(
+                                  target.partition->name());
+                          }
+
+                          // Discarding the whole partition spares the eMMC
+                          // preserving the old data, zeroing it is only
+                          // worth it past the image, and so is clearing a
+                          // partition the write resumes on.
+                          auto resuming =
+                              recorded &&
+                              recorded->committed(target.partition->name());
+                          clear(*target.partition,
+                                config.clear == Clear::zeroOut || resuming
+                                    ? target.source->size()
+                                    : 0);
+                          writeVerified(verifier, *target.partition,
+                                        *target.source, false, onProgress,
+                                        nullptr, recorded, recordedDigests);
+                      });
+    }
+    if (ubootDevice)
+    {
+        scheduler.add(devices.chipOf(config.bootPartition),
+                      [&](const ProgressCallback& onProgress) {
+                          FileSource source(uboot);
+                          writeVerified(verifier, *ubootDevice, source, false,
+                                        onProgress, nullptr, recorded);
+                      });
+    }
+
+    try
+    {
+        scheduler.run();
+        verified = verifier.wait();
+        if (checkpoint)
+        {
+            checkpoint->clear();
+        }
+
+        // Restore the labels like mmc_update does. Only a label that was
+        // changed meanwhile is written, and only its partition is reloaded
+        // rather than probing every disk.
+        for (const auto& target : targets)
+        {
+            gpt.rename(target.entry.index, target.entry.name);
+        }
+    }
+    catch (const WriteCancelled&)
+    {
+        // Keep what was written for the write to resume.
+        throw;
+    }
+    catch (const std::exception&)
+    {
+        verifier.stop();
+        if (checkpoint)
+        {
+            checkpoint->clear();
+        }
+        for (auto& target : targets)
+        {
+            try
+            {
+                if (digests)
+                {
+                    digests->changing(target.partition->name());
+                }
+                wipe(*target.partition);
+            }
+            catch (const std::exception&)
+            {}
+        }
+        throw;
+    }
+}
+
+void MmcBackend::remove(const std::string& label)
+{
+    if (label == config.runningLabel)
+    {
+        throw std::invalid_argument("Cannot remove the running side " +
+                                    label);
+    }
+
+    std::optional<ContentDigests> digests;
+    if (!config.digestFile.empty())
+    {
+        digests.emplace(config.digestFile);
+    }
+
+    Gpt gpt(devices.disk(config.disk));
+    for (const auto& name : {"boot-" + label, "rofs-" + label})
+    {
+        auto partition = gpt.open(name);
+        if (digests)
+        {
+            digests->changing(partition->name());
+        }
+        wipe(*partition);
+    }
+}
+
+void MmcBackend::clear(FlashDevice& partition, uint64_t offset)
+{
+    auto blockSize = partition.eraseSize();
+    auto start = (offset + blockSize - 1) / blockSize * blockSize;
+    auto end = partition.size() / blockSize * blockSize;
+    if (start >= end)
+    {
+        return;
+    }
+
+    switch (config.clear)
+    {
+        case Clear::none:
+            break;
+        case Clear::discard:
+            partition.discard(start, end - start, false);
+            break;
+        case Clear::zeroOut:
+            partition.erase(start, end - start);
+            break;
+        case Clear::secureDiscard:
+            partition.discard(start, end - start, true);
+            break;
+    }
+}
+
+void MmcBackend::wipe(FlashDevice& partition)
+{
+    clear(partition);
+
+    // Whatever discarded blocks read back as, the file system headers
+    // must be gone, like the dd of mmc_remove does.
+    if (config.clear != Clear::zeroOut)
+    {
+        auto blockSize = partition.eraseSize();
+        auto length = std::min<uint64_t>(partition.size(), wipeSize);
+        partition.erase(0, length / blockSize * blockSize);
+    }
+    partition.sync();
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,655 @@
+#pragma once
+
+#include "flash_device.hpp"
+#include "image_source.hpp"
+#include "readback.hpp"
+#include "ubi_device.hpp"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace fs = std::filesystem;
+
+/** @class FlashDevices
+ *  @brief Looks up the devices the images are programmed into.
+ *  @details Implemented on top of the real MTD, UBI and eMMC devices on the
+ *           BMC, and on top of regular files to exercise the update path
+ *           without hardware. The returned devices are owned by the
+ *           provider. Lookups of missing devices throw std::invalid_argument.
+ */
+class FlashDevices
+{
+  public:
+    virtual ~FlashDevices() = default;
+
+    /** @brief An MTD partition by name, e.g. "u-boot" or "bmc" */
+    virtual FlashDevice& mtd(const std::string& name) = 0;
+
+    /** @brief The UBI device attached to the named MTD partition */
+    virtual UbiDevice& ubi(const std::string& mtdName) = 0;
+
+    /** @brief A whole block device by name, e.g. "mmcblk0" */
+    virtual FlashDevice& disk(const std::string& name) = 0;
+
+    /** @brief The physical chip an MTD partition or a disk is on. Writes
+     *         to the same chip are serialized by it, writes to different
+     *         chips can run in parallel. By default each name is its own
+     *         chip.
+     *
+     *  @param[in] name - The MTD partition or disk name
+     *
+     *  @return An identifier of the chip
+     */
+    virtual std::string chipOf(const std::string& name)
+    {
+        return name;
+    }
+};
+
+/** @class SystemFlashDevices
+ *  @brief The flash devices of the running BMC, looked up by name in
+ *         /proc/mtd and sysfs and opened on first use.
+ */
+class SystemFlashDevices : public FlashDevices
+{
+  public:
+    SystemFlashDevices(const SystemFlashDevices&) = delete;
+    SystemFlashDevices& operator=(const SystemFlashDevices&) = delete;
+    SystemFlashDevices(SystemFlashDevices&&) = delete;
+    SystemFlashDevices& operator=(SystemFlashDevices&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] directIo - Write the disks with O_DIRECT
+     */
+    explicit SystemFlashDevices(bool directIo = false) : directIo(directIo)
+    {}
+
+    /** @brief Makes the disks made writable read only again */
+    ~SystemFlashDevices() override;
+
+    FlashDevice& mtd(const std::string& name) override;
+    UbiDevice& ubi(const std::string& mtdName) override;
+    FlashDevice& disk(const std::string& name) override;
+    std::string chipOf(const std::string& name) override;
+
+  private:
+    bool directIo;
+    std::map<std::string, std::unique_ptr<FlashDevice>> mtds;
+    std::map<std::string, std::unique_ptr<UbiDevice>> ubis;
+    std::map<std::string, std::unique_ptr<FlashDevice>> disks;
+
+    /** @brief The force_ro attributes cleared to write a disk */
+    std::vector<fs::path> forcedWritable;
+};
+
+/** @struct WritePlan
+ *  @brief The erase blocks of a device that differ from an image, the only
+ *         ones that need to be erased and programmed to write it.
+ *  @details Stored as text next to a staged image, for the shutdown
+ *           flasher: a line with the erase block size and the image size,
+ *           then a line with the offset and the length of each range of
+ *           blocks, all decimal bytes. The last range can extend past the
+ *           end of the image to the end of its block, which is erased.
+ */
+struct WritePlan
+{
+    uint32_t blockSize = 0;
+    uint64_t imageSize = 0;
+
+    /** @brief The offset and length of the ranges, in order and merged */
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+
+    /** @brief Whether a range of the device overlaps the plan */
+    bool covers(uint64_t offset, uint64_t length) const;
+
+    /** @brief The number of bytes the plan erases */
+    uint64_t bytes() const;
+
+    /** @brief Store the plan, replacing the file atomically */
+    void store(const fs::path& path) const;
+
+    /** @brief Read a stored plan
+     *
+     *  @return std::nullopt if the file is missing or malformed
+     */
+    static std::optional<WritePlan> load(const fs::path& path);
+};
+
+/** @brief Compare an image with a device, one erase block at a time
+ *
+ *  @param[in] device - The device the image would be programmed into
+ *  @param[in] source - The image data, read to its end
+ *
+ *  @return The blocks writeImage() would change
+ */
+WritePlan planWrite(FlashDevice& device, ImageSource& source);
+
+/** @class WriteCheckpoint
+ *  @brief Records how far the images of a version were programmed, so that
+ *         writing the version again after the updater restarted or the BMC
+ *         lost power resumes where it stopped.
+ *  @details For each image, the record holds the bytes committed to the
+ *           device and the SHA-256 digest of those bytes. It is stored
+ *           every few MiB, after syncing the device, so that it never
+ *           claims more than the device holds. A resumed write checks the
+ *           device and then the image against the digest before skipping
+ *           the recorded bytes. The methods can be called from several
+ *           writer threads.
+ */
+class WriteCheckpoint
+{
+  public:
+    using Digest = std::array<uint8_t, 32>;
+
+    WriteCheckpoint(const WriteCheckpoint&) = delete;
+    WriteCheckpoint& operator=(const WriteCheckpoint&) = delete;
+    WriteCheckpoint(WriteCheckpoint&&) = delete;
+    WriteCheckpoint& operator=(WriteCheckpoint&&) = delete;
+
+    /** @brief Reads the record
+     *
+     *  @param[in] file - The file holding the record
+     *  @param[in] versionId - The version written, the record of another
+     *                         version is dropped
+     */
+    WriteCheckpoint(const fs::path& file, const std::string& versionId);
+
+    /** @brief The bytes of an image the record holds as committed */
+    uint64_t committed(const std::string& name);
+
+    /** @brief Start writing an image, resuming after the recorded bytes
+     *         when the device and then the image start with them. Throws
+     *         std::runtime_error if only the device does, since the start
+     *         of the image was read, and drops the record of the image.
+     *
+     *  @param[in] name - The image, unique within the version
+     *  @param[in] source - The image, not read yet
+     *  @param[in] device - Reads the device back
+     *  @param[in] align - Only resume at a multiple of it or at the end of
+     *                     the image
+     *
+     *  @return The bytes to skip, read from the source already
+     */
+    uint64_t resume(const std::string& name, ImageSource& source,
+                    const ReadbackVerifier::Reader& device, uint64_t align);
+
+    /** @brief Record data of an image committed to the device, following
+     *         what was resumed or committed before
+     *
+     *  @param[in] name - The image
+     *  @param[in] data - The data
+     *  @param[in] length - The size of the data
+     *  @param[in] total - The size of the image, the record is stored once
+     *                     it is complete
+     *  @param[in] sync - Flushes the device before the record is stored
+     */
+    void advance(const std::string& name, const void* data, size_t length,
+                 uint64_t total, const std::function<void()>& sync);
+
+    /** @brief Record an image committed at once, e.g. a UBI volume
+     *
+     *  @param[in] name - The image
+     *  @param[in] size - The size of the image
+     *  @param[in] digest - The digest of the image
+     */
+    void completed(const std::string& name, uint64_t size,
+                   const Digest& digest);
+
+    /** @brief Drop the record, once the version was written or its images
+     *         were removed */
+    void clear();
+
+    /** @brief Name of the record file in PERSIST_DIR */
+    static constexpr auto fileName = "write-checkpoint";
+
+  private:
+    struct Image
+    {
+        /** @brief The recorded bytes and their digest */
+        uint64_t committed = 0;
+        Digest digest{};
+
+        /** @brief The bytes written so far and their digest, only used
+         *         by the writer of the image */
+        uint64_t written = 0;
+        std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+            nullptr, EVP_MD_CTX_free};
+    };
+
+    /** @brief Store the record, with the lock held */
+    void store();
+
+    fs::path file;
+    std::string versionId;
+
+    std::mutex lock;
+    std::map<std::string, Image> images;
+};
+
+/** @class ContentDigests
+ *  @brief Records the size and SHA-256 digest of the image each partition
+ *         or volume was written with, so that activating an image that a
+ *         partition already holds, e.g. flipping back to the other side or
+ *         pushing the same release again, skips writing it.
+ *  @details A record is dropped before its partition is written and stored
+ *           once the write completed. Since other tools may write the
+ *           partitions too, the start of a partition is also compared with
+ *           the image before it is deemed to hold it. The methods can be
+ *           called from several writer threads.
+ */
+class ContentDigests
+{
+  public:
+    using Digest = std::array<uint8_t, 32>;
+
+    ContentDigests(const ContentDigests&) = delete;
+    ContentDigests& operator=(const ContentDigests&) = delete;
+    ContentDigests(ContentDigests&&) = delete;
+    ContentDigests& operator=(ContentDigests&&) = delete;
+
+    /** @brief Reads the records
+     *
+     *  @param[in] file - The file holding the records
+     */
+    explicit ContentDigests(const fs::path& file);
+
+    /** @brief Whether a partition holds an image. Reads the image through
+     *         unless there is no record of the same size.
+     *
+     *  @param[in] name - The partition or volume
+     *  @param[in] source - The image, not read yet
+     *  @param[in] device - Reads the partition, may throw if it is gone
+     */
+    bool holds(const std::string& name, ImageSource& source,
+               const ReadbackVerifier::Reader& device);
+
+    /** @brief Drop the record of a partition about to be written */
+    void changing(const std::string& name);
+
+    /** @brief Record the image a partition was written with
+     *
+     *  @param[in] name - The partition or volume
+     *  @param[in] size - The size of the image
+     *  @param[in] digest - The digest of the image
+     */
+    void written(const std::string& name, uint64_t size,
+                 const Digest& digest);
+
+    /** @brief Name of the record file in PERSIST_DIR */
+    static constexpr auto fileName = "content-digests";
+
+  private:
+    /** @brief Store the records, with the lock held */
+    void store();
+
+    fs::path file;
+
+    std::mutex lock;
+    std::map<std::string, std::pair<uint64_t, Digest>> images;
+};
+
+/** @brief Program an image into a device
+ *
+ *  @param[in] device - The device to program
+ *  @param[in] source - The image data
+ *  @param[in] erase - Erase each block before programming it, required on
+ *                     NOR flash
+ *  @param[in] progress - Optional progress callback
+ *  @param[in] plan - Optional, only program the blocks of the plan made
+ *                    for this image and device. The image is still read
+ *                    through.
+ *  @param[in] checkpoint - Optional, resume the write from it and record
+ *                          its progress, under the device name
+ *
+ *  @return The size of the image
+ */
+uint64_t writeImage(FlashDevice& device, ImageSource& source, bool erase,
+                    const ProgressCallback& progress = nullptr,
+                    const WritePlan* plan = nullptr,
+                    WriteCheckpoint* checkpoint = nullptr);
+
+/** @brief Make a device hold the data of another one, erasing and
+ *         programming only the erase blocks that differ
+ *
+ *  @param[in] source - The device to copy
+ *  @param[in] target - The device to update, at least as large as the
+ *                      source
+ *
+ *  @return The number of bytes programmed
+ */
+uint64_t mirrorDevice(FlashDevice& source, FlashDevice& target);
+
+/** @class UbootMirror
+ *  @brief Keeps u-boot and its environment on the alt chip the same as on
+ *         the running chip, like the obmc-flash-bmc mirroruboot command.
+ *  @details The partitions are only mirrored when u-boot differs, and then
+ *           only their erase blocks that differ are rewritten. Once the
+ *           chips match, a record of the u-boot generation and of the
+ *           CRC-32 of the first block of both u-boots is stored. The
+ *           generation is bumped whenever the updater programs u-boot, so
+ *           the chips are not read again while it and the first blocks,
+ *           which change when the chips are swapped, stay the same.
+ */
+class UbootMirror
+{
+  public:
+    struct Config
+    {
+        /** @brief The MTD partitions to mirror and their copies on the
+         *         alt chip, u-boot first */
+        std::vector<std::pair<std::string, std::string>> partitions = {
+            {"u-boot", "alt-u-boot"}, {"u-boot-env", "alt-u-boot-env"}};
+
+        /** @brief The file holding the record */
+        fs::path stateFile;
+    };
+
+    UbootMirror(FlashDevices& devices, const Config& config) :
+        devices(devices), config(config)
+    {}
+
+    /** @brief Mirror the partitions if u-boot differs
+     *
+     *  @param[in] onMirrored - Optional, called once partitions were
+     *                          programmed and before the record is stored,
+     *                          e.g. to fix up the copied environment. It
+     *                          runs with the EnvLock held, like the copy of
+     *                          the environment.
+     *
+     *  @return Whether anything was programmed
+     */
+    bool mirror(const std::function<void()>& onMirrored = nullptr);
+
+    /** @brief Bump the u-boot generation, after u-boot was programmed
+     *
+     *  @param[in] stateFile - The file holding the record
+     */
+    static void sourceChanged(const fs::path& stateFile);
+
+    /** @brief Name of the record file in PERSIST_DIR */
+    static constexpr auto stateFileName = "uboot-mirror";
+
+  private:
+    /** @brief The CRC-32 of the first blocks of u-boot and its copy */
+    uint32_t fingerprint();
+
+    FlashDevices& devices;
+    Config config;
+};
+
+/** @class FlashBackend
+ *  @brief Programs an extracted BMC image into flash for one of the
+ *         supported layouts.
+ *  @details The images are read back as they are programmed, see
+ *           ReadbackVerifier, and write() fails if one does not match.
+ */
+class FlashBackend
+{
+  public:
+    virtual ~FlashBackend() = default;
+
+    /** @brief Program the images of a version
+     *
+     *  @param[in] imageDir - Directory holding the image-* files
+     *  @param[in] versionId - The version id, used to name the volumes
+     *  @param[in] progress - Optional progress callback over all images
+     */
+    virtual void write(const fs::path& imageDir, const std::string& versionId,
+                       const ProgressCallback& progress = nullptr) = 0;
+
+    /** @brief The images the last write() read back, all matching */
+    const std::vector<ReadbackVerifier::Result>& readback() const
+    {
+        return verified;
+    }
+
+  protected:
+    std::vector<ReadbackVerifier::Result> verified;
+};
+
+/** @class StaticBackend
+ *  @brief Static layout, each image file is programmed into the MTD
+ *         partition of the same name, like the shutdown update script does.
+ *  @details Only the erase blocks that differ from the images are erased
+ *           and programmed, as planned by planWrite().
+ */
+class StaticBackend : public FlashBackend
+{
+  public:
+    explicit StaticBackend(FlashDevices& devices) : devices(devices)
+    {}
+
+    void write(const fs::path& imageDir, const std::string& versionId,
+               const ProgressCallback& progress = nullptr) override;
+
+  private:
+    FlashDevices& devices;
+};
+
+/** @class UbiBackend
+ *  @brief UBI layout, the kernel and rofs images go into static volumes
+ *         named after the version and the rwfs into a shared volume, like
+ *         the obmc-flash-bmc ubi_rw and ubi_ro functions do.
+ *  @details The volumes on different chips, e.g. the kernel copy on the
+ *           alt chip, are written in parallel. When the write fails, the
+ *           volumes of the version are removed again, like the
+ *           obmc-flash-bmc-ubiro-remove unit does. The kernel and rofs can
+ *           be shipped as deltas against the volumes of the running
+ *           version.
+ */
+class UbiBackend : public FlashBackend
+{
+  public:
+    struct Config
+    {
+        /** @brief MTD partition holding the rwfs volume */
+        std::string rwMtd = "bmc";
+
+        /** @brief MTD partitions for the read-only volumes. When they
+         *         differ, the one not holding the running version is used. */
+        std::string roMtd = "bmc";
+        std::string roMtdAlt = "alt-bmc";
+
+        /** @brief Size of the rwfs volume */
+        uint64_t rwSize = 0x600000;
+
+        /** @brief Version id of the running image, whose volumes are kept */
+        std::string runningVersionId;
+
+        /** @brief Another MTD partition that gets a copy of the kernel
+         *         volume, like create_vol_in_alt does. Empty for none. */
+        std::string kernelMirrorMtd;
+
+        /** @brief MTD partition u-boot is programmed into when the image
+         *         has one that differs from it. Empty to leave u-boot
+         *         alone. */
+        std::string ubootMtd;
+
+        /** @brief The file recording how far the volumes were written,
+         *         see WriteCheckpoint. Empty to always write them whole. */
+        fs::path checkpointFile;
+
+        /** @brief The file recording the images the volumes hold, see
+         *         ContentDigests. Empty to always write them. */
+        fs::path digestFile;
+    };
+
+    UbiBackend(FlashDevices& devices, const Config& config) :
+        devices(devices), config(config)
+    {}
+
+    void write(const fs::path& imageDir, const std::string& versionId,
+               const ProgressCallback& progress = nullptr) override;
+
+    /** @brief The versions whose volumes the last write() removed to make
+     *         room */
+    const std::vector<std::string>& removedVersions() const
+    {
+        return removed;
+    }
+
+    /** @brief Whether the last write() programmed u-boot */
+    bool ubootProgrammed() const
+    {
+        return ubootWritten;
+    }
+
+  private:
+    /** @brief The device the read-only volumes of a new version go to */
+    UbiDevice& roDevice();
+
+    /** @brief Remove the read-only volumes of old versions to make room
+     *
+     *  @param[in] ubi - The device to make room on
+     *  @param[in] prefix - The volume name prefix the versions are counted
+     *                      by, "rofs-" or "kernel-"
+     *  @param[in] keep - Remove versions until fewer than this are left
+     *  @param[in] versionId - The version being written, which is kept
+     *  @param[in] digests - The records to drop the removed volumes from
+     */
+    void removeOldVolumes(UbiDevice& ubi, const std::string& prefix,
+                          size_t keep, const std::string& versionId,
+                          ContentDigests* digests);
+
+    /** @brief Create a static volume for an image if needed, program it
+     *         and have it read back. A volume the checkpoint holds as
+     *         written is kept.
+     *
+     *  @return The number of bytes programmed
+     */
+    uint64_t writeVolume(UbiDevice& ubi, const std::string& volName,
+                         ImageSource& source, ReadbackVerifier& verifier,
+                         WriteCheckpoint* checkpoint, ContentDigests* digests,
+                         const ProgressCallback& progress);
+
+    /** @brief Open an image of the version to write. An image shipped as a
+     *         delta is rebuilt from the volume of the running version.
+     *
+     *  @param[in] imageDir - Directory holding the image-* files
+     *  @param[in] name - The image, "kernel" or "rofs"
+     */
+    std::unique_ptr<ImageSource> openImage(const fs::path& imageDir,
+                                           const std::string& name);
+
+    FlashDevices& devices;
+    Config config;
+    std::vector<std::string> removed;
+    bool ubootWritten = false;
+};
+
+/** @class MmcBackend
+ *  @brief eMMC layout, the kernel and rofs images go into the boot-<label>
+ *         and rofs-<label> partitions of the side not running, and u-boot
+ *         into the boot hardware partition when it changed.
+ *  @details The images are written concurrently. The zstd compressed ones
+ *           are decompressed on the fly, like zstd -d -c | dd does, and
+ *           the ones shipped as deltas are rebuilt from the partitions of
+ *           the running side. The partitions are cleared before they are
+ *           written, so that the eMMC does not preserve the old data, and
+ *           wiped when the write fails or the version is removed.
+ */
+class MmcBackend : public FlashBackend
+{
+  public:
+    /** @brief How the partitions are cleared */
+    enum class Clear
+    {
+        /** @brief Left as they are */
+        none,
+        /** @brief Discarded, BLKDISCARD */
+        discard,
+        /** @brief Zeroed, BLKZEROOUT, only past the image when writing */
+        zeroOut,
+        /** @brief Securely discarded, BLKSECDISCARD */
+        secureDiscard
+    };
+
+    struct Config
+    {
+        /** @brief The whole disk holding the GPT */
+        std::string disk = "mmcblk0";
+
+        /** @brief The boot hardware partition holding u-boot */
+        std::string bootPartition = "mmcblk0boot0";
+
+        /** @brief Label of the running side, "a" or "b" */
+        std::string runningLabel = "a";
+
+        /** @brief Version id of the running image, the one deltas apply
+         *         to */
+        std::string runningVersionId;
+
+        /** @brief The threads decompressing each zstd image, 0 for one per
+         *         CPU */
+        unsigned decoderThreads = 0;
+
+        /** @brief How the partitions are cleared */
+        Clear clear = Clear::discard;
+
+        /** @brief The file recording how far the partitions were
+         *         written, see WriteCheckpoint. Empty to always write them
+         *         whole. */
+        fs::path checkpointFile;
+
+        /** @brief The file recording the images the partitions hold, see
+         *         ContentDigests. Empty to always write them. */
+        fs::path digestFile;
+    };
+
+    MmcBackend(FlashDevices& devices, const Config& config) :
+        devices(devices), config(config)
+    {}
+
+    void write(const fs::path& imageDir, const std::string& versionId,
+               const ProgressCallback& progress = nullptr) override;
+
+    /** @brief Wipe the boot and rofs partitions of a side, like the
+     *         obmc-flash-mmc-remove unit does. Clears them and zeroes their
+     *         first MiB, so that the side does not boot, and drops their
+     *         content records. Throws std::invalid_argument for the running
+     *         side.
+     *
+     *  @param[in] label - The side, "a" or "b"
+     */
+    void remove(const std::string& label);
+
+    /** @brief The label of the side updates are written to */
+    std::string secondaryLabel() const
+    {
+        return config.runningLabel == "a" ? "b" : "a";
+    }
+
+  private:
+    /** @brief Clear a partition as configured, from an offset to its end
+     *
+     *  @param[in] partition - The partition
+     *  @param[in] offset - Where to start, rounded up to an erase block
+     */
+    void clear(FlashDevice& partition, uint64_t offset = 0);
+
+    /** @brief Clear a partition and zero its first MiB */
+    void wipe(FlashDevice& partition);
+
+    FlashDevices& devices;
+    Config config;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
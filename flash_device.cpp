@@ -0,0 +1,523 @@
+#include "flash_device.hpp"
+
+#include <fcntl.h>
+#include <linux/blkpg.h>
+#include <linux/fs.h>
+#include <mtd/mtd-user.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/** @brief Erased NOR flash reads back as all ones */
+constexpr uint8_t norErasedByte = 0xFF;
+
+[[noreturn]] void throwErrno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+void preadAll(int fd, void* data, size_t length, uint64_t offset)
+{
+    auto buf = static_cast<uint8_t*>(data);
+    while (length > 0)
+    {
+        auto rc = pread(fd, buf, length, offset);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throwErrno("pread");
+        }
+        if (rc == 0)
+        {
+            // Past the end of a sparse file, reads as erased.
+            std::fill_n(buf, length, 0);
+            return;
+        }
+        buf += rc;
+        offset += rc;
+        length -= rc;
+    }
+}
+
+void pwriteAll(int fd, const void* data, size_t length, uint64_t offset)
+{
+    auto buf = static_cast<const uint8_t*>(data);
+    while (length > 0)
+    {
+        auto rc = pwrite(fd, buf, length, offset);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throwErrno("pwrite");
+        }
+        buf += rc;
+        offset += rc;
+        length -= rc;
+    }
+}
+
+} // namespace
+
+void FlashDevice::checkRange(uint64_t offset, uint64_t length) const
+{
+    if (offset > size() || length > size() - offset)
+    {
+        throw std::out_of_range("Access beyond the end of " + name());
+    }
+}
+
+void FlashDevice::checkEraseRange(uint64_t offset, uint64_t length) const
+{
+    checkRange(offset, length);
+    if (offset % eraseSize() || length % eraseSize())
+    {
+        throw std::invalid_argument("Unaligned erase of " + name());
+    }
+}
+
+FileDevice::FileDevice(const std::string& path, uint64_t size,
+                       uint32_t eraseSize, Type type) :
+    devName(fs::path(path).filename()),
+    devSize(size), blockSize(eraseSize), type(type)
+{
+    bool created = !fs::exists(path);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throwErrno("open " + path);
+    }
+
+    if (created)
+    {
+        if (ftruncate(fd, devSize) < 0)
+        {
+            auto error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(),
+                                    "ftruncate " + path);
+        }
+        if (type == Type::nor)
+        {
+            erase(0, devSize - devSize % blockSize);
+            erased = 0;
+        }
+    }
+}
+
+FileDevice::~FileDevice()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void FileDevice::read(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    preadAll(fd, data, length, offset);
+}
+
+void FileDevice::write(uint64_t offset, const void* data, size_t length)
+{
+    checkRange(offset, length);
+    if (type == Type::block)
+    {
+        pwriteAll(fd, data, length, offset);
+    }
+    else
+    {
+        // Programming NOR flash can only clear bits.
+        std::vector<uint8_t> current(length);
+        preadAll(fd, current.data(), length, offset);
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < length; i++)
+        {
+            current[i] &= bytes[i];
+        }
+        pwriteAll(fd, current.data(), length, offset);
+    }
+    written += length;
+}
+
+void FileDevice::erase(uint64_t offset, uint64_t length)
+{
+    checkEraseRange(offset, length);
+    if (type == Type::block)
+    {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                      length) < 0)
+        {
+            std::vector<uint8_t> zeros(blockSize, 0);
+            for (uint64_t pos = 0; pos < length; pos += blockSize)
+            {
+                pwriteAll(fd, zeros.data(), blockSize, offset + pos);
+            }
+        }
+    }
+    else
+    {
+        std::vector<uint8_t> ones(blockSize, norErasedByte);
+        for (uint64_t pos = 0; pos < length; pos += blockSize)
+        {
+            pwriteAll(fd, ones.data(), blockSize, offset + pos);
+        }
+    }
+    erased += length;
+}
+
+void FileDevice::discard(uint64_t offset, uint64_t length, bool secure)
+{
+    // Discarded blocks of an eMMC read back as zeros, like erased ones,
+    // NOR flash has nothing to discard.
+    checkEraseRange(offset, length);
+    if (type == Type::block || secure)
+    {
+        erase(offset, length);
+    }
+}
+
+void FileDevice::sync()
+{
+    if (fdatasync(fd) < 0)
+    {
+        throwErrno("fdatasync " + devName);
+    }
+}
+
+MtdDevice::MtdDevice(const std::string& path, const std::string& name) :
+    devName(name.empty() ? fs::path(path).filename().string() : name)
+{
+    fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throwErrno("open " + path);
+    }
+
+    mtd_info_t info{};
+    if (ioctl(fd, MEMGETINFO, &info) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "MEMGETINFO " + path);
+    }
+    devSize = info.size;
+    blockSize = info.erasesize;
+    nor = info.type == MTD_NORFLASH;
+}
+
+MtdDevice::~MtdDevice()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+std::string MtdDevice::find(const std::string& name)
+{
+    // Lines look like: mtd2: 00020000 00010000 "u-boot-env"
+    std::ifstream mtdDevices("/proc/mtd");
+    std::string line;
+    auto quoted = "\"" + name + "\"";
+    while (std::getline(mtdDevices, line))
+    {
+        auto colon = line.find(':');
+        if (colon != std::string::npos && line.size() >= quoted.size() &&
+            line.compare(line.size() - quoted.size(), quoted.size(),
+                         quoted) == 0)
+        {
+            return "/dev/" + line.substr(0, colon);
+        }
+    }
+    return {};
+}
+
+void MtdDevice::read(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    preadAll(fd, data, length, offset);
+}
+
+void MtdDevice::write(uint64_t offset, const void* data, size_t length)
+{
+    checkRange(offset, length);
+    pwriteAll(fd, data, length, offset);
+    written += length;
+}
+
+void MtdDevice::erase(uint64_t offset, uint64_t length)
+{
+    checkEraseRange(offset, length);
+    erase_info_t info{};
+    info.start = offset;
+    info.length = length;
+    if (ioctl(fd, MEMERASE, &info) < 0)
+    {
+        throwErrno("MEMERASE " + devName);
+    }
+    erased += length;
+}
+
+BlockDevice::BlockDevice(const std::string& path, const std::string& name,
+                         bool directIo) :
+    devName(name.empty() ? fs::path(path).filename().string() : name)
+{
+    fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throwErrno("open " + path);
+    }
+
+    struct stat st
+    {};
+    if (fstat(fd, &st) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "fstat " + path);
+    }
+
+    devSize = st.st_size;
+    isBlockDevice = S_ISBLK(st.st_mode);
+    if (isBlockDevice)
+    {
+        int logicalSize = 0;
+        if (ioctl(fd, BLKGETSIZE64, &devSize) < 0 ||
+            ioctl(fd, BLKSSZGET, &logicalSize) < 0)
+        {
+            auto error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(),
+                                    "ioctl " + path);
+        }
+        sectorSize = logicalSize;
+    }
+
+    // The reads and the unaligned writes still go through the page cache,
+    // which O_DIRECT writes invalidate. Not every file system supports
+    // O_DIRECT, e.g. tmpfs, those are written through the cache only.
+    if (directIo)
+    {
+        directFd = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    }
+}
+
+BlockDevice::~BlockDevice()
+{
+    if (directFd >= 0)
+    {
+        close(directFd);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void BlockDevice::read(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    preadAll(fd, data, length, offset);
+}
+
+void BlockDevice::readBack(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    if (sync_file_range(fd, offset, length,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+    {
+        throwErrno("Failed to write back " + devName);
+    }
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+    preadAll(fd, data, length, offset);
+}
+
+void BlockDevice::write(uint64_t offset, const void* data, size_t length)
+{
+    checkRange(offset, length);
+    auto address = reinterpret_cast<uintptr_t>(data);
+    if (directFd >= 0 && offset % sectorSize == 0 &&
+        length % sectorSize == 0 && address % sectorSize == 0)
+    {
+        pwriteAll(directFd, data, length, offset);
+    }
+    else
+    {
+        pwriteAll(fd, data, length, offset);
+    }
+    written += length;
+}
+
+void BlockDevice::erase(uint64_t offset, uint64_t length)
+{
+    checkEraseRange(offset, length);
+    erased += length;
+
+    // Let the device zero the range, or write the zeros when it cannot.
+    uint64_t range[2] = {offset, length};
+    auto rc = isBlockDevice
+                  ? ioctl(fd, BLKZEROOUT, range)
+                  : fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                              offset, length);
+    if (rc == 0)
+    {
+        return;
+    }
+
+    constexpr size_t chunkSize = 64 * 1024;
+    std::vector<uint8_t> zeros(std::min<uint64_t>(length, chunkSize), 0);
+    for (uint64_t pos = 0; pos < length; pos += zeros.size())
+    {
+        auto count = std::min<uint64_t>(length - pos, zeros.size());
+        pwriteAll(fd, zeros.data(), count, offset + pos);
+    }
+}
+
+void BlockDevice::discard(uint64_t offset, uint64_t length, bool secure)
+{
+    checkEraseRange(offset, length);
+    if (!isBlockDevice)
+    {
+        // Reads back as zeros, like an eMMC with discard support.
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                      length) < 0 &&
+            secure)
+        {
+            erase(offset, length);
+        }
+        return;
+    }
+
+    uint64_t range[2] = {offset, length};
+    if (ioctl(fd, secure ? BLKSECDISCARD : BLKDISCARD, range) == 0)
+    {
+        return;
+    }
+
+    // Without discard support the data stays where it is, unless it must
+    // be gone.
+    if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL)
+    {
+        throwErrno("discard " + devName);
+    }
+    if (secure)
+    {
+        erase(offset, length);
+    }
+}
+
+void BlockDevice::reloadPartition(uint32_t number, uint64_t offset,
+                                  uint64_t length)
+{
+    if (!isBlockDevice)
+    {
+        return;
+    }
+
+    blkpg_partition part{};
+    part.start = offset;
+    part.length = length;
+    part.pno = number;
+    blkpg_ioctl_arg arg{};
+    arg.op = BLKPG_DEL_PARTITION;
+    arg.datalen = sizeof(part);
+    arg.data = &part;
+    if (ioctl(fd, BLKPG, &arg) < 0 && errno != ENXIO)
+    {
+        throwErrno("delete partition " + std::to_string(number) + " of " +
+                   devName);
+    }
+
+    arg.op = BLKPG_ADD_PARTITION;
+    if (ioctl(fd, BLKPG, &arg) < 0)
+    {
+        throwErrno("add partition " + std::to_string(number) + " of " +
+                   devName);
+    }
+}
+
+void BlockDevice::sync()
+{
+    if (fdatasync(fd) < 0)
+    {
+        throwErrno("fdatasync " + devName);
+    }
+}
+
+PartitionDevice::PartitionDevice(FlashDevice& parent, const std::string& name,
+                                 uint64_t offset, uint64_t size) :
+    parent(parent),
+    partName(name), partOffset(offset), partSize(size)
+{
+    if (offset > parent.size() || size > parent.size() - offset)
+    {
+        throw std::out_of_range("Partition " + name + " beyond the end of " +
+                                parent.name());
+    }
+}
+
+void PartitionDevice::read(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    parent.read(partOffset + offset, data, length);
+}
+
+void PartitionDevice::readBack(uint64_t offset, void* data, size_t length)
+{
+    checkRange(offset, length);
+    parent.readBack(partOffset + offset, data, length);
+}
+
+void PartitionDevice::write(uint64_t offset, const void* data, size_t length)
+{
+    checkRange(offset, length);
+    parent.write(partOffset + offset, data, length);
+    written += length;
+}
+
+void PartitionDevice::erase(uint64_t offset, uint64_t length)
+{
+    checkEraseRange(offset, length);
+    parent.erase(partOffset + offset, length);
+    erased += length;
+}
+
+void PartitionDevice::discard(uint64_t offset, uint64_t length, bool secure)
+{
+    checkEraseRange(offset, length);
+    parent.discard(partOffset + offset, length, secure);
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
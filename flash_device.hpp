@@ -0,0 +1,436 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @brief Called while programming with the number of bytes done so far and
+ *         the total number of bytes. */
+using ProgressCallback = std::function<void(uint64_t done, uint64_t total)>;
+
+/** @class WriteCancelled
+ *  @brief Thrown by a progress callback to stop programming, e.g. when the
+ *         updater stops. What was programmed is kept, so that the write
+ *         can resume, unlike after a failure.
+ */
+class WriteCancelled : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/** @class FlashDevice
+ *  @brief Raw access to a flash partition.
+ *  @details Abstracts an MTD partition, an eMMC partition or a file standing
+ *           in for either, so that the code programming the images does not
+ *           depend on the hardware it runs on. Errors are reported by
+ *           throwing std::system_error.
+ */
+class FlashDevice
+{
+  public:
+    virtual ~FlashDevice() = default;
+
+    /** @brief The name of the device, e.g. the MTD partition name */
+    virtual const std::string& name() const = 0;
+
+    /** @brief The size of the device in bytes */
+    virtual uint64_t size() const = 0;
+
+    /** @brief The size of an erase block. Erase requests must be aligned
+     *         to it, and on NOR flash a block must be erased before it can
+     *         be programmed again. */
+    virtual uint32_t eraseSize() const = 0;
+
+    /** @brief Read from the device
+     *
+     *  @param[in] offset - Offset in bytes from the start of the device
+     *  @param[out] data - Buffer to read into
+     *  @param[in] length - Number of bytes to read
+     */
+    virtual void read(uint64_t offset, void* data, size_t length) = 0;
+
+    /** @brief Read programmed data back from the medium rather than from a
+     *         cache, to check it. The same as read() on devices without a
+     *         cache.
+     *
+     *  @param[in] offset - Offset in bytes from the start of the device
+     *  @param[out] data - Buffer to read into
+     *  @param[in] length - Number of bytes to read
+     */
+    virtual void readBack(uint64_t offset, void* data, size_t length)
+    {
+        read(offset, data, length);
+    }
+
+    /** @brief Program the device
+     *
+     *  @param[in] offset - Offset in bytes from the start of the device
+     *  @param[in] data - Data to write
+     *  @param[in] length - Number of bytes to write
+     */
+    virtual void write(uint64_t offset, const void* data, size_t length) = 0;
+
+    /** @brief Erase a range of erase blocks
+     *
+     *  @param[in] offset - Offset of the first block, aligned to eraseSize()
+     *  @param[in] length - Length of the range, aligned to eraseSize()
+     */
+    virtual void erase(uint64_t offset, uint64_t length) = 0;
+
+    /** @brief Tell the device a range of erase blocks is no longer used,
+     *         so that it can reclaim it instead of preserving the data.
+     *         What the range reads back as afterwards depends on the
+     *         device. Does nothing on devices without such support.
+     *
+     *  @param[in] offset - Offset of the first block, aligned to eraseSize()
+     *  @param[in] length - Length of the range, aligned to eraseSize()
+     *  @param[in] secure - Make the device erase any copy of the data it
+     *                      kept too, falls back to erasing the range
+     */
+    virtual void discard(uint64_t offset, uint64_t length, bool secure)
+    {
+        checkEraseRange(offset, length);
+        if (secure)
+        {
+            erase(offset, length);
+        }
+    }
+
+    /** @brief Whether a block must be erased before it is programmed
+     *         again, true for NOR flash. */
+    virtual bool requiresErase() const
+    {
+        return true;
+    }
+
+    /** @brief Whether the device is NOR flash, where programming can
+     *         clear bits in place without erasing the block */
+    virtual bool isNor() const
+    {
+        return false;
+    }
+
+    /** @brief Flush any written data to the medium */
+    virtual void sync()
+    {}
+
+    /** @brief Make the kernel reload one partition of a disk, e.g. after
+     *         its label changed. Does nothing on other devices.
+     *
+     *  @param[in] number - The partition number, the N of mmcblk0pN
+     *  @param[in] offset - Offset of the partition in bytes
+     *  @param[in] length - Length of the partition in bytes
+     */
+    virtual void reloadPartition(uint32_t /* number */, uint64_t /* offset */,
+                                 uint64_t /* length */)
+    {}
+
+    /** @brief Number of bytes programmed through this object */
+    uint64_t bytesWritten() const
+    {
+        return written;
+    }
+
+    /** @brief Number of bytes erased through this object */
+    uint64_t bytesErased() const
+    {
+        return erased;
+    }
+
+  protected:
+    /** @brief Throws if the range is not aligned to erase blocks or does
+     *         not fit in the device. */
+    void checkEraseRange(uint64_t offset, uint64_t length) const;
+
+    /** @brief Throws if the range does not fit in the device */
+    void checkRange(uint64_t offset, uint64_t length) const;
+
+    /** @brief Atomic, the partitions of a device can be written from
+     *         several threads */
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> erased{0};
+};
+
+/** @class FileDevice
+ *  @brief A flash device emulated with a regular file.
+ *  @details In NOR mode, erased blocks read as 0xFF and programming can
+ *           only clear bits, like the real flash, so a missing erase shows
+ *           up as corrupted data. In block mode (eMMC), erasing discards the
+ *           range which then reads back as zeros.
+ */
+class FileDevice : public FlashDevice
+{
+  public:
+    enum class Type
+    {
+        nor,
+        block
+    };
+
+    FileDevice() = delete;
+    FileDevice(const FileDevice&) = delete;
+    FileDevice& operator=(const FileDevice&) = delete;
+    FileDevice(FileDevice&&) = delete;
+    FileDevice& operator=(FileDevice&&) = delete;
+
+    /** @brief Opens the backing file, creating it as an erased device of
+     *         the given size if it does not exist.
+     *
+     *  @param[in] path - Path of the backing file
+     *  @param[in] size - Size of the device in bytes
+     *  @param[in] eraseSize - Erase block size in bytes
+     *  @param[in] type - Flash type to emulate
+     */
+    FileDevice(const std::string& path, uint64_t size, uint32_t eraseSize,
+               Type type);
+
+    ~FileDevice() override;
+
+    const std::string& name() const override
+    {
+        return devName;
+    }
+
+    uint64_t size() const override
+    {
+        return devSize;
+    }
+
+    uint32_t eraseSize() const override
+    {
+        return blockSize;
+    }
+
+    bool requiresErase() const override
+    {
+        return type == Type::nor;
+    }
+
+    bool isNor() const override
+    {
+        return type == Type::nor;
+    }
+
+    void read(uint64_t offset, void* data, size_t length) override;
+    void write(uint64_t offset, const void* data, size_t length) override;
+    void erase(uint64_t offset, uint64_t length) override;
+    void discard(uint64_t offset, uint64_t length, bool secure) override;
+    void sync() override;
+
+  private:
+    int fd = -1;
+    std::string devName;
+    uint64_t devSize;
+    uint32_t blockSize;
+    Type type;
+};
+
+/** @class MtdDevice
+ *  @brief An MTD character device, e.g. /dev/mtd3.
+ */
+class MtdDevice : public FlashDevice
+{
+  public:
+    MtdDevice() = delete;
+    MtdDevice(const MtdDevice&) = delete;
+    MtdDevice& operator=(const MtdDevice&) = delete;
+    MtdDevice(MtdDevice&&) = delete;
+    MtdDevice& operator=(MtdDevice&&) = delete;
+
+    /** @brief Opens the device and queries its geometry
+     *
+     *  @param[in] path - Path of the MTD character device
+     *  @param[in] name - The partition name, defaults to the device name
+     */
+    explicit MtdDevice(const std::string& path, const std::string& name = "");
+
+    ~MtdDevice() override;
+
+    /** @brief Find the device of an MTD partition by name in /proc/mtd
+     *
+     *  @param[in] name - The partition name, e.g. "u-boot-env"
+     *
+     *  @return The device path, e.g. "/dev/mtd2", or an empty string
+     */
+    static std::string find(const std::string& name);
+
+    const std::string& name() const override
+    {
+        return devName;
+    }
+
+    uint64_t size() const override
+    {
+        return devSize;
+    }
+
+    uint32_t eraseSize() const override
+    {
+        return blockSize;
+    }
+
+    bool isNor() const override
+    {
+        return nor;
+    }
+
+    void read(uint64_t offset, void* data, size_t length) override;
+    void write(uint64_t offset, const void* data, size_t length) override;
+    void erase(uint64_t offset, uint64_t length) override;
+
+  private:
+    int fd = -1;
+    std::string devName;
+    uint64_t devSize = 0;
+    uint32_t blockSize = 0;
+    bool nor = false;
+};
+
+/** @class BlockDevice
+ *  @brief A block device, e.g. an eMMC partition, or a regular file.
+ *  @details Blocks can be rewritten without erasing them first. Erasing
+ *           a range zeroes it, with BLKZEROOUT when the device supports
+ *           it. Discarding uses BLKDISCARD or BLKSECDISCARD, or punches a
+ *           hole in a regular file.
+ */
+class BlockDevice : public FlashDevice
+{
+  public:
+    BlockDevice() = delete;
+    BlockDevice(const BlockDevice&) = delete;
+    BlockDevice& operator=(const BlockDevice&) = delete;
+    BlockDevice(BlockDevice&&) = delete;
+    BlockDevice& operator=(BlockDevice&&) = delete;
+
+    /** @brief Opens the device
+     *
+     *  @param[in] path - Path of the block device or file
+     *  @param[in] name - The device name, defaults to the file name
+     *  @param[in] directIo - Write the aligned data with O_DIRECT, past the
+     *                        page cache, when the device supports it
+     */
+    explicit BlockDevice(const std::string& path,
+                         const std::string& name = "",
+                         bool directIo = false);
+
+    ~BlockDevice() override;
+
+    const std::string& name() const override
+    {
+        return devName;
+    }
+
+    uint64_t size() const override
+    {
+        return devSize;
+    }
+
+    uint32_t eraseSize() const override
+    {
+        return sectorSize;
+    }
+
+    bool requiresErase() const override
+    {
+        return false;
+    }
+
+    void read(uint64_t offset, void* data, size_t length) override;
+
+    /** @brief Writes the range back and drops it from the page cache
+     *         before reading it */
+    void readBack(uint64_t offset, void* data, size_t length) override;
+
+    void write(uint64_t offset, const void* data, size_t length) override;
+    void erase(uint64_t offset, uint64_t length) override;
+    void discard(uint64_t offset, uint64_t length, bool secure) override;
+    void sync() override;
+
+    /** @brief Deletes and adds back the partition with BLKPG, so that the
+     *         kernel and udev see it anew without rescanning the disk */
+    void reloadPartition(uint32_t number, uint64_t offset,
+                         uint64_t length) override;
+
+  private:
+    int fd = -1;
+
+    /** @brief Whether fd is a block device rather than a regular file */
+    bool isBlockDevice = false;
+
+    /** @brief The device opened with O_DIRECT, or -1 */
+    int directFd = -1;
+
+    std::string devName;
+    uint64_t devSize = 0;
+    uint32_t sectorSize = 512;
+};
+
+/** @class PartitionDevice
+ *  @brief A range of another device, e.g. an MTD partition of a whole chip
+ *         or a GPT partition of an eMMC disk.
+ */
+class PartitionDevice : public FlashDevice
+{
+  public:
+    /** @brief Constructor
+     *
+     *  @param[in] parent - The device holding the partition, which must
+     *                      outlive this object
+     *  @param[in] name - The partition name
+     *  @param[in] offset - Offset of the partition in the parent device
+     *  @param[in] size - Size of the partition
+     */
+    PartitionDevice(FlashDevice& parent, const std::string& name,
+                    uint64_t offset, uint64_t size);
+
+    const std::string& name() const override
+    {
+        return partName;
+    }
+
+    uint64_t size() const override
+    {
+        return partSize;
+    }
+
+    uint32_t eraseSize() const override
+    {
+        return parent.eraseSize();
+    }
+
+    bool requiresErase() const override
+    {
+        return parent.requiresErase();
+    }
+
+    void read(uint64_t offset, void* data, size_t length) override;
+    void readBack(uint64_t offset, void* data, size_t length) override;
+    void write(uint64_t offset, const void* data, size_t length) override;
+    void erase(uint64_t offset, uint64_t length) override;
+    void discard(uint64_t offset, uint64_t length, bool secure) override;
+    void sync() override
+    {
+        parent.sync();
+    }
+
+  private:
+    FlashDevice& parent;
+    std::string partName;
+    uint64_t partOffset;
+    uint64_t partSize;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,143 @@
+#include "flash_job.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+FlashJob::FlashJob(sd_event* event, Work work, ProgressCallback onProgress,
+                   DoneHandler onDone) :
+    onProgress(std::move(onProgress)),
+    onDone(std::move(onDone))
+{
+    eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (eventFd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    }
+
+    auto rc = sd_event_add_io(event, &source, eventFd, EPOLLIN,
+                              FlashJob::onWakeup, this);
+    if (rc < 0)
+    {
+        close(eventFd);
+        throw std::system_error(-rc, std::generic_category(),
+                                "sd_event_add_io");
+    }
+
+    try
+    {
+        worker = std::thread([this, work = std::move(work)] { run(work); });
+    }
+    catch (...)
+    {
+        sd_event_source_unref(source);
+        close(eventFd);
+        throw;
+    }
+}
+
+FlashJob::~FlashJob()
+{
+    cancelled = true;
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+    sd_event_source_unref(source);
+    close(eventFd);
+}
+
+void FlashJob::run(const Work& work)
+{
+    std::exception_ptr failure;
+    try
+    {
+        work([this](uint64_t bytesDone, uint64_t bytesTotal) {
+            if (cancelled)
+            {
+                throw WriteCancelled("Flash job cancelled");
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                done = bytesDone;
+                total = bytesTotal;
+            }
+            wakeup();
+        });
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        error = failure;
+        finished = true;
+    }
+    wakeup();
+}
+
+void FlashJob::wakeup()
+{
+    // The counter cannot overflow, the loop resets it on every wakeup.
+    uint64_t one = 1;
+    while (::write(eventFd, &one, sizeof(one)) < 0 && errno == EINTR)
+    {
+    }
+}
+
+int FlashJob::onWakeup(sd_event_source* /* source */, int fd,
+                       uint32_t /* revents */, void* userdata)
+{
+    auto job = static_cast<FlashJob*>(userdata);
+
+    uint64_t count;
+    while (::read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+    {
+    }
+
+    uint64_t bytesDone;
+    uint64_t bytesTotal;
+    bool isFinished;
+    std::exception_ptr failure;
+    {
+        std::lock_guard<std::mutex> guard(job->lock);
+        bytesDone = job->done;
+        bytesTotal = job->total;
+        isFinished = job->finished;
+        failure = job->error;
+    }
+
+    if (bytesTotal && job->onProgress)
+    {
+        job->onProgress(bytesDone, bytesTotal);
+    }
+
+    if (isFinished)
+    {
+        job->worker.join();
+        sd_event_source_set_enabled(job->source, SD_EVENT_OFF);
+
+        // The handler may destroy the job.
+        auto handler = std::move(job->onDone);
+        handler(failure);
+    }
+    return 0;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "flash_device.hpp"
+
+#include <systemd/sd-event.h>
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @class FlashJob
+ *  @brief Programs flash on a worker thread, so that the updater keeps
+ *         serving D-Bus while the images are written.
+ *  @details The work only touches the devices it opens itself. Its progress
+ *           and its completion are delivered from the event loop, through
+ *           an eventfd, so the handlers can update the D-Bus objects. The
+ *           progress is coalesced: the handler sees the latest value when
+ *           the loop gets to it.
+ */
+class FlashJob
+{
+  public:
+    /** @brief The work, which reports its progress through the callback
+     *         and throws on failure */
+    using Work = std::function<void(const ProgressCallback& progress)>;
+
+    /** @brief Called once the work is done, with the exception it threw,
+     *         or nullptr if it succeeded */
+    using DoneHandler = std::function<void(std::exception_ptr error)>;
+
+    FlashJob() = delete;
+    FlashJob(const FlashJob&) = delete;
+    FlashJob& operator=(const FlashJob&) = delete;
+    FlashJob(FlashJob&&) = delete;
+    FlashJob& operator=(FlashJob&&) = delete;
+
+    /** @brief Start the work. Throws std::system_error if the worker
+     *         cannot be started.
+     *
+     *  @param[in] event - The event loop the handlers are called from
+     *  @param[in] work - The work to run on the worker thread
+     *  @param[in] onProgress - Called with the progress of the work
+     *  @param[in] onDone - Called once the work is done, may destroy this
+     *                      object
+     */
+    FlashJob(sd_event* event, Work work, ProgressCallback onProgress,
+             DoneHandler onDone);
+
+    /** @brief Cancels the work if it is still running, the progress
+     *         callback of the work throws WriteCancelled, and waits for
+     *         the worker. */
+    ~FlashJob();
+
+  private:
+    /** @brief Run the work, on the worker thread */
+    void run(const Work& work);
+
+    /** @brief Wake the event loop up */
+    void wakeup();
+
+    /** @brief Deliver the progress and the completion, on the loop */
+    static int onWakeup(sd_event_source* source, int fd, uint32_t revents,
+                        void* userdata);
+
+    ProgressCallback onProgress;
+    DoneHandler onDone;
+
+    int eventFd = -1;
+    sd_event_source* source = nullptr;
+
+    /** @brief Set by the destructor to stop the work */
+    std::atomic<bool> cancelled{false};
+
+    /** @brief Guards the state shared with the worker below */
+    std::mutex lock;
+    uint64_t done = 0;
+    uint64_t total = 0;
+    bool finished = false;
+    std::exception_ptr error;
+
+    std::thread worker;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
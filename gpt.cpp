@@ -0,0 +1,353 @@
+#include "gpt.hpp"
+
+#include "crc32.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+// On-disk structures, as defined by the UEFI specification. All fields are
+// little-endian, like the BMC processors.
+
+struct __attribute__((packed)) GptHeader
+{
+    char signature[8];
+    uint32_t revision;
+    uint32_t headerSize;
+    uint32_t headerCrc;
+    uint32_t reserved;
+    uint64_t myLba;
+    uint64_t alternateLba;
+    uint64_t firstUsableLba;
+    uint64_t lastUsableLba;
+    uint8_t diskGuid[16];
+    uint64_t entriesLba;
+    uint32_t numEntries;
+    uint32_t entrySize;
+    uint32_t entriesCrc;
+};
+static_assert(sizeof(GptHeader) == 92, "GPT header layout");
+
+struct GptEntry
+{
+    uint8_t typeGuid[16];
+    uint8_t uniqueGuid[16];
+    uint64_t firstLba;
+    uint64_t lastLba;
+    uint64_t attributes;
+    uint16_t name[36];
+};
+static_assert(sizeof(GptEntry) == 128, "GPT entry layout");
+
+constexpr char gptSignature[8] = {'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T'};
+constexpr uint32_t gptRevision = 0x00010000;
+constexpr uint32_t numEntries = 128;
+constexpr uint64_t entriesSectors =
+    numEntries * sizeof(GptEntry) / Gpt::sectorSize;
+
+/** @brief Linux filesystem data, 0FC63DAF-8483-4772-8E79-3D69D8477DE4 */
+constexpr uint8_t linuxDataGuid[16] = {0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84,
+                                       0x72, 0x47, 0x8E, 0x79, 0x3D, 0x69,
+                                       0xD8, 0x47, 0x7D, 0xE4};
+
+/** @brief Partitions are aligned to 1MiB like sgdisk does */
+constexpr uint64_t alignmentSectors = 2048;
+
+bool isUsed(const GptEntry& entry)
+{
+    return std::any_of(std::begin(entry.typeGuid), std::end(entry.typeGuid),
+                       [](uint8_t b) { return b != 0; });
+}
+
+std::string entryName(const GptEntry& entry)
+{
+    // Partition labels are UTF-16LE, the ones used on the BMC are ASCII.
+    std::string name;
+    for (auto c : entry.name)
+    {
+        if (c == 0)
+        {
+            break;
+        }
+        name.push_back(c < 0x80 ? static_cast<char>(c) : '?');
+    }
+    return name;
+}
+
+void setEntryName(GptEntry& entry, const std::string& name)
+{
+    if (name.size() > std::size(entry.name))
+    {
+        throw std::invalid_argument("GPT partition name too long: " + name);
+    }
+    std::fill(std::begin(entry.name), std::end(entry.name), 0);
+    std::copy(name.begin(), name.end(), entry.name);
+}
+
+void randomGuid(uint8_t* guid)
+{
+    static std::mt19937 gen{std::random_device{}()};
+    for (size_t i = 0; i < 16; i++)
+    {
+        guid[i] = gen();
+    }
+    // Version 4, variant 1
+    guid[7] = (guid[7] & 0x0F) | 0x40;
+    guid[8] = (guid[8] & 0x3F) | 0x80;
+}
+
+uint32_t headerCrc(GptHeader header)
+{
+    header.headerCrc = 0;
+    return utils::crc32(&header, sizeof(header));
+}
+
+/** @brief Reads and validates the header at the given block, and its
+ *         partition entries. */
+bool readTable(FlashDevice& disk, uint64_t lba, GptHeader& header,
+               std::vector<GptEntry>& entries)
+{
+    disk.read(lba * Gpt::sectorSize, &header, sizeof(header));
+    if (std::memcmp(header.signature, gptSignature, sizeof(gptSignature)) ||
+        header.headerSize != sizeof(GptHeader) ||
+        header.headerCrc != headerCrc(header) || header.myLba != lba ||
+        header.entrySize != sizeof(GptEntry) || header.numEntries == 0 ||
+        header.numEntries > numEntries)
+    {
+        return false;
+    }
+
+    entries.resize(header.numEntries);
+    auto bytes = entries.size() * sizeof(GptEntry);
+    if (header.entriesLba * Gpt::sectorSize + bytes > disk.size())
+    {
+        return false;
+    }
+    disk.read(header.entriesLba * Gpt::sectorSize, entries.data(), bytes);
+    return header.entriesCrc == utils::crc32(entries.data(), bytes);
+}
+
+/** @brief Writes the entries and the header, updating the CRCs */
+void writeTable(FlashDevice& disk, GptHeader header,
+                const std::vector<GptEntry>& entries)
+{
+    auto bytes = entries.size() * sizeof(GptEntry);
+    header.entriesCrc = utils::crc32(entries.data(), bytes);
+    header.headerCrc = headerCrc(header);
+
+    disk.write(header.entriesLba * Gpt::sectorSize, entries.data(), bytes);
+
+    std::vector<uint8_t> sector(Gpt::sectorSize, 0);
+    std::memcpy(sector.data(), &header, sizeof(header));
+    disk.write(header.myLba * Gpt::sectorSize, sector.data(), sector.size());
+}
+
+/** @brief Sectors taken by the partition entries of a table */
+uint64_t tableSectors(const GptHeader& header)
+{
+    return (uint64_t{header.numEntries} * header.entrySize + Gpt::sectorSize -
+            1) /
+           Gpt::sectorSize;
+}
+
+void writeProtectiveMbr(FlashDevice& disk, uint64_t sectors)
+{
+    std::vector<uint8_t> mbr(Gpt::sectorSize, 0);
+    auto* part = &mbr[446];
+    part[1] = 0x00; // CHS of the first block, 0/0/2
+    part[2] = 0x02;
+    part[4] = 0xEE; // GPT protective partition type
+    part[5] = part[6] = part[7] = 0xFF;
+    uint32_t first = 1;
+    uint32_t count = std::min<uint64_t>(sectors - 1, UINT32_MAX);
+    std::memcpy(&part[8], &first, sizeof(first));
+    std::memcpy(&part[12], &count, sizeof(count));
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+    disk.write(0, mbr.data(), mbr.size());
+}
+
+} // namespace
+
+Gpt::Gpt(FlashDevice& disk) : disk(disk)
+{
+    GptHeader header{};
+    std::vector<GptEntry> entries;
+    auto lastLba = disk.size() / sectorSize - 1;
+    if (!readTable(disk, 1, header, entries) &&
+        !readTable(disk, lastLba, header, entries))
+    {
+        throw std::runtime_error("No valid GPT on " + disk.name());
+    }
+
+    for (uint32_t i = 0; i < entries.size(); i++)
+    {
+        if (isUsed(entries[i]))
+        {
+            parts.push_back({i, entryName(entries[i]), entries[i].firstLba,
+                             entries[i].lastLba});
+        }
+    }
+}
+
+void Gpt::create(FlashDevice& disk,
+                 const std::vector<std::pair<std::string, uint64_t>>& layout)
+{
+    auto sectors = disk.size() / sectorSize;
+    if (sectors < 2 * (entriesSectors + 1) + alignmentSectors)
+    {
+        throw std::invalid_argument("Disk too small for a GPT: " +
+                                    disk.name());
+    }
+
+    std::vector<GptEntry> entries(numEntries);
+    std::memset(entries.data(), 0, entries.size() * sizeof(GptEntry));
+
+    GptHeader header{};
+    std::memcpy(header.signature, gptSignature, sizeof(gptSignature));
+    header.revision = gptRevision;
+    header.headerSize = sizeof(GptHeader);
+    header.myLba = 1;
+    header.alternateLba = sectors - 1;
+    header.firstUsableLba = 2 + entriesSectors;
+    header.lastUsableLba = sectors - 2 - entriesSectors;
+    randomGuid(header.diskGuid);
+    header.entriesLba = 2;
+    header.numEntries = numEntries;
+    header.entrySize = sizeof(GptEntry);
+
+    if (layout.size() > numEntries)
+    {
+        throw std::invalid_argument("Too many GPT partitions");
+    }
+
+    uint64_t next = alignmentSectors;
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        const auto& [name, size] = layout[i];
+        auto count = (size + sectorSize - 1) / sectorSize;
+        if (count == 0 || next + count - 1 > header.lastUsableLba)
+        {
+            throw std::invalid_argument("GPT partition does not fit: " + name);
+        }
+
+        auto& entry = entries[i];
+        std::memcpy(entry.typeGuid, linuxDataGuid, sizeof(linuxDataGuid));
+        randomGuid(entry.uniqueGuid);
+        entry.firstLba = next;
+        entry.lastLba = next + count - 1;
+        setEntryName(entry, name);
+
+        next += (count + alignmentSectors - 1) / alignmentSectors *
+                alignmentSectors;
+    }
+
+    writeProtectiveMbr(disk, sectors);
+    writeTable(disk, header, entries);
+
+    header.myLba = sectors - 1;
+    header.alternateLba = 1;
+    header.entriesLba = sectors - 1 - entriesSectors;
+    writeTable(disk, header, entries);
+
+    disk.sync();
+}
+
+bool Gpt::rename(uint32_t index, const std::string& name)
+{
+    GptHeader header{};
+    std::vector<GptEntry> entries;
+    auto lastLba = disk.size() / sectorSize - 1;
+    if (!readTable(disk, 1, header, entries) &&
+        !readTable(disk, lastLba, header, entries))
+    {
+        throw std::runtime_error("No valid GPT on " + disk.name());
+    }
+    if (index >= entries.size() || !isUsed(entries[index]))
+    {
+        throw std::invalid_argument("No GPT partition " +
+                                    std::to_string(index + 1) + " on " +
+                                    disk.name());
+    }
+    if (entryName(entries[index]) == name)
+    {
+        return false;
+    }
+    setEntryName(entries[index], name);
+
+    // Derive the header of the other table from the valid one.
+    auto primary = header;
+    auto backup = header;
+    if (header.myLba == 1)
+    {
+        backup.myLba = header.alternateLba > header.lastUsableLba &&
+                               header.alternateLba <= lastLba
+                           ? header.alternateLba
+                           : lastLba;
+        backup.alternateLba = 1;
+        backup.entriesLba = backup.myLba - tableSectors(header);
+        primary.alternateLba = backup.myLba;
+    }
+    else
+    {
+        primary.myLba = 1;
+        primary.alternateLba = header.myLba;
+        primary.entriesLba = 2;
+    }
+
+    writeTable(disk, backup, entries);
+    disk.sync();
+    writeTable(disk, primary, entries);
+    disk.sync();
+
+    const auto& entry = entries[index];
+    for (auto& part : parts)
+    {
+        if (part.index == index)
+        {
+            part.name = name;
+        }
+    }
+    disk.reloadPartition(index + 1, entry.firstLba * sectorSize,
+                         (entry.lastLba - entry.firstLba + 1) * sectorSize);
+    return true;
+}
+
+std::optional<GptPartition> Gpt::find(const std::string& name) const
+{
+    auto it = std::find_if(parts.begin(), parts.end(),
+                           [&name](const auto& p) { return p.name == name; });
+    if (it == parts.end())
+    {
+        return std::nullopt;
+    }
+    return *it;
+}
+
+std::unique_ptr<FlashDevice> Gpt::open(const std::string& name)
+{
+    auto part = find(name);
+    if (!part)
+    {
+        throw std::invalid_argument("No GPT partition " + name + " on " +
+                                    disk.name());
+    }
+    return std::make_unique<PartitionDevice>(
+        disk, name, part->firstLba * sectorSize,
+        (part->lastLba - part->firstLba + 1) * sectorSize);
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
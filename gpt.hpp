@@ -0,0 +1,105 @@
+#pragma once
+
+#include "flash_device.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @struct GptPartition
+ *  @brief A partition of a GUID partition table.
+ */
+struct GptPartition
+{
+    /** @brief Index in the partition entry array, the N of mmcblk0pN is
+     *         index + 1 */
+    uint32_t index;
+
+    /** @brief Partition label */
+    std::string name;
+
+    /** @brief First and last (inclusive) logical blocks */
+    uint64_t firstLba;
+    uint64_t lastLba;
+};
+
+/** @class Gpt
+ *  @brief Reads the GUID partition table of a disk.
+ *  @details The primary table is used when it is valid, otherwise the backup
+ *           table at the end of the disk. Only the 512 byte sector size used
+ *           by eMMC is supported. Throws std::runtime_error if the disk has
+ *           no valid table.
+ */
+class Gpt
+{
+  public:
+    static constexpr uint32_t sectorSize = 512;
+
+    Gpt() = delete;
+    Gpt(const Gpt&) = delete;
+    Gpt& operator=(const Gpt&) = delete;
+    Gpt(Gpt&&) = delete;
+    Gpt& operator=(Gpt&&) = delete;
+
+    /** @brief Reads the partition table
+     *
+     *  @param[in] disk - The whole disk device, which must outlive this object
+     */
+    explicit Gpt(FlashDevice& disk);
+
+    /** @brief Writes a new partition table with protective MBR, primary and
+     *         backup headers.
+     *
+     *  @param[in] disk - The whole disk device
+     *  @param[in] layout - Partition names and sizes in bytes, laid out in
+     *                      order from the first usable block
+     */
+    static void create(FlashDevice& disk,
+                       const std::vector<std::pair<std::string, uint64_t>>&
+                           layout);
+
+    /** @brief The partitions in the table */
+    const std::vector<GptPartition>& partitions() const
+    {
+        return parts;
+    }
+
+    /** @brief Find a partition by label */
+    std::optional<GptPartition> find(const std::string& name) const;
+
+    /** @brief Open a partition by label, throws std::invalid_argument if
+     *         there is no such partition. */
+    std::unique_ptr<FlashDevice> open(const std::string& name);
+
+    /** @brief Sets the label of a partition in both the primary and backup
+     *         tables, and has the kernel reload that partition only.
+     *  @details The backup table is written first, so that an interrupted
+     *           update leaves two valid tables. An invalid table is rebuilt
+     *           from the other one.
+     *
+     *  @param[in] index - Index of the partition in the entry array
+     *  @param[in] name - The new label, at most 36 characters
+     *
+     *  @return Whether the label changed, nothing is written otherwise
+     */
+    bool rename(uint32_t index, const std::string& name);
+
+  private:
+    FlashDevice& disk;
+    std::vector<GptPartition> parts;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
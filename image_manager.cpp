@@ -2,13 +2,14 @@
 
 #include "image_manager.hpp"
 
+#include "spawn.hpp"
+#include "utils.hpp"
 #include "version.hpp"
 #include "watch.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include <elog-errors.hpp>
@@ -37,40 +38,18 @@ using InternalFail = Software::Image::InternalFailure;
 using ImageFail = Software::Image::ImageFailure;
 namespace fs = std::filesystem;
 
-struct RemovablePath
-{
-    fs::path path;
+/** @brief How long tar may take to extract an image */
+constexpr std::chrono::minutes unTarTimeout(5);
 
-    RemovablePath(const fs::path& path) : path(path)
-    {}
-    ~RemovablePath()
+RemovablePath::~RemovablePath()
+{
+    if (!path.empty())
     {
-        if (!path.empty())
-        {
-            std::error_code ec;
-            fs::remove_all(path, ec);
-        }
+        std::error_code ec;
+        fs::remove_all(path, ec);
     }
-};
-
-namespace // anonymous
-{
-
-std::vector<std::string> getSoftwareObjects(sdbusplus::bus::bus& bus)
-{
-    std::vector<std::string> paths;
-    auto method = bus.new_method_call(MAPPER_BUSNAME, MAPPER_PATH,
-                                      MAPPER_INTERFACE, "GetSubTreePaths");
-    method.append(SOFTWARE_OBJPATH);
-    method.append(0); // Depth 0 to search all
-    method.append(std::vector<std::string>({VERSION_BUSNAME}));
-    auto reply = bus.call(method);
-    reply.read(paths);
-    return paths;
 }
 
-} // namespace
-
 int Manager::processImage(const std::string& tarFilePath)
 {
     if (!fs::is_regular_file(tarFilePath))
@@ -80,7 +59,7 @@ int Manager::processImage(const std::string& tarFilePath)
         report<ManifestFileFailure>(ManifestFail::PATH(tarFilePath.c_str()));
         return -1;
     }
-    RemovablePath tarPathRemove(tarFilePath);
+    auto tarPathRemove = std::make_shared<RemovablePath>(tarFilePath);
     fs::path tmpDirPath(std::string{IMG_UPLOAD_DIR});
     tmpDirPath /= "imageXXXXXX";
     auto tmpDir = tmpDirPath.string();
@@ -95,18 +74,33 @@ int Manager::processImage(const std::string& tarFilePath)
     }
 
     tmpDirPath = tmpDir;
-    RemovablePath tmpDirToRemove(tmpDirPath);
+    auto tmpDirToRemove = std::make_shared<RemovablePath>(tmpDirPath);
+
+    // Untar tarball into the tmp dir, the rest of the processing resumes
+    // once tar exits. Both paths are removed once it is done.
+    return unTarAsync(
+        sd_bus_get_event(bus.get()), tarFilePath, tmpDirPath.string(),
+        [this, tarFilePath, tarPathRemove, tmpDirToRemove](bool extracted) {
+            if (!extracted)
+            {
+                log<level::ERR>("Error occurred during untar");
+                return;
+            }
+            if (processExtractedImage(tarFilePath, *tmpDirToRemove) < 0)
+            {
+                log<level::ERR>("Error processing image",
+                                entry("IMAGE=%s", tarFilePath.c_str()));
+            }
+        });
+}
+
+int Manager::processExtractedImage(const std::string& tarFilePath,
+                                   RemovablePath& tmpDirToRemove)
+{
+    fs::path tmpDirPath = tmpDirToRemove.path;
     fs::path manifestPath = tmpDirPath;
     manifestPath /= MANIFEST_FILE_NAME;
 
-    // Untar tarball into the tmp dir
-    auto rc = unTar(tarFilePath, tmpDirPath.string());
-    if (rc < 0)
-    {
-        log<level::ERR>("Error occurred during untar");
-        return -1;
-    }
-
     // Verify the manifest file
     if (!fs::is_regular_file(manifestPath))
     {
@@ -187,6 +181,15 @@ int Manager::processImage(const std::string& tarFilePath)
     // Compute id
     auto id = Version::getId(version);
 
+    // Another upload of the same version may have finished while this one
+    // was being extracted, leave its image directory alone.
+    if (versions.find(id) != versions.end())
+    {
+        log<level::INFO>("Software Object with the same version already exists",
+                         entry("VERSION_ID=%s", id.c_str()));
+        return 0;
+    }
+
     fs::path imageDirPath = std::string{IMG_UPLOAD_DIR};
     imageDirPath /= id;
 
@@ -206,10 +209,11 @@ int Manager::processImage(const std::string& tarFilePath)
     // This service only manages the uploaded versions, and there could be
     // active versions on D-Bus that is not managed by this service.
     // So check D-Bus if there is an existing version.
-    auto allSoftwareObjs = getSoftwareObjects(bus);
+    const auto& allSoftwareObjs =
+        lookups.getSubTreePaths(SOFTWARE_OBJPATH, VERSION_BUSNAME);
     auto it =
         std::find(allSoftwareObjs.begin(), allSoftwareObjs.end(), objPath);
-    if (versions.find(id) == versions.end() && it == allSoftwareObjs.end())
+    if (it == allSoftwareObjs.end())
     {
         // Create Version object
         auto versionPtr = std::make_unique<Version>(
@@ -256,56 +260,38 @@ void Manager::erase(std::string entryId)
     this->versions.erase(entryId);
 }
 
-int Manager::unTar(const std::string& tarFilePath,
-                   const std::string& extractDirPath)
+int Manager::unTarAsync(sd_event* event, const std::string& tarFilePath,
+                        const std::string& extractDirPath,
+                        std::function<void(bool extracted)> handler)
 {
-    if (tarFilePath.empty())
+    if (tarFilePath.empty() || extractDirPath.empty())
     {
-        log<level::ERR>("Error TarFilePath is empty");
+        log<level::ERR>("Error TarFilePath or ExtractDirPath is empty");
         report<UnTarFailure>(UnTarFail::PATH(tarFilePath.c_str()));
         return -1;
     }
-    if (extractDirPath.empty())
-    {
-        log<level::ERR>("Error ExtractDirPath is empty");
-        report<UnTarFailure>(UnTarFail::PATH(extractDirPath.c_str()));
-        return -1;
-    }
 
     log<level::INFO>("Untaring", entry("FILENAME=%s", tarFilePath.c_str()),
                      entry("EXTRACTIONDIR=%s", extractDirPath.c_str()));
-    int status = 0;
-    pid_t pid = fork();
-
-    if (pid == 0)
-    {
-        // child process
-        execl("/bin/tar", "tar", "-xf", tarFilePath.c_str(), "-C",
-              extractDirPath.c_str(), (char*)0);
-        // execl only returns on fail
-        log<level::ERR>("Failed to execute untar file",
-                        entry("FILENAME=%s", tarFilePath.c_str()));
-        report<UnTarFailure>(UnTarFail::PATH(tarFilePath.c_str()));
-        return -1;
-    }
-    else if (pid > 0)
+    auto argv = utils::internal::constructArgv(
+        "tar", "-xf", tarFilePath.c_str(), "-C", extractDirPath.c_str());
+    auto started = utils::spawnAsync(
+        event, "/bin/tar", argv.data(), unTarTimeout,
+        [tarFilePath, handler](const utils::ChildExit& result) {
+            if (result.status != 0)
+            {
+                log<level::ERR>("Failed to untar file",
+                                entry("FILENAME=%s", tarFilePath.c_str()),
+                                entry("ERRORS=%s", result.errors.c_str()));
+                report<UnTarFailure>(UnTarFail::PATH(tarFilePath.c_str()));
+            }
+            handler(result.status == 0);
+        });
+    if (!started)
     {
-        waitpid(pid, &status, 0);
-        if (WEXITSTATUS(status))
-        {
-            log<level::ERR>("Failed to untar file",
-                            entry("FILENAME=%s", tarFilePath.c_str()));
-            report<UnTarFailure>(UnTarFail::PATH(tarFilePath.c_str()));
-            return -1;
-        }
-    }
-    else
-    {
-        log<level::ERR>("fork() failed.");
         report<UnTarFailure>(UnTarFail::PATH(tarFilePath.c_str()));
         return -1;
     }
-
     return 0;
 }
 
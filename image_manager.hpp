@@ -1,8 +1,13 @@
 #pragma once
+#include "lookup_cache.hpp"
 #include "version.hpp"
 
+#include <systemd/sd-event.h>
+
 #include <sdbusplus/server.hpp>
 
+#include <filesystem>
+#include <functional>
 #include <string>
 
 namespace phosphor
@@ -12,6 +17,18 @@ namespace software
 namespace manager
 {
 
+/** @struct RemovablePath
+ *  @brief Removes a file or directory tree when it goes out of scope.
+ */
+struct RemovablePath
+{
+    std::filesystem::path path;
+
+    RemovablePath(const std::filesystem::path& path) : path(path)
+    {}
+    ~RemovablePath();
+};
+
 /** @class Manager
  *  @brief Contains a map of Version dbus objects.
  *  @details The software image manager class that contains the Version dbus
@@ -24,14 +41,17 @@ class Manager
      *
      * @param[in] bus - The Dbus bus object
      */
-    Manager(sdbusplus::bus::bus& bus) : bus(bus){};
+    Manager(sdbusplus::bus::bus& bus) :
+        bus(bus), lookups(bus, SOFTWARE_OBJPATH){};
 
     /**
      * @brief Verify and untar the tarball. Verify the manifest file.
      *        Create and populate the version and filepath interfaces.
+     *        The tarball is extracted by a child process, the rest of the
+     *        processing is done from the event loop once it exits.
      *
      * @param[in]  tarballFilePath - Tarball path.
-     * @param[out] result          - 0 if successful.
+     * @param[out] result          - 0 if the extraction was started.
      */
     int processImage(const std::string& tarballFilePath);
 
@@ -43,7 +63,33 @@ class Manager
      */
     void erase(std::string entryId);
 
+    /**
+     * @brief Untar the tarball without blocking the event loop.
+     *
+     * @param[in]  event           - The event loop tar is reaped from.
+     * @param[in]  tarballFilePath - Tarball path.
+     * @param[in]  extractDirPath  - Dir path to extract tarball ball to.
+     * @param[in]  handler         - Called with whether the tarball was
+     *                               extracted once tar exits.
+     * @param[out] result          - 0 if tar was started.
+     */
+    static int unTarAsync(sd_event* event, const std::string& tarballFilePath,
+                          const std::string& extractDirPath,
+                          std::function<void(bool extracted)> handler);
+
   private:
+    /**
+     * @brief Verify the manifest file of an extracted tarball, then create
+     *        and populate the version and filepath interfaces.
+     *
+     * @param[in]  tarballFilePath - Tarball path.
+     * @param[in]  tmpDirToRemove  - The extraction dir, which is renamed to
+     *                               the image dir on success.
+     * @param[out] result          - 0 if successful.
+     */
+    int processExtractedImage(const std::string& tarballFilePath,
+                              RemovablePath& tmpDirToRemove);
+
     /** @brief Persistent map of Version dbus objects and their
      * version id */
     std::map<std::string, std::unique_ptr<Version>> versions;
@@ -51,15 +97,8 @@ class Manager
     /** @brief Persistent sdbusplus DBus bus connection. */
     sdbusplus::bus::bus& bus;
 
-    /**
-     * @brief Untar the tarball.
-     *
-     * @param[in]  tarballFilePath - Tarball path.
-     * @param[in]  extractDirPath  - Dir path to extract tarball ball to.
-     * @param[out] result          - 0 if successful.
-     */
-    static int unTar(const std::string& tarballFilePath,
-                     const std::string& extractDirPath);
+    /** @brief Lookups of the versions published by the updater. */
+    utils::LookupCache lookups;
 };
 
 } // namespace manager
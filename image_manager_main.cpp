@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include "image_manager.hpp"
+#include "spawn.hpp"
 #include "watch.hpp"
 
 #include <phosphor-logging/log.hpp>
@@ -12,6 +13,9 @@
 int main()
 {
     using namespace phosphor::software::manager;
+    // Before any thread or child exists, see utils::spawnAsync().
+    utils::blockChildSignal();
+
     auto bus = sdbusplus::bus::new_default();
 
     sd_event* loop = nullptr;
@@ -0,0 +1,527 @@
+#include "image_source.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+/** @brief The size of the chunks the frames are decompressed into */
+constexpr size_t chunkSize = 1024 * 1024;
+
+/** @brief The chunks of a frame decompressed ahead of the reader */
+constexpr size_t maxQueuedChunks = 4;
+
+/** @brief The header of a delta file */
+struct __attribute__((packed)) DeltaHeader
+{
+    std::array<char, 8> magic;
+    uint64_t imageSize;
+    std::array<uint8_t, 32> digest;
+};
+static_assert(sizeof(DeltaHeader) == 48, "Delta header layout");
+
+/** @brief A command of a delta file, followed by its data for the data
+ *         command */
+struct __attribute__((packed)) DeltaCommand
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+};
+static_assert(sizeof(DeltaCommand) == 24, "Delta command layout");
+
+using DecoderContext = std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)>;
+
+DecoderContext makeDecoder()
+{
+    DecoderContext ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (!ctx)
+    {
+        throw std::bad_alloc();
+    }
+    return ctx;
+}
+
+/** @brief Decompress one frame into chunks
+ *
+ *  @param[in] ctx - The decoder
+ *  @param[in] data - The compressed frame
+ *  @param[in] size - The size of the frame
+ *  @param[in] emit - Called with each decompressed chunk
+ */
+template <typename Emit>
+void decompressFrame(ZSTD_DCtx* ctx, const uint8_t* data, size_t size,
+                     Emit&& emit)
+{
+    ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+    ZSTD_inBuffer in{data, size, 0};
+    size_t rc = 1;
+    while (rc != 0)
+    {
+        std::vector<uint8_t> chunk(chunkSize);
+        ZSTD_outBuffer out{chunk.data(), chunk.size(), 0};
+        while (rc != 0 && out.pos < out.size)
+        {
+            rc = ZSTD_decompressStream(ctx, &out, &in);
+            if (ZSTD_isError(rc))
+            {
+                throw std::runtime_error(std::string("zstd: ") +
+                                         ZSTD_getErrorName(rc));
+            }
+            if (rc != 0 && in.pos == in.size && out.pos < out.size)
+            {
+                throw std::runtime_error("zstd: truncated frame");
+            }
+        }
+        chunk.resize(out.pos);
+        if (!chunk.empty())
+        {
+            emit(std::move(chunk));
+        }
+    }
+}
+
+} // namespace
+
+FileSource::FileSource(const fs::path& path)
+{
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(),
+                                "open " + path.string());
+    }
+
+    struct stat st
+    {};
+    if (fstat(fd, &st) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "fstat " + path.string());
+    }
+    fileSize = st.st_size;
+
+    // The image is read once from start to end.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+FileSource::~FileSource()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+size_t FileSource::read(void* data, size_t length)
+{
+    while (true)
+    {
+        auto rc = ::read(fd, data, length);
+        if (rc >= 0)
+        {
+            return rc;
+        }
+        if (errno != EINTR)
+        {
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+    }
+}
+
+ZstdSource::ZstdSource(const fs::path& path, unsigned threads)
+{
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(),
+                                "open " + path.string());
+    }
+
+    try
+    {
+        struct stat st
+        {};
+        if (fstat(fd, &st) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(),
+                                    "fstat " + path.string());
+        }
+
+        mapSize = st.st_size;
+        if (mapSize)
+        {
+            map = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                map = nullptr;
+                throw std::system_error(errno, std::generic_category(),
+                                        "mmap " + path.string());
+            }
+            madvise(map, mapSize, MADV_SEQUENTIAL);
+        }
+
+        // Index the frames. The size of the image is needed up front, so
+        // a frame written without its content size is decompressed once
+        // to measure it.
+        auto base = static_cast<const uint8_t*>(map);
+        DecoderContext ctx(nullptr, ZSTD_freeDCtx);
+        for (size_t pos = 0; pos < mapSize;)
+        {
+            auto size = ZSTD_findFrameCompressedSize(base + pos, mapSize - pos);
+            if (ZSTD_isError(size))
+            {
+                throw std::runtime_error(path.string() + ": " +
+                                         ZSTD_getErrorName(size));
+            }
+
+            auto content = ZSTD_getFrameContentSize(base + pos, size);
+            if (content == ZSTD_CONTENTSIZE_ERROR)
+            {
+                throw std::runtime_error(path.string() +
+                                         ": invalid zstd frame");
+            }
+            if (content == ZSTD_CONTENTSIZE_UNKNOWN)
+            {
+                if (!ctx)
+                {
+                    ctx = makeDecoder();
+                }
+                content = 0;
+                decompressFrame(ctx.get(), base + pos, size,
+                                [&content](std::vector<uint8_t>&& chunk) {
+                                    content += chunk.size();
+                                });
+            }
+
+            frames.push_back({base + pos, size, {}, false, nullptr});
+            contentSize += content;
+            pos += size;
+        }
+
+        if (threads == 0)
+        {
+            threads = std::max(std::thread::hardware_concurrency(), 1U);
+        }
+        threads = std::min<size_t>(threads, frames.size());
+        for (unsigned i = 0; i < threads; i++)
+        {
+            decoders.emplace_back(&ZstdSource::decode, this);
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+ZstdSource::~ZstdSource()
+{
+    close();
+}
+
+void ZstdSource::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    consumed.notify_all();
+    for (auto& decoder : decoders)
+    {
+        decoder.join();
+    }
+    decoders.clear();
+
+    if (map)
+    {
+        munmap(map, mapSize);
+        map = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool ZstdSource::isCompressed(const fs::path& path)
+{
+    // The magic number 0xFD2FB528, little endian.
+    constexpr uint8_t magic[] = {0x28, 0xB5, 0x2F, 0xFD};
+    uint8_t header[sizeof(magic)] = {};
+    std::ifstream file(path, std::ios::binary);
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    return file && std::memcmp(header, magic, sizeof(magic)) == 0;
+}
+
+void ZstdSource::decode()
+{
+    DecoderContext ctx(nullptr, ZSTD_freeDCtx);
+    while (true)
+    {
+        Frame* frame = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping || nextFrame == frames.size())
+            {
+                return;
+            }
+            frame = &frames[nextFrame++];
+        }
+
+        // The frames are taken in order, so the one being read always has
+        // a decoder and the decoders waiting for the reader cannot block
+        // it.
+        std::exception_ptr error;
+        try
+        {
+            if (!ctx)
+            {
+                ctx = makeDecoder();
+            }
+            decompressFrame(ctx.get(), frame->data, frame->size,
+                            [this, frame](std::vector<uint8_t>&& chunk) {
+                                push(*frame, std::move(chunk));
+                            });
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            frame->finished = true;
+            frame->error = error;
+        }
+        produced.notify_all();
+    }
+}
+
+void ZstdSource::push(Frame& frame, std::vector<uint8_t>&& chunk)
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        consumed.wait(guard, [this, &frame] {
+            return stopping || frame.chunks.size() < maxQueuedChunks;
+        });
+        if (stopping)
+        {
+            throw std::runtime_error("zstd: stopped");
+        }
+        frame.chunks.push_back(std::move(chunk));
+    }
+    produced.notify_all();
+}
+
+bool ZstdSource::nextChunk()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (current < frames.size())
+    {
+        auto& frame = frames[current];
+        produced.wait(guard, [&frame] {
+            return !frame.chunks.empty() || frame.finished;
+        });
+        if (!frame.chunks.empty())
+        {
+            chunk = std::move(frame.chunks.front());
+            chunkPos = 0;
+            frame.chunks.pop_front();
+            guard.unlock();
+            consumed.notify_all();
+            return true;
+        }
+        if (frame.error)
+        {
+            std::rethrow_exception(frame.error);
+        }
+        current++;
+    }
+    return false;
+}
+
+size_t ZstdSource::read(void* data, size_t length)
+{
+    auto out = static_cast<uint8_t*>(data);
+    size_t copied = 0;
+    while (copied < length)
+    {
+        if (chunkPos == chunk.size() && !nextChunk())
+        {
+            break;
+        }
+        auto count = std::min(length - copied, chunk.size() - chunkPos);
+        std::memcpy(out + copied, chunk.data() + chunkPos, count);
+        chunkPos += count;
+        copied += count;
+    }
+    return copied;
+}
+
+DigestSource::DigestSource(ImageSource& source) : source(source)
+{
+    hash.reset(EVP_MD_CTX_new());
+    if (!hash || !EVP_DigestInit_ex(hash.get(), EVP_sha256(), nullptr))
+    {
+        throw std::bad_alloc();
+    }
+}
+
+size_t DigestSource::read(void* data, size_t length)
+{
+    auto count = source.read(data, length);
+    EVP_DigestUpdate(hash.get(), data, count);
+    return count;
+}
+
+std::array<uint8_t, 32> DigestSource::digest() const
+{
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> copy{
+        EVP_MD_CTX_new(), EVP_MD_CTX_free};
+    std::array<uint8_t, EVP_MAX_MD_SIZE> result{};
+    unsigned int resultSize = 0;
+    if (!copy || !EVP_MD_CTX_copy_ex(copy.get(), hash.get()) ||
+        !EVP_DigestFinal_ex(copy.get(), result.data(), &resultSize))
+    {
+        throw std::bad_alloc();
+    }
+
+    std::array<uint8_t, 32> digest{};
+    std::copy_n(result.begin(), digest.size(), digest.begin());
+    return digest;
+}
+
+DeltaSource::DeltaSource(const fs::path& path, BaseReader base,
+                         uint64_t baseSize) :
+    delta(path),
+    base(std::move(base)), baseSize(baseSize)
+{
+    DeltaHeader header{};
+    readDelta(&header, sizeof(header));
+    if (header.magic != magic)
+    {
+        throw std::runtime_error("Not a delta: " + path.string());
+    }
+    imageSize = header.imageSize;
+    digest = header.digest;
+
+    hash.reset(EVP_MD_CTX_new());
+    if (!hash || !EVP_DigestInit_ex(hash.get(), EVP_sha256(), nullptr))
+    {
+        throw std::bad_alloc();
+    }
+}
+
+bool DeltaSource::isDelta(const fs::path& path)
+{
+    std::array<char, 8> start{};
+    std::ifstream file(path, std::ios::binary);
+    return file.read(start.data(), start.size()) && start == magic;
+}
+
+void DeltaSource::readDelta(void* data, size_t length)
+{
+    auto buf = static_cast<uint8_t*>(data);
+    while (length > 0)
+    {
+        auto rc = delta.read(buf, length);
+        if (rc == 0)
+        {
+            throw std::runtime_error("Delta ended early");
+        }
+        buf += rc;
+        length -= rc;
+    }
+}
+
+void DeltaSource::nextCommand()
+{
+    DeltaCommand next{};
+    readDelta(&next, sizeof(next));
+    if ((next.type != copyCommand && next.type != dataCommand) ||
+        next.length == 0 || next.length > imageSize - produced ||
+        (next.type == copyCommand &&
+         (next.offset > baseSize || next.length > baseSize - next.offset)))
+    {
+        throw std::runtime_error("Malformed delta command");
+    }
+    command = next.type;
+    offset = next.offset;
+    remaining = next.length;
+}
+
+size_t DeltaSource::read(void* data, size_t length)
+{
+    auto buf = static_cast<uint8_t*>(data);
+    size_t done = 0;
+    while (done < length && produced < imageSize)
+    {
+        if (remaining == 0)
+        {
+            nextCommand();
+        }
+
+        auto count = static_cast<size_t>(std::min<uint64_t>(
+            length - done, remaining));
+        if (command == copyCommand)
+        {
+            base(offset, buf + done, count);
+            offset += count;
+        }
+        else
+        {
+            readDelta(buf + done, count);
+        }
+        remaining -= count;
+        produced += count;
+        done += count;
+    }
+    if (done == 0)
+    {
+        return 0;
+    }
+
+    EVP_DigestUpdate(hash.get(), buf, done);
+    if (produced == imageSize)
+    {
+        std::array<uint8_t, EVP_MAX_MD_SIZE> result{};
+        unsigned int resultSize = 0;
+        EVP_DigestFinal_ex(hash.get(), result.data(), &resultSize);
+        if (resultSize != digest.size() ||
+            !std::equal(digest.begin(), digest.end(), result.begin()))
+        {
+            throw std::runtime_error("Rebuilt image does not match its "
+                                     "digest");
+        }
+    }
+    return done;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
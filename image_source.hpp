@@ -0,0 +1,293 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace fs = std::filesystem;
+
+/** @class ImageSource
+ *  @brief A stream of image data to be programmed into flash.
+ */
+class ImageSource
+{
+  public:
+    virtual ~ImageSource() = default;
+
+    /** @brief The total number of bytes the stream produces */
+    virtual uint64_t size() const = 0;
+
+    /** @brief Read the next chunk of data
+     *
+     *  @param[out] data - Buffer to read into
+     *  @param[in] length - Size of the buffer
+     *
+     *  @return The number of bytes read, 0 at the end of the stream
+     */
+    virtual size_t read(void* data, size_t length) = 0;
+};
+
+/** @class FileSource
+ *  @brief Streams an image file as is.
+ */
+class FileSource : public ImageSource
+{
+  public:
+    FileSource() = delete;
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+    FileSource(FileSource&&) = delete;
+    FileSource& operator=(FileSource&&) = delete;
+
+    /** @brief Opens the file, throws std::system_error on failure */
+    explicit FileSource(const fs::path& path);
+
+    ~FileSource() override;
+
+    uint64_t size() const override
+    {
+        return fileSize;
+    }
+
+    size_t read(void* data, size_t length) override;
+
+  private:
+    int fd = -1;
+    uint64_t fileSize = 0;
+};
+
+/** @class ZstdSource
+ *  @brief Streams a zstd compressed image file decompressed, like
+ *         zstd -d -c does.
+ *  @details The frames of the file are decompressed in parallel, each one
+ *           by one of the decoder threads, and read back in order. An image
+ *           compressed into several frames, e.g. by pzstd, decompresses on
+ *           all the threads. A single frame decompresses on one thread
+ *           while the data before it is written. Only a few chunks of each
+ *           frame being decompressed are held in memory.
+ */
+class ZstdSource : public ImageSource
+{
+  public:
+    ZstdSource() = delete;
+    ZstdSource(const ZstdSource&) = delete;
+    ZstdSource& operator=(const ZstdSource&) = delete;
+    ZstdSource(ZstdSource&&) = delete;
+    ZstdSource& operator=(ZstdSource&&) = delete;
+
+    /** @brief Opens the file and starts decompressing it. Throws
+     *         std::system_error if it cannot be read and
+     *         std::runtime_error if it is not a valid zstd file.
+     *
+     *  @param[in] path - The compressed file
+     *  @param[in] threads - The number of decoder threads, 0 for one per
+     *                       CPU
+     */
+    explicit ZstdSource(const fs::path& path, unsigned threads = 0);
+
+    /** @brief Stops the decoder threads */
+    ~ZstdSource() override;
+
+    /** @brief The size of the decompressed image */
+    uint64_t size() const override
+    {
+        return contentSize;
+    }
+
+    /** @brief Read the next chunk of decompressed data. Throws
+     *         std::runtime_error if the data is corrupted. */
+    size_t read(void* data, size_t length) override;
+
+    /** @brief Whether a file starts with a zstd frame */
+    static bool isCompressed(const fs::path& path);
+
+  private:
+    /** @brief A frame of the file and the data decompressed from it */
+    struct Frame
+    {
+        const uint8_t* data;
+        size_t size;
+        std::deque<std::vector<uint8_t>> chunks;
+        bool finished = false;
+        std::exception_ptr error;
+    };
+
+    /** @brief Decompress the frames not taken by another thread yet */
+    void decode();
+
+    /** @brief Queue a decompressed chunk of a frame, waits while the frame
+     *         has enough chunks queued */
+    void push(Frame& frame, std::vector<uint8_t>&& chunk);
+
+    /** @brief Take the next chunk in the order of the frames
+     *
+     *  @return false at the end of the image
+     */
+    bool nextChunk();
+
+    /** @brief Stop and join the decoder threads, unmap the file */
+    void close();
+
+    int fd = -1;
+    void* map = nullptr;
+    size_t mapSize = 0;
+    uint64_t contentSize = 0;
+    std::vector<Frame> frames;
+
+    /** @brief The chunk being read and the position in it */
+    std::vector<uint8_t> chunk;
+    size_t chunkPos = 0;
+
+    /** @brief The frame read from */
+    size_t current = 0;
+
+    /** @brief Guards the frames and the state below, shared with the
+     *         decoders */
+    std::mutex lock;
+    std::condition_variable produced;
+    std::condition_variable consumed;
+    size_t nextFrame = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> decoders;
+};
+
+/** @class DigestSource
+ *  @brief Passes another stream through and computes the SHA-256 digest of
+ *         its data, e.g. to check the data programmed when it is read back.
+ */
+class DigestSource : public ImageSource
+{
+  public:
+    DigestSource() = delete;
+    DigestSource(const DigestSource&) = delete;
+    DigestSource& operator=(const DigestSource&) = delete;
+    DigestSource(DigestSource&&) = delete;
+    DigestSource& operator=(DigestSource&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] source - The stream to pass through, which must outlive
+     *                      this object
+     */
+    explicit DigestSource(ImageSource& source);
+
+    uint64_t size() const override
+    {
+        return source.size();
+    }
+
+    size_t read(void* data, size_t length) override;
+
+    /** @brief The digest of the data read so far */
+    std::array<uint8_t, 32> digest() const;
+
+  private:
+    ImageSource& source;
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+        nullptr, EVP_MD_CTX_free};
+};
+
+/** @class DeltaSource
+ *  @brief Streams an image rebuilt from a block delta against a base image,
+ *         e.g. the same image of the running version.
+ *  @details The delta file starts with a header holding the size and the
+ *           SHA-256 digest of the image. Commands follow, each either
+ *           copying a range of the base or carrying literal data, until the
+ *           whole image is produced. All the fields are little-endian.
+ *
+ *           The digest of the rebuilt image is checked as the last chunk is
+ *           read. Since the delta file is signed, this verifies the image
+ *           like its signature would. read() throws std::runtime_error on a
+ *           mismatch or a malformed delta, so the image is discarded like
+ *           after any failed write.
+ */
+class DeltaSource : public ImageSource
+{
+  public:
+    /** @brief Reads a range of the base image, throws on failure */
+    using BaseReader =
+        std::function<void(uint64_t offset, void* data, size_t length)>;
+
+    DeltaSource() = delete;
+    DeltaSource(const DeltaSource&) = delete;
+    DeltaSource& operator=(const DeltaSource&) = delete;
+    DeltaSource(DeltaSource&&) = delete;
+    DeltaSource& operator=(DeltaSource&&) = delete;
+
+    /** @brief Opens the delta and reads its header. Throws
+     *         std::system_error if it cannot be read and std::runtime_error
+     *         if it is not a delta.
+     *
+     *  @param[in] path - The delta file
+     *  @param[in] base - Reads the base image
+     *  @param[in] baseSize - The size of the base image
+     */
+    DeltaSource(const fs::path& path, BaseReader base, uint64_t baseSize);
+
+    uint64_t size() const override
+    {
+        return imageSize;
+    }
+
+    size_t read(void* data, size_t length) override;
+
+    /** @brief Whether a file starts like a delta */
+    static bool isDelta(const fs::path& path);
+
+    /** @brief The magic the delta files start with */
+    static constexpr std::array<char, 8> magic = {'O', 'B', 'M', 'C',
+                                                  'D', 'L', 'T', '1'};
+
+    /** @brief The types of the commands */
+    static constexpr uint32_t copyCommand = 1;
+    static constexpr uint32_t dataCommand = 2;
+
+  private:
+    /** @brief Read exactly length bytes of the delta */
+    void readDelta(void* data, size_t length);
+
+    /** @brief Read the next command and check it */
+    void nextCommand();
+
+    FileSource delta;
+    BaseReader base;
+    uint64_t baseSize;
+    uint64_t imageSize = 0;
+    std::array<uint8_t, 32> digest{};
+
+    /** @brief The current command, the base offset it copies from and
+     *         the bytes it still produces */
+    uint32_t command = 0;
+    uint64_t offset = 0;
+    uint64_t remaining = 0;
+
+    /** @brief The bytes produced so far */
+    uint64_t produced = 0;
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+        nullptr, EVP_MD_CTX_free};
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
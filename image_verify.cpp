@@ -405,10 +405,9 @@ bool Signature::checkAndVerifyImage(const std::string& filePath,
     fileFound = false;
     for (auto& bmcImage : imageList)
     {
-        fs::path file(filePath);
-        file /= bmcImage;
-
-        if (!fs::exists(file))
+        // A delta is signed like the image it stands for.
+        fs::path file(imageFile(filePath, bmcImage));
+        if (file.empty())
         {
             valid = false;
             break;
@@ -145,6 +145,18 @@ class Signature
      */
     bool verify();
 
+    /**
+     * @brief Verify the file signature using public key and hash function
+     *
+     * @param[in]  - Image file path
+     * @param[in]  - Signature file path
+     * @param[in]  - Public key
+     * @param[in]  - Hash function name
+     * @return true if signature verification was successful, false if not
+     */
+    bool verifyFile(const fs::path& file, const fs::path& signature,
+                    const fs::path& publicKey, const std::string& hashFunc);
+
   private:
     /**
      * @brief Function used for system level file signature validation
@@ -172,18 +184,6 @@ class Signature
      */
     inline KeyHashPathPair getKeyHashFileNames(const Key_t& key) const;
 
-    /**
-     * @brief Verify the file signature using public key and hash function
-     *
-     * @param[in]  - Image file path
-     * @param[in]  - Signature file path
-     * @param[in]  - Public key
-     * @param[in]  - Hash function name
-     * @return true if signature verification was successful, false if not
-     */
-    bool verifyFile(const fs::path& file, const fs::path& signature,
-                    const fs::path& publicKey, const std::string& hashFunc);
-
     /**
      * @brief Create RSA object from the public key
      * @param[in]  - publickey
@@ -2,6 +2,7 @@
 
 #include "images.hpp"
 
+#include <filesystem>
 #include <iterator>
 #include <sstream>
 #include <string>
@@ -23,6 +24,22 @@ std::vector<std::string> getOptionalImages()
     return optionalImages;
 }
 
+std::string imageFile(const std::string& dir, const std::string& image)
+{
+    auto file = std::filesystem::path(dir) / image;
+    if (std::filesystem::exists(file))
+    {
+        return file;
+    }
+    file += deltaSuffix;
+    return std::filesystem::exists(file) ? file.string() : std::string{};
+}
+
+std::string planFile(const std::string& dir, const std::string& image)
+{
+    return std::filesystem::path(dir) / ("." + image + ".plan");
+}
+
 } // namespace image
 } // namespace software
 } // namespace phosphor
@@ -16,8 +16,26 @@ const std::vector<std::string> bmcImages = {"image-kernel", "image-rofs",
 // BMC flash image file name list for full flash image (image-bmc)
 const std::string bmcFullImages = {"image-bmc"};
 
+// Suffix of an image shipped as a delta against the same image of the
+// version named by DeltaSource in the MANIFEST.
+const std::string deltaSuffix = ".delta";
+
+// The staged images planned against the flash. The others go into
+// partitions written at runtime, so the flasher writes them whole.
+const std::vector<std::string> plannedImages = {"image-kernel", "image-rofs",
+                                                "image-u-boot"};
+
 std::vector<std::string> getOptionalImages();
 
+/** @brief The file an image is shipped as in a directory, the image itself
+ *         or its delta, or an empty path if there is neither */
+std::string imageFile(const std::string& dir, const std::string& image);
+
+/** @brief The write plan of an image staged in a directory for the shutdown
+ *         flasher, see WritePlan. Hidden, so that the flasher does not take
+ *         it for an image. */
+std::string planFile(const std::string& dir, const std::string& image);
+
 } // namespace image
 } // namespace software
 } // namespace phosphor
@@ -0,0 +1,231 @@
+#include "inventory_snapshot.hpp"
+
+#include "crc32.hpp"
+#include "persistent_state.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+constexpr char magic[] = {'O', 'B', 'V', 'I'};
+constexpr uint8_t formatVersion = 1;
+
+/** @brief 64-bit FNV-1a */
+class Hash
+{
+  public:
+    void add(const void* data, size_t length)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < length; i++)
+        {
+            value = (value ^ bytes[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    template <typename T>
+    void add(const T& field)
+    {
+        add(&field, sizeof(field));
+    }
+
+    void add(const std::string& s)
+    {
+        add(s.data(), s.size() + 1);
+    }
+
+    uint64_t value = 0xcbf29ce484222325ULL;
+};
+
+void hashStat(Hash& hash, const fs::path& path)
+{
+    struct stat st
+    {};
+    if (stat(path.c_str(), &st) < 0)
+    {
+        hash.add(uint8_t{0});
+        return;
+    }
+    hash.add(uint64_t(st.st_dev));
+    hash.add(uint64_t(st.st_ino));
+    hash.add(uint64_t(st.st_size));
+    hash.add(int64_t(st.st_mtim.tv_sec));
+    hash.add(int64_t(st.st_mtim.tv_nsec));
+}
+
+void putString(std::string& data, const std::string& s)
+{
+    if (s.size() > UINT16_MAX)
+    {
+        throw std::length_error("Snapshot field too long");
+    }
+    uint16_t length = s.size();
+    data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    data += s;
+}
+
+/** @brief Reads the fields of a snapshot, in order */
+class Reader
+{
+  public:
+    Reader(const std::string& data, size_t pos, size_t end) :
+        data(data), pos(pos), end(end)
+    {}
+
+    template <typename T>
+    bool get(T& value)
+    {
+        if (end - pos < sizeof(value))
+        {
+            return false;
+        }
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool get(std::string& s)
+    {
+        uint16_t length;
+        if (!get(length) || end - pos < length)
+        {
+            return false;
+        }
+        s.assign(data, pos, length);
+        pos += length;
+        return true;
+    }
+
+    bool done() const
+    {
+        return pos == end;
+    }
+
+  private:
+    const std::string& data;
+    size_t pos;
+    size_t end;
+};
+
+} // namespace
+
+std::optional<InventorySnapshot> InventorySnapshot::load(const fs::path& path)
+{
+    std::string data;
+    try
+    {
+        if (!readFile(path, data))
+        {
+            return std::nullopt;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        return std::nullopt;
+    }
+
+    constexpr size_t header = sizeof(magic) + 1;
+    uint32_t crc;
+    if (data.size() < header + sizeof(crc) ||
+        data.compare(0, sizeof(magic), magic, sizeof(magic)) != 0 ||
+        static_cast<uint8_t>(data[sizeof(magic)]) != formatVersion)
+    {
+        return std::nullopt;
+    }
+    auto end = data.size() - sizeof(crc);
+    std::memcpy(&crc, data.data() + end, sizeof(crc));
+    if (crc != utils::crc32(data.data(), end))
+    {
+        return std::nullopt;
+    }
+
+    InventorySnapshot snapshot;
+    Reader reader(data, header, end);
+    uint16_t count;
+    if (!reader.get(snapshot.generation) ||
+        !reader.get(snapshot.bmcInventoryPath) || !reader.get(count))
+    {
+        return std::nullopt;
+    }
+    snapshot.versions.resize(count);
+    for (auto& version : snapshot.versions)
+    {
+        if (!reader.get(version.versionId) || !reader.get(version.version) ||
+            !reader.get(version.extendedVersion) ||
+            !reader.get(version.mountPath))
+        {
+            return std::nullopt;
+        }
+    }
+    if (!reader.done())
+    {
+        return std::nullopt;
+    }
+    return snapshot;
+}
+
+void InventorySnapshot::save(const fs::path& path) const
+{
+    if (versions.size() > UINT16_MAX)
+    {
+        throw std::length_error("Too many versions in snapshot");
+    }
+
+    std::string data(magic, sizeof(magic));
+    data.push_back(formatVersion);
+    data.append(reinterpret_cast<const char*>(&generation),
+                sizeof(generation));
+    putString(data, bmcInventoryPath);
+    uint16_t count = versions.size();
+    data.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& version : versions)
+    {
+        putString(data, version.versionId);
+        putString(data, version.version);
+        putString(data, version.extendedVersion);
+        putString(data, version.mountPath);
+    }
+    uint32_t crc = utils::crc32(data.data(), data.size());
+    data.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+
+    writeFileAtomic(path, data);
+}
+
+uint64_t mediaGeneration(const fs::path& mediaDir, const std::string& prefix,
+                         const fs::path& osRelease)
+{
+    std::vector<fs::path> mounts;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(mediaDir, ec))
+    {
+        if (entry.path().native().compare(0, prefix.size(), prefix) == 0)
+        {
+            mounts.push_back(entry.path());
+        }
+    }
+    std::sort(mounts.begin(), mounts.end());
+
+    Hash hash;
+    hashStat(hash, osRelease);
+    for (const auto& mount : mounts)
+    {
+        hash.add(mount.native());
+        hashStat(hash, mount / osRelease.relative_path());
+    }
+    return hash.value;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
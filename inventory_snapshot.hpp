@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace fs = std::filesystem;
+
+/** @struct SnapshotVersion
+ *  @brief A BMC version found under MEDIA_DIR.
+ */
+struct SnapshotVersion
+{
+    std::string versionId;
+    std::string version;
+    std::string extendedVersion;
+
+    /** @brief The directory the version is mounted on */
+    std::string mountPath;
+};
+
+/** @struct InventorySnapshot
+ *  @brief The BMC versions found the last time the mounted versions were
+ *         scanned, so that they can be published at startup without
+ *         reading each os-release again.
+ *  @details The snapshot is only valid for the mounts it was taken from,
+ *           see mediaGeneration(). The priority and purpose of the versions
+ *           are not part of it, they are kept by PersistentState.
+ */
+struct InventorySnapshot
+{
+    /** @brief mediaGeneration() when the snapshot was taken */
+    uint64_t generation = 0;
+
+    /** @brief The path of the BMC inventory item */
+    std::string bmcInventoryPath;
+
+    std::vector<SnapshotVersion> versions;
+
+    /** @brief Read a snapshot
+     *
+     *  @param[in] path - The snapshot file
+     *
+     *  @return The snapshot, or std::nullopt if the file is missing or not a
+     *          valid snapshot
+     */
+    static std::optional<InventorySnapshot> load(const fs::path& path);
+
+    /** @brief Write the snapshot atomically, throws std::system_error */
+    void save(const fs::path& path) const;
+};
+
+/** @brief A value that changes whenever a version is mounted or unmounted
+ *         under the media directory, or the os-release of one of the mounted
+ *         versions or of the running BMC changes. Only the directory and
+ *         the os-release files are stat'ed, nothing is read.
+ *
+ *  @param[in] mediaDir - The directory the versions are mounted under
+ *  @param[in] prefix - The path prefix of the version mounts
+ *  @param[in] osRelease - The os-release file, relative to each mount
+ */
+uint64_t mediaGeneration(const fs::path& mediaDir, const std::string& prefix,
+                         const fs::path& osRelease);
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
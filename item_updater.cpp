@@ -2,8 +2,12 @@
 
 #include "item_updater.hpp"
 
+#include "async_call.hpp"
+#include "deferred_signals.hpp"
 #include "images.hpp"
+#include "inventory_snapshot.hpp"
 #include "serialize.hpp"
+#include "uboot_env.hpp"
 #include "version.hpp"
 #include "xyz/openbmc_project/Software/ExtendedVersion/server.hpp"
 #include "xyz/openbmc_project/Software/Version/server.hpp"
@@ -14,11 +18,14 @@
 #include <xyz/openbmc_project/Common/error.hpp>
 #include <xyz/openbmc_project/Software/Image/error.hpp>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <optional>
 #include <queue>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace phosphor
 {
@@ -30,28 +37,29 @@ namespace updater
 // When you see server:: you know we're referencing our base class
 namespace server = sdbusplus::xyz::openbmc_project::Software::server;
 namespace control = sdbusplus::xyz::openbmc_project::Control::server;
+using AssociationsServer =
+    sdbusplus::xyz::openbmc_project::Association::server::Definitions;
 
 using namespace phosphor::logging;
 using namespace sdbusplus::xyz::openbmc_project::Software::Image::Error;
 using namespace phosphor::software::image;
 namespace fs = std::filesystem;
+
+/** @brief The inventory snapshot file in PERSIST_DIR */
+constexpr auto snapshotFileName = "inventory";
 using NotAllowed = sdbusplus::xyz::openbmc_project::Common::Error::NotAllowed;
 
-void ItemUpdater::createActivation(sdbusplus::message::message& msg)
+void ItemUpdater::createActivation(const std::string& path,
+                                   const SignalRouter::Interfaces& interfaces)
 {
 
     using SVersion = server::Version;
     using VersionPurpose = SVersion::VersionPurpose;
     using VersionClass = phosphor::software::manager::Version;
 
-    sdbusplus::message::object_path objPath;
     auto purpose = VersionPurpose::Unknown;
     std::string extendedVersion;
     std::string version;
-    std::map<std::string, std::map<std::string, std::variant<std::string>>>
-        interfaces;
-    msg.read(objPath, interfaces);
-    std::string path(std::move(objPath));
     std::string filePath;
 
     for (const auto& intf : interfaces)
@@ -179,7 +187,6 @@ void ItemUpdater::processBMCImage()
     // BMC Software Versions.
     for (const auto& iter : fs::directory_iterator(MEDIA_DIR))
     {
-        auto activationState = server::Activation::Activations::Active;
         static const auto BMC_RO_PREFIX_LEN = strlen(BMC_ROFS_PREFIX);
 
         // Check if the BMC_RO_PREFIXis the prefix of the iter.path
@@ -230,79 +237,13 @@ void ItemUpdater::processBMCImage()
                 continue;
             }
 
-            auto purpose = server::Version::VersionPurpose::BMC;
-            restorePurpose(id, purpose);
-
             // Read os-release from /etc/ to get the BMC extended version
             std::string extendedVersion =
                 VersionClass::getBMCExtendedVersion(osRelease);
 
-            auto path = fs::path(SOFTWARE_OBJPATH) / id;
-
-            // Create functional association if this is the functional
-            // version
-            if (version.compare(functionalVersion) == 0)
-            {
-                createFunctionalAssociation(path);
-            }
-
-            AssociationList associations = {};
-
-            if (activationState == server::Activation::Activations::Active)
-            {
-                // Create an association to the BMC inventory item
-                associations.emplace_back(std::make_tuple(
-                    ACTIVATION_FWD_ASSOCIATION, ACTIVATION_REV_ASSOCIATION,
-                    bmcInventoryPath));
-
-                // Create an active association since this image is active
-                createActiveAssociation(path);
-            }
-
-            // All updateable firmware components must expose the updateable
-            // association.
-            createUpdateableAssociation(path);
-
-            // Create Version instance for this version.
-            auto versionPtr = std::make_unique<VersionClass>(
-                bus, path, version, purpose, extendedVersion, "",
-                std::bind(&ItemUpdater::erase, this, std::placeholders::_1));
-            auto isVersionFunctional = versionPtr->isFunctional();
-            if (!isVersionFunctional)
-            {
-                versionPtr->deleteObject =
-                    std::make_unique<phosphor::software::manager::Delete>(
-                        bus, path, *versionPtr);
-            }
-            versions.insert(std::make_pair(id, std::move(versionPtr)));
-
-            // Create Activation instance for this version.
-            activations.insert(std::make_pair(
-                id, std::make_unique<Activation>(
-                        bus, path, *this, id, activationState, associations)));
-
-            // If Active, create RedundancyPriority instance for this
-            // version.
-            if (activationState == server::Activation::Activations::Active)
-            {
-                uint8_t priority = std::numeric_limits<uint8_t>::max();
-                if (!restorePriority(id, priority))
-                {
-                    if (isVersionFunctional)
-                    {
-                        priority = 0;
-                    }
-                    else
-                    {
-                        log<level::ERR>("Unable to restore priority from file.",
-                                        entry("VERSIONID=%s", id.c_str()));
-                    }
-                }
-                activations.find(id)->second->redundancyPriority =
-                    std::make_unique<RedundancyPriority>(
-                        bus, path, *(activations.find(id)->second), priority,
-                        false);
-            }
+            createBMCVersion(id, version, extendedVersion,
+                             version.compare(functionalVersion) == 0);
+            mountPaths[id] = iter.path();
         }
     }
 
@@ -334,6 +275,221 @@ void ItemUpdater::processBMCImage()
     return;
 }
 
+void ItemUpdater::createBMCVersion(const std::string& id,
+                                   const std::string& version,
+                                   const std::string& extendedVersion,
+                                   bool functional)
+{
+    auto purpose = server::Version::VersionPurpose::BMC;
+    restorePurpose(id, purpose);
+
+    auto path = fs::path(SOFTWARE_OBJPATH) / id;
+
+    // Create functional association if this is the functional
+    // version
+    if (functional)
+    {
+        createFunctionalAssociation(path);
+    }
+
+    // Create an association to the BMC inventory item, once it is known
+    AssociationList associations = {};
+    if (!bmcInventoryPath.empty())
+    {
+        associations.emplace_back(std::make_tuple(ACTIVATION_FWD_ASSOCIATION,
+                                                  ACTIVATION_REV_ASSOCIATION,
+                                                  bmcInventoryPath));
+    }
+
+    // Create an active association since this image is active
+    createActiveAssociation(path);
+
+    // All updateable firmware components must expose the updateable
+    // association.
+    createUpdateableAssociation(path);
+
+    // Create Version instance for this version.
+    auto versionPtr = std::make_unique<VersionClass>(
+        bus, path, version, purpose, extendedVersion, "",
+        std::bind(&ItemUpdater::erase, this, std::placeholders::_1));
+    if (!functional)
+    {
+        versionPtr->deleteObject =
+            std::make_unique<phosphor::software::manager::Delete>(
+                bus, path, *versionPtr);
+    }
+    versions.insert(std::make_pair(id, std::move(versionPtr)));
+
+    // Create Activation instance for this version.
+    auto activation = std::make_unique<Activation>(
+        bus, path, *this, id, server::Activation::Activations::Active,
+        associations);
+
+    // Create RedundancyPriority instance for this version.
+    uint8_t priority = std::numeric_limits<uint8_t>::max();
+    if (!restorePriority(id, priority))
+    {
+        if (functional)
+        {
+            priority = 0;
+        }
+        else
+        {
+            log<level::ERR>("Unable to restore priority from file.",
+                            entry("VERSIONID=%s", id.c_str()));
+        }
+    }
+    activation->redundancyPriority = std::make_unique<RedundancyPriority>(
+        bus, path, *activation, priority, false);
+    activations.insert(std::make_pair(id, std::move(activation)));
+}
+
+uint64_t ItemUpdater::currentGeneration()
+{
+    return mediaGeneration(MEDIA_DIR, BMC_ROFS_PREFIX, OS_RELEASE_FILE);
+}
+
+bool ItemUpdater::restoreSnapshot()
+{
+    auto snapshot =
+        InventorySnapshot::load(fs::path(PERSIST_DIR) / snapshotFileName);
+    if (!snapshot || snapshot->versions.empty() ||
+        snapshot->generation != currentGeneration())
+    {
+        return false;
+    }
+
+    auto functionalVersion = VersionClass::getBMCVersion(OS_RELEASE_FILE);
+    bmcInventoryPath = snapshot->bmcInventoryPath;
+    for (const auto& version : snapshot->versions)
+    {
+        createBMCVersion(version.versionId, version.version,
+                         version.extendedVersion,
+                         version.version == functionalVersion);
+        mountPaths[version.versionId] = version.mountPath;
+    }
+
+    snapshotGeneration = snapshot->generation;
+    restoredFromSnapshot = true;
+    return true;
+}
+
+void ItemUpdater::saveSnapshot()
+{
+    InventorySnapshot snapshot;
+    snapshot.generation = snapshotGeneration;
+    snapshot.bmcInventoryPath = bmcInventoryPath;
+    for (const auto& [id, mountPath] : mountPaths)
+    {
+        auto it = versions.find(id);
+        if (it != versions.end())
+        {
+            snapshot.versions.push_back({id, it->second->version(),
+                                         it->second->extendedVersion(),
+                                         mountPath});
+        }
+    }
+
+    try
+    {
+        snapshot.save(fs::path(PERSIST_DIR) / snapshotFileName);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to save the inventory snapshot",
+                        entry("ERROR=%s", e.what()));
+    }
+}
+
+void ItemUpdater::reconcile()
+{
+    // Look the inventory item up again, it may have changed since the
+    // snapshot was taken.
+    setBMCInventoryPath();
+
+    if (restoredFromSnapshot)
+    {
+        restoredFromSnapshot = false;
+
+        auto generation = currentGeneration();
+        if (generation != snapshotGeneration)
+        {
+            // Drop the versions that are no longer mounted, processBMCImage()
+            // adds the new ones and skips the ones already published.
+            std::vector<std::string> unmounted;
+            for (const auto& [id, mountPath] : mountPaths)
+            {
+                if (!fs::exists(mountPath))
+                {
+                    unmounted.push_back(id);
+                }
+            }
+            for (const auto& id : unmounted)
+            {
+                auto it = activations.find(id);
+                if (it != activations.end())
+                {
+                    removeAssociations(it->second->path);
+                    activations.erase(it);
+                }
+                versions.erase(id);
+                mountPaths.erase(id);
+            }
+            processBMCImage();
+
+            snapshotGeneration = generation;
+            saveSnapshot();
+        }
+        else
+        {
+            mirrorUbootToAlt();
+        }
+    }
+
+    logStartupTime("BMC versions ready");
+}
+
+void ItemUpdater::updateInventoryAssociations()
+{
+    for (const auto& [id, activation] : activations)
+    {
+        if (activation->activation() !=
+                server::Activation::Activations::Active &&
+            activation->activation() != server::Activation::Activations::Ready)
+        {
+            continue;
+        }
+
+        auto associations = activation->associations();
+        auto it = std::find_if(
+            associations.begin(), associations.end(), [](const auto& a) {
+                return std::get<0>(a) == ACTIVATION_FWD_ASSOCIATION;
+            });
+        if (it == associations.end())
+        {
+            associations.emplace_back(
+                std::make_tuple(ACTIVATION_FWD_ASSOCIATION,
+                                ACTIVATION_REV_ASSOCIATION, bmcInventoryPath));
+        }
+        else
+        {
+            std::get<2>(*it) = bmcInventoryPath;
+        }
+        activation->associations(associations, true);
+        getDeferredSignals().propertyChanged(
+            activation->path, AssociationsServer::interface, "Associations");
+    }
+}
+
+void ItemUpdater::logStartupTime(const char* message)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    log<level::INFO>(message, entry("VERSIONS=%zu", activations.size()),
+                     entry("DURATION_MS=%lld",
+                           static_cast<long long>(elapsed.count())));
+}
+
 void ItemUpdater::erase(std::string entryId)
 {
     // Find entry in versions map
@@ -390,6 +546,7 @@ void ItemUpdater::erase(std::string entryId)
     }
 
     helper.clearEntry(entryId);
+    mountPaths.erase(entryId);
 
     return;
 }
@@ -474,6 +631,8 @@ void ItemUpdater::freePriority(uint8_t value, const std::string& versionId)
     std::set<std::pair<std::string, uint8_t>, cmpPriority> prioritySet(
         priorityMap.begin(), priorityMap.end(), cmpPriorityFunc);
 
+    // Compute the new ordering as a whole before committing any of it.
+    std::map<std::string, uint8_t> changed = {{versionId, value}};
     auto freePriorityValue = value;
     for (auto& element : prioritySet)
     {
@@ -484,9 +643,7 @@ void ItemUpdater::freePriority(uint8_t value, const std::string& versionId)
         if (element.second == freePriorityValue)
         {
             ++freePriorityValue;
-            auto it = activations.find(element.first);
-            it->second->redundancyPriority.get()->sdbusPriority(
-                freePriorityValue);
+            changed[element.first] = freePriorityValue;
         }
     }
 
@@ -495,7 +652,32 @@ void ItemUpdater::freePriority(uint8_t value, const std::string& versionId)
     {
         lowestVersion = versionId;
     }
-    updateUbootEnvVars(lowestVersion);
+
+    // Update the objects without signals, persist the new ordering, commit
+    // it to the boot environment in one write and only then let the
+    // clients know. The caller emits the signal of the requested version.
+    std::vector<RedundancyPriority*> bumped;
+    storePriorities(changed);
+    for (const auto& [id, priority] : changed)
+    {
+        if (id == versionId)
+        {
+            continue;
+        }
+        auto it = activations.find(id);
+        if (it != activations.end() && it->second->redundancyPriority)
+        {
+            it->second->redundancyPriority->reorderPriority(priority);
+            bumped.push_back(it->second->redundancyPriority.get());
+        }
+    }
+
+    helper.setPriorities(changed, lowestVersion);
+
+    for (auto redundancyPriority : bumped)
+    {
+        redundancyPriority->emitPriorityChanged();
+    }
 }
 
 void ItemUpdater::reset()
@@ -517,23 +699,27 @@ bool ItemUpdater::fieldModeEnabled(bool value)
     {
         control::FieldMode::fieldModeEnabled(value);
 
-        auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                          SYSTEMD_INTERFACE, "StartUnit");
-        method.append("obmc-flash-bmc-setenv@fieldmode\\x3dtrue.service",
-                      "replace");
-        bus.call_noreply(method);
+        try
+        {
+            getSystemEnv().set("fieldmode", "true");
+        }
+        catch (const std::exception& e)
+        {
+            log<level::ERR>("Failed to set fieldmode in U-Boot environment",
+                            entry("ERROR=%s", e.what()));
+        }
 
-        method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                     SYSTEMD_INTERFACE, "StopUnit");
+        auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
+                                          SYSTEMD_INTERFACE, "StopUnit");
         method.append("usr-local.mount", "replace");
-        bus.call_noreply(method);
+        utils::callAsync(bus, method, "StopUnit usr-local.mount");
 
         std::vector<std::string> usrLocal = {"usr-local.mount"};
 
         method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
                                      SYSTEMD_INTERFACE, "MaskUnitFiles");
         method.append(usrLocal, false, true);
-        bus.call_noreply(method);
+        utils::callAsync(bus, method, "MaskUnitFiles usr-local.mount");
     }
     else if (!value && control::FieldMode::fieldModeEnabled())
     {
@@ -546,11 +732,18 @@ bool ItemUpdater::fieldModeEnabled(bool value)
 
 void ItemUpdater::restoreFieldModeStatus()
 {
-    std::ifstream input("/dev/mtd/u-boot-env");
-    std::string envVar;
-    std::getline(input, envVar);
+    std::optional<std::string> fieldMode;
+    try
+    {
+        fieldMode = getSystemEnv().get("fieldmode");
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to read U-Boot environment",
+                        entry("ERROR=%s", e.what()));
+    }
 
-    if (envVar.find("fieldmode=true") != std::string::npos)
+    if (fieldMode == "true")
     {
         ItemUpdater::fieldModeEnabled(true);
     }
@@ -567,65 +760,70 @@ void ItemUpdater::setBMCInventoryPath()
     std::vector<std::string> filter = {BMC_INVENTORY_INTERFACE};
     mapperCall.append(filter);
 
-    try
-    {
-        auto response = bus.call(mapperCall);
-
-        using ObjectPaths = std::vector<std::string>;
-        ObjectPaths result;
-        response.read(result);
+    utils::callAsync(
+        bus, mapperCall,
+        [this](sdbusplus::message::message& response,
+               const sd_bus_error* error) {
+            if (error)
+            {
+                log<level::ERR>("Error in mapper GetSubTreePath");
+                return;
+            }
 
-        if (!result.empty())
-        {
-            bmcInventoryPath = result.front();
-        }
-    }
-    catch (const sdbusplus::exception::SdBusError& e)
-    {
-        log<level::ERR>("Error in mapper GetSubTreePath");
-        return;
-    }
+            using ObjectPaths = std::vector<std::string>;
+            ObjectPaths result;
+            response.read(result);
 
-    return;
+            if (!result.empty() && result.front() != bmcInventoryPath)
+            {
+                bmcInventoryPath = result.front();
+                updateInventoryAssociations();
+                saveSnapshot();
+            }
+        });
 }
 
 void ItemUpdater::createActiveAssociation(const std::string& path)
 {
     assocs.emplace_back(
         std::make_tuple(ACTIVE_FWD_ASSOCIATION, ACTIVE_REV_ASSOCIATION, path));
-    associations(assocs);
+    setAssociations();
 }
 
 void ItemUpdater::createFunctionalAssociation(const std::string& path)
 {
     assocs.emplace_back(std::make_tuple(FUNCTIONAL_FWD_ASSOCIATION,
                                         FUNCTIONAL_REV_ASSOCIATION, path));
-    associations(assocs);
+    setAssociations();
 }
 
 void ItemUpdater::createUpdateableAssociation(const std::string& path)
 {
     assocs.emplace_back(std::make_tuple(UPDATEABLE_FWD_ASSOCIATION,
                                         UPDATEABLE_REV_ASSOCIATION, path));
-    associations(assocs);
+    setAssociations();
 }
 
 void ItemUpdater::removeAssociations(const std::string& path)
 {
-    for (auto iter = assocs.begin(); iter != assocs.end();)
+    auto end = std::remove_if(assocs.begin(), assocs.end(),
+                              [&path](const auto& association) {
+                                  return std::get<2>(association) == path;
+                              });
+    if (end != assocs.end())
     {
-        if ((std::get<2>(*iter)).compare(path) == 0)
-        {
-            iter = assocs.erase(iter);
-            associations(assocs);
-        }
-        else
-        {
-            ++iter;
-        }
+        assocs.erase(end, assocs.end());
+        setAssociations();
     }
 }
 
+void ItemUpdater::setAssociations()
+{
+    associations(assocs, true);
+    getDeferredSignals().propertyChanged(
+        objPath, AssociationsServer::interface, "Associations");
+}
+
 bool ItemUpdater::isLowestPriority(uint8_t value)
 {
     for (const auto& intf : activations)
@@ -736,10 +934,9 @@ bool ItemUpdater::checkImage(const std::string& filePath,
 
     for (auto& bmcImage : imageList)
     {
-        fs::path file(filePath);
-        file /= bmcImage;
+        auto file = imageFile(filePath, bmcImage);
         std::ifstream efile(file.c_str());
-        if (efile.good() != 1)
+        if (file.empty() || efile.good() != 1)
         {
             valid = false;
             break;
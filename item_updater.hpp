@@ -2,6 +2,7 @@
 
 #include "activation.hpp"
 #include "item_updater_helper.hpp"
+#include "lookup_cache.hpp"
 #include "version.hpp"
 #include "xyz/openbmc_project/Collection/DeleteAll/server.hpp"
 
@@ -10,6 +11,8 @@
 #include <xyz/openbmc_project/Common/FactoryReset/server.hpp>
 #include <xyz/openbmc_project/Control/FieldMode/server.hpp>
 
+#include <chrono>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -26,7 +29,6 @@ using ItemUpdaterInherit = sdbusplus::server::object::object<
     sdbusplus::xyz::openbmc_project::Association::server::Definitions,
     sdbusplus::xyz::openbmc_project::Collection::server::DeleteAll>;
 
-namespace MatchRules = sdbusplus::bus::match::rules;
 using VersionClass = phosphor::software::manager::Version;
 using AssociationList =
     std::vector<std::tuple<std::string, std::string, std::string>>;
@@ -52,22 +54,37 @@ class ItemUpdater : public ItemUpdaterInherit
      * @param[in] bus    - The D-Bus bus object
      */
     ItemUpdater(sdbusplus::bus::bus& bus, const std::string& path) :
-        ItemUpdaterInherit(bus, path.c_str(), false), bus(bus), helper(bus),
-        versionMatch(bus,
-                     MatchRules::interfacesAdded() +
-                         MatchRules::path("/xyz/openbmc_project/software"),
-                     std::bind(std::mem_fn(&ItemUpdater::createActivation),
-                               this, std::placeholders::_1))
+        ItemUpdaterInherit(bus, path.c_str(), false), signalRouter(bus),
+        lookups(bus, path), bus(bus), objPath(path),
+        helper(bus, signalRouter),
+        versionAdded(signalRouter.onInterfacesAdded(
+            path, std::bind(std::mem_fn(&ItemUpdater::createActivation), this,
+                            std::placeholders::_1, std::placeholders::_2))),
+        startTime(std::chrono::steady_clock::now())
     {
-        setBMCInventoryPath();
-        processBMCImage();
+        if (!restoreSnapshot())
+        {
+            snapshotGeneration = currentGeneration();
+            processBMCImage();
+            saveSnapshot();
+        }
         restoreFieldModeStatus();
 #ifdef HOST_BIOS_UPGRADE
         createBIOSObject();
 #endif
         emit_object_added();
+        logStartupTime(restoredFromSnapshot
+                           ? "Published BMC versions from snapshot"
+                           : "Published BMC versions");
     };
 
+    /** @brief Finish the startup once the bus name is owned: look up the
+     *  BMC inventory item and, when the versions were published from the
+     *  inventory snapshot, pick up the versions mounted or unmounted since
+     *  the snapshot was taken and mirror U-Boot.
+     */
+    void reconcile();
+
     /** @brief Save priority value to persistent storage (flash and optionally
      *  a U-Boot environment variable)
      *
@@ -78,7 +95,10 @@ class ItemUpdater : public ItemUpdaterInherit
     void savePriority(const std::string& versionId, uint8_t value);
 
     /** @brief Sets the given priority free by incrementing
-     *  any existing priority with the same value by 1
+     *  any existing priority with the same value by 1. The new priorities
+     *  of all the versions are persisted, and written to the U-Boot
+     *  environment together with the version to boot, before any
+     *  PropertiesChanged signal is emitted.
      *
      *  @param[in] value - The priority that needs to be set free.
      *  @param[in] versionId - The Id of the version for which we
@@ -92,6 +112,16 @@ class ItemUpdater : public ItemUpdaterInherit
      */
     void processBMCImage();
 
+    /** @brief Create the D-Bus objects of an active BMC version
+     *
+     * @param[in] id - The version id
+     * @param[in] version - The version string
+     * @param[in] extendedVersion - The extended version string
+     * @param[in] functional - Whether this is the running version
+     */
+    void createBMCVersion(const std::string& id, const std::string& version,
+                          const std::string& extendedVersion, bool functional);
+
     /**
      * @brief Erase specified entry D-Bus object
      *        if Action property is not set to Active
@@ -161,6 +191,15 @@ class ItemUpdater : public ItemUpdaterInherit
      */
     void createUpdateableAssociation(const std::string& path);
 
+    /** @brief Dispatches the systemd and software signals to the
+     * activations and versions, declared before them so that it outlives
+     * their registrations */
+    SignalRouter signalRouter;
+
+    /** @brief Cached lookups of the services and properties of the other
+     * daemons */
+    utils::LookupCache lookups;
+
     /** @brief Persistent map of Version D-Bus objects and their
      * version id */
     std::map<std::string, std::unique_ptr<VersionClass>> versions;
@@ -172,9 +211,11 @@ class ItemUpdater : public ItemUpdaterInherit
     /** @brief Callback function for Software.Version match.
      *  @details Creates an Activation D-Bus object.
      *
-     * @param[in]  msg       - Data associated with subscribed signal
+     * @param[in]  path       - The object path of the version
+     * @param[in]  interfaces - The interfaces added to the object
      */
-    void createActivation(sdbusplus::message::message& msg);
+    void createActivation(const std::string& path,
+                          const SignalRouter::Interfaces& interfaces);
 
     /**
      * @brief Validates the presence of SquashFS image in the image dir.
@@ -202,7 +243,8 @@ class ItemUpdater : public ItemUpdaterInherit
     bool fieldModeEnabled(bool value) override;
 
     /** @brief Sets the BMC inventory item path under
-     *  /xyz/openbmc_project/inventory/system/chassis/. */
+     *  /xyz/openbmc_project/inventory/system/chassis/, once the mapper
+     *  replies, and points the activations at it. */
     void setBMCInventoryPath();
 
     /** @brief The path to the BMC inventory item. */
@@ -221,6 +263,9 @@ class ItemUpdater : public ItemUpdaterInherit
     /** @brief Persistent sdbusplus D-Bus bus connection. */
     sdbusplus::bus::bus& bus;
 
+    /** @brief The D-Bus object path of the item updater. */
+    std::string objPath;
+
     /** @brief The helper of image updater. */
     Helper helper;
 
@@ -228,8 +273,44 @@ class ItemUpdater : public ItemUpdaterInherit
      * version id */
     std::map<std::string, std::unique_ptr<Activation>> activations;
 
-    /** @brief sdbusplus signal match for Software.Version */
-    sdbusplus::bus::match_t versionMatch;
+    /** @brief Registration for the Software.Version objects added */
+    SignalRouter::Registration versionAdded;
+
+    /** @brief When the updater started, to log the startup time */
+    std::chrono::steady_clock::time_point startTime;
+
+    /** @brief The mount directory of each active BMC version */
+    std::map<std::string, std::string> mountPaths;
+
+    /** @brief Whether the versions were published from the snapshot and
+     *  still need to be reconciled */
+    bool restoredFromSnapshot = false;
+
+    /** @brief The generation of the mounts the snapshot was taken from */
+    uint64_t snapshotGeneration = 0;
+
+    /** @brief The generation of the mounted BMC versions */
+    uint64_t currentGeneration();
+
+    /** @brief Publish the versions from the inventory snapshot
+     *
+     * @return false if there is no snapshot for the current mounts
+     */
+    bool restoreSnapshot();
+
+    /** @brief Save the inventory snapshot, for snapshotGeneration, which
+     *  is taken before the mounts are scanned */
+    void saveSnapshot();
+
+    /** @brief Point the activations at the current BMC inventory item */
+    void updateInventoryAssociations();
+
+    /** @brief Log the time elapsed since the updater started */
+    void logStartupTime(const char* message);
+
+    /** @brief Set the associations property to assocs, emitting the change
+     *  at the end of the event loop iteration */
+    void setAssociations();
 
     /** @brief This entry's associations */
     AssociationList assocs = {};
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "async_call.hpp"
+#include "flash_job.hpp"
+#include "signal_router.hpp"
+
 #include <sdbusplus/bus.hpp>
 
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
 
 namespace phosphor
@@ -23,8 +31,10 @@ class Helper
     /** @brief Constructor
      *
      *  @param[in] bus - sdbusplus D-Bus bus connection
+     *  @param[in] router - The router of the systemd signals
      */
-    Helper(sdbusplus::bus::bus& bus) : bus(bus)
+    Helper(sdbusplus::bus::bus& bus, SignalRouter& router) :
+        bus(bus), router(router)
     {
         // Empty
     }
@@ -60,12 +70,52 @@ class Helper
      */
     void updateUbootVersionId(const std::string& versionId);
 
+    /** @brief Set the priority variables of several versions and point
+     *         U-Boot at the version to boot, in a single environment update
+     *
+     * @param[in] priorities - The new priority of each version that changed
+     * @param[in] bootVersionId - The version id of the image to boot
+     */
+    void setPriorities(const std::map<std::string, uint8_t>& priorities,
+                       const std::string& bootVersionId);
+
     /** @brief Mirror Uboot to the alt uboot partition */
     void mirrorAlt();
 
   private:
+    /** @brief Start the unit that sets the first queued version as the
+     *         primary one */
+    void startSetPrimary();
+
+    /** @brief Move on to the next queued version once the unit is done
+     *
+     * @param[in] job - The removed job of the unit
+     */
+    void setPrimaryDone(const JobRemoved& job);
+
     /** @brief Persistent sdbusplus D-Bus bus connection. */
     sdbusplus::bus::bus& bus;
+
+    /** @brief The router of the systemd signals */
+    SignalRouter& router;
+
+    /** @brief The versions to set as the primary one, in order, the first
+     *         one is being set */
+    std::deque<std::string> primaryQueue;
+
+    /** @brief The systemd signals and the watch of the unit, while one of
+     *         the queued versions is being set */
+    std::unique_ptr<SignalRouter::Subscription> systemdSubscription;
+    SignalRouter::Registration setPrimaryWatch;
+
+    /** @brief Lets the replies of the calls check the helper still exists */
+    utils::Lifetime lifetime;
+
+    /** @brief The mirroring of u-boot, while it runs */
+    std::unique_ptr<FlashJob> mirrorJob;
+
+    /** @brief The removals of versions, by version id, while they run */
+    std::map<std::string, std::unique_ptr<FlashJob>> removeJobs;
 };
 
 } // namespace updater
@@ -1,14 +1,36 @@
 #include "config.h"
 
+#include "deferred_signals.hpp"
 #include "item_updater.hpp"
 
+#include <systemd/sd-event.h>
+
 #include <sdbusplus/bus.hpp>
 #include <sdbusplus/server/manager.hpp>
 
+namespace
+{
+
+/** @brief Emit the changes made while handling an event in one go */
+int flushDeferredSignals(sd_event_source* /* source */, void* userdata)
+{
+    auto bus = static_cast<sdbusplus::bus::bus*>(userdata);
+    phosphor::software::updater::getDeferredSignals().flush(*bus);
+    return 0;
+}
+
+} // namespace
+
 int main()
 {
     auto bus = sdbusplus::bus::new_default();
 
+    // The event loop also delivers the progress of the images written in
+    // process.
+    sd_event* loop = nullptr;
+    sd_event_default(&loop);
+    bus.attach_event(loop, SD_EVENT_PRIORITY_NORMAL);
+
     // Add sdbusplus ObjectManager.
     sdbusplus::server::manager::manager objManager(bus, SOFTWARE_OBJPATH);
 
@@ -16,10 +38,14 @@ int main()
 
     bus.request_name(BUSNAME_UPDATER);
 
-    while (true)
-    {
-        bus.process_discard();
-        bus.wait();
-    }
+    // The versions may have been published from the inventory snapshot,
+    // finish the startup now that clients can reach them.
+    updater.reconcile();
+
+    // Post sources run after every iteration that dispatched an event.
+    sd_event_add_post(loop, nullptr, flushDeferredSignals, &bus);
+    sd_event_loop(loop);
+
+    sd_event_unref(loop);
     return 0;
 }
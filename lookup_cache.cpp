@@ -0,0 +1,282 @@
+#include "config.h"
+
+#include "lookup_cache.hpp"
+
+#include "utils.hpp"
+
+#include <phosphor-logging/log.hpp>
+
+#include <variant>
+
+namespace utils
+{
+
+using namespace phosphor::logging;
+namespace sdbusRule = sdbusplus::bus::match::rules;
+
+namespace
+{
+
+/** @brief Whether an object path is at or under a root path */
+bool isUnder(const std::string& path, const std::string& root)
+{
+    if (path.compare(0, root.size(), root) != 0)
+    {
+        return false;
+    }
+    return path.size() == root.size() || root == "/" ||
+           path[root.size()] == '/';
+}
+
+/** @brief Erase the entries of a map matching a predicate */
+template <typename Map, typename Predicate>
+void eraseIf(Map& map, Predicate predicate)
+{
+    for (auto it = map.begin(); it != map.end();)
+    {
+        if (predicate(*it))
+        {
+            it = map.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+} // namespace
+
+LookupCache::LookupCache(sdbusplus::bus::bus& bus, const std::string& root) :
+    bus(bus), root(root)
+{}
+
+std::string LookupCache::getService(const std::string& path,
+                                    const std::string& interface)
+{
+    auto key = std::make_pair(path, interface);
+    auto it = services.find(key);
+    if (it != services.end())
+    {
+        return it->second;
+    }
+
+    auto service = utils::getService(bus, path, interface);
+    if (!service.empty() && isCached(path))
+    {
+        watchObjects();
+        watchService(service);
+        services.emplace(std::move(key), service);
+    }
+    return service;
+}
+
+void LookupCache::getServiceAsync(
+    const std::string& path, const std::string& interface,
+    std::function<void(const std::string& service)> handler)
+{
+    auto key = std::make_pair(path, interface);
+    auto it = services.find(key);
+    if (it != services.end())
+    {
+        handler(it->second);
+        return;
+    }
+
+    utils::getServiceAsync(
+        bus, path, interface,
+        [this, alive = lifetime.token(), key = std::move(key),
+         started = generation,
+         handler = std::move(handler)](const std::string& service) {
+            if (!alive.expired() && started == generation &&
+                !service.empty() && isCached(key.first))
+            {
+                watchObjects();
+                watchService(service);
+                services.emplace(key, service);
+            }
+            handler(service);
+        });
+}
+
+std::vector<std::string>
+    LookupCache::getSubTreePaths(const std::string& root,
+                                 const std::string& interface)
+{
+    std::vector<std::string> paths;
+    auto method = bus.new_method_call(MAPPER_BUSNAME, MAPPER_PATH,
+                                      MAPPER_INTERFACE, "GetSubTreePaths");
+    method.append(root);
+    method.append(0); // Depth 0 to search all
+    method.append(std::vector<std::string>({interface}));
+    auto reply = bus.call(method);
+    reply.read(paths);
+    return paths;
+}
+
+void LookupCache::getPropertyAsync(
+    const std::string& path, const std::string& interface,
+    const std::string& property,
+    std::function<void(bool found, const std::string& value)> handler)
+{
+    auto key = std::make_tuple(path, interface, property);
+    auto it = properties.find(key);
+    if (it != properties.end())
+    {
+        handler(true, it->second.value);
+        return;
+    }
+
+    // Listen before reading, so that a change made while the value is on
+    // its way invalidates it.
+    if (isCached(path))
+    {
+        watchProperties(path);
+    }
+
+    auto started = generation;
+    auto alive = lifetime.token();
+    getServiceAsync(
+        path, interface,
+        [this, alive, started, key = std::move(key),
+         handler = std::move(handler)](const std::string& service) {
+            if (service.empty() || alive.expired())
+            {
+                handler(false, {});
+                return;
+            }
+
+            const auto& [path, interface, property] = key;
+            auto method =
+                bus.new_method_call(service.c_str(), path.c_str(),
+                                    "org.freedesktop.DBus.Properties", "Get");
+            method.append(interface, property);
+            callAsync(
+                bus, method,
+                [this, alive, started, key, service,
+                 handler](sdbusplus::message::message& reply,
+                          const sd_bus_error* error) {
+                    if (error)
+                    {
+                        log<level::ERR>("Error in getting property",
+                                        entry("PATH=%s",
+                                              std::get<0>(key).c_str()),
+                                        entry("PROPERTY=%s",
+                                              std::get<2>(key).c_str()),
+                                        entry("ERROR=%s", error->name));
+                        handler(false, {});
+                        return;
+                    }
+
+                    std::variant<std::string> value;
+                    reply.read(value);
+                    const auto& text = std::get<std::string>(value);
+                    if (!alive.expired() && started == generation &&
+                        isCached(std::get<0>(key)))
+                    {
+                        properties.emplace(key, Property{service, text});
+                    }
+                    handler(true, text);
+                });
+        });
+}
+
+void LookupCache::objectChanged(sdbusplus::message::message& msg)
+{
+    sdbusplus::message::object_path objPath;
+    msg.read(objPath);
+    std::string path(std::move(objPath));
+
+    ++generation;
+    eraseIf(services,
+            [&path](const auto& entry) { return entry.first.first == path; });
+    eraseIf(properties, [&path](const auto& entry) {
+        return std::get<0>(entry.first) == path;
+    });
+}
+
+void LookupCache::nameOwnerChanged(const std::string& service)
+{
+    ++generation;
+    eraseIf(services,
+            [&service](const auto& entry) { return entry.second == service; });
+    eraseIf(properties, [&service](const auto& entry) {
+        return entry.second.service == service;
+    });
+}
+
+void LookupCache::propertiesChanged(const std::string& path,
+                                    sdbusplus::message::message& msg)
+{
+    std::string interface;
+    msg.read(interface);
+
+    ++generation;
+    eraseIf(properties, [&path, &interface](const auto& entry) {
+        return std::get<0>(entry.first) == path &&
+               std::get<1>(entry.first) == interface;
+    });
+}
+
+bool LookupCache::isCached(const std::string& path) const
+{
+    return isUnder(path, root);
+}
+
+void LookupCache::watchObjects()
+{
+    if (interfacesAddedMatch)
+    {
+        return;
+    }
+
+    // The signals come from the path of the ObjectManager, which may be
+    // above the root, so match on the path of the object they carry.
+    auto objects = sdbusRule::argNpath(0, root + "/");
+    interfacesAddedMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus, sdbusRule::interfacesAdded() + objects,
+        std::bind(std::mem_fn(&LookupCache::objectChanged), this,
+                  std::placeholders::_1));
+    interfacesRemovedMatch = std::make_unique<sdbusplus::bus::match_t>(
+        bus, sdbusRule::interfacesRemoved() + objects,
+        std::bind(std::mem_fn(&LookupCache::objectChanged), this,
+                  std::placeholders::_1));
+}
+
+void LookupCache::watchService(const std::string& service)
+{
+    if (serviceWatches.count(service))
+    {
+        return;
+    }
+
+    serviceWatches.emplace(
+        service, std::make_unique<sdbusplus::bus::match_t>(
+                     bus,
+                     sdbusRule::nameOwnerChanged() +
+                         sdbusRule::argN(0, service),
+                     [this, service](sdbusplus::message::message&) {
+                         nameOwnerChanged(service);
+                     }));
+}
+
+void LookupCache::watchProperties(const std::string& path)
+{
+    if (propertyWatches.count(path))
+    {
+        return;
+    }
+
+    propertyWatches.emplace(
+        path, std::make_unique<sdbusplus::bus::match_t>(
+                  bus,
+                  sdbusRule::type::signal() +
+                      sdbusRule::member("PropertiesChanged") +
+                      sdbusRule::path(path) +
+                      sdbusRule::interface("org.freedesktop.DBus.Properties"),
+                  [this, path](sdbusplus::message::message& msg) {
+                      propertiesChanged(path, msg);
+                  }));
+}
+
+} // namespace utils
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "async_call.hpp"
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
+#include <sdbusplus/message.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace utils
+{
+
+/** @class LookupCache
+ *  @brief Caches the ObjectMapper lookups and the string properties the
+ *         updaters read from other services, so that repeated lookups do
+ *         not go to the bus.
+ *  @details Only the objects under the root of the cache are cached, and
+ *           the cache is kept coherent by signals matched for them only:
+ *           InterfacesAdded and InterfacesRemoved drop the lookups of the
+ *           object, the NameOwnerChanged of a service that answered a
+ *           lookup drops the lookups it answered, and PropertiesChanged
+ *           drops the properties of the object. Failed lookups are not
+ *           cached. A reply that arrives after an invalidation is passed on
+ *           but not cached.
+ */
+class LookupCache
+{
+  public:
+    LookupCache() = delete;
+    LookupCache(const LookupCache&) = delete;
+    LookupCache& operator=(const LookupCache&) = delete;
+    LookupCache(LookupCache&&) = delete;
+    LookupCache& operator=(LookupCache&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] bus - The bus to look up on
+     *  @param[in] root - The namespace of the objects to cache
+     */
+    LookupCache(sdbusplus::bus::bus& bus, const std::string& root);
+
+    /** @brief Cached getService()
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface the service must implement
+     *
+     *  @return The service, empty if not found
+     */
+    std::string getService(const std::string& path,
+                           const std::string& interface);
+
+    /** @brief Cached getServiceAsync(). The handler is called right away
+     *         on a hit.
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface the service must implement
+     *  @param[in] handler - Called with the service, empty if not found
+     */
+    void getServiceAsync(
+        const std::string& path, const std::string& interface,
+        std::function<void(const std::string& service)> handler);
+
+    /** @brief Mapper GetSubTreePaths, at any depth. Throws SdBusError if
+     *         the mapper call fails.
+     *  @details Not cached: the mapper indexes new objects when it gets to
+     *           their signals, so an answer can lag behind the signals that
+     *           would invalidate it.
+     *
+     *  @param[in] root - The root of the subtree
+     *  @param[in] interface - The interface the objects must implement
+     *
+     *  @return The object paths
+     */
+    std::vector<std::string>
+        getSubTreePaths(const std::string& root, const std::string& interface);
+
+    /** @brief Read a string property of an object, from whichever service
+     *         implements its interface. The handler is called right away
+     *         on a hit.
+     *
+     *  @param[in] path - The object path
+     *  @param[in] interface - The interface of the property
+     *  @param[in] property - The property name
+     *  @param[in] handler - Called with true and the value, or with false
+     *                       if the property could not be read
+     */
+    void getPropertyAsync(
+        const std::string& path, const std::string& interface,
+        const std::string& property,
+        std::function<void(bool found, const std::string& value)> handler);
+
+  private:
+    /** @brief A cached property and the service it was read from */
+    struct Property
+    {
+        std::string service;
+        std::string value;
+    };
+
+    using ObjectKey = std::pair<std::string, std::string>;
+    using PropertyKey = std::tuple<std::string, std::string, std::string>;
+
+    /** @brief Drop the lookups of an object whose interfaces changed */
+    void objectChanged(sdbusplus::message::message& msg);
+
+    /** @brief Drop the lookups answered by a service that changed owner */
+    void nameOwnerChanged(const std::string& service);
+
+    /** @brief Drop the properties of an object that changed them */
+    void propertiesChanged(const std::string& path,
+                           sdbusplus::message::message& msg);
+
+    /** @brief Whether the lookups of an object are cached */
+    bool isCached(const std::string& path) const;
+
+    /** @brief Listen for the objects added and removed under the root */
+    void watchObjects();
+
+    /** @brief Listen for the owner changes of a service */
+    void watchService(const std::string& service);
+
+    /** @brief Listen for the property changes of an object */
+    void watchProperties(const std::string& path);
+
+    sdbusplus::bus::bus& bus;
+
+    /** @brief The namespace of the cached objects */
+    std::string root;
+
+    /** @brief Services by object path and interface */
+    std::map<ObjectKey, std::string> services;
+
+    /** @brief Properties by object path, interface and name */
+    std::map<PropertyKey, Property> properties;
+
+    /** @brief Bumped on every invalidation, so that replies to lookups
+     *  started before it are not cached */
+    uint64_t generation = 0;
+
+    /** @brief The object matches, once something is cached */
+    std::unique_ptr<sdbusplus::bus::match_t> interfacesAddedMatch;
+    std::unique_ptr<sdbusplus::bus::match_t> interfacesRemovedMatch;
+
+    /** @brief NameOwnerChanged matches by service */
+    std::map<std::string, std::unique_ptr<sdbusplus::bus::match_t>>
+        serviceWatches;
+
+    /** @brief PropertiesChanged matches by object path */
+    std::map<std::string, std::unique_ptr<sdbusplus::bus::match_t>>
+        propertyWatches;
+
+    /** @brief Lets the replies check that the cache still exists */
+    Lifetime lifetime;
+};
+
+} // namespace utils
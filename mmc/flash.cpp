@@ -3,6 +3,15 @@
 #include "flash.hpp"
 
 #include "activation.hpp"
+#include "flash_backend.hpp"
+#include "item_updater.hpp"
+#include "mmc_layout.hpp"
+#include "utils.hpp"
+
+#include <phosphor-logging/log.hpp>
+
+#include <filesystem>
+#include <map>
 
 namespace phosphor
 {
@@ -13,69 +22,183 @@ namespace updater
 
 namespace softwareServer = sdbusplus::xyz::openbmc_project::Software::server;
 
-void Activation::flashWrite()
+using namespace phosphor::logging;
+namespace fs = std::filesystem;
+
+namespace
 {
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    auto serviceFile = "obmc-flash-mmc@" + versionId + ".service";
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
-}
 
-void Activation::onStateChanges(sdbusplus::message::message& msg)
+/** @brief The progress of the activation before and after the images are
+ *         written */
+constexpr uint8_t writeStartProgress = 10;
+constexpr uint8_t writeEndProgress = 90;
+
+/** @brief Write the partitions with O_DIRECT */
+#ifdef MMC_DIRECT_IO
+constexpr bool directIo = true;
+#else
+constexpr bool directIo = false;
+#endif
+
+/** @brief Install the host firmware of the version into the hostfw file
+ *         system and mount it as the alternate one, like mmc_update does.
+ *         Runs on the worker.
+ */
+void updateHostFw(const fs::path& imageDir, const std::string& label)
 {
-    uint32_t newStateID{};
-    sdbusplus::message::object_path newStateObjPath;
-    std::string newStateUnit{};
-    std::string newStateResult{};
+    auto image = imageDir / "image-hostfw";
+    if (!fs::exists(image))
+    {
+        return;
+    }
 
-    // Read the msg and populate each variable
-    msg.read(newStateID, newStateObjPath, newStateUnit, newStateResult);
+    // Remove the patches of the previous alternate image.
+    std::error_code ec;
+    for (const auto& patch :
+         fs::directory_iterator("/usr/local/share/hostfw/alternate", ec))
+    {
+        fs::remove_all(patch.path(), ec);
+    }
 
-    auto mmcServiceFile = "obmc-flash-mmc@" + versionId + ".service";
-    auto mmcSetPrimary = "obmc-flash-mmc-setprimary@" + versionId + ".service";
+    auto hostfwDir = mmc::hostFwDir();
+    if (hostfwDir.empty())
+    {
+        return;
+    }
 
-    if (newStateUnit == mmcServiceFile && newStateResult == "done")
+    auto file = hostfwDir / ("hostfw-" + label);
+    fs::copy_file(image, file, fs::copy_options::overwrite_existing);
+    auto alternate = hostfwDir / "alternate";
+    fs::create_directories(alternate);
+    if (utils::execute("/bin/mount", file.c_str(), alternate.c_str(), "-o",
+                       "ro") != 0)
     {
-        roVolumeCreated = true;
-        activationProgress->progress(activationProgress->progress() + 1);
+        throw std::runtime_error("Failed to mount " + file.string());
     }
+}
 
-    if (newStateUnit == mmcSetPrimary && newStateResult == "done")
+} // namespace
+
+void Activation::flashWrite()
+{
+    // Setting the priority starts the unit that makes this version the
+    // primary one.
+    watchUnit("obmc-flash-mmc-setprimary@" + versionId + ".service");
+
+    auto config = mmc::backendConfig(mmc::runningLabel());
+    if (config.runningLabel.empty())
     {
-        ubootEnvVarsUpdated = true;
+        log<level::ERR>("Failed to find the running eMMC side",
+                        entry("VERSIONID=%s", versionId.c_str()));
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+        return;
     }
 
-    if (newStateUnit == mmcServiceFile || newStateUnit == mmcSetPrimary)
+    for (const auto& [id, version] : parent.versions)
     {
-        if (newStateResult == "failed" || newStateResult == "dependency")
+        if (version->isFunctional())
         {
-            Activation::activation(
-                softwareServer::Activation::Activations::Failed);
+            config.runningVersionId = id;
+        }
+    }
+
+    auto imageDir = fs::path(IMG_UPLOAD_DIR) / versionId;
+    std::string label = config.runningLabel == "a" ? "b" : "a";
+    auto verified = std::make_shared<std::map<std::string, uint64_t>>();
+
+    auto work = [imageDir, versionId = versionId, config, label,
+                 verified](const ProgressCallback& progress) {
+        SystemFlashDevices devices(directIo);
+        MmcBackend backend(devices, config);
+        backend.write(imageDir, versionId, progress);
+        for (const auto& image : backend.readback())
+        {
+            log<level::INFO>("Read back the image",
+                             entry("VERSIONID=%s", versionId.c_str()),
+                             entry("IMAGE=%s", image.name.c_str()),
+                             entry("SIZE=%s",
+                                   std::to_string(image.size).c_str()));
+            (*verified)[image.name] = image.size;
         }
-        else if (roVolumeCreated)
+        updateHostFw(imageDir, label);
+        mmc::storeVersionLabel(versionId, label);
+    };
+
+    auto onProgress = [this](uint64_t done, uint64_t total) {
+        if (activationProgress)
+        {
+            activationProgress->bytesWritten(done, total, writeStartProgress,
+                                             writeEndProgress);
+        }
+    };
+
+    auto onDone = [this, verified](std::exception_ptr error) {
+        if (error)
         {
-            if (!ubootEnvVarsUpdated)
+            try
             {
-                activationProgress->progress(90);
-
-                // Set the priority which triggers the service that updates the
-                // environment variables.
-                if (!Activation::redundancyPriority)
-                {
-                    Activation::redundancyPriority =
-                        std::make_unique<RedundancyPriority>(bus, path, *this,
-                                                             0);
-                }
+                std::rethrow_exception(error);
             }
-            else // Environment variables were updated
+            catch (const std::exception& e)
             {
-                Activation::onFlashWriteSuccess();
+                log<level::ERR>("Failed to write the eMMC partitions",
+                                entry("VERSIONID=%s", versionId.c_str()),
+                                entry("ERROR=%s", e.what()));
             }
+            Activation::activation(
+                softwareServer::Activation::Activations::Failed);
+            return;
+        }
+
+        roVolumeCreated = true;
+        activationProgress->progress(writeEndProgress);
+        activationReadback =
+            std::make_unique<ActivationReadback>(bus, path, *verified);
+
+        // Set the priority which triggers the service that updates the
+        // environment variables.
+        if (!Activation::redundancyPriority)
+        {
+            Activation::redundancyPriority =
+                std::make_unique<RedundancyPriority>(bus, path, *this, 0);
         }
+    };
+
+    try
+    {
+        flashJob = std::make_unique<FlashJob>(sd_bus_get_event(bus.get()),
+                                              std::move(work),
+                                              std::move(onProgress),
+                                              std::move(onDone));
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to start writing the eMMC partitions",
+                        entry("ERROR=%s", e.what()));
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+    }
+}
+
+void Activation::onStateChanges(const JobRemoved& job)
+{
+    auto mmcSetPrimary = "obmc-flash-mmc-setprimary@" + versionId + ".service";
+    if (job.unit != mmcSetPrimary)
+    {
+        return;
     }
 
-    return;
+    if (job.result == "done")
+    {
+        ubootEnvVarsUpdated = true;
+        if (roVolumeCreated)
+        {
+            Activation::onFlashWriteSuccess();
+        }
+    }
+    else if (job.result == "failed" || job.result == "dependency")
+    {
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+    }
 }
 
 } // namespace updater
@@ -2,7 +2,15 @@
 
 #include "item_updater_helper.hpp"
 
-#include <thread>
+#include "async_call.hpp"
+#include "flash_backend.hpp"
+#include "mmc_layout.hpp"
+
+#include <sys/mount.h>
+
+#include <phosphor-logging/log.hpp>
+
+#include <filesystem>
 
 namespace phosphor
 {
@@ -11,6 +19,9 @@ namespace software
 namespace updater
 {
 
+using namespace phosphor::logging;
+namespace fs = std::filesystem;
+
 void Helper::setEntry(const std::string& /* entryId */, uint8_t /* value */)
 {
     // Empty
@@ -33,30 +44,145 @@ void Helper::factoryReset()
 
 void Helper::removeVersion(const std::string& versionId)
 {
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    auto serviceFile = "obmc-flash-mmc-remove@" + versionId + ".service";
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
-
-    // Wait a few seconds for the service file to finish, otherwise the BMC may
-    // start the update while the image is still being deleted.
-    constexpr auto removeWait = std::chrono::seconds(3);
-    std::this_thread::sleep_for(removeWait);
+    if (removeJobs.count(versionId))
+    {
+        return;
+    }
+
+    // Like mmc_remove, wipe the side the version was written to, or the
+    // side not running if that is not known. Never the running one.
+    auto running = mmc::runningLabel();
+    if (running.empty())
+    {
+        log<level::ERR>("Failed to find the running eMMC side",
+                        entry("VERSIONID=%s", versionId.c_str()));
+        return;
+    }
+
+    // Discarding whole partitions can take seconds, it runs on a worker.
+    auto label = std::make_shared<std::string>(mmc::versionLabel(versionId));
+    auto work = [running, label](const ProgressCallback&) {
+        SystemFlashDevices devices;
+        MmcBackend backend(devices, mmc::backendConfig(running));
+        if (label->empty())
+        {
+            *label = backend.secondaryLabel();
+        }
+        backend.remove(*label);
+    };
+
+    auto onDone = [this, versionId, label](std::exception_ptr error) {
+        if (error)
+        {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const std::exception& e)
+            {
+                log<level::ERR>("Failed to remove the eMMC partitions",
+                                entry("VERSIONID=%s", versionId.c_str()),
+                                entry("ERROR=%s", e.what()));
+            }
+        }
+
+        // Unmount and remove the host firmware of that side.
+        auto hostfwDir = mmc::hostFwDir();
+        if (!hostfwDir.empty())
+        {
+            auto alternate = hostfwDir / "alternate";
+            umount2(alternate.c_str(), MNT_DETACH);
+            std::error_code ec;
+            fs::remove(hostfwDir / ("hostfw-" + *label), ec);
+        }
+        removeJobs.erase(versionId);
+    };
+
+    try
+    {
+        removeJobs.emplace(versionId, std::make_unique<FlashJob>(
+                                          sd_bus_get_event(bus.get()),
+                                          std::move(work), nullptr,
+                                          std::move(onDone)));
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to start removing the eMMC partitions",
+                        entry("VERSIONID=%s", versionId.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
 }
 
 void Helper::updateUbootVersionId(const std::string& versionId)
 {
+    // The units run one at a time, in the order asked, so that the last
+    // version asked for ends up as the primary one. The BMC must not be
+    // rebooted while one runs, the activations wait for their own unit.
+    primaryQueue.push_back(versionId);
+    if (primaryQueue.size() == 1)
+    {
+        startSetPrimary();
+    }
+}
+
+void Helper::startSetPrimary()
+{
+    auto unit = "obmc-flash-mmc-setprimary@" + primaryQueue.front() +
+                ".service";
+
+    // Subscribe before starting the unit, the calls are handled in order.
+    if (!systemdSubscription)
+    {
+        systemdSubscription =
+            std::make_unique<SignalRouter::Subscription>(router);
+    }
+    setPrimaryWatch = router.onJobRemoved(
+        unit, [this](const JobRemoved& job) { setPrimaryDone(job); });
+
     auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
                                       SYSTEMD_INTERFACE, "StartUnit");
-    auto serviceFile = "obmc-flash-mmc-setprimary@" + versionId + ".service";
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
-
-    // Wait a few seconds for the service file to finish, otherwise the BMC may
-    // be rebooted while pointing to a non-existent version.
-    constexpr auto setPrimaryWait = std::chrono::seconds(3);
-    std::this_thread::sleep_for(setPrimaryWait);
+    method.append(unit, "replace");
+    utils::callAsync(
+        bus, method,
+        [this, alive = lifetime.token(), unit](sdbusplus::message::message&,
+                                                const sd_bus_error* error) {
+            if (!error || alive.expired())
+            {
+                return;
+            }
+            // No job was queued, so no JobRemoved will follow.
+            setPrimaryDone({0, {}, unit, "failed"});
+        });
+}
+
+void Helper::setPrimaryDone(const JobRemoved& job)
+{
+    if (job.result != "done")
+    {
+        log<level::ERR>("Failed to set the primary eMMC side",
+                        entry("UNIT=%s", job.unit.c_str()),
+                        entry("RESULT=%s", job.result.c_str()));
+    }
+
+    primaryQueue.pop_front();
+    if (!primaryQueue.empty())
+    {
+        startSetPrimary();
+        return;
+    }
+
+    // The router lets a handler remove its own registration.
+    setPrimaryWatch = SignalRouter::Registration();
+    systemdSubscription.reset();
+}
+
+void Helper::setPriorities(
+    const std::map<std::string, uint8_t>& /* priorities */,
+    const std::string& bootVersionId)
+{
+    // The eMMC layout boots the side selected by the setprimary service,
+    // the priorities are not stored in the environment.
+    updateUbootVersionId(bootVersionId);
 }
 
 void Helper::mirrorAlt()
@@ -0,0 +1,129 @@
+#include "config.h"
+
+#include "mmc_layout.hpp"
+
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+namespace mmc
+{
+
+namespace
+{
+
+/** @brief A mounted file system, its device and its mount point */
+using Mount = std::pair<std::string, fs::path>;
+
+/** @brief The last entry of /proc/mounts that matches, it hides the
+ *         earlier ones, or empty paths */
+Mount findMount(const std::function<bool(const Mount& mount)>& match)
+{
+    std::ifstream mounts("/proc/mounts");
+    std::string line;
+    Mount found;
+    while (std::getline(mounts, line))
+    {
+        std::istringstream fields(line);
+        std::string device;
+        std::string dir;
+        if (fields >> device >> dir && match({device, dir}))
+        {
+            found = {device, dir};
+        }
+    }
+    return found;
+}
+
+/** @brief Where the side of a version is stored */
+fs::path labelFile(const std::string& versionId)
+{
+    return fs::path(PERSIST_DIR) / versionId / "partlabel";
+}
+
+} // namespace
+
+std::string runningLabel()
+{
+    auto root =
+        findMount([](const Mount& mount) { return mount.second == "/"; });
+    if (root.first.empty())
+    {
+        return {};
+    }
+
+    for (const auto& label : {"a", "b"})
+    {
+        std::error_code ec;
+        auto rofs = fs::canonical(fs::path("/dev/disk/by-partlabel") /
+                                      (std::string("rofs-") + label),
+                                  ec);
+        if (!ec && rofs == root.first)
+        {
+            return label;
+        }
+    }
+    return {};
+}
+
+MmcBackend::Config backendConfig(const std::string& running)
+{
+    MmcBackend::Config config;
+    config.runningLabel = running;
+
+    const std::string clear = MMC_CLEAR;
+    if (clear == "none")
+    {
+        config.clear = MmcBackend::Clear::none;
+    }
+    else if (clear == "zeroout")
+    {
+        config.clear = MmcBackend::Clear::zeroOut;
+    }
+    else if (clear == "secdiscard")
+    {
+        config.clear = MmcBackend::Clear::secureDiscard;
+    }
+    else
+    {
+        config.clear = MmcBackend::Clear::discard;
+    }
+    config.checkpointFile = fs::path(PERSIST_DIR) / WriteCheckpoint::fileName;
+    config.digestFile = fs::path(PERSIST_DIR) / ContentDigests::fileName;
+    return config;
+}
+
+std::string versionLabel(const std::string& versionId)
+{
+    std::string label;
+    std::ifstream(labelFile(versionId)) >> label;
+    return label;
+}
+
+void storeVersionLabel(const std::string& versionId, const std::string& label)
+{
+    auto file = labelFile(versionId);
+    fs::create_directories(file.parent_path());
+    std::ofstream(file) << label << '\n';
+}
+
+fs::path hostFwDir()
+{
+    return findMount([](const Mount& mount) {
+               return mount.second.filename() == "hostfw";
+           })
+        .second;
+}
+
+} // namespace mmc
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "flash_backend.hpp"
+
+#include <filesystem>
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+namespace mmc
+{
+
+namespace fs = std::filesystem;
+
+/** @brief The label of the side the BMC runs from, "a" or "b", from the
+ *         rofs partition mounted on /, like mmc_get_primary_label
+ *
+ *  @return The label, or an empty string if the BMC does not run from
+ *          either side
+ */
+std::string runningLabel();
+
+/** @brief The configuration of the eMMC layout, from the build options
+ *
+ *  @param[in] running - The label of the running side
+ */
+MmcBackend::Config backendConfig(const std::string& running);
+
+/** @brief The side a version was written to, stored where mmc_remove and
+ *         mmc_setprimary look for it
+ *
+ *  @param[in] versionId - The version id
+ *
+ *  @return The label, or an empty string if none is stored
+ */
+std::string versionLabel(const std::string& versionId);
+
+/** @brief Store the side a version was written to */
+void storeVersionLabel(const std::string& versionId, const std::string& label);
+
+/** @brief The mount point of the host firmware file system, or an empty
+ *         path if it is not mounted */
+fs::path hostFwDir();
+
+} // namespace mmc
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,376 @@
+#include "config.h"
+
+#include "persistent_state.hpp"
+
+#include "crc32.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cereal/archives/json.hpp>
+#include <phosphor-logging/log.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+using namespace phosphor::logging;
+
+namespace
+{
+
+constexpr char magic[] = {'O', 'B', 'V', 'S'};
+constexpr uint8_t formatVersion = 1;
+
+constexpr uint8_t hasPriority = 0x01;
+constexpr uint8_t hasPurpose = 0x02;
+
+const std::string priorityName = "priority";
+const std::string purposeName = "purpose";
+
+/** @brief Read a value stored by the previous cereal serialization */
+template <typename T>
+std::optional<T> readLegacy(const fs::path& path, const std::string& name)
+{
+    std::ifstream is(path);
+    if (!is)
+    {
+        return std::nullopt;
+    }
+    try
+    {
+        T value{};
+        cereal::JSONInputArchive iarchive(is);
+        iarchive(cereal::make_nvp(name, value));
+        return value;
+    }
+    catch (const cereal::Exception& e)
+    {
+        log<level::WARNING>("Ignoring invalid persistent data",
+                            entry("PATH=%s", path.c_str()));
+        return std::nullopt;
+    }
+}
+
+void writeAll(int fd, const std::string& data, const fs::path& path)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        auto rc = ::write(fd, data.data() + done, data.size() - done);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "write " + path.string());
+        }
+        done += rc;
+    }
+}
+
+} // namespace
+
+bool readFile(const fs::path& path, std::string& data)
+{
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(),
+                                "open " + path.string());
+    }
+
+    struct stat st
+    {};
+    if (fstat(fd, &st) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "stat " + path.string());
+    }
+    data.resize(st.st_size);
+    auto rc = read(fd, data.data(), data.size());
+    auto error = errno;
+    close(fd);
+    if (rc < 0)
+    {
+        throw std::system_error(error, std::generic_category(),
+                                "read " + path.string());
+    }
+    data.resize(rc);
+    return true;
+}
+
+void writeFileAtomic(const fs::path& path, const std::string& data)
+{
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+
+    auto fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+    if (fd < 0 && errno == ENOENT)
+    {
+        fs::create_directories(path.parent_path());
+        fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    }
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(),
+                                "open " + tmpPath.string());
+    }
+    try
+    {
+        writeAll(fd, data, tmpPath);
+        if (fsync(fd) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(),
+                                    "fsync " + tmpPath.string());
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        unlink(tmpPath.c_str());
+        throw;
+    }
+    close(fd);
+
+    if (rename(tmpPath.c_str(), path.c_str()) < 0)
+    {
+        auto error = errno;
+        unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category(),
+                                "rename " + path.string());
+    }
+
+    // Make the rename itself durable.
+    fd = open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+PersistentState::PersistentState(const fs::path& dir) : dir(dir)
+{
+    // Empty
+}
+
+std::optional<uint8_t> PersistentState::priority(const std::string& versionId)
+{
+    load();
+    auto it = versions.find(versionId);
+    return it == versions.end() ? std::nullopt : it->second.priority;
+}
+
+std::optional<uint8_t> PersistentState::purpose(const std::string& versionId)
+{
+    load();
+    auto it = versions.find(versionId);
+    return it == versions.end() ? std::nullopt : it->second.purpose;
+}
+
+void PersistentState::setPriority(const std::string& versionId,
+                                  uint8_t priority)
+{
+    load();
+    auto& state = versions[versionId];
+    dirty |= state.priority != priority;
+    state.priority = priority;
+}
+
+void PersistentState::setPurpose(const std::string& versionId, uint8_t purpose)
+{
+    load();
+    auto& state = versions[versionId];
+    dirty |= state.purpose != purpose;
+    state.purpose = purpose;
+}
+
+void PersistentState::remove(const std::string& versionId)
+{
+    load();
+    dirty |= versions.erase(versionId) > 0;
+}
+
+void PersistentState::commit()
+{
+    load();
+    if (!dirty)
+    {
+        return;
+    }
+
+    std::string data(magic, sizeof(magic));
+    data.push_back(formatVersion);
+    for (const auto& [versionId, state] : versions)
+    {
+        if (versionId.size() > UINT8_MAX)
+        {
+            throw std::length_error("Version id too long: " + versionId);
+        }
+        data.push_back(static_cast<char>(versionId.size()));
+        data += versionId;
+        data.push_back((state.priority ? hasPriority : 0) |
+                       (state.purpose ? hasPurpose : 0));
+        data.push_back(state.priority.value_or(0));
+        data.push_back(state.purpose.value_or(0));
+    }
+    uint32_t crc = utils::crc32(data.data(), data.size());
+    data.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+
+    writeFileAtomic(dir / fileName, data);
+    dirty = false;
+}
+
+void PersistentState::load()
+{
+    if (loaded)
+    {
+        return;
+    }
+    loaded = true;
+
+    auto path = dir / fileName;
+    std::string data;
+    try
+    {
+        if (!readFile(path, data))
+        {
+            if (migrate())
+            {
+                dirty = true;
+                commit();
+                removeLegacyFiles();
+            }
+            return;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to load persistent state",
+                        entry("PATH=%s", path.c_str()),
+                        entry("ERROR=%s", e.what()));
+        return;
+    }
+
+    if (!parse(data))
+    {
+        log<level::ERR>("Ignoring invalid persistent state",
+                        entry("PATH=%s", path.c_str()));
+        versions.clear();
+    }
+}
+
+bool PersistentState::parse(const std::string& data)
+{
+    constexpr size_t header = sizeof(magic) + 1;
+    uint32_t crc;
+    if (data.size() < header + sizeof(crc) ||
+        data.compare(0, sizeof(magic), magic, sizeof(magic)) != 0 ||
+        static_cast<uint8_t>(data[sizeof(magic)]) != formatVersion)
+    {
+        return false;
+    }
+
+    auto end = data.size() - sizeof(crc);
+    std::memcpy(&crc, data.data() + end, sizeof(crc));
+    if (crc != utils::crc32(data.data(), end))
+    {
+        return false;
+    }
+
+    for (size_t pos = header; pos < end;)
+    {
+        size_t length = static_cast<uint8_t>(data[pos++]);
+        if (pos + length + 3 > end)
+        {
+            return false;
+        }
+        auto& state = versions[data.substr(pos, length)];
+        pos += length;
+
+        uint8_t fields = data[pos++];
+        uint8_t priority = data[pos++];
+        uint8_t purpose = data[pos++];
+        if (fields & hasPriority)
+        {
+            state.priority = priority;
+        }
+        if (fields & hasPurpose)
+        {
+            state.purpose = purpose;
+        }
+    }
+    return true;
+}
+
+bool PersistentState::migrate()
+{
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+    {
+        if (!entry.is_directory(ec))
+        {
+            continue;
+        }
+        auto versionId = entry.path().filename().string();
+
+        auto priority =
+            readLegacy<uint8_t>(entry.path() / priorityName, priorityName);
+        auto purpose = readLegacy<int>(entry.path() / purposeName, purposeName);
+        if (priority || purpose)
+        {
+            auto& state = versions[versionId];
+            state.priority = priority;
+            if (purpose)
+            {
+                state.purpose = static_cast<uint8_t>(*purpose);
+            }
+        }
+    }
+    return !versions.empty();
+}
+
+void PersistentState::removeLegacyFiles()
+{
+    std::error_code ec;
+    for (const auto& [versionId, state] : versions)
+    {
+        auto path = dir / versionId;
+        fs::remove(path / priorityName, ec);
+        fs::remove(path / purposeName, ec);
+        if (fs::is_empty(path, ec))
+        {
+            fs::remove(path, ec);
+        }
+    }
+}
+
+PersistentState& getPersistentState()
+{
+    static PersistentState state(PERSIST_DIR);
+    return state;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace fs = std::filesystem;
+
+/** @struct VersionState
+ *  @brief The persistent state of one version.
+ */
+struct VersionState
+{
+    /** @brief The RedundancyPriority value */
+    std::optional<uint8_t> priority;
+
+    /** @brief The VersionPurpose, as its underlying value */
+    std::optional<uint8_t> purpose;
+
+    bool operator==(const VersionState& other) const
+    {
+        return priority == other.priority && purpose == other.purpose;
+    }
+};
+
+/** @class PersistentState
+ *  @brief The state of all the versions, kept in a single file.
+ *  @details The file is read with a single read the first time the state is
+ *           needed. Changes are made in memory and written by commit(), so
+ *           that a set of changes is written at once: to a temporary file
+ *           that is synced and then renamed over the previous one, so that
+ *           a power loss leaves either the old or the new state.
+ *
+ *           The file holds a magic, a format version, the entries and a
+ *           CRC-32 of all of them. A file that fails the checks is ignored.
+ *
+ *           When there is no state file, the state is migrated from the
+ *           previous layout of one <versionId>/priority and one
+ *           <versionId>/purpose cereal file per version, which are removed
+ *           once the new file is written. Other files in the version
+ *           directories are left alone.
+ *
+ *           Write errors are reported by throwing std::system_error.
+ */
+class PersistentState
+{
+  public:
+    PersistentState() = delete;
+    PersistentState(const PersistentState&) = delete;
+    PersistentState& operator=(const PersistentState&) = delete;
+    PersistentState(PersistentState&&) = delete;
+    PersistentState& operator=(PersistentState&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] dir - The directory holding the state
+     */
+    explicit PersistentState(const fs::path& dir);
+
+    /** @brief The priority of a version, if stored */
+    std::optional<uint8_t> priority(const std::string& versionId);
+
+    /** @brief The purpose of a version, if stored */
+    std::optional<uint8_t> purpose(const std::string& versionId);
+
+    /** @brief Set the priority of a version, written on commit() */
+    void setPriority(const std::string& versionId, uint8_t priority);
+
+    /** @brief Set the purpose of a version, written on commit() */
+    void setPurpose(const std::string& versionId, uint8_t purpose);
+
+    /** @brief Forget a version, written on commit() */
+    void remove(const std::string& versionId);
+
+    /** @brief Write the state if it changed since the last commit */
+    void commit();
+
+    /** @brief Name of the state file in the directory */
+    static constexpr auto fileName = "state";
+
+  private:
+    /** @brief Read the state file, or migrate the previous layout */
+    void load();
+
+    /** @brief Parse the content of the state file
+     *
+     *  @return false if the content is not a valid state
+     */
+    bool parse(const std::string& data);
+
+    /** @brief Read the per version cereal files
+     *
+     *  @return true if any were found
+     */
+    bool migrate();
+
+    /** @brief Remove the per version cereal files */
+    void removeLegacyFiles();
+
+    fs::path dir;
+    std::map<std::string, VersionState> versions;
+    bool loaded = false;
+    bool dirty = false;
+};
+
+/** @brief Read a whole file with a single read
+ *
+ *  @param[in] path - The file to read
+ *  @param[out] data - The content of the file
+ *
+ *  @return false if the file does not exist, throws std::system_error on
+ *          other errors
+ */
+bool readFile(const fs::path& path, std::string& data);
+
+/** @brief Replace a file so that a power loss leaves either the previous or
+ *         the new content: the data is written to a temporary file, synced
+ *         and renamed over the file. Throws std::system_error on errors.
+ *
+ *  @param[in] path - The file to replace, its directory is created if needed
+ *  @param[in] data - The new content
+ */
+void writeFileAtomic(const fs::path& path, const std::string& data);
+
+/** @brief The state of the BMC versions, kept in PERSIST_DIR */
+PersistentState& getPersistentState();
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,75 @@
+#include "progress_meter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+/** @brief The least time between two samples of the throughput */
+constexpr std::chrono::milliseconds sampleTime{250};
+
+/** @brief The weight of a new sample in the average throughput */
+constexpr double sampleWeight = 0.3;
+
+} // namespace
+
+ProgressMeter::ProgressMeter(uint8_t first, uint8_t last,
+                             Clock::duration interval) :
+    first(first),
+    last(last), interval(interval), percent(first)
+{}
+
+bool ProgressMeter::update(uint64_t done, uint64_t total,
+                           Clock::time_point now)
+{
+    if (total == 0)
+    {
+        return false;
+    }
+    done = std::min(done, total);
+    percent = first + done * (last - first) / total;
+    remaining = total - done;
+
+    if (!sampled || done < sampledBytes)
+    {
+        sampled = now;
+        sampledBytes = done;
+    }
+    else if (now - *sampled >= sampleTime)
+    {
+        auto current = (done - sampledBytes) /
+                       std::chrono::duration<double>(now - *sampled).count();
+        rate = rate ? rate + (current - rate) * sampleWeight : current;
+        sampled = now;
+        sampledBytes = done;
+    }
+
+    if (published && now - *published < interval && remaining)
+    {
+        return false;
+    }
+    published = now;
+    return true;
+}
+
+uint64_t ProgressMeter::bytesPerSecond() const
+{
+    return static_cast<uint64_t>(rate);
+}
+
+uint64_t ProgressMeter::secondsRemaining() const
+{
+    return rate >= 1 ? static_cast<uint64_t>(std::ceil(remaining / rate)) : 0;
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @class ProgressMeter
+ *  @brief Turns the bytes an activation wrote into its progress, its
+ *         throughput and the time it has left, and paces how often they
+ *         are published.
+ *  @details The throughput is sampled at most every quarter of a second and
+ *           averaged, weighing the recent samples more, so that the
+ *           estimate follows the chip being written. The values are due for
+ *           publishing once the interval passed since they were last
+ *           published, and when the bytes are all done.
+ */
+class ProgressMeter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /** @brief Constructor
+     *
+     *  @param[in] first - The progress before the first byte
+     *  @param[in] last - The progress once the bytes are all done
+     *  @param[in] interval - The least time between two publications
+     */
+    ProgressMeter(uint8_t first, uint8_t last,
+                  Clock::duration interval = std::chrono::seconds(1));
+
+    /** @brief Account for the bytes done
+     *
+     *  @param[in] done - The bytes done so far
+     *  @param[in] total - The bytes to do
+     *  @param[in] now - The time of the update
+     *
+     *  @return Whether the values are due for publishing
+     */
+    bool update(uint64_t done, uint64_t total,
+                Clock::time_point now = Clock::now());
+
+    /** @brief The progress, from first to last */
+    uint8_t progress() const
+    {
+        return percent;
+    }
+
+    /** @brief The throughput, 0 until it is known */
+    uint64_t bytesPerSecond() const;
+
+    /** @brief The time left, 0 until the throughput is known */
+    uint64_t secondsRemaining() const;
+
+  private:
+    uint8_t first;
+    uint8_t last;
+    Clock::duration interval;
+
+    uint8_t percent;
+    uint64_t remaining = 0;
+
+    /** @brief The last sample of the throughput, in bytes per second */
+    std::optional<Clock::time_point> sampled;
+    uint64_t sampledBytes = 0;
+    double rate = 0;
+
+    std::optional<Clock::time_point> published;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
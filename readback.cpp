@@ -0,0 +1,191 @@
+#include "readback.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+/** @brief The largest read made at once */
+constexpr uint64_t readChunkSize = 1024 * 1024;
+
+} // namespace
+
+ReadbackVerifier::ReadbackVerifier() : reader([this] { run(); })
+{}
+
+ReadbackVerifier::~ReadbackVerifier()
+{
+    stop();
+}
+
+void ReadbackVerifier::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (reader.joinable())
+    {
+        reader.join();
+    }
+}
+
+size_t ReadbackVerifier::add(const std::string& name, Reader reader)
+{
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+        EVP_MD_CTX_new(), EVP_MD_CTX_free};
+    if (!hash || !EVP_DigestInit_ex(hash.get(), EVP_sha256(), nullptr))
+    {
+        throw std::bad_alloc();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto& image = images.emplace_back();
+    image.name = name;
+    image.reader = std::move(reader);
+    image.hash = std::move(hash);
+    return images.size() - 1;
+}
+
+void ReadbackVerifier::committed(size_t id, uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& image = images.at(id);
+        if (bytes <= image.committed)
+        {
+            return;
+        }
+        image.committed = bytes;
+    }
+    changed.notify_all();
+}
+
+void ReadbackVerifier::completed(size_t id, uint64_t size,
+                                 const Digest& digest)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& image = images.at(id);
+        image.committed = size;
+        image.size = size;
+        image.expected = digest;
+        image.complete = true;
+    }
+    changed.notify_all();
+}
+
+std::vector<ReadbackVerifier::Result> ReadbackVerifier::wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] {
+        return error || stopping ||
+               std::all_of(images.begin(), images.end(),
+                           [](const auto& image) {
+                               return image.done || !image.complete;
+                           });
+    });
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    if (stopping)
+    {
+        throw std::runtime_error("Readback stopped");
+    }
+
+    std::vector<Result> results;
+    for (const auto& image : images)
+    {
+        if (image.done)
+        {
+            results.push_back({image.name, image.size});
+        }
+    }
+    return results;
+}
+
+void ReadbackVerifier::run()
+{
+    std::vector<uint8_t> buffer(readChunkSize);
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        // Serve the images in the order they were added, each as far as
+        // it is committed.
+        Image* image = nullptr;
+        changed.wait(guard, [this, &image] {
+            for (auto& next : images)
+            {
+                if (!next.done &&
+                    (next.verified < next.committed ||
+                     (next.complete && next.verified == next.size)))
+                {
+                    image = &next;
+                    break;
+                }
+            }
+            return stopping || error || image;
+        });
+        if (stopping || error)
+        {
+            return;
+        }
+
+        auto offset = image->verified;
+        auto length = std::min(readChunkSize, image->committed - offset);
+        guard.unlock();
+        try
+        {
+            if (length)
+            {
+                image->reader(offset, buffer.data(), length);
+                EVP_DigestUpdate(image->hash.get(), buffer.data(), length);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            guard.lock();
+            error = std::make_exception_ptr(std::runtime_error(
+                "Failed to read back " + image->name + ": " + e.what()));
+            changed.notify_all();
+            return;
+        }
+        guard.lock();
+
+        image->verified += length;
+        if (!image->complete || image->verified != image->size)
+        {
+            continue;
+        }
+
+        std::array<uint8_t, EVP_MAX_MD_SIZE> result{};
+        unsigned int resultSize = 0;
+        EVP_DigestFinal_ex(image->hash.get(), result.data(), &resultSize);
+        image->done = true;
+        if (resultSize != image->expected.size() ||
+            !std::equal(image->expected.begin(), image->expected.end(),
+                        result.begin()))
+        {
+            error = std::make_exception_ptr(std::runtime_error(
+                "Readback of " + image->name +
+                " does not match what was written"));
+        }
+        changed.notify_all();
+    }
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
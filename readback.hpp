@@ -0,0 +1,137 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @class ReadbackVerifier
+ *  @brief Reads back the images programmed into flash and compares the
+ *         SHA-256 digest of what the devices hold with the digest of the
+ *         data written.
+ *  @details The reads run on a thread of their own, behind the writers: a
+ *           writer reports how much of an image is on the device and the
+ *           verifier reads up to there, so that most of the readback
+ *           overlaps the writes. Images that cannot be read while they are
+ *           written, e.g. UBI volumes being updated, are read back once
+ *           complete, while the next ones are written. The methods can be
+ *           called from several writer threads.
+ */
+class ReadbackVerifier
+{
+  public:
+    /** @brief Reads a range of an image back from its device, throws on
+     *         failure */
+    using Reader =
+        std::function<void(uint64_t offset, void* data, size_t length)>;
+
+    using Digest = std::array<uint8_t, 32>;
+
+    /** @brief An image that was read back and matched */
+    struct Result
+    {
+        std::string name;
+        uint64_t size;
+    };
+
+    ReadbackVerifier(const ReadbackVerifier&) = delete;
+    ReadbackVerifier& operator=(const ReadbackVerifier&) = delete;
+    ReadbackVerifier(ReadbackVerifier&&) = delete;
+    ReadbackVerifier& operator=(ReadbackVerifier&&) = delete;
+
+    /** @brief Starts the reader thread */
+    ReadbackVerifier();
+
+    /** @brief Calls stop(). The devices read must outlive this object. */
+    ~ReadbackVerifier();
+
+    /** @brief Start the readback of an image
+     *
+     *  @param[in] name - The name of the image in the results and errors
+     *  @param[in] reader - Reads the image back from its device
+     *
+     *  @return The id of the image for the calls below
+     */
+    size_t add(const std::string& name, Reader reader);
+
+    /** @brief The first bytes of an image are on its device */
+    void committed(size_t id, uint64_t bytes);
+
+    /** @brief The whole image was written
+     *
+     *  @param[in] id - The id of the image
+     *  @param[in] size - The size of the image
+     *  @param[in] digest - The SHA-256 digest of the data written
+     */
+    void completed(size_t id, uint64_t size, const Digest& digest);
+
+    /** @brief Wait for the readback of the completed images. Throws
+     *         std::runtime_error naming the first image that does not
+     *         match, or the error reading it back.
+     *
+     *  @return The images read back
+     */
+    std::vector<Result> wait();
+
+    /** @brief Abandon the pending readbacks and wait for the reader thread,
+     *         e.g. before removing the images of a failed write */
+    void stop();
+
+  private:
+    struct Image
+    {
+        std::string name;
+        Reader reader;
+
+        /** @brief The bytes on the device and those read back so far */
+        uint64_t committed = 0;
+        uint64_t verified = 0;
+
+        /** @brief Set once the writer is done */
+        bool complete = false;
+        uint64_t size = 0;
+        Digest expected{};
+
+        /** @brief Set once read back */
+        bool done = false;
+
+        /** @brief Only used by the reader thread */
+        std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash{
+            nullptr, EVP_MD_CTX_free};
+    };
+
+    /** @brief Read back the images as they are committed */
+    void run();
+
+    /** @brief Guards the state below, shared with the reader thread */
+    std::mutex lock;
+    std::condition_variable changed;
+
+    /** @brief A deque, so the images keep their address */
+    std::deque<Image> images;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    std::thread reader;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -2,12 +2,13 @@
 
 #include "serialize.hpp"
 
-#include <cereal/archives/json.hpp>
+#include "persistent_state.hpp"
+#include "uboot_env.hpp"
+
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/server.hpp>
 
 #include <filesystem>
-#include <fstream>
 
 namespace phosphor
 {
@@ -19,101 +20,63 @@ namespace updater
 using namespace phosphor::logging;
 namespace fs = std::filesystem;
 
-const std::string priorityName = "priority";
-const std::string purposeName = "purpose";
-
 void storePriority(const std::string& versionId, uint8_t priority)
 {
-    auto path = fs::path(PERSIST_DIR) / versionId;
-    if (!fs::is_directory(path))
+    storePriorities({{versionId, priority}});
+}
+
+void storePriorities(const std::map<std::string, uint8_t>& priorities)
+{
+    try
     {
-        if (fs::exists(path))
+        auto& state = getPersistentState();
+        for (const auto& [versionId, priority] : priorities)
         {
-            // Delete if it's a non-directory file
-            log<level::WARNING>("Removing non-directory file",
-                                entry("PATH=%s", path.c_str()));
-            fs::remove_all(path);
+            state.setPriority(versionId, priority);
         }
-        fs::create_directories(path);
+        state.commit();
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to store priorities",
+                        entry("ERROR=%s", e.what()));
     }
-    path = path / priorityName;
-
-    std::ofstream os(path.c_str());
-    cereal::JSONOutputArchive oarchive(os);
-    oarchive(cereal::make_nvp(priorityName, priority));
 }
 
 void storePurpose(const std::string& versionId, VersionPurpose purpose)
 {
-    auto path = fs::path(PERSIST_DIR) / versionId;
-    if (!fs::is_directory(path))
+    try
     {
-        if (fs::exists(path))
-        {
-            // Delete if it's a non-directory file
-            log<level::WARNING>("Removing non-directory file",
-                                entry("PATH=%s", path.c_str()));
-            fs::remove_all(path);
-        }
-        fs::create_directories(path);
+        auto& state = getPersistentState();
+        state.setPurpose(versionId, static_cast<uint8_t>(purpose));
+        state.commit();
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to store purpose",
+                        entry("VERSIONID=%s", versionId.c_str()),
+                        entry("ERROR=%s", e.what()));
     }
-    path = path / purposeName;
-
-    std::ofstream os(path.c_str());
-    cereal::JSONOutputArchive oarchive(os);
-    oarchive(cereal::make_nvp(purposeName, purpose));
 }
 
 bool restorePriority(const std::string& versionId, uint8_t& priority)
 {
-    auto path = fs::path(PERSIST_DIR) / versionId / priorityName;
-    if (fs::exists(path))
+    auto stored = getPersistentState().priority(versionId);
+    if (stored)
     {
-        std::ifstream is(path.c_str(), std::ios::in);
-        try
-        {
-            cereal::JSONInputArchive iarchive(is);
-            iarchive(cereal::make_nvp(priorityName, priority));
-            return true;
-        }
-        catch (cereal::Exception& e)
-        {
-            fs::remove_all(path);
-        }
+        priority = *stored;
+        return true;
     }
 
-    // Find the mtd device "u-boot-env" to retrieve the environment variables
-    std::ifstream mtdDevices("/proc/mtd");
-    std::string device, devicePath;
-
+    // Fall back to the priority kept in the U-Boot environment, as a
+    // "versionId=priority" variable.
     try
     {
-        while (std::getline(mtdDevices, device))
+        auto value = getSystemEnv().get(versionId);
+        if (value)
         {
-            if (device.find("u-boot-env") != std::string::npos)
-            {
-                devicePath = "/dev/" + device.substr(0, device.find(':'));
-                break;
-            }
-        }
-
-        if (!devicePath.empty())
-        {
-            std::ifstream input(devicePath.c_str());
-            std::string envVars;
-            std::getline(input, envVars);
-
-            std::string versionVar = versionId + "=";
-            auto varPosition = envVars.find(versionVar);
-
-            if (varPosition != std::string::npos)
-            {
-                // Grab the environment variable for this versionId. These
-                // variables follow the format "versionId=priority\0"
-                auto var = envVars.substr(varPosition);
-                priority = std::stoi(var.substr(versionVar.length()));
-                return true;
-            }
+            priority = std::stoi(*value);
+            return true;
         }
     }
     catch (const std::exception& e)
@@ -124,20 +87,11 @@ bool restorePriority(const std::string& versionId, uint8_t& priority)
 
 bool restorePurpose(const std::string& versionId, VersionPurpose& purpose)
 {
-    auto path = fs::path(PERSIST_DIR) / versionId / purposeName;
-    if (fs::exists(path))
+    auto stored = getPersistentState().purpose(versionId);
+    if (stored)
     {
-        std::ifstream is(path.c_str(), std::ios::in);
-        try
-        {
-            cereal::JSONInputArchive iarchive(is);
-            iarchive(cereal::make_nvp(purposeName, purpose));
-            return true;
-        }
-        catch (cereal::Exception& e)
-        {
-            fs::remove_all(path);
-        }
+        purpose = static_cast<VersionPurpose>(*stored);
+        return true;
     }
 
     return false;
@@ -145,6 +99,21 @@ bool restorePurpose(const std::string& versionId, VersionPurpose& purpose)
 
 void removePersistDataDirectory(const std::string& versionId)
 {
+    try
+    {
+        auto& state = getPersistentState();
+        state.remove(versionId);
+        state.commit();
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to remove persistent state",
+                        entry("VERSIONID=%s", versionId.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
+
+    // Other data, like the partition label of the eMMC layout, is kept in
+    // a directory per version.
     auto path = fs::path(PERSIST_DIR) / versionId;
     if (fs::exists(path))
     {
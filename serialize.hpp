@@ -4,6 +4,7 @@
 
 #include "version.hpp"
 
+#include <map>
 #include <string>
 
 namespace phosphor
@@ -22,6 +23,12 @@ using VersionPurpose =
  **/
 void storePriority(const std::string& versionId, uint8_t priority);
 
+/** @brief Serialization function - stores the priorities of several
+ *         versions to file in a single write
+ *  @param[in] priorities - RedundancyPriority value of each version.
+ **/
+void storePriorities(const std::map<std::string, uint8_t>& priorities);
+
 /** @brief Serialization function - stores purpose information to file
  *  @param[in] versionId - The version for which to store information.
  *  @param[in] purpose - VersionPurpose value for that version.
@@ -42,7 +49,8 @@ bool restorePriority(const std::string& versionId, uint8_t& priority);
  **/
 bool restorePurpose(const std::string& versionId, VersionPurpose& purpose);
 
-/** @brief Removes the serial directory for a given version.
+/** @brief Removes the stored information and the serial directory for a
+ *         given version.
  *  @param[in] versionId - The version for which to remove a file, if it exists.
  **/
 void removePersistDataDirectory(const std::string& versionId);
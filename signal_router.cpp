@@ -0,0 +1,178 @@
+#include "config.h"
+
+#include "signal_router.hpp"
+
+#include "async_call.hpp"
+
+#include <phosphor-logging/log.hpp>
+
+#include <utility>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+using namespace phosphor::logging;
+namespace sdbusRule = sdbusplus::bus::match::rules;
+
+SignalRouter::Registration::Registration(std::function<void()> remove) :
+    remove(std::move(remove))
+{}
+
+SignalRouter::Registration::Registration(Registration&& other) noexcept :
+    remove(std::move(other.remove))
+{
+    other.remove = nullptr;
+}
+
+SignalRouter::Registration&
+    SignalRouter::Registration::operator=(Registration&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (remove)
+        {
+            remove();
+        }
+        remove = std::move(other.remove);
+        other.remove = nullptr;
+    }
+    return *this;
+}
+
+SignalRouter::Registration::~Registration()
+{
+    if (remove)
+    {
+        remove();
+    }
+}
+
+SignalRouter::Subscription::Subscription(SignalRouter& router) : router(router)
+{
+    router.subscribe();
+}
+
+SignalRouter::Subscription::~Subscription()
+{
+    router.unsubscribe();
+}
+
+SignalRouter::SignalRouter(sdbusplus::bus::bus& bus) :
+    bus(bus),
+    jobRemovedMatch(
+        bus,
+        sdbusRule::type::signal() + sdbusRule::member("JobRemoved") +
+            sdbusRule::sender(SYSTEMD_BUSNAME) +
+            sdbusRule::path(SYSTEMD_PATH) +
+            sdbusRule::interface(SYSTEMD_INTERFACE),
+        std::bind(std::mem_fn(&SignalRouter::jobRemoved), this,
+                  std::placeholders::_1)),
+    interfacesAddedMatch(
+        bus,
+        sdbusRule::interfacesAdded() + sdbusRule::path(SOFTWARE_OBJPATH),
+        std::bind(std::mem_fn(&SignalRouter::interfacesAdded), this,
+                  std::placeholders::_1))
+{}
+
+SignalRouter::Registration
+    SignalRouter::onJobRemoved(const std::string& unit, JobHandler handler)
+{
+    auto id = nextId++;
+    jobs[unit].emplace(id, std::move(handler));
+    return Registration(
+        [this, unit, id] { internal::removeHandler(jobs, unit, id); });
+}
+
+SignalRouter::Registration
+    SignalRouter::onInterfacesAdded(const std::string& parent,
+                                    InterfacesAddedHandler handler)
+{
+    auto id = nextId++;
+    interfaces[parent].emplace(id, std::move(handler));
+    return Registration([this, parent, id] {
+        internal::removeHandler(interfaces, parent, id);
+    });
+}
+
+void SignalRouter::jobRemoved(sdbusplus::message::message& msg)
+{
+    if (jobs.empty())
+    {
+        return;
+    }
+
+    JobRemoved job{};
+    sdbusplus::message::object_path jobPath;
+    msg.read(job.id, jobPath, job.unit, job.result);
+    job.job = std::move(jobPath);
+
+    internal::dispatch(jobs, job.unit, job);
+}
+
+void SignalRouter::interfacesAdded(sdbusplus::message::message& msg)
+{
+    sdbusplus::message::object_path objPath;
+    msg.read(objPath);
+    std::string path(std::move(objPath));
+
+    auto pos = path.rfind('/');
+    if (pos == std::string::npos)
+    {
+        return;
+    }
+    auto parent = path.substr(0, pos);
+    if (!interfaces.count(parent))
+    {
+        return;
+    }
+
+    // Each handler gets the same decoded map, the message can only be read
+    // once.
+    Interfaces added;
+    msg.read(added);
+    internal::dispatch(interfaces, parent, path, added);
+}
+
+void SignalRouter::subscribe()
+{
+    if (subscribers++ > 0)
+    {
+        return;
+    }
+
+    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
+                                      SYSTEMD_INTERFACE, "Subscribe");
+    utils::callAsync(
+        bus, method,
+        [](sdbusplus::message::message&, const sd_bus_error* error) {
+            // A previous instance of the updater may have subscribed on a
+            // connection systemd still tracks.
+            if (error &&
+                !sd_bus_error_has_name(
+                    error, "org.freedesktop.systemd1.AlreadySubscribed"))
+            {
+                log<level::ERR>("Error subscribing to systemd",
+                                entry("ERROR=%s", error->name));
+            }
+        });
+}
+
+void SignalRouter::unsubscribe()
+{
+    if (--subscribers > 0)
+    {
+        return;
+    }
+
+    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
+                                      SYSTEMD_INTERFACE, "Unsubscribe");
+    utils::callAsync(bus, method, "Unsubscribe from systemd signals");
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
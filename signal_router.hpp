@@ -0,0 +1,206 @@
+#pragma once
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
+#include <sdbusplus/message.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace internal
+{
+
+/** @brief Call the handlers registered under a key. The handlers are looked
+ *         up again before each call, so that a handler can remove any of
+ *         them, and copied so that it can remove itself.
+ */
+template <typename Handlers, typename... Args>
+void dispatch(Handlers& handlers, const std::string& key, Args&&... args)
+{
+    auto it = handlers.find(key);
+    if (it == handlers.end())
+    {
+        return;
+    }
+
+    std::vector<uint64_t> ids;
+    for (const auto& handler : it->second)
+    {
+        ids.push_back(handler.first);
+    }
+    for (auto id : ids)
+    {
+        it = handlers.find(key);
+        if (it == handlers.end())
+        {
+            return;
+        }
+        auto handler = it->second.find(id);
+        if (handler != it->second.end())
+        {
+            auto call = handler->second;
+            call(args...);
+        }
+    }
+}
+
+/** @brief Remove a handler, and its key once it has none left */
+template <typename Handlers>
+void removeHandler(Handlers& handlers, const std::string& key, uint64_t id)
+{
+    auto it = handlers.find(key);
+    if (it != handlers.end())
+    {
+        it->second.erase(id);
+        if (it->second.empty())
+        {
+            handlers.erase(it);
+        }
+    }
+}
+
+} // namespace internal
+
+/** @struct JobRemoved
+ *  @brief A decoded systemd JobRemoved signal.
+ */
+struct JobRemoved
+{
+    uint32_t id;
+    std::string job;
+    std::string unit;
+    std::string result;
+};
+
+/** @class SignalRouter
+ *  @brief Installs one match per signal the updater listens to, decodes
+ *         each signal once and dispatches it to the handlers registered for
+ *         its unit or object path.
+ *  @details Handlers are registered through Registration objects, which
+ *           remove them when destroyed. A handler may destroy its own or
+ *           other registrations while it runs.
+ */
+class SignalRouter
+{
+  public:
+    using JobHandler = std::function<void(const JobRemoved& job)>;
+
+    /** @brief The interfaces of an InterfacesAdded signal and their string
+     *         properties. Properties of other types are skipped. */
+    using Interfaces =
+        std::map<std::string, std::map<std::string, std::variant<std::string>>>;
+
+    /** @brief Called with the object path of an InterfacesAdded signal and
+     *         its interfaces, decoded once for all the handlers. */
+    using InterfacesAddedHandler = std::function<void(
+        const std::string& path, const Interfaces& interfaces)>;
+
+    /** @class Registration
+     *  @brief Keeps a handler registered while it exists.
+     */
+    class Registration
+    {
+      public:
+        Registration() = default;
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+        Registration(Registration&& other) noexcept;
+        Registration& operator=(Registration&& other) noexcept;
+        ~Registration();
+
+      private:
+        friend class SignalRouter;
+        Registration(std::function<void()> remove);
+
+        std::function<void()> remove;
+    };
+
+    /** @class Subscription
+     *  @brief Keeps the systemd signals enabled while it exists.
+     *  @details systemd only emits JobRemoved to clients that called
+     *           Subscribe, and a single Unsubscribe cancels it for the whole
+     *           connection, so the subscription is shared by reference
+     *           count.
+     */
+    class Subscription
+    {
+      public:
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+        Subscription(Subscription&&) = delete;
+        Subscription& operator=(Subscription&&) = delete;
+
+        explicit Subscription(SignalRouter& router);
+        ~Subscription();
+
+      private:
+        SignalRouter& router;
+    };
+
+    SignalRouter() = delete;
+    SignalRouter(const SignalRouter&) = delete;
+    SignalRouter& operator=(const SignalRouter&) = delete;
+    SignalRouter(SignalRouter&&) = delete;
+    SignalRouter& operator=(SignalRouter&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] bus - The bus to listen on
+     */
+    explicit SignalRouter(sdbusplus::bus::bus& bus);
+
+    /** @brief Call a handler when a job of a systemd unit is removed
+     *
+     *  @param[in] unit - The unit name
+     *  @param[in] handler - The handler
+     */
+    Registration onJobRemoved(const std::string& unit, JobHandler handler);
+
+    /** @brief Call a handler when interfaces are added to an object under
+     *         a path, which is the parent of the object path
+     *
+     *  @param[in] parent - The parent path of the objects
+     *  @param[in] handler - The handler
+     */
+    Registration onInterfacesAdded(const std::string& parent,
+                                   InterfacesAddedHandler handler);
+
+  private:
+    void jobRemoved(sdbusplus::message::message& msg);
+    void interfacesAdded(sdbusplus::message::message& msg);
+
+    /** @brief Take or release a reference to the systemd subscription */
+    void subscribe();
+    void unsubscribe();
+
+    sdbusplus::bus::bus& bus;
+
+    /** @brief Handlers by unit name, then by registration id */
+    std::unordered_map<std::string, std::map<uint64_t, JobHandler>> jobs;
+
+    /** @brief Handlers by parent path, then by registration id */
+    std::unordered_map<std::string, std::map<uint64_t, InterfacesAddedHandler>>
+        interfaces;
+
+    uint64_t nextId = 0;
+    unsigned subscribers = 0;
+
+    sdbusplus::bus::match_t jobRemovedMatch;
+    sdbusplus::bus::match_t interfacesAddedMatch;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
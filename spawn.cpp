@@ -0,0 +1,283 @@
+#include "spawn.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <phosphor-logging/log.hpp>
+
+#include <cerrno>
+#include <memory>
+#include <utility>
+
+extern char** environ;
+
+namespace utils
+{
+
+using namespace phosphor::logging;
+
+namespace
+{
+
+/** @brief Spawn attributes that reset the signal state of the child, which
+ *  would otherwise inherit the signals blocked by the caller. */
+class SpawnAttributes
+{
+  public:
+    SpawnAttributes()
+    {
+        posix_spawnattr_init(&attr);
+
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attr, &signals);
+        sigfillset(&signals);
+        posix_spawnattr_setsigdefault(&attr, &signals);
+
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                            POSIX_SPAWN_SETSIGDEF);
+    }
+
+    ~SpawnAttributes()
+    {
+        posix_spawnattr_destroy(&attr);
+    }
+
+    SpawnAttributes(const SpawnAttributes&) = delete;
+    SpawnAttributes& operator=(const SpawnAttributes&) = delete;
+
+    const posix_spawnattr_t* get() const
+    {
+        return &attr;
+    }
+
+  private:
+    posix_spawnattr_t attr;
+};
+
+pid_t spawnWith(const char* path, char* const argv[],
+                const posix_spawn_file_actions_t* actions)
+{
+    static const SpawnAttributes attributes;
+
+    pid_t pid = -1;
+    auto rc = posix_spawn(&pid, path, actions, attributes.get(), argv,
+                          environ);
+    if (rc != 0)
+    {
+        log<level::ERR>("Failed to execute command", entry("ERRNO=%d", rc),
+                        entry("COMMAND=%s", path));
+        return -1;
+    }
+    return pid;
+}
+
+/** @brief How much of the stderr of a child is kept */
+constexpr size_t maxErrorBytes = 4096;
+
+/** @brief A child started by spawnAsync(), owned by its event sources
+ *  until it exits. */
+struct AsyncChild
+{
+    AsyncChild() = default;
+    AsyncChild(const AsyncChild&) = delete;
+    AsyncChild& operator=(const AsyncChild&) = delete;
+
+    ~AsyncChild()
+    {
+        sd_event_source_unref(childSource);
+        sd_event_source_unref(errorSource);
+        sd_event_source_unref(timeoutSource);
+        if (errorFd >= 0)
+        {
+            close(errorFd);
+        }
+    }
+
+    pid_t pid = -1;
+    int errorFd = -1;
+    bool timedOut = false;
+    std::string errors;
+    std::function<void(const ChildExit& result)> handler;
+    sd_event_source* childSource = nullptr;
+    sd_event_source* errorSource = nullptr;
+    sd_event_source* timeoutSource = nullptr;
+};
+
+/** @brief Read what the child wrote to stderr so far, keeping the end.
+ *
+ *  @return true once the child closed its stderr
+ */
+bool readErrors(AsyncChild& child)
+{
+    char buffer[512];
+    while (true)
+    {
+        auto bytes = read(child.errorFd, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            return bytes == 0;
+        }
+
+        child.errors.append(buffer, bytes);
+        if (child.errors.size() > maxErrorBytes)
+        {
+            child.errors.erase(0, child.errors.size() - maxErrorBytes);
+        }
+    }
+}
+
+int onErrors(sd_event_source* source, int /* fd */, uint32_t /* revents */,
+             void* userdata)
+{
+    if (readErrors(*static_cast<AsyncChild*>(userdata)))
+    {
+        sd_event_source_set_enabled(source, SD_EVENT_OFF);
+    }
+    return 0;
+}
+
+int onTimeout(sd_event_source* /* source */, uint64_t /* usec */,
+              void* userdata)
+{
+    auto& child = *static_cast<AsyncChild*>(userdata);
+    log<level::ERR>("Killing command that timed out",
+                    entry("PID=%d", child.pid));
+    child.timedOut = true;
+    kill(child.pid, SIGKILL);
+    return 0;
+}
+
+int onExit(sd_event_source* /* source */, const siginfo_t* info,
+           void* userdata)
+{
+    // The event loop reaps the child once this returns.
+    std::unique_ptr<AsyncChild> child(static_cast<AsyncChild*>(userdata));
+    readErrors(*child);
+
+    ChildExit result{info->si_code == CLD_EXITED ? info->si_status : -1,
+                     child->timedOut, std::move(child->errors)};
+    auto handler = std::move(child->handler);
+    child.reset();
+
+    handler(result);
+    return 0;
+}
+
+} // namespace
+
+pid_t spawn(const char* path, char* const argv[])
+{
+    return spawnWith(path, argv, nullptr);
+}
+
+int waitChild(pid_t pid)
+{
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            auto error = errno;
+            log<level::ERR>("waitpid error", entry("ERRNO=%d", error),
+                            entry("PID=%d", pid));
+            return -1;
+        }
+    }
+
+    if (WIFSIGNALED(status))
+    {
+        log<level::ERR>("Command killed by signal",
+                        entry("SIGNAL=%d", WTERMSIG(status)),
+                        entry("PID=%d", pid));
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+bool spawnAsync(sd_event* event, const char* path, char* const argv[],
+                std::chrono::seconds timeout,
+                std::function<void(const ChildExit& result)> handler)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        auto error = errno;
+        log<level::ERR>("Failed to create pipe", entry("ERRNO=%d", error),
+                        entry("COMMAND=%s", path));
+        return false;
+    }
+
+    // The child gets the write end as its stderr, without O_CLOEXEC.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    auto pid = spawnWith(path, argv, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return false;
+    }
+
+    auto child = std::make_unique<AsyncChild>();
+    child->pid = pid;
+    child->errorFd = fds[0];
+    child->handler = std::move(handler);
+
+    auto rc = sd_event_add_child(event, &child->childSource, pid, WEXITED,
+                                 onExit, child.get());
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to watch child process",
+                        entry("RC=%d", rc), entry("COMMAND=%s", path));
+        kill(pid, SIGKILL);
+        waitChild(pid);
+        return false;
+    }
+
+    // Without these the child still runs and is reaped, only its stderr or
+    // timeout is lost.
+    rc = sd_event_add_io(event, &child->errorSource, child->errorFd, EPOLLIN,
+                         onErrors, child.get());
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to watch child stderr", entry("RC=%d", rc),
+                        entry("COMMAND=%s", path));
+    }
+
+    uint64_t now = 0;
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    rc = sd_event_add_time(
+        event, &child->timeoutSource, CLOCK_MONOTONIC,
+        now + std::chrono::microseconds(timeout).count(), 0, onTimeout,
+        child.get());
+    if (rc < 0)
+    {
+        log<level::ERR>("Failed to add child timeout", entry("RC=%d", rc),
+                        entry("COMMAND=%s", path));
+    }
+
+    // Owned by the event sources from now on, freed by onExit().
+    child.release();
+    return true;
+}
+
+void blockChildSignal()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+}
+
+} // namespace utils
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sys/types.h>
+#include <systemd/sd-event.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace utils
+{
+
+/**
+ * @brief Start a program in a child process.
+ *
+ * @details Uses posix_spawn, which the C library implements with vfork or
+ *          clone(CLONE_VM): the child shares the memory of the caller
+ *          until it executes the program instead of duplicating its page
+ *          tables, and a program that cannot be executed is reported to
+ *          the caller instead of leaving a copy of the daemon running in
+ *          the child. The child gets the environment of the caller, an
+ *          empty signal mask and the default signal dispositions.
+ *
+ * @param[in] path - Fully qualified name of the executable
+ * @param[in] argv - The arguments, starting with the program name and
+ *                   terminated by nullptr
+ * @return The pid of the child, or -1 if it could not be started, which
+ *         is logged
+ */
+pid_t spawn(const char* path, char* const argv[]);
+
+/**
+ * @brief Wait for a child process to exit.
+ *
+ * @param[in] pid - The pid of the child
+ * @return The exit status of the child, or -1 if it was killed by a
+ *         signal or could not be waited for, which is logged
+ */
+int waitChild(pid_t pid);
+
+/** @struct ChildExit
+ *  @brief How a child started by spawnAsync() ended.
+ */
+struct ChildExit
+{
+    /** @brief The exit status, or -1 if the child was killed */
+    int status;
+
+    /** @brief Whether the child was killed for outliving its timeout */
+    bool timedOut;
+
+    /** @brief The last bytes the child wrote to its stderr */
+    std::string errors;
+};
+
+/**
+ * @brief Start a program in a child process and return without waiting
+ *        for it. The child is reaped by the event loop, which calls the
+ *        handler once it has exited and its stderr has been read. The
+ *        child is killed if it runs longer than the timeout.
+ *
+ * @details SIGCHLD must be blocked, see blockChildSignal().
+ *
+ * @param[in] event - The event loop to reap the child from
+ * @param[in] path - Fully qualified name of the executable
+ * @param[in] argv - The arguments, starting with the program name and
+ *                   terminated by nullptr
+ * @param[in] timeout - How long the child may run
+ * @param[in] handler - Called when the child has exited
+ * @return false if the child could not be started, which is logged, in
+ *         which case the handler is not called
+ */
+bool spawnAsync(sd_event* event, const char* path, char* const argv[],
+                std::chrono::seconds timeout,
+                std::function<void(const ChildExit& result)> handler);
+
+/**
+ * @brief Block SIGCHLD, so that the event loop can watch the children
+ *        started by spawnAsync(). Call it from main() before any thread is
+ *        started. The children get an empty signal mask regardless.
+ */
+void blockChildSignal();
+
+} // namespace utils
@@ -3,10 +3,18 @@
 #include "flash.hpp"
 
 #include "activation.hpp"
+#include "flash_backend.hpp"
 #include "images.hpp"
 #include "item_updater.hpp"
+#include "utils.hpp"
+#include "version.hpp"
 
+#include <phosphor-logging/log.hpp>
+
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <vector>
 
 namespace
 {
@@ -21,24 +29,250 @@ namespace updater
 {
 
 namespace fs = std::filesystem;
+namespace softwareServer = sdbusplus::xyz::openbmc_project::Software::server;
 using namespace phosphor::software::image;
+using namespace phosphor::logging;
+
+namespace
+{
+
+/** @brief Rebuild an image from its delta against the MTD partition of the
+ *         same name, which holds the running version
+ *
+ *  @param[in] delta - The delta file
+ *  @param[in] image - The image name, e.g. "image-rofs"
+ *  @param[in] to - The file to write the image to
+ */
+void rebuildImage(const fs::path& delta, const std::string& image,
+                  const fs::path& to)
+{
+    SystemFlashDevices devices;
+    auto& device = devices.mtd(image.substr(image.find('-') + 1));
+    DeltaSource source(
+        delta,
+        [&device](uint64_t offset, void* data, size_t length) {
+            device.read(offset, data, length);
+        },
+        device.size());
+
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    std::vector<char> buffer(1024 * 1024);
+    while (auto length = source.read(buffer.data(), buffer.size()))
+    {
+        out.write(buffer.data(), length);
+    }
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("Failed to write " + to.string());
+    }
+}
+
+/** @brief Store the write plan of an image in the staging directory, so
+ *         that the shutdown flasher only programs the erase blocks that
+ *         differ from the MTD partition of the same name
+ *
+ *  @param[in] file - The image file
+ *  @param[in] image - The image name, e.g. "image-rofs"
+ *  @param[in] stageDir - The directory the image is staged in
+ *
+ *  @return False if the partition already holds the image, which then
+ *          needs no staging
+ */
+bool planImage(const fs::path& file, const std::string& image,
+               const fs::path& stageDir)
+{
+    fs::path plan = planFile(stageDir, image);
+    fs::remove(plan);
+    if (std::find(plannedImages.begin(), plannedImages.end(), image) ==
+        plannedImages.end())
+    {
+        return true;
+    }
+
+    // Without a plan the image is written whole, so failing to make one
+    // does not fail the activation.
+    try
+    {
+        SystemFlashDevices devices;
+        FileSource source(file);
+        auto planned =
+            planWrite(devices.mtd(image.substr(image.find('-') + 1)), source);
+        if (planned.ranges.empty())
+        {
+            return false;
+        }
+        planned.store(plan);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to plan the write of the image",
+                        entry("IMAGE=%s", image.c_str()),
+                        entry("ERROR=%s", e.what()));
+        fs::remove(plan);
+    }
+    return true;
+}
+
+/** @brief Stage the images of a version in /run/initramfs for the shutdown
+ *         flasher. Reads and compares whole MTD partitions, so it runs on a
+ *         worker.
+ *
+ *  @param[in] images - The images to stage
+ *  @param[in] imageDir - The directory of the version's images
+ *  @param[in] runningVersionId - The version the flash holds, which deltas
+ *                                must be against
+ */
+void stageImages(const std::vector<std::string>& images,
+                 const fs::path& imageDir, const std::string& runningVersionId)
+{
+    fs::path toPath(PATH_INITRAMFS);
+
+    // The images are moved rather than copied, both directories being in
+    // RAM. They are moved back if the activation fails, so that it can be
+    // retried.
+    std::vector<std::string> moved;
+    std::string bmcImage;
+    try
+    {
+        for (const auto& image : images)
+        {
+            bmcImage = image;
+            auto from = imageDir / bmcImage;
+            if (fs::exists(from))
+            {
+                // An image the flash already holds, e.g. the same release
+                // pushed again, is not staged, nor one staged before.
+                if (!planImage(from, bmcImage, toPath))
+                {
+                    log<level::INFO>("The flash already holds the image",
+                                     entry("IMAGE=%s", bmcImage.c_str()));
+                    fs::remove(toPath / bmcImage);
+                    continue;
+                }
+                utils::moveFile(from, toPath / bmcImage);
+                moved.push_back(bmcImage);
+                continue;
+            }
+
+            // Images shipped as deltas are rebuilt against the flash, which
+            // holds the running version.
+            auto source = manager::Version::getValue(
+                (imageDir / MANIFEST_FILE_NAME).string(), "DeltaSource");
+            if (runningVersionId.empty() || source != runningVersionId)
+            {
+                throw std::invalid_argument("Deltas against version " +
+                                            source + ", not the running one");
+            }
+
+            from += deltaSuffix;
+            rebuildImage(from, bmcImage, toPath / bmcImage);
+            if (!planImage(toPath / bmcImage, bmcImage, toPath))
+            {
+                log<level::INFO>("The flash already holds the image",
+                                 entry("IMAGE=%s", bmcImage.c_str()));
+                fs::remove(toPath / bmcImage);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to stage the image",
+                        entry("IMAGE=%s", bmcImage.c_str()),
+                        entry("ERROR=%s", e.what()));
+        bool lost = dynamic_cast<const utils::MoveSourceLost*>(&e);
+        for (const auto& image : images)
+        {
+            std::error_code ec;
+            fs::remove(planFile(toPath, image), ec);
+            if (std::find(moved.begin(), moved.end(), image) == moved.end())
+            {
+                fs::remove(toPath / image, ec);
+                continue;
+            }
+            try
+            {
+                utils::moveFile(toPath / image, imageDir / image);
+            }
+            catch (const std::exception& err)
+            {
+                log<level::ERR>("Failed to move the image back",
+                                entry("IMAGE=%s", image.c_str()),
+                                entry("ERROR=%s", err.what()));
+                fs::remove(toPath / image, ec);
+                lost = true;
+            }
+        }
+
+        // The upload misses an image once one is lost, so it must not be
+        // activated again.
+        if (lost)
+        {
+            throw utils::MoveSourceLost("Lost an image of the version");
+        }
+        throw;
+    }
+}
+
+} // namespace
 
 void Activation::flashWrite()
 {
     // For static layout code update, just put images in /run/initramfs.
     // It expects user to trigger a reboot and an updater script will program
     // the image to flash during reboot.
-    fs::path uploadDir(IMG_UPLOAD_DIR);
-    fs::path toPath(PATH_INITRAMFS);
+    std::string runningVersionId;
+    for (const auto& [id, version] : parent.versions)
+    {
+        if (version->isFunctional())
+        {
+            runningVersionId = id;
+        }
+    }
+
+    auto work = [images = parent.imageUpdateList,
+                 imageDir = fs::path(IMG_UPLOAD_DIR) / versionId,
+                 runningVersionId](const ProgressCallback&) {
+        stageImages(images, imageDir, runningVersionId);
+    };
+
+    auto onDone = [this](std::exception_ptr error) {
+        if (error)
+        {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const utils::MoveSourceLost&)
+            {
+                // Drop the damaged upload from the image manager, which
+                // removes its directory.
+                Activation::deleteImageManagerObject();
+            }
+            catch (const std::exception&)
+            {}
+            Activation::activation(
+                softwareServer::Activation::Activations::Failed);
+            return;
+        }
+        Activation::onFlashWriteSuccess();
+    };
 
-    for (const auto& bmcImage : parent.imageUpdateList)
+    try
+    {
+        flashJob = std::make_unique<FlashJob>(sd_bus_get_event(bus.get()),
+                                              std::move(work), nullptr,
+                                              std::move(onDone));
+    }
+    catch (const std::exception& e)
     {
-        fs::copy_file(uploadDir / versionId / bmcImage, toPath / bmcImage,
-                      fs::copy_options::overwrite_existing);
+        log<level::ERR>("Failed to start staging the image",
+                        entry("ERROR=%s", e.what()));
+        Activation::activation(softwareServer::Activation::Activations::Failed);
     }
 }
 
-void Activation::onStateChanges(sdbusplus::message::message& /*msg*/)
+void Activation::onStateChanges(const JobRemoved& /*job*/)
 {
     // Empty
 }
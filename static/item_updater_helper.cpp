@@ -1,6 +1,8 @@
 #include "item_updater_helper.hpp"
 
-#include "utils.hpp"
+#include "uboot_env.hpp"
+
+#include <phosphor-logging/log.hpp>
 
 namespace phosphor
 {
@@ -9,6 +11,8 @@ namespace software
 namespace updater
 {
 
+using namespace phosphor::logging;
+
 void Helper::setEntry(const std::string& /* entryId */, uint8_t /* value */)
 {
     // Empty
@@ -28,7 +32,15 @@ void Helper::factoryReset()
 {
     // Set openbmconce=factory-reset env in U-Boot.
     // The init will cleanup rwfs during boot.
-    utils::execute("/sbin/fw_setenv", "openbmconce", "factory-reset");
+    try
+    {
+        getSystemEnv().set("openbmconce", "factory-reset");
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to set openbmconce in U-Boot environment",
+                        entry("ERROR=%s", e.what()));
+    }
 }
 
 void Helper::removeVersion(const std::string& /* versionId */)
@@ -41,6 +53,13 @@ void Helper::updateUbootVersionId(const std::string& /* versionId */)
     // Empty
 }
 
+void Helper::setPriorities(
+    const std::map<std::string, uint8_t>& /* priorities */,
+    const std::string& /* bootVersionId */)
+{
+    // Empty
+}
+
 void Helper::mirrorAlt()
 {
     // Empty
@@ -2,13 +2,16 @@
 
 #include "sync_manager.hpp"
 
+#include "spawn.hpp"
+#include "utils.hpp"
+
 #include <sys/inotify.h>
-#include <sys/wait.h>
-#include <unistd.h>
 
 #include <phosphor-logging/log.hpp>
 
+#include <chrono>
 #include <filesystem>
+#include <vector>
 
 namespace phosphor
 {
@@ -20,65 +23,84 @@ namespace manager
 using namespace phosphor::logging;
 namespace fs = std::filesystem;
 
+/** @brief How long one rsync may take */
+constexpr std::chrono::minutes rsyncTimeout(1);
+
 int Sync::processEntry(int mask, const fs::path& entryPath)
 {
-    int status{};
-    pid_t pid = fork();
+    pending.push_back({mask, entryPath});
+    if (!running)
+    {
+        startNext();
+    }
+    return 0;
+}
 
-    if (pid == 0)
+void Sync::startNext()
+{
+    while (!pending.empty())
     {
+        auto next = std::move(pending.front());
+        pending.pop_front();
+
         fs::path dst(ALT_RWFS);
-        dst /= entryPath.relative_path();
+        dst /= next.path.relative_path();
 
-        // rsync needs an additional --delete argument to handle file deletions
-        // so need to differentiate between the different file events.
-        if (mask & IN_CLOSE_WRITE)
+        // rsync needs an additional --delete argument to handle file
+        // deletions so need to differentiate between the different file
+        // events.
+        std::vector<char*> argv;
+        if (next.mask & IN_CLOSE_WRITE)
         {
-            if (!(fs::exists(dst)))
+            // Errors are left for rsync to report.
+            std::error_code ec;
+            if (!(fs::exists(dst, ec)))
             {
-                if (fs::is_directory(entryPath))
+                if (fs::is_directory(next.path, ec))
                 {
                     // Source is a directory, create it at the destination.
-                    fs::create_directories(dst);
+                    fs::create_directories(dst, ec);
                 }
                 else
                 {
-                    // Source is a file, create the directory where this file
-                    // resides at the destination.
-                    fs::create_directories(dst.parent_path());
+                    // Source is a file, create the directory where this
+                    // file resides at the destination.
+                    fs::create_directories(dst.parent_path(), ec);
                 }
             }
-
-            execl("/usr/bin/rsync", "rsync", "-a", entryPath.c_str(),
-                  dst.c_str(), nullptr);
-            // execl only returns on fail
-            log<level::ERR>("Error occurred during the rsync call",
-                            entry("ERRNO=%d", errno),
-                            entry("PATH=%s", entryPath.c_str()));
-            return -1;
+            argv = utils::internal::constructArgv(
+                "rsync", "-a", next.path.c_str(), dst.c_str());
         }
-        else if (mask & IN_DELETE)
+        else if (next.mask & IN_DELETE)
         {
-            execl("/usr/bin/rsync", "rsync", "-a", "--delete",
-                  entryPath.c_str(), dst.c_str(), nullptr);
-            // execl only returns on fail
-            log<level::ERR>("Error occurred during the rsync delete call",
-                            entry("ERRNO=%d", errno),
-                            entry("PATH=%s", entryPath.c_str()));
-            return -1;
+            argv = utils::internal::constructArgv(
+                "rsync", "-a", "--delete", next.path.c_str(), dst.c_str());
+        }
+        else
+        {
+            continue;
         }
-    }
-    else if (pid > 0)
-    {
-        waitpid(pid, &status, 0);
-    }
-    else
-    {
-        log<level::ERR>("Error occurred during fork", entry("ERRNO=%d", errno));
-        return -1;
-    }
 
-    return 0;
+        running = utils::spawnAsync(
+            loop, "/usr/bin/rsync", argv.data(), rsyncTimeout,
+            [this, path = next.path](const utils::ChildExit& result) {
+                // Keep watching, the next change of the file syncs it
+                // again.
+                if (result.status != 0)
+                {
+                    log<level::ERR>("Error occurred during the rsync call",
+                                    entry("PATH=%s", path.c_str()),
+                                    entry("STATUS=%d", result.status),
+                                    entry("ERRORS=%s", result.errors.c_str()));
+                }
+                running = false;
+                startNext();
+            });
+        if (running)
+        {
+            return;
+        }
+    }
 }
 
 } // namespace manager
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <systemd/sd-event.h>
+
+#include <deque>
 #include <filesystem>
 
 namespace phosphor
@@ -19,20 +22,49 @@ namespace fs = std::filesystem;
 class Sync
 {
   public:
-    Sync() = default;
+    Sync() = delete;
     Sync(const Sync&) = delete;
     Sync& operator=(const Sync&) = delete;
-    Sync(Sync&&) = default;
-    Sync& operator=(Sync&&) = default;
+    Sync(Sync&&) = delete;
+    Sync& operator=(Sync&&) = delete;
     ~Sync() = default;
 
     /**
-     * @brief Process requested file or directory.
+     * @brief Constructor
+     * @param[in] loop - The event loop that reaps the rsync processes.
+     */
+    explicit Sync(sd_event* loop) : loop(loop)
+    {}
+
+    /**
+     * @brief Process requested file or directory. The entry is synced by
+     *        an rsync process once the ones of the earlier entries have
+     *        exited, so that the changes reach the alternate copy in order.
      * @param[in] mask - The inotify mask.
      * @param[in] entryPath - The file or directory to process.
      * @param[out] result - 0 if successful.
      */
     int processEntry(int mask, const fs::path& entryPath);
+
+  private:
+    /** @brief A change waiting to be synced */
+    struct Entry
+    {
+        int mask;
+        fs::path path;
+    };
+
+    /** @brief Start the rsync of the next queued entry, if any */
+    void startNext();
+
+    /** @brief The event loop that reaps the rsync processes */
+    sd_event* loop;
+
+    /** @brief The changes not synced yet, in the order they happened */
+    std::deque<Entry> pending;
+
+    /** @brief Whether an rsync process is running */
+    bool running = false;
 };
 
 } // namespace manager
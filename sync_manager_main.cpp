@@ -1,5 +1,6 @@
 #include "config.h"
 
+#include "spawn.hpp"
 #include "sync_manager.hpp"
 #include "sync_watch.hpp"
 
@@ -13,6 +14,9 @@
 
 int main()
 {
+    // Before any thread or child exists, see utils::spawnAsync().
+    utils::blockChildSignal();
+
     auto bus = sdbusplus::bus::new_default();
 
     sd_event* loop = nullptr;
@@ -22,7 +26,7 @@ int main()
 
     try
     {
-        phosphor::software::manager::Sync syncManager;
+        phosphor::software::manager::Sync syncManager(loop);
 
         using namespace phosphor::software::manager;
         phosphor::software::manager::SyncWatch watch(
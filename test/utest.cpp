@@ -1,21 +1,47 @@
+#include "crc32.hpp"
+#include "deferred_signals.hpp"
+#include "flash_backend.hpp"
+#include "flash_device.hpp"
+#include "gpt.hpp"
+#include "image_source.hpp"
 #include "image_verify.hpp"
+#include "inventory_snapshot.hpp"
+#include "persistent_state.hpp"
+#include "progress_meter.hpp"
+#include "readback.hpp"
+#include "signal_router.hpp"
+#include "spawn.hpp"
+#include "ubi_device.hpp"
+#include "uboot_env.hpp"
 #include "utils.hpp"
 #include "version.hpp"
 
 #include <openssl/sha.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
 
+#include <csignal>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 using namespace phosphor::software::manager;
 using namespace phosphor::software::image;
+using namespace phosphor::software::updater;
 
 class VersionTest : public testing::Test
 {
@@ -384,3 +410,1265 @@ TEST(ExecTest, TestConstructArgv)
     EXPECT_EQ(charArray[2], arg2);
     EXPECT_EQ(charArray[3], nullptr);
 }
+
+/** @brief Make sure the exit status of a spawned child gets back to the
+ *         caller */
+TEST(SpawnTest, TestExitStatus)
+{
+    auto argV = utils::internal::constructArgv("sh", "-c", "exit 3");
+    auto pid = utils::spawn("/bin/sh", argV.data());
+    ASSERT_GT(pid, 0);
+    EXPECT_EQ(utils::waitChild(pid), 3);
+
+    argV = utils::internal::constructArgv("sh", "-c", "kill -KILL $$");
+    pid = utils::spawn("/bin/sh", argV.data());
+    ASSERT_GT(pid, 0);
+    EXPECT_EQ(utils::waitChild(pid), -1);
+
+    // A program that cannot be executed is reported to the caller.
+    argV = utils::internal::constructArgv("missing");
+    EXPECT_EQ(utils::spawn("/nonexistent/missing", argV.data()), -1);
+}
+
+/** @brief Make sure a child started from the event loop is reaped with its
+ *         exit status and stderr, and killed once it outlives its timeout */
+TEST(SpawnTest, TestSpawnAsync)
+{
+    utils::blockChildSignal();
+    sd_event* event = nullptr;
+    ASSERT_GE(sd_event_new(&event), 0);
+
+    std::vector<utils::ChildExit> exits;
+    auto onExit = [&exits, event](const utils::ChildExit& result) {
+        exits.push_back(result);
+        if (exits.size() == 2)
+        {
+            sd_event_exit(event, 0);
+        }
+    };
+
+    auto argV =
+        utils::internal::constructArgv("sh", "-c", "echo failed >&2; exit 2");
+    EXPECT_TRUE(utils::spawnAsync(event, "/bin/sh", argV.data(),
+                                  std::chrono::seconds(10), onExit));
+    argV = utils::internal::constructArgv("sh", "-c", "exec sleep 10");
+    EXPECT_TRUE(utils::spawnAsync(event, "/bin/sh", argV.data(),
+                                  std::chrono::seconds(1), onExit));
+    sd_event_loop(event);
+    sd_event_unref(event);
+
+    ASSERT_EQ(exits.size(), 2);
+    EXPECT_EQ(exits[0].status, 2);
+    EXPECT_FALSE(exits[0].timedOut);
+    EXPECT_EQ(exits[0].errors, "failed\n");
+    EXPECT_EQ(exits[1].status, -1);
+    EXPECT_TRUE(exits[1].timedOut);
+}
+
+/** @brief Make sure a moved file keeps its data, within a directory and
+ *         to the temporary directory, which can be another filesystem */
+TEST(MoveFileTest, TestMoveFile)
+{
+    char moveDir[] = "./moveXXXXXX";
+    std::string directory = mkdtemp(moveDir);
+    ASSERT_FALSE(directory.empty());
+
+    std::string data(3 * 1024 * 1024 + 100, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(i * 31);
+    }
+    auto from = directory + "/image";
+    std::ofstream(from, std::ios::binary) << data;
+
+    auto renamed = directory + "/renamed";
+    auto moved = fs::temp_directory_path() / fs::path(directory).filename();
+    utils::moveFile(from, renamed);
+    utils::moveFile(renamed, moved);
+    EXPECT_FALSE(fs::exists(from));
+    EXPECT_FALSE(fs::exists(renamed));
+
+    std::ifstream in(moved, std::ios::binary);
+    std::string read((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    EXPECT_EQ(read, data);
+
+    fs::remove(moved);
+    fs::remove_all(directory);
+}
+
+/** @brief Make sure a move that fails part way across filesystems leaves the
+ *         source whole, although the copied chunks were freed from it */
+TEST(MoveFileTest, TestWriteFailure)
+{
+    char moveDir[] = "./moveXXXXXX";
+    std::string directory = mkdtemp(moveDir);
+    ASSERT_FALSE(directory.empty());
+    auto moved = fs::temp_directory_path() / fs::path(directory).filename();
+    struct stat from, to;
+    ASSERT_EQ(stat(directory.c_str(), &from), 0);
+    ASSERT_EQ(stat(moved.parent_path().c_str(), &to), 0);
+    if (from.st_dev == to.st_dev)
+    {
+        fs::remove_all(directory);
+        GTEST_SKIP() << "The temporary directory is on the same filesystem";
+    }
+
+    std::string data(3 * 1024 * 1024 + 100, '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(i * 31);
+    }
+    auto image = directory + "/image";
+    std::ofstream(image, std::ios::binary) << data;
+
+    // Fail the writes past the second chunk, as a full /run would.
+    struct rlimit limit, saved;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+    limit = saved;
+    limit.rlim_cur = 1536 * 1024;
+    auto handler = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+    EXPECT_THROW(utils::moveFile(image, moved), std::system_error);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, handler);
+
+    EXPECT_FALSE(fs::exists(moved));
+    EXPECT_FALSE(fs::exists(moved.parent_path() /
+                            ("." + moved.filename().string() + ".part")));
+    std::ifstream in(image, std::ios::binary);
+    std::string read((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    EXPECT_EQ(read, data);
+
+    fs::remove_all(directory);
+}
+
+class UbootEnvTest : public testing::Test
+{
+  protected:
+    static constexpr uint32_t eraseSize = 0x10000;
+
+    virtual void SetUp()
+    {
+        char envDir[] = "./envXXXXXX";
+        _directory = mkdtemp(envDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+        _envFile = _directory + "/u-boot-env";
+
+        // U-Boot saved its default environment in the first bank.
+        std::vector<uint8_t> env(eraseSize, 0);
+        std::string defaults = "bootcmd=bootm";
+        std::copy(defaults.begin(), defaults.end(), env.begin() + 5);
+        uint32_t crc = utils::crc32(env.data() + 5, env.size() - 5);
+        std::memcpy(env.data(), &crc, sizeof(crc));
+        env[4] = 1;
+        FileDevice(_envFile, 2 * eraseSize, eraseSize, FileDevice::Type::nor)
+            .write(0, env.data(), env.size());
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    /** @brief Open a redundant environment with one bank per erase block */
+    std::unique_ptr<UbootEnv> openEnv()
+    {
+        std::vector<EnvBank> banks;
+        for (uint64_t offset : {0u, eraseSize})
+        {
+            banks.push_back({std::make_unique<FileDevice>(
+                                 _envFile, 2 * eraseSize, eraseSize,
+                                 FileDevice::Type::nor),
+                             offset, eraseSize});
+        }
+        return std::make_unique<UbootEnv>(std::move(banks));
+    }
+
+    std::string readEnvFile()
+    {
+        std::ifstream f(_envFile, std::ios::in | std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(f), {});
+    }
+
+    std::string _directory;
+    std::string _envFile;
+};
+
+/** @brief Make sure a set of changes is persisted and read back */
+TEST_F(UbootEnvTest, TestApplyAndReadBack)
+{
+    openEnv()->apply({{"fieldmode", "true"}, {"a1b2c3d4", "0"}});
+
+    auto env = openEnv();
+    EXPECT_EQ(env->get("fieldmode"), "true");
+    EXPECT_EQ(env->get("a1b2c3d4"), "0");
+    EXPECT_EQ(env->get("missing"), std::nullopt);
+    EXPECT_EQ(env->get("bootcmd"), "bootm");
+    EXPECT_EQ(env->vars().size(), 3);
+
+    env->unset("fieldmode");
+    EXPECT_EQ(openEnv()->get("fieldmode"), std::nullopt);
+}
+
+/** @brief Make sure updates alternate between the banks, so that a corrupt
+ *  bank falls back to the previous environment */
+TEST_F(UbootEnvTest, TestRedundantBanks)
+{
+    openEnv()->set("rwreset", "false");
+    openEnv()->set("rwreset", "true");
+    EXPECT_EQ(openEnv()->get("rwreset"), "true");
+
+    // The second write went to the first bank, corrupt it.
+    {
+        std::fstream f(_envFile,
+                       std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(8);
+        f.put('X');
+    }
+    EXPECT_EQ(openEnv()->get("rwreset"), "false");
+}
+
+/** @brief Make sure fw_env reads the latest write: on NOR flash the new
+ *  bank is marked active and the previous one obsolete */
+TEST_F(UbootEnvTest, TestFwEnvSelection)
+{
+    openEnv()->set("priority", "0");
+    openEnv()->set("priority", "1");
+    openEnv()->set("priority", "2");
+
+    // fw_env picks the bank marked active over the one marked obsolete,
+    // else the one with an erased flag, else bank 0.
+    auto data = readEnvFile();
+    auto flag0 = static_cast<uint8_t>(data[4]);
+    auto flag1 = static_cast<uint8_t>(data[eraseSize + 4]);
+    EXPECT_EQ(flag0, 0);
+    EXPECT_EQ(flag1, 1);
+    size_t bank = 0;
+    if ((flag0 == 0 && flag1 == 1) || (flag0 != 0xFF && flag1 == 0xFF))
+    {
+        bank = 1;
+    }
+
+    auto env = data.substr(bank * eraseSize, eraseSize);
+    uint32_t crc;
+    std::memcpy(&crc, env.data(), sizeof(crc));
+    EXPECT_EQ(crc, utils::crc32(env.data() + 5, env.size() - 5));
+    EXPECT_NE(env.find(std::string("priority=2\0", 11)), std::string::npos);
+    EXPECT_NE(env.find(std::string("bootcmd=bootm\0", 14)),
+              std::string::npos);
+}
+
+/** @brief Make sure changes are not written without a valid environment,
+ *  which would drop the defaults U-Boot boots with */
+TEST_F(UbootEnvTest, TestNoValidBank)
+{
+    {
+        FileDevice device(_envFile, 2 * eraseSize, eraseSize,
+                          FileDevice::Type::nor);
+        device.erase(0, eraseSize);
+    }
+    auto before = readEnvFile();
+    auto env = openEnv();
+    EXPECT_FALSE(env->valid());
+    EXPECT_THROW(env->set("fieldmode", "true"), std::runtime_error);
+    EXPECT_EQ(readEnvFile(), before);
+}
+
+/** @brief Make sure setting a variable to its current value is not
+ *  written */
+TEST_F(UbootEnvTest, TestUnchangedNotWritten)
+{
+    openEnv()->set("openbmconce", "factory-reset");
+    auto before = readEnvFile();
+
+    openEnv()->set("openbmconce", "factory-reset");
+    EXPECT_EQ(readEnvFile(), before);
+}
+
+class KernelUbiDeviceTest : public testing::Test
+{
+  protected:
+    virtual void SetUp()
+    {
+        char sysfsDir[] = "./sysfsXXXXXX";
+        _directory = mkdtemp(sysfsDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+
+        // ubi1 on mtd5 with 128KiB eraseblocks, 10 of them free.
+        writeAttribute("ubi1/mtd_num", "5");
+        writeAttribute("ubi1/eraseblock_size", "131072");
+        writeAttribute("ubi1/avail_eraseblocks", "10");
+        addVolume(0, "rwfs", 48, "dynamic");
+        addVolume(2, "rofs-a1b2c3d4", 160, "static");
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    void writeAttribute(const std::string& path, const std::string& value)
+    {
+        auto file = fs::path(_directory) / path;
+        fs::create_directories(file.parent_path());
+        std::ofstream(file) << value << '\n';
+    }
+
+    void addVolume(int id, const std::string& name, int ebs,
+                   const std::string& type)
+    {
+        auto volume = "ubi1_" + std::to_string(id) + "/";
+        writeAttribute(volume + "name", name);
+        writeAttribute(volume + "reserved_ebs", std::to_string(ebs));
+        writeAttribute(volume + "usable_eb_size", "131072");
+        writeAttribute(volume + "type", type);
+    }
+
+    std::string _directory;
+};
+
+/** @brief Make sure the volumes are read from sysfs once */
+TEST_F(KernelUbiDeviceTest, TestSysfsIndex)
+{
+    EXPECT_EQ(KernelUbiDevice::findAttached(5, _directory), 1);
+    EXPECT_EQ(KernelUbiDevice::findAttached(4, _directory), -1);
+
+    KernelUbiDevice ubi(1, "bmc", _directory, _directory);
+    auto volumes = ubi.volumes();
+    ASSERT_EQ(volumes.size(), 2);
+    EXPECT_EQ(volumes[0].name, "rwfs");
+    EXPECT_EQ(volumes[0].size, 48 * 131072);
+    EXPECT_FALSE(volumes[0].isStatic);
+    EXPECT_EQ(volumes[1].id, 2);
+    EXPECT_TRUE(volumes[1].isStatic);
+    EXPECT_EQ(ubi.availableBytes(), 10 * 131072);
+
+    // Later lookups use the cached index.
+    addVolume(3, "kernel-a1b2c3d4", 32, "static");
+    EXPECT_FALSE(ubi.find("kernel-a1b2c3d4"));
+    EXPECT_TRUE(ubi.find("rofs-a1b2c3d4"));
+}
+
+/** @brief Make sure discarded and erased ranges of a file read as zeros */
+TEST(BlockDeviceTest, TestDiscardAndErase)
+{
+    char path[] = "./diskXXXXXX";
+    auto fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    std::ofstream(path, std::ios::binary) << std::string(64 * 1024, 'x');
+
+    {
+        BlockDevice disk(path);
+        disk.discard(4096, 8192, false);
+        disk.erase(32768, 512);
+        disk.discard(40960, 512, true);
+
+        std::vector<char> data(disk.size());
+        disk.read(0, data.data(), data.size());
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            bool cleared = (i >= 4096 && i < 12288) ||
+                           (i >= 32768 && i < 33280) ||
+                           (i >= 40960 && i < 41472);
+            ASSERT_EQ(data[i], cleared ? '\0' : 'x') << i;
+        }
+        EXPECT_EQ(disk.bytesErased(), 512);
+    }
+    fs::remove(path);
+}
+
+/** @brief Make sure a relabel updates both tables, and repairs a corrupt
+ *         primary table */
+TEST(GptTest, TestRename)
+{
+    char path[] = "./diskXXXXXX";
+    auto fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 4 * 1024 * 1024), 0);
+    close(fd);
+
+    {
+        BlockDevice disk(path);
+        Gpt::create(disk, {{"boot-a", 1024 * 1024}, {"rofs-a", 1024 * 1024}});
+
+        Gpt gpt(disk);
+        EXPECT_FALSE(gpt.rename(1, "rofs-a"));
+        EXPECT_TRUE(gpt.rename(1, "rofs-b"));
+        EXPECT_TRUE(gpt.find("rofs-b"));
+        EXPECT_THROW(gpt.rename(5, "rofs-b"), std::invalid_argument);
+
+        // The backup table has the new label too.
+        std::vector<char> zeros(Gpt::sectorSize, 0);
+        disk.write(Gpt::sectorSize, zeros.data(), zeros.size());
+        Gpt backup(disk);
+        ASSERT_TRUE(backup.find("rofs-b"));
+        EXPECT_EQ(backup.find("rofs-b")->index, 1);
+        EXPECT_TRUE(backup.find("boot-a"));
+
+        // Renaming from the backup table rewrites the primary one.
+        EXPECT_TRUE(backup.rename(0, "boot-b"));
+        disk.write(disk.size() - Gpt::sectorSize, zeros.data(), zeros.size());
+        Gpt primary(disk);
+        EXPECT_TRUE(primary.find("boot-b"));
+        EXPECT_TRUE(primary.find("rofs-b"));
+        EXPECT_EQ(primary.partitions().size(), 2);
+    }
+    fs::remove(path);
+}
+
+class UbootMirrorTest : public testing::Test
+{
+  protected:
+    static constexpr uint32_t eraseSize = 64 * 1024;
+    static constexpr uint64_t size = 4 * eraseSize;
+
+    /** @brief MTD partitions backed by files in the test directory */
+    class Devices : public FlashDevices
+    {
+      public:
+        explicit Devices(const std::string& dir) : dir(dir)
+        {}
+
+        FlashDevice& mtd(const std::string& name) override
+        {
+            auto& device = mtds[name];
+            if (!device)
+            {
+                device = std::make_unique<FileDevice>(
+                    dir + "/" + name, size, eraseSize, FileDevice::Type::nor);
+            }
+            return *device;
+        }
+
+        UbiDevice& ubi(const std::string& name) override
+        {
+            throw std::invalid_argument(name);
+        }
+
+        FlashDevice& disk(const std::string& name) override
+        {
+            throw std::invalid_argument(name);
+        }
+
+      private:
+        std::string dir;
+        std::map<std::string, std::unique_ptr<FileDevice>> mtds;
+    };
+
+    virtual void SetUp()
+    {
+        char mirrorDir[] = "./mirrorXXXXXX";
+        _directory = mkdtemp(mirrorDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+        _config.stateFile = _directory + "/state";
+
+        Devices devices(_directory);
+        for (const auto& name : {"u-boot", "u-boot-env"})
+        {
+            std::vector<uint8_t> data(size);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                data[i] = static_cast<uint8_t>(i * 13 + name[2]);
+            }
+            devices.mtd(name).erase(0, size);
+            devices.mtd(name).write(0, data.data(), data.size());
+        }
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    /** @brief Change a byte of a block of a partition */
+    void changeBlock(const std::string& name, uint64_t block)
+    {
+        Devices devices(_directory);
+        auto& device = devices.mtd(name);
+        std::vector<uint8_t> data(eraseSize);
+        device.read(block * eraseSize, data.data(), data.size());
+        data[100] ^= 0xFF;
+        device.erase(block * eraseSize, eraseSize);
+        device.write(block * eraseSize, data.data(), data.size());
+    }
+
+    std::string _directory;
+    UbootMirror::Config _config;
+};
+
+/** @brief Make sure only the blocks that differ are programmed */
+TEST_F(UbootMirrorTest, TestChangedBlocksOnly)
+{
+    {
+        Devices devices(_directory);
+        bool fixedUp = false;
+        EXPECT_TRUE(UbootMirror(devices, _config).mirror([&fixedUp]() {
+            fixedUp = true;
+        }));
+        EXPECT_TRUE(fixedUp);
+        EXPECT_EQ(devices.mtd("alt-u-boot").bytesWritten(), size);
+        EXPECT_EQ(devices.mtd("alt-u-boot-env").bytesWritten(), size);
+    }
+
+    changeBlock("u-boot", 2);
+    UbootMirror::sourceChanged(_config.stateFile);
+    {
+        Devices devices(_directory);
+        EXPECT_TRUE(UbootMirror(devices, _config).mirror());
+        EXPECT_EQ(devices.mtd("alt-u-boot").bytesWritten(), eraseSize);
+        EXPECT_EQ(devices.mtd("alt-u-boot-env").bytesWritten(), 0);
+
+        std::vector<uint8_t> source(size);
+        std::vector<uint8_t> copy(size);
+        devices.mtd("u-boot").read(0, source.data(), size);
+        devices.mtd("alt-u-boot").read(0, copy.data(), size);
+        EXPECT_EQ(source, copy);
+    }
+}
+
+/** @brief Make sure the chips are only compared again when u-boot was
+ *         programmed or the first blocks changed */
+TEST_F(UbootMirrorTest, TestRecordSkipsCompare)
+{
+    {
+        Devices devices(_directory);
+        EXPECT_TRUE(UbootMirror(devices, _config).mirror());
+    }
+
+    // The record is trusted as long as the first blocks match it.
+    changeBlock("alt-u-boot", 3);
+    {
+        Devices devices(_directory);
+        EXPECT_FALSE(UbootMirror(devices, _config).mirror());
+        EXPECT_EQ(devices.mtd("alt-u-boot").bytesWritten(), 0);
+    }
+
+    changeBlock("alt-u-boot", 0);
+    {
+        Devices devices(_directory);
+        EXPECT_TRUE(UbootMirror(devices, _config).mirror());
+        EXPECT_EQ(devices.mtd("alt-u-boot").bytesWritten(), 2 * eraseSize);
+    }
+}
+
+/** @brief Make sure an update of the environment waits for its copy on the
+ *         alt chip to be made and fixed up */
+TEST_F(UbootMirrorTest, TestEnvWrittenDuringMirror)
+{
+    auto openEnv = [this](const std::string& name) {
+        std::vector<EnvBank> banks;
+        banks.push_back({std::make_unique<FileDevice>(_directory + "/" + name,
+                                                      size, eraseSize,
+                                                      FileDevice::Type::nor),
+                         0, eraseSize});
+        return std::make_unique<UbootEnv>(std::move(banks));
+    };
+
+    std::vector<uint8_t> env(eraseSize, 0);
+    std::string defaults = "bootcmd=bootm";
+    std::copy(defaults.begin(), defaults.end(), env.begin() + 4);
+    uint32_t crc = utils::crc32(env.data() + 4, env.size() - 4);
+    std::memcpy(env.data(), &crc, sizeof(crc));
+    {
+        Devices devices(_directory);
+        devices.mtd("u-boot-env").erase(0, eraseSize);
+        devices.mtd("u-boot-env").write(0, env.data(), env.size());
+    }
+
+    Devices devices(_directory);
+    std::future<void> update;
+    EXPECT_TRUE(UbootMirror(devices, _config).mirror([&]() {
+        update = std::async(std::launch::async, [&openEnv]() {
+            openEnv("u-boot-env")->set("bootcmd", "run bootb");
+        });
+        EXPECT_EQ(update.wait_for(std::chrono::milliseconds(100)),
+                  std::future_status::timeout);
+    }));
+    update.get();
+
+    EXPECT_EQ(openEnv("alt-u-boot-env")->get("bootcmd"), "bootm");
+    EXPECT_EQ(openEnv("u-boot-env")->get("bootcmd"), "run bootb");
+}
+
+/** @brief Make sure a write plan holds the blocks that differ, and that
+ *         only they are programmed */
+TEST(WritePlanTest, TestChangedBlocksOnly)
+{
+    char planDir[] = "./planXXXXXX";
+    std::string directory = mkdtemp(planDir);
+    ASSERT_FALSE(directory.empty());
+
+    constexpr uint32_t eraseSize = 4096;
+    std::vector<uint8_t> data(6 * eraseSize + eraseSize / 2);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 7);
+    }
+    {
+        FileDevice device(directory + "/mtd", 8 * eraseSize, eraseSize,
+                          FileDevice::Type::nor);
+        device.write(0, data.data(), data.size());
+    }
+
+    for (auto block : {1, 2, 5})
+    {
+        data[block * eraseSize + 10] ^= 0xFF;
+    }
+    auto image = directory + "/image";
+    std::ofstream(image, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    {
+        FileDevice device(directory + "/mtd", 8 * eraseSize, eraseSize,
+                          FileDevice::Type::nor);
+        FileSource compared(image);
+        auto plan = planWrite(device, compared);
+        std::vector<std::pair<uint64_t, uint64_t>> ranges = {
+            {eraseSize, 2 * eraseSize}, {5 * eraseSize, eraseSize}};
+        EXPECT_EQ(plan.ranges, ranges);
+        EXPECT_EQ(plan.imageSize, data.size());
+
+        plan.store(directory + "/image.plan");
+        auto stored = WritePlan::load(directory + "/image.plan");
+        ASSERT_TRUE(stored);
+        EXPECT_EQ(stored->blockSize, eraseSize);
+        EXPECT_EQ(stored->ranges, ranges);
+
+        FileSource source(image);
+        writeImage(device, source, true, nullptr, &*stored);
+        EXPECT_EQ(device.bytesWritten(), 3 * eraseSize);
+
+        std::vector<uint8_t> written(data.size());
+        device.read(0, written.data(), written.size());
+        EXPECT_EQ(written, data);
+
+        FileSource again(image);
+        EXPECT_TRUE(planWrite(device, again).ranges.empty());
+    }
+    fs::remove_all(directory);
+}
+
+/** @brief Make sure the readback finds the image that differs from what
+ *         was written, as it is committed */
+TEST(ReadbackVerifierTest, TestMismatch)
+{
+    char path[] = "./readbackXXXXXX";
+    auto fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    std::vector<uint8_t> data(3 * 1024 * 1024 + 100);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 17);
+    }
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    FileSource file(path);
+    DigestSource source(file);
+    std::vector<uint8_t> buffer(data.size());
+    while (source.read(buffer.data(), buffer.size()))
+    {}
+    ReadbackVerifier::Digest digest{};
+    SHA256(data.data(), data.size(), digest.data());
+    EXPECT_EQ(source.digest(), digest);
+    fs::remove(path);
+
+    auto corrupt = data;
+    corrupt[2 * 1024 * 1024 + 5] ^= 0x10;
+    auto reader = [](const std::vector<uint8_t>& device) {
+        return [&device](uint64_t offset, void* out, size_t length) {
+            std::memcpy(out, device.data() + offset, length);
+        };
+    };
+
+    {
+        ReadbackVerifier verifier;
+        auto id = verifier.add("good", reader(data));
+        for (uint64_t done = 0; done < data.size(); done += 64 * 1024)
+        {
+            verifier.committed(id, done);
+        }
+        verifier.completed(id, data.size(), digest);
+        auto results = verifier.wait();
+        ASSERT_EQ(results.size(), 1);
+        EXPECT_EQ(results[0].name, "good");
+        EXPECT_EQ(results[0].size, data.size());
+    }
+
+    ReadbackVerifier verifier;
+    verifier.completed(verifier.add("good", reader(data)), data.size(),
+                       digest);
+    verifier.completed(verifier.add("bad", reader(corrupt)), data.size(),
+                       digest);
+    EXPECT_THROW(verifier.wait(), std::runtime_error);
+}
+
+/** @brief Make sure a cancelled write resumes after the checkpoint, and
+ *         that an image that changed meanwhile is not resumed */
+TEST(WriteCheckpointTest, TestResume)
+{
+    char checkpointDir[] = "./checkpointXXXXXX";
+    std::string directory = mkdtemp(checkpointDir);
+    ASSERT_FALSE(directory.empty());
+
+    constexpr uint64_t mib = 1024 * 1024;
+    std::vector<uint8_t> data(10 * mib + 100);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 13);
+    }
+    auto image = directory + "/image";
+    std::ofstream(image, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+    auto file = directory + "/checkpoint";
+
+    {
+        FileDevice device(directory + "/mmc", 16 * mib, 4096,
+                          FileDevice::Type::block);
+        WriteCheckpoint checkpoint(file, "1234");
+        FileSource source(image);
+        EXPECT_THROW(writeImage(device, source, false,
+                                [](uint64_t done, uint64_t) {
+                                    if (done >= 6 * mib)
+                                    {
+                                        throw WriteCancelled("Cancelled");
+                                    }
+                                },
+                                nullptr, &checkpoint),
+                     WriteCancelled);
+    }
+
+    {
+        FileDevice device(directory + "/mmc", 16 * mib, 4096,
+                          FileDevice::Type::block);
+        WriteCheckpoint checkpoint(file, "1234");
+        EXPECT_EQ(checkpoint.committed(device.name()), 4 * mib);
+        FileSource source(image);
+        writeImage(device, source, false, nullptr, nullptr, &checkpoint);
+        EXPECT_EQ(device.bytesWritten(), data.size() - 4 * mib);
+
+        std::vector<uint8_t> written(data.size());
+        device.read(0, written.data(), written.size());
+        EXPECT_EQ(written, data);
+    }
+
+    // Another version does not resume, nor does another image.
+    EXPECT_EQ(WriteCheckpoint(file, "5678").committed("mmc"), 0);
+    data[10] ^= 0xFF;
+    std::ofstream(image, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+    {
+        FileDevice device(directory + "/mmc", 16 * mib, 4096,
+                          FileDevice::Type::block);
+        WriteCheckpoint checkpoint(file, "1234");
+        FileSource source(image);
+        EXPECT_THROW(writeImage(device, source, false, nullptr, nullptr,
+                                &checkpoint),
+                     std::runtime_error);
+        EXPECT_EQ(checkpoint.committed(device.name()), 0);
+    }
+    fs::remove_all(directory);
+}
+
+/** @brief Make sure a partition is only deemed to hold an image recorded
+ *         for it that its start matches */
+TEST(ContentDigestsTest, TestHolds)
+{
+    char digestDir[] = "./digestXXXXXX";
+    std::string directory = mkdtemp(digestDir);
+    ASSERT_FALSE(directory.empty());
+
+    std::vector<uint8_t> data(2 * 1024 * 1024 + 100);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 11);
+    }
+    auto image = directory + "/image";
+    std::ofstream(image, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+    ContentDigests::Digest digest{};
+    SHA256(data.data(), data.size(), digest.data());
+
+    FileDevice device(directory + "/mmc", 4 * 1024 * 1024, 4096,
+                      FileDevice::Type::block);
+    auto reader = [&device](uint64_t offset, void* out, size_t length) {
+        device.read(offset, out, length);
+    };
+    auto file = directory + "/digests";
+    {
+        FileSource source(image);
+        writeImage(device, source, false);
+        ContentDigests digests(file);
+        FileSource unrecorded(image);
+        EXPECT_FALSE(digests.holds("mmc", unrecorded, reader));
+        digests.written("mmc", data.size(), digest);
+    }
+
+    ContentDigests digests(file);
+    FileSource source(image);
+    EXPECT_TRUE(digests.holds("mmc", source, reader));
+
+    // Another tool overwrote the partition.
+    device.erase(0, 4096);
+    FileSource overwritten(image);
+    EXPECT_FALSE(digests.holds("mmc", overwritten, reader));
+
+    digests.changing("mmc");
+    EXPECT_FALSE(ContentDigests(file).holds("mmc", source, reader));
+    fs::remove_all(directory);
+}
+
+/** @brief Make sure the progress follows the bytes, and that the values
+ *         are only due once a second and at the end */
+TEST(ProgressMeterTest, TestPacing)
+{
+    using namespace std::chrono_literals;
+    constexpr uint64_t mib = 1024 * 1024;
+    ProgressMeter meter(10, 90);
+    ProgressMeter::Clock::time_point start{};
+
+    EXPECT_TRUE(meter.update(0, 100 * mib, start));
+    EXPECT_EQ(meter.progress(), 10);
+    EXPECT_EQ(meter.bytesPerSecond(), 0);
+    EXPECT_EQ(meter.secondsRemaining(), 0);
+
+    // 10 MiB/s, in updates every 100ms.
+    for (int i = 1; i < 10; i++)
+    {
+        EXPECT_FALSE(meter.update(i * mib, 100 * mib, start + i * 100ms));
+    }
+    EXPECT_TRUE(meter.update(10 * mib, 100 * mib, start + 1s));
+    EXPECT_EQ(meter.progress(), 18);
+    EXPECT_EQ(meter.bytesPerSecond(), 10 * mib);
+    EXPECT_EQ(meter.secondsRemaining(), 9);
+
+    EXPECT_FALSE(meter.update(50 * mib, 100 * mib, start + 1500ms));
+    EXPECT_TRUE(meter.update(100 * mib, 100 * mib, start + 1600ms));
+    EXPECT_EQ(meter.progress(), 90);
+    EXPECT_EQ(meter.secondsRemaining(), 0);
+}
+
+/** @brief Make sure a handler can remove itself and the handlers after it
+ *         while they are called */
+TEST(SignalRouterTest, TestDispatchRemoval)
+{
+    using Handlers = std::map<uint64_t, std::function<void(int)>>;
+    std::unordered_map<std::string, Handlers> handlers;
+    std::vector<std::string> calls;
+    handlers["unit"][0] = [&](int value) {
+        calls.push_back("first " + std::to_string(value));
+        internal::removeHandler(handlers, "unit", 0);
+        internal::removeHandler(handlers, "unit", 2);
+    };
+    handlers["unit"][1] = [&](int value) {
+        calls.push_back("second " + std::to_string(value));
+    };
+    handlers["unit"][2] = [&](int) { calls.push_back("third"); };
+
+    internal::dispatch(handlers, "unit", 1);
+    EXPECT_EQ(calls, (std::vector<std::string>{"first 1", "second 1"}));
+
+    internal::dispatch(handlers, "unit", 2);
+    internal::dispatch(handlers, "other", 3);
+    EXPECT_EQ(calls.size(), 3);
+    EXPECT_EQ(calls.back(), "second 2");
+
+    // The key goes with its last handler.
+    internal::removeHandler(handlers, "unit", 1);
+    EXPECT_TRUE(handlers.empty());
+}
+
+/** @brief Make sure the signals of one iteration are coalesced */
+TEST(DeferredSignalsTest, TestCoalescing)
+{
+    DeferredSignals signals;
+    const std::string path = "/xyz/openbmc_project/software/a1b2c3d4";
+    const std::string activation = "xyz.openbmc_project.Software.Activation";
+    const std::string progress =
+        "xyz.openbmc_project.Software.ActivationProgress";
+    const std::string priority =
+        "xyz.openbmc_project.Software.RedundancyPriority";
+
+    // An interface added and removed again is never announced.
+    signals.interfaceAdded(path, progress.c_str());
+    signals.propertyChanged(path, progress.c_str(), "Progress");
+    signals.interfaceRemoved(path, progress.c_str());
+
+    // The changes of a new interface go with its InterfacesAdded.
+    signals.interfaceAdded(path, priority.c_str());
+    signals.propertyChanged(path, priority.c_str(), "Priority");
+
+    // The changes of an interface are merged.
+    signals.propertyChanged(path, activation.c_str(), "Activation");
+    signals.propertyChanged(path, activation.c_str(), "RequestedActivation");
+    signals.propertyChanged(path, activation.c_str(), "Activation");
+
+    auto pending = signals.take();
+    ASSERT_EQ(pending.size(), 1);
+    const auto& object = pending.at(path);
+    EXPECT_TRUE(object.removed.empty());
+    EXPECT_EQ(object.added, std::set<std::string>{priority});
+    ASSERT_EQ(object.changed.size(), 1);
+    EXPECT_EQ(object.changed.at(activation),
+              (std::set<std::string>{"Activation", "RequestedActivation"}));
+    EXPECT_TRUE(signals.take().empty());
+}
+
+class ZstdSourceTest : public testing::Test
+{
+  protected:
+    virtual void SetUp()
+    {
+        char imageDir[] = "./imageXXXXXX";
+        _directory = mkdtemp(imageDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+
+        // 3MiB of data that compresses, but not to nothing.
+        for (size_t i = 0; i < 3 * 1024 * 1024; i++)
+        {
+            _data.push_back(static_cast<uint8_t>((i * 7) ^ (i >> 12)));
+        }
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    /** @brief Compress the data into a file, one frame per part */
+    fs::path compress(size_t parts)
+    {
+        std::vector<uint8_t> file;
+        auto partSize = _data.size() / parts;
+        for (size_t i = 0; i < parts; i++)
+        {
+            auto length = i + 1 == parts ? _data.size() - i * partSize
+                                         : partSize;
+            std::vector<uint8_t> frame(ZSTD_compressBound(length));
+            auto size = ZSTD_compress(frame.data(), frame.size(),
+                                      _data.data() + i * partSize, length, 1);
+            file.insert(file.end(), frame.begin(), frame.begin() + size);
+        }
+
+        auto path = fs::path(_directory) / "image-rofs";
+        std::ofstream(path, std::ios::binary)
+            .write(reinterpret_cast<const char*>(file.data()), file.size());
+        return path;
+    }
+
+    std::vector<uint8_t> readAll(ImageSource& source)
+    {
+        std::vector<uint8_t> result;
+        std::vector<uint8_t> buffer(100000);
+        while (auto length = source.read(buffer.data(), buffer.size()))
+        {
+            result.insert(result.end(), buffer.begin(),
+                          buffer.begin() + length);
+        }
+        return result;
+    }
+
+    std::string _directory;
+    std::vector<uint8_t> _data;
+};
+
+/** @brief Make sure the frames are read back in order */
+TEST_F(ZstdSourceTest, TestFramesInOrder)
+{
+    for (size_t parts : {1, 5})
+    {
+        auto path = compress(parts);
+        EXPECT_TRUE(ZstdSource::isCompressed(path));
+
+        ZstdSource source(path, 3);
+        EXPECT_EQ(source.size(), _data.size());
+        EXPECT_EQ(readAll(source), _data);
+    }
+}
+
+/** @brief Make sure a truncated image is reported */
+TEST_F(ZstdSourceTest, TestTruncatedImage)
+{
+    auto path = compress(2);
+    fs::resize_file(path, fs::file_size(path) - 10);
+    EXPECT_THROW(
+        {
+            ZstdSource source(path);
+            readAll(source);
+        },
+        std::runtime_error);
+
+    auto plain = fs::path(_directory) / "image-kernel";
+    std::ofstream(plain) << "not compressed";
+    EXPECT_FALSE(ZstdSource::isCompressed(plain));
+}
+
+class DeltaSourceTest : public testing::Test
+{
+  protected:
+    virtual void SetUp()
+    {
+        char deltaDir[] = "./deltaXXXXXX";
+        _directory = mkdtemp(deltaDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+
+        for (size_t i = 0; i < 256 * 1024; i++)
+        {
+            _base.push_back(static_cast<uint8_t>(i * 31 ^ (i >> 9)));
+        }
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    /** @brief Write a delta of the given commands, which are copies from
+     *         the base or literal data, for an image with the given digest
+     */
+    fs::path writeDelta(
+        const std::vector<std::pair<uint64_t, std::vector<uint8_t>>>& commands,
+        const std::vector<uint8_t>& digest)
+    {
+        std::vector<uint8_t> delta(DeltaSource::magic.begin(),
+                                   DeltaSource::magic.end());
+        auto append = [&delta](const void* data, size_t length) {
+            auto bytes = static_cast<const uint8_t*>(data);
+            delta.insert(delta.end(), bytes, bytes + length);
+        };
+
+        uint64_t size = 0;
+        for (const auto& [offset, data] : commands)
+        {
+            size += data.size();
+        }
+        append(&size, sizeof(size));
+        append(digest.data(), digest.size());
+        for (const auto& [offset, data] : commands)
+        {
+            bool copy = offset != UINT64_MAX;
+            uint32_t type = copy ? DeltaSource::copyCommand
+                                 : DeltaSource::dataCommand;
+            uint32_t reserved = 0;
+            uint64_t from = copy ? offset : 0;
+            uint64_t length = data.size();
+            append(&type, sizeof(type));
+            append(&reserved, sizeof(reserved));
+            append(&from, sizeof(from));
+            append(&length, sizeof(length));
+            if (!copy)
+            {
+                append(data.data(), data.size());
+            }
+        }
+
+        auto path = fs::path(_directory) / "image-rofs.delta";
+        std::ofstream(path, std::ios::binary)
+            .write(reinterpret_cast<const char*>(delta.data()), delta.size());
+        return path;
+    }
+
+    std::vector<uint8_t> rebuild(const fs::path& path)
+    {
+        DeltaSource source(
+            path,
+            [this](uint64_t offset, void* data, size_t length) {
+                std::memcpy(data, _base.data() + offset, length);
+            },
+            _base.size());
+        std::vector<uint8_t> image(source.size());
+        size_t done = 0;
+        while (auto length = source.read(image.data() + done, 4096))
+        {
+            done += length;
+        }
+        EXPECT_EQ(done, image.size());
+        return image;
+    }
+
+    static std::vector<uint8_t> sha256(const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> digest(SHA256_DIGEST_LENGTH);
+        SHA256(data.data(), data.size(), digest.data());
+        return digest;
+    }
+
+    std::string _directory;
+    std::vector<uint8_t> _base;
+};
+
+/** @brief Make sure an image is rebuilt from copies and literal data */
+TEST_F(DeltaSourceTest, TestRebuild)
+{
+    // The second half of the base, new data, then the first block again.
+    std::vector<uint8_t> second(_base.begin() + 128 * 1024, _base.end());
+    std::vector<uint8_t> literal(10000, 0x5A);
+    std::vector<uint8_t> first(_base.begin(), _base.begin() + 4096);
+    std::vector<uint8_t> image = second;
+    image.insert(image.end(), literal.begin(), literal.end());
+    image.insert(image.end(), first.begin(), first.end());
+
+    auto path = writeDelta(
+        {{128 * 1024, second}, {UINT64_MAX, literal}, {0, first}},
+        sha256(image));
+    EXPECT_TRUE(DeltaSource::isDelta(path));
+    EXPECT_EQ(rebuild(path), image);
+}
+
+/** @brief Make sure a rebuilt image that does not match its digest, or a
+ *         delta reaching past the base, fails */
+TEST_F(DeltaSourceTest, TestBadDelta)
+{
+    std::vector<uint8_t> literal(10000, 0x5A);
+    auto digest = sha256(literal);
+    digest[0] ^= 1;
+    EXPECT_THROW(rebuild(writeDelta({{UINT64_MAX, literal}}, digest)),
+                 std::runtime_error);
+
+    std::vector<uint8_t> past(4096);
+    EXPECT_THROW(rebuild(writeDelta({{_base.size() - 1024, past}},
+                                    sha256(past))),
+                 std::runtime_error);
+}
+
+class PersistentStateTest : public testing::Test
+{
+  protected:
+    virtual void SetUp()
+    {
+        char stateDir[] = "./stateXXXXXX";
+        _directory = mkdtemp(stateDir);
+
+        if (_directory.empty())
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    virtual void TearDown()
+    {
+        fs::remove_all(_directory);
+    }
+
+    std::string _directory;
+};
+
+/** @brief Make sure committed changes are read back from a single file */
+TEST_F(PersistentStateTest, TestCommitAndReadBack)
+{
+    {
+        PersistentState state(_directory);
+        state.setPriority("a1b2c3d4", 0);
+        state.setPriority("e5f6a7b8", 1);
+        state.setPurpose("a1b2c3d4", 2);
+        state.commit();
+    }
+
+    PersistentState state(_directory);
+    EXPECT_EQ(state.priority("a1b2c3d4"), 0);
+    EXPECT_EQ(state.priority("e5f6a7b8"), 1);
+    EXPECT_EQ(state.purpose("a1b2c3d4"), 2);
+    EXPECT_EQ(state.purpose("e5f6a7b8"), std::nullopt);
+    EXPECT_EQ(state.priority("missing"), std::nullopt);
+
+    // Nothing but the state file is left in the directory.
+    auto entries = std::distance(fs::directory_iterator(_directory),
+                                 fs::directory_iterator{});
+    EXPECT_EQ(entries, 1);
+
+    state.remove("e5f6a7b8");
+    state.commit();
+    EXPECT_EQ(PersistentState(_directory).priority("e5f6a7b8"), std::nullopt);
+}
+
+/** @brief Make sure the per version files are migrated and removed, and
+ *  that other files in the version directories are kept */
+TEST_F(PersistentStateTest, TestMigrateLegacyFiles)
+{
+    auto versionDir = fs::path(_directory) / "a1b2c3d4";
+    fs::create_directories(versionDir);
+    std::ofstream(versionDir / "priority") << "{\n    \"priority\": 3\n}\n";
+    std::ofstream(versionDir / "purpose") << "{\n    \"purpose\": 1\n}\n";
+    std::ofstream(versionDir / "partlabel") << "b";
+
+    PersistentState state(_directory);
+    EXPECT_EQ(state.priority("a1b2c3d4"), 3);
+    EXPECT_EQ(state.purpose("a1b2c3d4"), 1);
+
+    EXPECT_FALSE(fs::exists(versionDir / "priority"));
+    EXPECT_FALSE(fs::exists(versionDir / "purpose"));
+    EXPECT_TRUE(fs::exists(versionDir / "partlabel"));
+    EXPECT_EQ(PersistentState(_directory).priority("a1b2c3d4"), 3);
+}
+
+/** @brief Make sure a corrupt state file is ignored */
+TEST_F(PersistentStateTest, TestCorruptFileIgnored)
+{
+    {
+        PersistentState state(_directory);
+        state.setPriority("a1b2c3d4", 0);
+        state.commit();
+    }
+    {
+        std::fstream f(fs::path(_directory) / PersistentState::fileName,
+                       std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(6);
+        f.put('X');
+    }
+    EXPECT_EQ(PersistentState(_directory).priority("a1b2c3d4"), std::nullopt);
+}
+
+/** @brief Make sure the inventory snapshot is read back, and that the
+ *  generation of the mounts changes when a version is mounted */
+TEST_F(PersistentStateTest, TestInventorySnapshot)
+{
+    auto media = fs::path(_directory) / "media";
+    auto prefix = (media / "rofs-").string();
+    fs::create_directories(media / "rofs-a1b2c3d4/etc");
+    std::ofstream(media / "rofs-a1b2c3d4/etc/os-release")
+        << "VERSION_ID=\"2.9.0\"\n";
+    auto generation = mediaGeneration(media, prefix, "/etc/os-release");
+
+    InventorySnapshot snapshot;
+    snapshot.generation = generation;
+    snapshot.bmcInventoryPath = "/xyz/openbmc_project/inventory/system/bmc";
+    snapshot.versions.push_back({"a1b2c3d4", "2.9.0", "", prefix + "a1b2c3d4"});
+    snapshot.save(fs::path(_directory) / "inventory");
+
+    auto restored = InventorySnapshot::load(fs::path(_directory) / "inventory");
+    ASSERT_TRUE(restored);
+    EXPECT_EQ(restored->generation, generation);
+    EXPECT_EQ(restored->bmcInventoryPath, snapshot.bmcInventoryPath);
+    ASSERT_EQ(restored->versions.size(), 1);
+    EXPECT_EQ(restored->versions[0].version, "2.9.0");
+    EXPECT_EQ(restored->versions[0].mountPath, prefix + "a1b2c3d4");
+
+    EXPECT_EQ(mediaGeneration(media, prefix, "/etc/os-release"), generation);
+    fs::create_directories(media / "rofs-e5f6a7b8/etc");
+    EXPECT_NE(mediaGeneration(media, prefix, "/etc/os-release"), generation);
+}
@@ -1,6 +1,15 @@
 #include "config.h"
 
 #include "activation.hpp"
+#include "flash_backend.hpp"
+#include "item_updater.hpp"
+#include "uboot_env.hpp"
+
+#include <phosphor-logging/log.hpp>
+
+#include <filesystem>
+#include <map>
+#include <memory>
 
 namespace phosphor
 {
@@ -11,85 +20,196 @@ namespace updater
 
 namespace softwareServer = sdbusplus::xyz::openbmc_project::Software::server;
 
-void Activation::flashWrite()
-{
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append("obmc-flash-bmc-ubirw.service", "replace");
-    bus.call_noreply(method);
-
-    auto roServiceFile = "obmc-flash-bmc-ubiro@" + versionId + ".service";
-    method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                 SYSTEMD_INTERFACE, "StartUnit");
-    method.append(roServiceFile, "replace");
-    bus.call_noreply(method);
-
-    return;
-}
+using namespace phosphor::logging;
+namespace fs = std::filesystem;
 
-void Activation::onStateChanges(sdbusplus::message::message& msg)
+namespace
 {
-    uint32_t newStateID{};
-    sdbusplus::message::object_path newStateObjPath;
-    std::string newStateUnit{};
-    std::string newStateResult{};
-
-    // Read the msg and populate each variable
-    msg.read(newStateID, newStateObjPath, newStateUnit, newStateResult);
 
-    auto rwServiceFile = "obmc-flash-bmc-ubirw.service";
-    auto roServiceFile = "obmc-flash-bmc-ubiro@" + versionId + ".service";
-    auto ubootVarsServiceFile =
-        "obmc-flash-bmc-updateubootvars@" + versionId + ".service";
+/** @brief The progress of the activation before and after the volumes are
+ *         written */
+constexpr uint8_t writeStartProgress = 10;
+constexpr uint8_t writeEndProgress = 90;
 
-    if (newStateUnit == rwServiceFile && newStateResult == "done")
+/** @brief The configuration of the UBI layout, from the build options */
+UbiBackend::Config backendConfig(const std::string& runningVersionId)
+{
+    UbiBackend::Config config;
+    config.rwMtd = UBI_RW_MTD;
+    config.rwSize = std::stoull(UBI_RW_SIZE, nullptr, 0);
+
+    // Either one partition or two, as "bmc+alt-bmc".
+    std::string ro = UBI_RO_MTD;
+    auto plus = ro.find('+');
+    config.roMtd = ro.substr(0, plus);
+    config.roMtdAlt =
+        plus == std::string::npos ? config.roMtd : ro.substr(plus + 1);
+
+    config.runningVersionId = runningVersionId;
+    if (!MtdDevice::find("alt-bmc").empty())
     {
-        rwVolumeCreated = true;
-        activationProgress->progress(activationProgress->progress() + 20);
+        config.kernelMirrorMtd = "alt-bmc";
     }
+    config.ubootMtd = "u-boot";
+    config.checkpointFile = fs::path(PERSIST_DIR) / WriteCheckpoint::fileName;
+    config.digestFile = fs::path(PERSIST_DIR) / ContentDigests::fileName;
+    return config;
+}
 
-    if (newStateUnit == roServiceFile && newStateResult == "done")
-    {
-        roVolumeCreated = true;
-        activationProgress->progress(activationProgress->progress() + 50);
-    }
+} // namespace
 
-    if (newStateUnit == ubootVarsServiceFile && newStateResult == "done")
+void Activation::flashWrite()
+{
+    std::string runningVersionId;
+    for (const auto& [id, version] : parent.versions)
     {
-        ubootEnvVarsUpdated = true;
+        if (version->isFunctional())
+        {
+            runningVersionId = id;
+        }
     }
 
-    if (newStateUnit == rwServiceFile || newStateUnit == roServiceFile ||
-        newStateUnit == ubootVarsServiceFile)
-    {
-        if (newStateResult == "failed" || newStateResult == "dependency")
+    auto imageDir = fs::path(IMG_UPLOAD_DIR) / versionId;
+    auto config = backendConfig(runningVersionId);
+    auto removed = std::make_shared<std::vector<std::string>>();
+    auto verified = std::make_shared<std::map<std::string, uint64_t>>();
+
+    auto work = [imageDir, versionId = versionId, config, removed,
+                 verified](const ProgressCallback& progress) {
+        backupEnvToAlt();
+
+        SystemFlashDevices devices;
+        UbiBackend backend(devices, config);
+
+        // Have the next mirror compare u-boot with the alt chip again, even
+        // when the write failed past programming it.
+        auto ubootChanged = [&backend]() {
+            if (backend.ubootProgrammed())
+            {
+                UbootMirror::sourceChanged(fs::path(PERSIST_DIR) /
+                                           UbootMirror::stateFileName);
+            }
+        };
+        try
         {
-            Activation::activation(
-                softwareServer::Activation::Activations::Failed);
+            backend.write(imageDir, versionId, progress);
         }
-        else if (rwVolumeCreated && roVolumeCreated) // Volumes were created
+        catch (const std::exception&)
+        {
+            ubootChanged();
+            throw;
+        }
+        ubootChanged();
+        *removed = backend.removedVersions();
+        for (const auto& image : backend.readback())
+        {
+            log<level::INFO>("Read back the image",
+                             entry("VERSIONID=%s", versionId.c_str()),
+                             entry("IMAGE=%s", image.name.c_str()),
+                             entry("SIZE=%s",
+                                   std::to_string(image.size).c_str()));
+            (*verified)[image.name] = image.size;
+        }
+    };
+
+    auto onProgress = [this](uint64_t done, uint64_t total) {
+        if (activationProgress)
+        {
+            activationProgress->bytesWritten(done, total, writeStartProgress,
+                                             writeEndProgress);
+        }
+    };
+
+    auto onDone = [this, removed, verified](std::exception_ptr error) {
+        if (error)
         {
-            if (!ubootEnvVarsUpdated)
+            try
             {
-                activationProgress->progress(90);
-
-                // Set the priority which triggers the service that updates the
-                // environment variables.
-                if (!Activation::redundancyPriority)
-                {
-                    Activation::redundancyPriority =
-                        std::make_unique<RedundancyPriority>(bus, path, *this,
-                                                             0);
-                }
+                std::rethrow_exception(error);
             }
-            else // Environment variables were updated
+            catch (const std::exception& e)
             {
-                Activation::onFlashWriteSuccess();
+                log<level::ERR>("Failed to write the UBI volumes",
+                                entry("VERSIONID=%s", versionId.c_str()),
+                                entry("ERROR=%s", e.what()));
             }
+            Activation::activation(
+                softwareServer::Activation::Activations::Failed);
+            return;
         }
+        activationReadback =
+            std::make_unique<ActivationReadback>(bus, path, *verified);
+        onVolumesWritten(*removed);
+    };
+
+    try
+    {
+        flashJob = std::make_unique<FlashJob>(sd_bus_get_event(bus.get()),
+                                              std::move(work),
+                                              std::move(onProgress),
+                                              std::move(onDone));
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to start writing the UBI volumes",
+                        entry("ERROR=%s", e.what()));
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+    }
+}
+
+void Activation::onVolumesWritten(const std::vector<std::string>& removed)
+{
+    // Record the size of the rwfs volume and drop the priorities of the
+    // versions removed to make room, like ubi_rw and ubi_remove_volumes do.
+    UbootEnv::Changes changes{{"rwfs_size", std::string{UBI_RW_SIZE}}};
+    for (const auto& version : removed)
+    {
+        changes.emplace(version, std::nullopt);
+    }
+    try
+    {
+        getSystemEnv().apply(changes);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to update the U-Boot environment",
+                        entry("ERROR=%s", e.what()));
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+        return;
     }
 
-    return;
+    activationProgress->progress(writeEndProgress);
+
+    // Set the priority, which updates the environment variables in place.
+    if (!Activation::redundancyPriority)
+    {
+        Activation::redundancyPriority =
+            std::make_unique<RedundancyPriority>(bus, path, *this, 0);
+    }
+    try
+    {
+        ubootEnvVarsUpdated =
+            getSystemEnv().get("kernelname") == "kernel-" + versionId;
+    }
+    catch (const std::exception& e)
+    {
+        ubootEnvVarsUpdated = false;
+    }
+
+    if (ubootEnvVarsUpdated)
+    {
+        Activation::onFlashWriteSuccess();
+    }
+    else
+    {
+        Activation::activation(softwareServer::Activation::Activations::Failed);
+    }
+}
+
+void Activation::onStateChanges(const JobRemoved& /* job */)
+{
+    // The volumes are written in process, no unit of this layout is
+    // watched.
 }
 
 } // namespace updater
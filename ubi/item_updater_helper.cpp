@@ -2,10 +2,15 @@
 
 #include "item_updater_helper.hpp"
 
-#include "utils.hpp"
+#include "async_call.hpp"
+#include "flash_backend.hpp"
+#include "uboot_env.hpp"
 
 #include <phosphor-logging/log.hpp>
-#include <sdbusplus/exception.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
 
 namespace phosphor
 {
@@ -15,41 +20,112 @@ namespace updater
 {
 
 using namespace phosphor::logging;
-using sdbusplus::exception::SdBusError;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/** @brief Find a UBI volume by name
+ *
+ *  @param[in] name - The volume name
+ *
+ *  @return The volume, e.g. "ubi0_3", or an empty string if not found
+ */
+std::string findUbiVolume(const std::string& name)
+{
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/sys/class/ubi", ec))
+    {
+        auto volume = entry.path().filename().string();
+        if (volume.find('_') == std::string::npos)
+        {
+            continue;
+        }
+        std::ifstream file(entry.path() / "name");
+        std::string volumeName;
+        if (std::getline(file, volumeName) && volumeName == name)
+        {
+            return volume;
+        }
+    }
+    return {};
+}
+
+/** @brief The variables U-Boot boots a version from, the same ones the
+ *         obmc-flash-bmc updateubootvars service sets
+ *
+ *  @param[in] versionId - The version id of the image
+ */
+UbootEnv::Changes bootVariables(const std::string& versionId)
+{
+    auto volume = findUbiVolume("rofs-" + versionId);
+    if (volume.empty())
+    {
+        throw std::runtime_error("No rofs volume for " + versionId);
+    }
+    auto block = "/dev/ubiblock" + volume.substr(3);
+    if (!fs::exists(block))
+    {
+        throw std::runtime_error("No block device " + block);
+    }
+
+    auto ubiblock = volume.substr(3);
+    ubiblock[ubiblock.find('_')] = ',';
+    return {{"kernelname", "kernel-" + versionId},
+            {"ubiblock", ubiblock},
+            {"root", block}};
+}
+
+} // namespace
 
 void Helper::setEntry(const std::string& entryId, uint8_t value)
 {
-    std::string serviceFile = "obmc-flash-bmc-setenv@" + entryId + "\\x3d" +
-                              std::to_string(value) + ".service";
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
+    try
+    {
+        getSystemEnv().set(entryId, std::to_string(value));
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to set U-Boot environment variable",
+                        entry("NAME=%s", entryId.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
 }
 
 void Helper::clearEntry(const std::string& entryId)
 {
     // Remove the priority environment variable.
-    auto serviceFile = "obmc-flash-bmc-setenv@" + entryId + ".service";
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
+    try
+    {
+        getSystemEnv().unset(entryId);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to clear U-Boot environment variable",
+                        entry("NAME=%s", entryId.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
 }
 
 void Helper::cleanup()
 {
     // Remove any volumes that do not match current versions.
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append("obmc-flash-bmc-cleanup.service", "replace");
-    bus.call_noreply(method);
+    utils::startUnitAsync(bus, "obmc-flash-bmc-cleanup.service");
 }
 
 void Helper::factoryReset()
 {
     // Mark the read-write partition for recreation upon reboot.
-    utils::execute("/sbin/fw_setenv", "rwreset", "true");
+    try
+    {
+        getSystemEnv().set("rwreset", "true");
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to set rwreset in U-Boot environment",
+                        entry("ERROR=%s", e.what()));
+    }
 }
 
 void Helper::removeVersion(const std::string& versionId)
@@ -57,45 +133,94 @@ void Helper::removeVersion(const std::string& versionId)
     auto serviceFile = "obmc-flash-bmc-ubiro-remove@" + versionId + ".service";
 
     // Remove the read-only partitions.
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    method.append(serviceFile, "replace");
-    bus.call_noreply(method);
+    utils::startUnitAsync(bus, serviceFile);
 }
 
 void Helper::updateUbootVersionId(const std::string& versionId)
 {
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    auto updateEnvVarsFile =
-        "obmc-flash-bmc-updateubootvars@" + versionId + ".service";
-    method.append(updateEnvVarsFile, "replace");
+    setPriorities({}, versionId);
+}
+
+void Helper::setPriorities(const std::map<std::string, uint8_t>& priorities,
+                           const std::string& bootVersionId)
+{
+    UbootEnv::Changes changes;
+    for (const auto& [versionId, priority] : priorities)
+    {
+        changes[versionId] = std::to_string(priority);
+    }
 
     try
     {
-        bus.call_noreply(method);
+        changes.merge(bootVariables(bootVersionId));
     }
-    catch (const SdBusError& e)
+    catch (const std::exception& e)
     {
         log<level::ERR>("Failed to update u-boot env variables",
-                        entry("VERSIONID=%s", versionId.c_str()));
+                        entry("VERSIONID=%s", bootVersionId.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
+
+    try
+    {
+        getSystemEnv().apply(changes);
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Failed to write U-Boot environment",
+                        entry("VERSIONID=%s", bootVersionId.c_str()),
+                        entry("ERROR=%s", e.what()));
     }
 }
 
 void Helper::mirrorAlt()
 {
-    auto method = bus.new_method_call(SYSTEMD_BUSNAME, SYSTEMD_PATH,
-                                      SYSTEMD_INTERFACE, "StartUnit");
-    auto mirrorUbootFile = "obmc-flash-bmc-mirroruboot.service";
-    method.append(mirrorUbootFile, "replace");
+    if (mirrorJob || MtdDevice::find("alt-u-boot").empty())
+    {
+        return;
+    }
+
+    auto mirrored = std::make_shared<bool>(false);
+    auto work = [mirrored](const ProgressCallback&) {
+        SystemFlashDevices devices;
+        UbootMirror::Config config;
+        config.stateFile = fs::path(PERSIST_DIR) / UbootMirror::stateFileName;
+        UbootMirror mirror(devices, config);
+
+        // The environment was copied along, point it back at the alt chip.
+        *mirrored = mirror.mirror(backupEnvToAlt);
+    };
+
+    auto onDone = [this, mirrored](std::exception_ptr error) {
+        if (error)
+        {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const std::exception& e)
+            {
+                log<level::ERR>("Failed to mirror U-Boot to the alt chip",
+                                entry("ERROR=%s", e.what()));
+            }
+        }
+        else if (*mirrored)
+        {
+            log<level::INFO>("Mirrored U-Boot to the alt chip");
+        }
+        mirrorJob.reset();
+    };
 
     try
     {
-        bus.call_noreply(method);
+        mirrorJob = std::make_unique<FlashJob>(sd_bus_get_event(bus.get()),
+                                               std::move(work), nullptr,
+                                               std::move(onDone));
     }
-    catch (const SdBusError& e)
+    catch (const std::exception& e)
     {
-        log<level::ERR>("Failed to copy U-Boot to alternate chip");
+        log<level::ERR>("Failed to start mirroring U-Boot",
+                        entry("ERROR=%s", e.what()));
     }
 }
 
@@ -0,0 +1,510 @@
+#include "ubi_device.hpp"
+
+#include <fcntl.h>
+#include <mtd/ubi-user.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+namespace
+{
+
+[[noreturn]] void throwErrno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/** @brief Closes a file descriptor when going out of scope */
+struct FdCloser
+{
+    int fd;
+    ~FdCloser()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+constexpr auto volumeIndexFile = "volumes";
+
+/** @brief Read the first line of a sysfs attribute */
+std::string readAttribute(const fs::path& path)
+{
+    std::ifstream file(path);
+    std::string value;
+    if (!std::getline(file, value))
+    {
+        throw std::system_error(ENOENT, std::generic_category(),
+                                "read " + path.string());
+    }
+    return value;
+}
+
+/** @brief Read a numeric sysfs attribute */
+uint64_t readNumber(const fs::path& path)
+{
+    auto value = readAttribute(path);
+    try
+    {
+        return std::stoull(value);
+    }
+    catch (const std::exception&)
+    {
+        throw std::system_error(EINVAL, std::generic_category(),
+                                "parse " + path.string());
+    }
+}
+
+/** @brief Open a device node, throws std::system_error on failure */
+int openNode(const fs::path& path, int flags)
+{
+    auto fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throwErrno("open " + path.string());
+    }
+    return fd;
+}
+
+} // namespace
+
+std::optional<UbiVolume> UbiDevice::find(const std::string& volName)
+{
+    for (const auto& volume : volumes())
+    {
+        if (volume.name == volName)
+        {
+            return volume;
+        }
+    }
+    return std::nullopt;
+}
+
+void UbiDevice::updateVolume(const std::string& volName, ImageSource& source,
+                             const ProgressCallback& progress)
+{
+    auto volume = find(volName);
+    if (!volume)
+    {
+        throw std::invalid_argument("No UBI volume " + volName + " on " +
+                                    name());
+    }
+
+    auto total = source.size();
+    if (total > volume->size)
+    {
+        throw std::length_error("Image does not fit in UBI volume " + volName);
+    }
+
+    FdCloser out{startUpdate(*volume, total)};
+    std::vector<uint8_t> buffer(updateChunkSize);
+    uint64_t done = 0;
+    while (done < total)
+    {
+        auto length = source.read(buffer.data(), buffer.size());
+        if (length == 0)
+        {
+            throw std::runtime_error("Image ended early for " + volName);
+        }
+
+        size_t pos = 0;
+        while (pos < length)
+        {
+            auto rc = write(out.fd, buffer.data() + pos, length - pos);
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throwErrno("write " + volName);
+            }
+            pos += rc;
+        }
+        done += length;
+        written += length;
+
+        if (progress)
+        {
+            progress(done, total);
+        }
+    }
+}
+
+void UbiDevice::readVolume(const std::string& volName, uint64_t offset,
+                           void* data, size_t length)
+{
+    auto volume = find(volName);
+    if (!volume)
+    {
+        throw std::invalid_argument("No UBI volume " + volName + " on " +
+                                    name());
+    }
+
+    FdCloser in{openVolume(*volume)};
+    auto buf = static_cast<uint8_t*>(data);
+    while (length > 0)
+    {
+        auto rc = pread(in.fd, buf, length, offset);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throwErrno("read " + volName);
+        }
+        if (rc == 0)
+        {
+            throw std::out_of_range("Read beyond the end of " + volName);
+        }
+        buf += rc;
+        offset += rc;
+        length -= rc;
+    }
+}
+
+FileUbiDevice::FileUbiDevice(const fs::path& dir, const std::string& name,
+                             uint64_t capacity) :
+    dir(dir),
+    mtdName(name), capacity(capacity)
+{
+    fs::create_directories(dir);
+}
+
+std::vector<UbiVolume> FileUbiDevice::volumes()
+{
+    std::vector<UbiVolume> vols;
+    std::ifstream index(dir / volumeIndexFile);
+    UbiVolume volume;
+    while (index >> volume.id >> volume.size >> volume.isStatic >>
+           volume.name)
+    {
+        vols.push_back(volume);
+    }
+    return vols;
+}
+
+uint64_t FileUbiDevice::availableBytes()
+{
+    uint64_t used = 0;
+    for (const auto& volume : volumes())
+    {
+        used += volume.size;
+    }
+    return used < capacity ? capacity - used : 0;
+}
+
+void FileUbiDevice::createVolume(const std::string& volName, uint64_t size,
+                                 bool isStatic)
+{
+    auto vols = volumes();
+    if (std::any_of(vols.begin(), vols.end(),
+                    [&volName](const auto& v) { return v.name == volName; }))
+    {
+        throw std::system_error(EEXIST, std::generic_category(),
+                                "UBI volume " + volName);
+    }
+    if (size > availableBytes())
+    {
+        throw std::system_error(ENOSPC, std::generic_category(),
+                                "UBI volume " + volName);
+    }
+
+    int id = 0;
+    while (std::any_of(vols.begin(), vols.end(),
+                       [id](const auto& v) { return v.id == id; }))
+    {
+        id++;
+    }
+    vols.push_back({id, volName, size, isStatic});
+    std::ofstream(dir / volName, std::ios::out | std::ios::trunc);
+    save(vols);
+}
+
+void FileUbiDevice::removeVolume(const std::string& volName)
+{
+    auto vols = volumes();
+    auto it = std::remove_if(vols.begin(), vols.end(), [&volName](auto& v) {
+        return v.name == volName;
+    });
+    if (it != vols.end())
+    {
+        vols.erase(it, vols.end());
+        save(vols);
+        fs::remove(dir / volName);
+    }
+}
+
+int FileUbiDevice::startUpdate(const UbiVolume& volume, uint64_t /* bytes */)
+{
+    auto path = dir / volume.name;
+    auto fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throwErrno("open " + path.string());
+    }
+    return fd;
+}
+
+int FileUbiDevice::openVolume(const UbiVolume& volume)
+{
+    auto path = dir / volume.name;
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throwErrno("open " + path.string());
+    }
+    return fd;
+}
+
+void FileUbiDevice::save(const std::vector<UbiVolume>& vols)
+{
+    std::ofstream index(dir / volumeIndexFile, std::ios::out | std::ios::trunc);
+    for (const auto& volume : vols)
+    {
+        index << volume.id << ' ' << volume.size << ' ' << volume.isStatic
+              << ' ' << volume.name << '\n';
+    }
+}
+
+KernelUbiDevice::KernelUbiDevice(int ubiNum, const std::string& name,
+                                 const fs::path& sysfsDir,
+                                 const fs::path& devDir) :
+    ubiNum(ubiNum),
+    mtdName(name), sysfsDir(sysfsDir), devDir(devDir)
+{}
+
+int KernelUbiDevice::findAttached(int mtdNum, const fs::path& sysfsDir)
+{
+    // The devices are ubiN, their volumes ubiN_M.
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(sysfsDir, ec))
+    {
+        auto device = entry.path().filename().string();
+        if (device.rfind("ubi", 0) != 0 ||
+            device.find('_') != std::string::npos)
+        {
+            continue;
+        }
+        try
+        {
+            if (readNumber(entry.path() / "mtd_num") ==
+                static_cast<uint64_t>(mtdNum))
+            {
+                return std::stoi(device.substr(std::strlen("ubi")));
+            }
+        }
+        catch (const std::exception&)
+        {
+            continue;
+        }
+    }
+    return -1;
+}
+
+KernelUbiDevice::Index& KernelUbiDevice::index()
+{
+    if (cache)
+    {
+        return *cache;
+    }
+
+    auto device = "ubi" + std::to_string(ubiNum);
+    Index loaded;
+    loaded.lebSize = readNumber(sysfsDir / device / "eraseblock_size");
+    loaded.availableBytes =
+        readNumber(sysfsDir / device / "avail_eraseblocks") * loaded.lebSize;
+
+    auto prefix = device + "_";
+    for (const auto& entry : fs::directory_iterator(sysfsDir))
+    {
+        auto volume = entry.path().filename().string();
+        if (volume.rfind(prefix, 0) != 0)
+        {
+            continue;
+        }
+        UbiVolume vol;
+        vol.id = std::stoi(volume.substr(prefix.size()));
+        vol.name = readAttribute(entry.path() / "name");
+        vol.size = readNumber(entry.path() / "reserved_ebs") *
+                   readNumber(entry.path() / "usable_eb_size");
+        vol.isStatic = readAttribute(entry.path() / "type") == "static";
+        loaded.volumes.push_back(std::move(vol));
+    }
+    std::sort(loaded.volumes.begin(), loaded.volumes.end(),
+              [](const auto& a, const auto& b) { return a.id < b.id; });
+
+    cache = std::move(loaded);
+    return *cache;
+}
+
+std::vector<UbiVolume> KernelUbiDevice::volumes()
+{
+    return index().volumes;
+}
+
+uint64_t KernelUbiDevice::availableBytes()
+{
+    return index().availableBytes;
+}
+
+void KernelUbiDevice::createVolume(const std::string& volName, uint64_t size,
+                                   bool isStatic)
+{
+    if (volName.empty() || volName.size() > UBI_MAX_VOLUME_NAME)
+    {
+        throw std::invalid_argument("Invalid UBI volume name " + volName);
+    }
+    auto& idx = index();
+
+    ubi_mkvol_req req{};
+    req.vol_id = UBI_VOL_NUM_AUTO;
+    req.alignment = 1;
+    req.bytes = size;
+    req.vol_type = isStatic ? UBI_STATIC_VOLUME : UBI_DYNAMIC_VOLUME;
+    req.name_len = volName.size();
+    std::memcpy(req.name, volName.c_str(), volName.size());
+
+    FdCloser ubi{openNode(devDir / ("ubi" + std::to_string(ubiNum)), O_RDWR)};
+    if (ioctl(ubi.fd, UBI_IOCMKVOL, &req) < 0)
+    {
+        throwErrno("UBI_IOCMKVOL " + volName);
+    }
+
+    // The kernel reserves whole eraseblocks and returns the volume id.
+    auto reserved = (size + idx.lebSize - 1) / idx.lebSize * idx.lebSize;
+    idx.volumes.push_back({req.vol_id, volName, reserved, isStatic});
+    idx.availableBytes -= std::min(idx.availableBytes, reserved);
+}
+
+void KernelUbiDevice::removeVolume(const std::string& volName)
+{
+    auto& idx = index();
+    auto it = std::find_if(
+        idx.volumes.begin(), idx.volumes.end(),
+        [&volName](const auto& volume) { return volume.name == volName; });
+    if (it == idx.volumes.end())
+    {
+        return;
+    }
+
+    detachBlock(*it);
+
+    FdCloser ubi{openNode(devDir / ("ubi" + std::to_string(ubiNum)), O_RDWR)};
+    int32_t id = it->id;
+    if (ioctl(ubi.fd, UBI_IOCRMVOL, &id) < 0)
+    {
+        throwErrno("UBI_IOCRMVOL " + volName);
+    }
+
+    idx.availableBytes += it->size;
+    idx.volumes.erase(it);
+}
+
+void KernelUbiDevice::attachBlock(const std::string& volName)
+{
+    auto volume = find(volName);
+    if (!volume)
+    {
+        throw std::invalid_argument("No UBI volume " + volName + " on " +
+                                    name());
+    }
+    if (fs::exists(blockNode(*volume)))
+    {
+        return;
+    }
+
+    FdCloser vol{openNode(volumeNode(*volume), O_RDONLY)};
+    ubi_blkcreate_req req{};
+    if (ioctl(vol.fd, UBI_IOCVOLCRBLK, &req) < 0 && errno != EEXIST)
+    {
+        throwErrno("UBI_IOCVOLCRBLK " + volName);
+    }
+}
+
+void KernelUbiDevice::detachBlock(const UbiVolume& volume)
+{
+    auto block = blockNode(volume);
+    if (!fs::exists(block))
+    {
+        return;
+    }
+
+    // Unmount the block device first, like ubi_remove does for the rofs
+    // volumes of the other versions mounted under the media dir.
+    std::ifstream mounts("/proc/mounts");
+    std::string source;
+    std::string target;
+    std::string rest;
+    while (mounts >> source >> target && std::getline(mounts, rest))
+    {
+        if (source != block.string())
+        {
+            continue;
+        }
+        if (umount2(target.c_str(), 0) < 0)
+        {
+            throwErrno("umount " + target);
+        }
+        std::error_code ec;
+        fs::remove(target, ec);
+    }
+
+    FdCloser vol{openNode(volumeNode(volume), O_RDONLY)};
+    if (ioctl(vol.fd, UBI_IOCVOLRMBLK) < 0 && errno != ENOENT)
+    {
+        throwErrno("UBI_IOCVOLRMBLK " + volume.name);
+    }
+}
+
+int KernelUbiDevice::startUpdate(const UbiVolume& volume, uint64_t bytes)
+{
+    auto fd = openNode(volumeNode(volume), O_WRONLY);
+    int64_t size = bytes;
+    if (ioctl(fd, UBI_IOCVOLUP, &size) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(),
+                                "UBI_IOCVOLUP " + volume.name);
+    }
+    return fd;
+}
+
+int KernelUbiDevice::openVolume(const UbiVolume& volume)
+{
+    return openNode(volumeNode(volume), O_RDONLY);
+}
+
+fs::path KernelUbiDevice::volumeNode(const UbiVolume& volume) const
+{
+    return devDir /
+           ("ubi" + std::to_string(ubiNum) + "_" + std::to_string(volume.id));
+}
+
+fs::path KernelUbiDevice::blockNode(const UbiVolume& volume) const
+{
+    return devDir / ("ubiblock" + std::to_string(ubiNum) + "_" +
+                     std::to_string(volume.id));
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
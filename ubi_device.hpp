@@ -0,0 +1,237 @@
+#pragma once
+
+#include "flash_device.hpp"
+#include "image_source.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @struct UbiVolume
+ *  @brief Description of a UBI volume.
+ */
+struct UbiVolume
+{
+    /** @brief Volume id within the UBI device */
+    int id;
+
+    /** @brief Volume name, e.g. rofs-<versionId> */
+    std::string name;
+
+    /** @brief Reserved size in bytes */
+    uint64_t size;
+
+    /** @brief Static volumes hold a read-only image of a fixed size */
+    bool isStatic;
+};
+
+/** @class UbiDevice
+ *  @brief A UBI device attached to an MTD partition.
+ *  @details Errors are reported by throwing std::system_error.
+ */
+class UbiDevice
+{
+  public:
+    virtual ~UbiDevice() = default;
+
+    /** @brief The name of the MTD partition the device is attached to */
+    virtual const std::string& name() const = 0;
+
+    /** @brief List the volumes of the device */
+    virtual std::vector<UbiVolume> volumes() = 0;
+
+    /** @brief Number of bytes available for new volumes */
+    virtual uint64_t availableBytes() = 0;
+
+    /** @brief Create a volume
+     *
+     *  @param[in] volName - The volume name
+     *  @param[in] size - The size to reserve in bytes
+     *  @param[in] isStatic - Create a static instead of a dynamic volume
+     */
+    virtual void createVolume(const std::string& volName, uint64_t size,
+                              bool isStatic) = 0;
+
+    /** @brief Remove a volume, if it exists */
+    virtual void removeVolume(const std::string& volName) = 0;
+
+    /** @brief Find a volume by name */
+    std::optional<UbiVolume> find(const std::string& volName);
+
+    /** @brief Replace the contents of a volume with an image
+     *
+     *  @param[in] volName - The volume to update, which must exist and be
+     *                       large enough for the image
+     *  @param[in] source - The image data
+     *  @param[in] progress - Optional progress callback
+     */
+    void updateVolume(const std::string& volName, ImageSource& source,
+                      const ProgressCallback& progress = nullptr);
+
+    /** @brief Create the ubiblock device a squashfs volume is mounted
+     *         from, if it does not exist yet. Nothing to do by default. */
+    virtual void attachBlock(const std::string& /* volName */)
+    {}
+
+    /** @brief Read data back from a volume */
+    void readVolume(const std::string& volName, uint64_t offset, void* data,
+                    size_t length);
+
+    /** @brief Number of bytes programmed through this object */
+    uint64_t bytesWritten() const
+    {
+        return written;
+    }
+
+  protected:
+    /** @brief Start a volume update, returning a file descriptor the new
+     *         contents are written to. The caller closes it. */
+    virtual int startUpdate(const UbiVolume& volume, uint64_t bytes) = 0;
+
+    /** @brief Open a volume for reading, the caller closes the descriptor */
+    virtual int openVolume(const UbiVolume& volume) = 0;
+
+    /** @brief Size of the chunks streamed into a volume */
+    static constexpr size_t updateChunkSize = 1024 * 1024;
+
+    uint64_t written = 0;
+};
+
+/** @class FileUbiDevice
+ *  @brief A UBI device emulated with a directory.
+ *  @details Each volume is a file in the directory, and a "volumes" index
+ *           file records the ids, reserved sizes and types.
+ */
+class FileUbiDevice : public UbiDevice
+{
+  public:
+    /** @brief Constructor
+     *
+     *  @param[in] dir - The directory backing the device, created if needed
+     *  @param[in] name - The name of the emulated MTD partition
+     *  @param[in] capacity - Usable size of the device in bytes
+     */
+    FileUbiDevice(const fs::path& dir, const std::string& name,
+                  uint64_t capacity);
+
+    const std::string& name() const override
+    {
+        return mtdName;
+    }
+
+    std::vector<UbiVolume> volumes() override;
+    uint64_t availableBytes() override;
+    void createVolume(const std::string& volName, uint64_t size,
+                      bool isStatic) override;
+    void removeVolume(const std::string& volName) override;
+
+  protected:
+    int startUpdate(const UbiVolume& volume, uint64_t bytes) override;
+    int openVolume(const UbiVolume& volume) override;
+
+  private:
+    /** @brief Write the volume index file */
+    void save(const std::vector<UbiVolume>& vols);
+
+    fs::path dir;
+    std::string mtdName;
+    uint64_t capacity;
+};
+
+/** @class KernelUbiDevice
+ *  @brief A UBI device of the kernel, e.g. /dev/ubi0, managed through the
+ *         UBI ioctls instead of the ubimkvol, ubirmvol, ubiupdatevol and
+ *         ubiblock tools.
+ *  @details The volumes are read from sysfs on first use, and the index is
+ *           kept up to date as volumes are created and removed through this
+ *           object, rather than scanning sysfs for every lookup like the
+ *           obmc-flash-bmc findubi function does. The sysfs and /dev
+ *           directories can be redirected to files to test the parsing.
+ */
+class KernelUbiDevice : public UbiDevice
+{
+  public:
+    KernelUbiDevice() = delete;
+    KernelUbiDevice(const KernelUbiDevice&) = delete;
+    KernelUbiDevice& operator=(const KernelUbiDevice&) = delete;
+    KernelUbiDevice(KernelUbiDevice&&) = delete;
+    KernelUbiDevice& operator=(KernelUbiDevice&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] ubiNum - The UBI device number, N of /dev/ubiN
+     *  @param[in] name - The name of the MTD partition it is attached to
+     *  @param[in] sysfsDir - Where the UBI devices are listed in sysfs
+     *  @param[in] devDir - Where the device nodes are
+     */
+    KernelUbiDevice(int ubiNum, const std::string& name,
+                    const fs::path& sysfsDir = "/sys/class/ubi",
+                    const fs::path& devDir = "/dev");
+
+    /** @brief Find the UBI device attached to an MTD partition
+     *
+     *  @param[in] mtdNum - The MTD device number, N of /dev/mtdN
+     *  @param[in] sysfsDir - Where the UBI devices are listed in sysfs
+     *
+     *  @return The UBI device number, or -1 if the partition is not
+     *          attached
+     */
+    static int findAttached(int mtdNum,
+                            const fs::path& sysfsDir = "/sys/class/ubi");
+
+    const std::string& name() const override
+    {
+        return mtdName;
+    }
+
+    std::vector<UbiVolume> volumes() override;
+    uint64_t availableBytes() override;
+    void createVolume(const std::string& volName, uint64_t size,
+                      bool isStatic) override;
+    void removeVolume(const std::string& volName) override;
+    void attachBlock(const std::string& volName) override;
+
+  protected:
+    int startUpdate(const UbiVolume& volume, uint64_t bytes) override;
+    int openVolume(const UbiVolume& volume) override;
+
+  private:
+    /** @brief The volumes and free space of the device */
+    struct Index
+    {
+        std::vector<UbiVolume> volumes;
+        uint64_t availableBytes;
+        uint64_t lebSize;
+    };
+
+    /** @brief The index, read from sysfs on first use */
+    Index& index();
+
+    /** @brief The device node of a volume, e.g. /dev/ubi0_3 */
+    fs::path volumeNode(const UbiVolume& volume) const;
+
+    /** @brief The ubiblock device node of a volume, e.g. /dev/ubiblock0_3 */
+    fs::path blockNode(const UbiVolume& volume) const;
+
+    /** @brief Unmount and remove the ubiblock device of a volume, if any,
+     *         so that the volume can be removed */
+    void detachBlock(const UbiVolume& volume);
+
+    int ubiNum;
+    std::string mtdName;
+    fs::path sysfsDir;
+    fs::path devDir;
+    std::optional<Index> cache;
+};
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
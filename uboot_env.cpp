@@ -0,0 +1,466 @@
+#include "config.h"
+
+#include "uboot_env.hpp"
+
+#include "crc32.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <phosphor-logging/log.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+using namespace phosphor::logging;
+namespace fs = std::filesystem;
+
+namespace
+{
+
+/** @brief The lock the U-Boot tools take around environment accesses */
+constexpr auto lockFile = "/var/lock/fw_printenv.lock";
+
+constexpr size_t crcSize = sizeof(uint32_t);
+
+/** @brief The flags of the banks of a redundant environment on NOR flash,
+ *         ENV_REDUND_ACTIVE and ENV_REDUND_OBSOLETE in fw_env */
+constexpr uint8_t bankActive = 1;
+constexpr uint8_t bankObsolete = 0;
+
+/** @brief The number of an MTD partition, e.g. "3" for /dev/mtd3, or an
+ *         empty string if there is no such partition */
+std::string mtdNumber(const std::string& name)
+{
+    auto device = MtdDevice::find(name);
+    return device.empty() ? device : device.substr(std::strlen("/dev/mtd"));
+}
+
+/** @brief Swap the chip numbers in a boot variable, since U-Boot on the alt
+ *         chip sees itself as the primary one
+ *
+ *  @param[in] value - The value of the variable
+ *  @param[in] bmc - The MTD number of the bmc partition
+ *  @param[in] alt - The MTD number of the alt-bmc partition
+ *  @param[in] separator - What follows the number in the value
+ */
+std::string swapChips(std::string value, const std::string& bmc,
+                      const std::string& alt, char separator)
+{
+    auto replace = [&value, separator](const std::string& from,
+                                       const std::string& to) {
+        auto pos = value.find(from + separator);
+        if (pos == std::string::npos)
+        {
+            return false;
+        }
+        value.replace(pos, from.size(), to);
+        return true;
+    };
+
+    if (!replace(alt, bmc))
+    {
+        replace(bmc, alt);
+    }
+    return value;
+}
+
+/** @brief Serializes the threads of the updater taking the lock */
+std::recursive_mutex envLockMutex;
+
+/** @brief How many times the lock is held by its thread, and the lock file
+ *  while it is held */
+unsigned envLockDepth = 0;
+int envLockFd = -1;
+
+/** @brief Size of the header of each bank */
+size_t headerSize(size_t numBanks)
+{
+    return numBanks > 1 ? crcSize + 1 : crcSize;
+}
+
+/** @brief Range of whole erase blocks covering a bank */
+std::pair<uint64_t, uint64_t> eraseRange(const EnvBank& bank)
+{
+    auto blockSize = bank.device->eraseSize();
+    auto start = bank.offset / blockSize * blockSize;
+    auto end = (bank.offset + bank.size + blockSize - 1) / blockSize *
+               blockSize;
+    return {start, end - start};
+}
+
+UbootEnv::Vars parse(const uint8_t* data, size_t length)
+{
+    UbootEnv::Vars vars;
+    auto end = data + length;
+    while (data < end && *data)
+    {
+        auto entryEnd = std::find(data, end, 0);
+        std::string entry(data, entryEnd);
+        auto eq = entry.find('=');
+        if (eq != std::string::npos)
+        {
+            vars[entry.substr(0, eq)] = entry.substr(eq + 1);
+        }
+        data = entryEnd + 1;
+    }
+    return vars;
+}
+
+std::vector<uint8_t> serialize(const UbootEnv::Vars& vars, size_t length)
+{
+    std::vector<uint8_t> data;
+    data.reserve(length);
+    for (const auto& [name, value] : vars)
+    {
+        data.insert(data.end(), name.begin(), name.end());
+        data.push_back('=');
+        data.insert(data.end(), value.begin(), value.end());
+        data.push_back(0);
+    }
+    // The list ends with an empty entry.
+    data.push_back(0);
+
+    if (data.size() > length)
+    {
+        throw std::length_error("U-Boot environment full");
+    }
+    data.resize(length, 0);
+    return data;
+}
+
+std::unique_ptr<FlashDevice> openDevice(const std::string& path)
+{
+    struct stat st
+    {};
+    if (stat(path.c_str(), &st) < 0)
+    {
+        throw std::system_error(errno, std::generic_category(),
+                                "stat " + path);
+    }
+    if (S_ISCHR(st.st_mode))
+    {
+        return std::make_unique<MtdDevice>(path);
+    }
+    return std::make_unique<BlockDevice>(path);
+}
+
+} // namespace
+
+EnvLock::EnvLock() : guard(envLockMutex)
+{
+    if (envLockDepth++ == 0)
+    {
+        envLockFd = open(lockFile, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (envLockFd >= 0)
+        {
+            flock(envLockFd, LOCK_EX);
+        }
+    }
+}
+
+EnvLock::~EnvLock()
+{
+    if (--envLockDepth == 0 && envLockFd >= 0)
+    {
+        flock(envLockFd, LOCK_UN);
+        close(envLockFd);
+        envLockFd = -1;
+    }
+}
+
+UbootEnv::UbootEnv(std::vector<EnvBank> banks) : banks(std::move(banks))
+{
+    if (this->banks.empty() || this->banks.size() > 2)
+    {
+        throw std::invalid_argument("U-Boot environment needs 1 or 2 banks");
+    }
+    for (const auto& bank : this->banks)
+    {
+        if (bank.size <= headerSize(this->banks.size()))
+        {
+            throw std::invalid_argument("U-Boot environment too small");
+        }
+    }
+    booleanFlags = this->banks.size() > 1 && this->banks[0].device->isNor();
+}
+
+std::unique_ptr<UbootEnv> UbootEnv::fromConfig(const std::string& configFile)
+{
+    std::ifstream config(configFile);
+    if (!config)
+    {
+        throw std::runtime_error("Cannot open " + configFile);
+    }
+
+    // Each line holds: device offset env-size [sector-size [sectors]]
+    std::vector<EnvBank> banks;
+    std::string line;
+    while (std::getline(config, line))
+    {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string device, offset, size;
+        if (!(fields >> device))
+        {
+            continue;
+        }
+        if (!(fields >> offset >> size))
+        {
+            throw std::runtime_error("Invalid line in " + configFile + ": " +
+                                     line);
+        }
+        banks.push_back({openDevice(device), std::stoull(offset, nullptr, 0),
+                         std::stoul(size, nullptr, 0)});
+    }
+    return std::make_unique<UbootEnv>(std::move(banks));
+}
+
+void UbootEnv::load()
+{
+    auto header = headerSize(banks.size());
+    std::vector<Vars> contents(banks.size());
+    std::vector<bool> valid(banks.size(), false);
+    std::vector<uint8_t> bankFlags(banks.size(), 0);
+
+    for (size_t i = 0; i < banks.size(); i++)
+    {
+        std::vector<uint8_t> data(banks[i].size);
+        banks[i].device->read(banks[i].offset, data.data(), data.size());
+
+        uint32_t crc;
+        std::memcpy(&crc, data.data(), sizeof(crc));
+        valid[i] = crc == utils::crc32(data.data() + header,
+                                       data.size() - header);
+        if (valid[i])
+        {
+            bankFlags[i] = banks.size() > 1 ? data[crcSize] : 0;
+            contents[i] = parse(data.data() + header, data.size() - header);
+        }
+    }
+
+    active = 0;
+    if (banks.size() > 1)
+    {
+        auto f0 = bankFlags[0];
+        auto f1 = bankFlags[1];
+        if (valid[0] && valid[1] && booleanFlags)
+        {
+            // Same rules as fw_env: the bank marked active over the one
+            // marked obsolete, else the erased flag, else bank 0.
+            if ((f0 == bankObsolete && f1 == bankActive) ||
+                (f0 != 0xFF && f1 == 0xFF))
+            {
+                active = 1;
+            }
+        }
+        else if (valid[0] && valid[1])
+        {
+            // The flags count up and wrap around.
+            if (f0 == 0xFF && f1 == 0)
+            {
+                active = 1;
+            }
+            else if (!(f1 == 0xFF && f0 == 0))
+            {
+                active = f1 > f0 ? 1 : 0;
+            }
+        }
+        else if (valid[1])
+        {
+            active = 1;
+        }
+    }
+
+    activeValid = valid[active];
+    if (!activeValid)
+    {
+        log<level::WARNING>("No valid U-Boot environment",
+                            entry("DEVICE=%s",
+                                  banks[active].device->name().c_str()));
+    }
+
+    flags = bankFlags[active];
+    snapshot = std::move(contents[active]);
+}
+
+std::optional<std::string> UbootEnv::get(const std::string& name)
+{
+    const auto& all = vars();
+    auto it = all.find(name);
+    if (it == all.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+const UbootEnv::Vars& UbootEnv::vars()
+{
+    if (!snapshot)
+    {
+        EnvLock lock;
+        load();
+    }
+    return *snapshot;
+}
+
+void UbootEnv::set(const std::string& name, const std::string& value)
+{
+    apply({{name, value}});
+}
+
+void UbootEnv::unset(const std::string& name)
+{
+    apply({{name, std::nullopt}});
+}
+
+bool UbootEnv::valid()
+{
+    vars();
+    return activeValid;
+}
+
+void UbootEnv::apply(const Changes& changes)
+{
+    EnvLock lock;
+    load();
+    if (!activeValid)
+    {
+        throw std::runtime_error("No valid U-Boot environment on " +
+                                 banks[active].device->name());
+    }
+
+    auto updated = *snapshot;
+    for (const auto& [name, value] : changes)
+    {
+        if (name.empty() || name.find('=') != std::string::npos)
+        {
+            throw std::invalid_argument("Invalid U-Boot variable " + name);
+        }
+        if (value)
+        {
+            updated[name] = *value;
+        }
+        else
+        {
+            updated.erase(name);
+        }
+    }
+    if (updated == *snapshot)
+    {
+        return;
+    }
+
+    // Write the bank that is not active, or rewrite the only one.
+    auto target = banks.size() > 1 ? 1 - active : 0;
+    auto& bank = banks[target];
+    auto header = headerSize(banks.size());
+    auto data = serialize(updated, bank.size - header);
+    uint32_t crc = utils::crc32(data.data(), data.size());
+    uint8_t newFlags = booleanFlags ? bankActive : flags + 1;
+
+    // The environment may share its erase blocks with other data, so
+    // rewrite the blocks as a whole.
+    auto [start, length] = eraseRange(bank);
+    std::vector<uint8_t> blocks(length);
+    bank.device->read(start, blocks.data(), blocks.size());
+
+    auto env = blocks.data() + (bank.offset - start);
+    std::memcpy(env, &crc, sizeof(crc));
+    if (banks.size() > 1)
+    {
+        env[crcSize] = newFlags;
+    }
+    std::memcpy(env + header, data.data(), data.size());
+
+    if (bank.device->requiresErase())
+    {
+        bank.device->erase(start, length);
+    }
+    bank.device->write(start, blocks.data(), blocks.size());
+    bank.device->sync();
+
+    // Like fw_env, mark the previous bank obsolete once the new one is
+    // written. Programming clears the flag bits without an erase.
+    if (booleanFlags)
+    {
+        auto& previous = banks[active];
+        previous.device->write(previous.offset + crcSize, &bankObsolete,
+                               sizeof(bankObsolete));
+        previous.device->sync();
+    }
+
+    active = target;
+    flags = newFlags;
+    snapshot = std::move(updated);
+}
+
+void UbootEnv::reload()
+{
+    snapshot.reset();
+}
+
+UbootEnv& getSystemEnv()
+{
+    static std::unique_ptr<UbootEnv> env;
+    if (!env)
+    {
+        env = UbootEnv::fromConfig(FW_ENV_CONFIG);
+    }
+    return *env;
+}
+
+void backupEnvToAlt()
+{
+    if (!fs::exists(altEnvConfig))
+    {
+        return;
+    }
+
+    auto env = UbootEnv::fromConfig(FW_ENV_CONFIG);
+    UbootEnv::Changes changes;
+    if (auto kernelname = env->get("kernelname"))
+    {
+        changes.emplace("kernelname", *kernelname);
+    }
+
+    auto bmc = mtdNumber("bmc");
+    auto alt = mtdNumber("alt-bmc");
+    if (!bmc.empty() && !alt.empty())
+    {
+        if (auto ubiblock = env->get("ubiblock"))
+        {
+            changes.emplace("ubiblock", swapChips(*ubiblock, bmc, alt, ','));
+        }
+        if (auto root = env->get("root"))
+        {
+            changes.emplace("root", swapChips(*root, bmc, alt, '_'));
+        }
+    }
+
+    // Without an environment of its own, U-Boot on the alt chip boots with
+    // its defaults, which the boot variables alone must not replace.
+    auto altEnv = UbootEnv::fromConfig(altEnvConfig);
+    if (!altEnv->valid())
+    {
+        return;
+    }
+    altEnv->apply(changes);
+}
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
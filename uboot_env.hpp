@@ -0,0 +1,166 @@
+#pragma once
+
+#include "flash_device.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace phosphor
+{
+namespace software
+{
+namespace updater
+{
+
+/** @brief The environment U-Boot reads when booting from the alt chip */
+constexpr auto altEnvConfig = "/etc/alt_fw_env.config";
+
+/** @class EnvLock
+ *  @brief Holds the fw_printenv lock while in scope, so that the
+ *         environment is not read or written halfway through an update.
+ *  @details The thread holding the lock can take it again, other threads
+ *           of the updater wait for it. Locking the file fw_setenv locks is
+ *           best effort, it is skipped if the file cannot be opened.
+ */
+class EnvLock
+{
+  public:
+    EnvLock();
+    ~EnvLock();
+
+    EnvLock(const EnvLock&) = delete;
+    EnvLock& operator=(const EnvLock&) = delete;
+
+  private:
+    std::unique_lock<std::recursive_mutex> guard;
+};
+
+/** @struct EnvBank
+ *  @brief Location of one copy of the U-Boot environment.
+ */
+struct EnvBank
+{
+    /** @brief The device holding the environment */
+    std::unique_ptr<FlashDevice> device;
+
+    /** @brief Offset of the environment in the device */
+    uint64_t offset;
+
+    /** @brief Size of the environment, including the header */
+    size_t size;
+};
+
+/** @class UbootEnv
+ *  @brief Reads and writes the U-Boot environment without fw_setenv and
+ *         fw_printenv.
+ *  @details The environment is a CRC-32 followed, when it is redundant, by
+ *           a flags byte and then "name=value\0" pairs ending with an empty
+ *           one. With two banks, updates go to the bank that is not active,
+ *           so that a power loss during the write leaves the previous
+ *           environment intact. The flags select the active bank the way
+ *           fw_env does: on NOR flash the new bank is marked active and
+ *           the previous one obsolete, elsewhere the flags count up.
+ *
+ *           The variables are read once and cached. Updates re-read the
+ *           devices under the fw_printenv lock first, so that changes made
+ *           by the flash scripts are not lost, then write all the changes
+ *           in a single erase/write of one bank.
+ *
+ *           Device errors are reported by throwing std::system_error.
+ */
+class UbootEnv
+{
+  public:
+    using Vars = std::map<std::string, std::string>;
+
+    /** @brief Variables to set, std::nullopt removes the variable */
+    using Changes = std::map<std::string, std::optional<std::string>>;
+
+    UbootEnv() = delete;
+    UbootEnv(const UbootEnv&) = delete;
+    UbootEnv& operator=(const UbootEnv&) = delete;
+    UbootEnv(UbootEnv&&) = delete;
+    UbootEnv& operator=(UbootEnv&&) = delete;
+
+    /** @brief Constructor
+     *
+     *  @param[in] banks - One bank, or two for a redundant environment
+     */
+    explicit UbootEnv(std::vector<EnvBank> banks);
+
+    /** @brief Opens the environment described by a fw_env.config file,
+     *         throws std::runtime_error if the file is missing or invalid.
+     *
+     *  @param[in] configFile - Path of the configuration file
+     */
+    static std::unique_ptr<UbootEnv> fromConfig(const std::string& configFile);
+
+    /** @brief Get a variable
+     *
+     *  @param[in] name - The variable name
+     *
+     *  @return The value, or std::nullopt if the variable is not set
+     */
+    std::optional<std::string> get(const std::string& name);
+
+    /** @brief All the variables */
+    const Vars& vars();
+
+    /** @brief Set a variable */
+    void set(const std::string& name, const std::string& value);
+
+    /** @brief Remove a variable */
+    void unset(const std::string& name);
+
+    /** @brief Apply a set of changes as a single write. Nothing is written
+     *         if the variables already have the requested values. Throws
+     *         std::runtime_error if no bank holds a valid environment,
+     *         since writing the changes alone would drop the defaults
+     *         U-Boot needs to boot. */
+    void apply(const Changes& changes);
+
+    /** @brief Whether a bank holds a valid environment */
+    bool valid();
+
+    /** @brief Drop the cached variables, they are read again on next use */
+    void reload();
+
+  private:
+    /** @brief Read the banks and select the active one */
+    void load();
+
+    std::vector<EnvBank> banks;
+
+    /** @brief The cached variables of the active bank */
+    std::optional<Vars> snapshot;
+
+    /** @brief Index and flags of the active bank, and whether it is
+     *         valid */
+    size_t active = 0;
+    uint8_t flags = 0;
+    bool activeValid = false;
+
+    /** @brief The banks are marked active and obsolete rather than
+     *         counted, like fw_env does on NOR flash */
+    bool booleanFlags = false;
+};
+
+/** @brief The environment of the running BMC, opened from FW_ENV_CONFIG on
+ *         first use. Throws std::runtime_error if it cannot be opened. */
+UbootEnv& getSystemEnv();
+
+/** @brief Copy the boot variables to the environment of the alt chip, with
+ *         the chip numbers swapped, like the obmc-flash-bmc createenvbackup
+ *         command. Does nothing without a valid alt environment. Opens
+ *         its own view of the environments, so it can run on a worker.
+ */
+void backupEnvToAlt();
+
+} // namespace updater
+} // namespace software
+} // namespace phosphor
@@ -1,9 +1,21 @@
 #include "utils.hpp"
 
+#include "spawn.hpp"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <phosphor-logging/log.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+#include <vector>
+
 namespace utils
 {
 
@@ -68,6 +80,168 @@ void mergeFiles(std::vector<std::string>& srcFiles, std::string& dstFile)
     outFile.close();
 }
 
+namespace
+{
+
+/** @brief The size of the chunks a file is streamed in */
+constexpr size_t moveChunkSize = 1024 * 1024;
+
+[[noreturn]] void throwErrno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/** @brief Closes a file descriptor when going out of scope */
+struct FdCloser
+{
+    int fd;
+    ~FdCloser()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+/** @brief Copy a file in chunks, punching each copied chunk out of the
+ *         source, so that at most one chunk is held twice
+ *
+ *  @param[in] in - The source
+ *  @param[in] out - The destination
+ *  @param[in] name - The name of the source, for errors
+ *  @param[out] punched - The length punched out of the source so far, which
+ *                        only the destination holds
+ */
+void streamFile(int in, int out, const std::string& name, off_t& punched)
+{
+    std::vector<char> buffer(moveChunkSize);
+    while (true)
+    {
+        auto length = pread(in, buffer.data(), buffer.size(), punched);
+        if (length < 0)
+        {
+            throwErrno("Failed to read " + name);
+        }
+        if (length == 0)
+        {
+            return;
+        }
+        for (ssize_t done = 0; done < length;)
+        {
+            auto rc = write(out, buffer.data() + done, length - done);
+            if (rc < 0)
+            {
+                throwErrno("Failed to write " + name);
+            }
+            done += rc;
+        }
+
+        // Filesystems without hole support keep the data until the source
+        // is removed.
+        fallocate(in, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, punched,
+                  length);
+        punched += length;
+    }
+}
+
+/** @brief Write the start of a file punched out by streamFile() back from
+ *         the copy
+ *
+ *  @param[in] copy - The partial copy
+ *  @param[in] source - The source
+ *  @param[in] length - The length punched out of the source
+ *
+ *  @return False if the source could not be restored
+ */
+bool restoreFile(int copy, int source, off_t length)
+{
+    std::vector<char> buffer(moveChunkSize);
+    for (off_t offset = 0; offset < length;)
+    {
+        auto size = std::min<off_t>(buffer.size(), length - offset);
+        auto rc = pread(copy, buffer.data(), size, offset);
+        if (rc <= 0)
+        {
+            return false;
+        }
+        for (ssize_t done = 0; done < rc;)
+        {
+            auto written =
+                pwrite(source, buffer.data() + done, rc - done, offset + done);
+            if (written < 0)
+            {
+                return false;
+            }
+            done += written;
+        }
+        offset += rc;
+    }
+    return true;
+}
+
+} // namespace
+
+void moveFile(const std::filesystem::path& from,
+              const std::filesystem::path& to)
+{
+    if (rename(from.c_str(), to.c_str()) == 0)
+    {
+        return;
+    }
+    if (errno != EXDEV)
+    {
+        throwErrno("Failed to move " + from.string());
+    }
+
+    FdCloser in{open(from.c_str(), O_RDWR | O_CLOEXEC)};
+    struct stat st;
+    if (in.fd < 0 || fstat(in.fd, &st) < 0)
+    {
+        throwErrno("Failed to open " + from.string());
+    }
+
+    // Fill a temporary file and rename it into place, so that a partial
+    // file is never taken for the destination.
+    auto temp = to.parent_path() / ("." + to.filename().string() + ".part");
+    FdCloser out{open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      st.st_mode & 07777)};
+    if (out.fd < 0)
+    {
+        throwErrno("Failed to create " + temp.string());
+    }
+
+    off_t punched = 0;
+    try
+    {
+        if (ioctl(out.fd, FICLONE, in.fd) < 0)
+        {
+            streamFile(in.fd, out.fd, from.string(), punched);
+        }
+        if (rename(temp.c_str(), to.c_str()) < 0)
+        {
+            throwErrno("Failed to move " + from.string());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        // The start of the source only lives in the copy, so write it back
+        // before dropping the copy. A source that cannot be restored is
+        // removed rather than left with holes.
+        if (punched && !restoreFile(out.fd, in.fd, punched))
+        {
+            log<level::ERR>("Failed to restore the source of a move",
+                            entry("FILE=%s", from.c_str()));
+            unlink(temp.c_str());
+            unlink(from.c_str());
+            throw MoveSourceLost(e.what());
+        }
+        unlink(temp.c_str());
+        throw;
+    }
+    unlink(from.c_str());
+}
+
 namespace internal
 {
 
@@ -85,40 +259,19 @@ static std::string buildCommandStr(const char* name, char** args)
 
 int executeCmd(const char* path, char** args)
 {
-    pid_t pid = fork();
-    if (pid == 0)
+    auto pid = spawn(path, args);
+    if (pid < 0)
     {
-        execv(path, args);
-
-        // execv only retruns on error
-        auto error = errno;
-        auto command = buildCommandStr(path, args);
-        log<level::ERR>("Failed to execute command", entry("ERRNO=%d", error),
-                        entry("COMMAND=%s", command.c_str()));
         return -1;
     }
-    else if (pid > 0)
-    {
-        int status;
-        if (waitpid(pid, &status, 0) < 0)
-        {
-            auto error = errno;
-            log<level::ERR>("waitpid error", entry("ERRNO=%d", error));
-            return -1;
-        }
-        else if (WEXITSTATUS(status) != 0)
-        {
-            auto command = buildCommandStr(path, args);
-            log<level::ERR>("Error occurred when executing command",
-                            entry("STATUS=%d", status),
-                            entry("COMMAND=%s", command.c_str()));
-            return -1;
-        }
-    }
-    else
+
+    auto status = waitChild(pid);
+    if (status != 0)
     {
-        auto error = errno;
-        log<level::ERR>("Error occurred during fork", entry("ERRNO=%d", error));
+        auto command = buildCommandStr(path, args);
+        log<level::ERR>("Error occurred when executing command",
+                        entry("STATUS=%d", status),
+                        entry("COMMAND=%s", command.c_str()));
         return -1;
     }
 
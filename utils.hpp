@@ -2,8 +2,10 @@
 
 #include <sdbusplus/server.hpp>
 
+#include <filesystem>
 #include <fstream>
 #include <map>
+#include <stdexcept>
 #include <string>
 
 namespace utils
@@ -26,6 +28,32 @@ std::string getService(sdbusplus::bus::bus& bus, const std::string& path,
  **/
 void mergeFiles(std::vector<std::string>& srcFiles, std::string& dstFile);
 
+/**
+ * @brief Thrown by moveFile() when a failed move could not restore the
+ *        source, which was removed
+ **/
+class MoveSourceLost : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Move a file without holding two copies of its data at once.
+ *        Within a filesystem it is renamed. Across filesystems, e.g. two
+ *        tmpfs mounts, it is reflinked when the filesystem supports it,
+ *        otherwise streamed and freed from the source as it is copied.
+ *        The destination only appears once complete. Throws
+ *        std::system_error on failure, after which the source is intact,
+ *        or MoveSourceLost if the data freed from it could not be written
+ *        back.
+ *
+ * @param[in] from - The file to move
+ * @param[in] to - The destination, replaced if it exists
+ **/
+void moveFile(const std::filesystem::path& from,
+              const std::filesystem::path& to);
+
 namespace internal
 {
 